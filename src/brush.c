@@ -539,6 +539,7 @@ void Draw_paintbrush(short x,short y,byte color)
       }
       else
       {
+        Prepare_smooth_area(start_x,start_y,width,height);
         if (Shade_table==Shade_table_left)
           for (y_pos=start_y,counter_y=start_y_counter;counter_y<end_counter_y;y_pos++,counter_y++)
             for (x_pos=start_x,counter_x=start_x_counter;counter_x<end_counter_x;x_pos++,counter_x++)
@@ -554,6 +555,7 @@ void Draw_paintbrush(short x,short y,byte color)
               if (Read_pixel_from_brush(counter_x,counter_y)!=Back_color)
                 Display_pixel(x_pos,y_pos,color);
             }
+        Forget_smooth_area();
       }
       Update_part_of_screen(start_x,start_y,width,height);
       break;
@@ -610,12 +612,14 @@ void Draw_paintbrush(short x,short y,byte color)
       }
       else
       {
+        Prepare_smooth_area(start_x,start_y,width,height);
         for (y_pos=start_y,counter_y=start_y_counter;counter_y<end_counter_y;y_pos++,counter_y++)
           for (x_pos=start_x,counter_x=start_x_counter;counter_x<end_counter_x;x_pos++,counter_x++)
           {
             if (Read_pixel_from_brush(counter_x,counter_y)!=Back_color)
               Display_pixel(x_pos,y_pos,color);
           }
+        Forget_smooth_area();
         Update_part_of_screen(start_x,start_y,width,height);
       }
       break;
@@ -674,12 +678,14 @@ void Draw_paintbrush(short x,short y,byte color)
       }
       else
       {
+        Prepare_smooth_area(start_x,start_y,width,height);
         for (y_pos=start_y,counter_y=start_y_counter;counter_y<end_counter_y;y_pos++,counter_y++)
           for (x_pos=start_x,counter_x=start_x_counter;counter_x<end_counter_x;x_pos++,counter_x++)
           {
             if (Paintbrush_sprite[(MAX_PAINTBRUSH_SIZE*counter_y)+counter_x] != 0)
               Display_pixel(x_pos,y_pos,color);
           }
+        Forget_smooth_area();
         Update_part_of_screen(start_x,start_y,width,height);
       }
   }
@@ -1270,6 +1276,42 @@ void Nibble_brush(void)
 }
 
 
+void Smooth_brush(void)
+{
+  long size=(long)Brush_width*Brush_height;
+  byte * smoothed;
+  long index;
+  int i;
+
+  smoothed=(byte *)malloc(size);
+  if (smoothed == NULL)
+  {
+    Error(0);
+    return;
+  }
+  memcpy(smoothed, Brush, size);
+  // The transparent pixels don't blend into the others
+  if (!Smooth_area(Brush, Brush_width, Brush_width, Brush_height,
+                   0, 0, Brush_width, Brush_height, smoothed, Brush_width, Back_color))
+  {
+    Error(0);
+    free(smoothed);
+    return;
+  }
+  // The transparent pixels stay so, and the others don't become transparent
+  for (index=0; index<size; index++)
+    if (Brush[index]!=Back_color && smoothed[index]!=Back_color)
+      Brush[index]=smoothed[index];
+  free(smoothed);
+
+  // Adopt the current palette.
+  memcpy(Brush_original_palette, Main.palette,sizeof(T_Palette));
+  memcpy(Brush_original_pixels, Brush, size);
+  for (i=0; i<256; i++)
+    Brush_colormap[i]=i;
+}
+
+
 
 void Capture_brush_with_lasso(int vertices, short * points,short clear)
 {
@@ -100,6 +100,12 @@ void Outline_brush(void);
 */
 void Nibble_brush(void);
 
+/*!
+    Smooth the brush with the Smooth matrix, like the Smooth effect does.
+    The transparent pixels (ie in back color) are not changed.
+*/
+void Smooth_brush(void);
+
 /*!
     Get brush from picture according to a freehand form.
     @param vertices number of points in the freehand form
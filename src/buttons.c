@@ -57,6 +57,7 @@
 #include "buttons.h"
 #include "operatio.h"
 #include "pages.h"
+#include "op_c.h"
 #include "palette.h"
 #include "errors.h"
 #include "readini.h"
@@ -701,7 +702,7 @@ void Button_Quit(int btn)
 void Button_Clear(int btn)
 {
   Hide_cursor();
-  Backup();
+  Backup_layers(Main.current_layer); // The whole layer is written at once
   if (Stencil_mode && Config.Clear_with_stencil)
     Clear_current_image_with_stencil(Main.backups->Pages->Transparent_color,Stencil);
   else
@@ -716,7 +717,7 @@ void Button_Clear(int btn)
 void Button_Clear_with_backcolor(int btn)
 {
   Hide_cursor();
-  Backup();
+  Backup_layers(Main.current_layer); // The whole layer is written at once
   if (Stencil_mode && Config.Clear_with_stencil)
     Clear_current_image_with_stencil(Back_color,Stencil);
   else
@@ -798,6 +799,21 @@ const T_Lookup Lookup_VirtualKeyboard[] = {
   {NULL,-1},
 };
 
+const T_Lookup Lookup_ColorReduction[] = {
+  {"Median",COLOR_REDUCTION_MEDIAN_CUT},
+  {"Wu",COLOR_REDUCTION_WU},
+  {NULL,-1},
+};
+
+const T_Lookup Lookup_Dithering[] = {
+  {"None",DITHERING_NONE},
+  {"Bayer",DITHERING_BAYER},
+  {"Blue noise",DITHERING_BLUE_NOISE},
+  {"Floyd-S.",DITHERING_FLOYD_STEINBERG},
+  {"Sierra",DITHERING_SIERRA},
+  {NULL,-1},
+};
+
 typedef struct {
   const char* Label;
   byte Type; // 0: label, 1+: setting (size in bytes)
@@ -993,7 +1009,7 @@ void Button_Settings(int btn)
   {"Auto count colors:",1,&(selected_config.Auto_nb_used),0,1,0,Lookup_YesNo},
   {"Right click colorpick:",1,&(selected_config.Right_click_colorpick),0,1,0,Lookup_YesNo},
   {"Multi shortcuts:",1,&(selected_config.Allow_multi_shortcuts),0,1,0,Lookup_YesNo},
-  {"",0,NULL,0,0,0,NULL},
+  {"Undo memory (MB):",2,&(selected_config.Undo_memory_budget),0,9999,4,NULL},
 
   {"      --- File selector  ---",0,NULL,0,0,0,NULL},
   {"Show in fileselector",0,NULL,0,0,0,NULL},
@@ -1011,10 +1027,10 @@ void Button_Settings(int btn)
   {"Screen size in GIF:",1,&(selected_config.Screen_size_in_GIF),0,1,0,Lookup_YesNo},
   {"Clear palette:",1,&(selected_config.Clear_palette),0,1,0,Lookup_YesNo},
   {"MO6/TO8 palette gamma",1,&(selected_config.MOTO_gamma),10,30,2,NULL},
-  {"",0,NULL,0,0,0,NULL},
-  {"",0,NULL,0,0,0,NULL},
-  {"",0,NULL,0,0,0,NULL},
-  {"",0,NULL,0,0,0,NULL},
+  {"True-color palette:",1,&(selected_config.Color_reduction),0,COLOR_REDUCTION_METHODS-1,0,Lookup_ColorReduction},
+  {"  k-means passes:",1,&(selected_config.Color_reduction_passes),0,99,2,NULL},
+  {"  k-means time (ms):",2,&(selected_config.Color_reduction_time),0,9999,4,NULL},
+  {"  Dithering:",1,&(selected_config.Color_reduction_dithering),0,DITHERING_METHODS-1,0,Lookup_Dithering},
   {"",0,NULL,0,0,0,NULL},
   {"",0,NULL,0,0,0,NULL},
   {"",0,NULL,0,0,0,NULL},
@@ -1569,6 +1585,7 @@ void Button_Page(int btn)
   memcpy(&temp_doc, &Main, sizeof(T_Document));
   memcpy(&Main, &Spare, sizeof(T_Document));
   memcpy(&Spare, &temp_doc, sizeof(T_Document));
+  Invalidate_layers_planes();
 
   Pixel_preview=(Main.magnifier_mode)?Pixel_preview_magnifier:Pixel_preview_normal;
 
@@ -3999,7 +4016,7 @@ void Button_Brush_FX(int btn)
   Window_set_normal_button( 58, 61, 75,14,"any angle"       ,0,1,Config_Key[SPECIAL_ROTATE_ANY_ANGLE][0]); // 6
   Window_set_normal_button(145, 46, 67,14,"Stretch"         ,0,1,Config_Key[SPECIAL_STRETCH][0]); // 7
   Window_set_normal_button(145, 61, 67,14,"Distort"         ,0,1,Config_Key[SPECIAL_DISTORT][0]); // 8
-  Window_set_normal_button(155, 99,131,14,"Recolorize"      ,0,1,Config_Key[SPECIAL_RECOLORIZE_BRUSH][0]); // 9
+  Window_set_normal_button(143, 99, 87,14,"Recolorize"      ,0,1,Config_Key[SPECIAL_RECOLORIZE_BRUSH][0]); // 9
   Window_set_normal_button(155,117,131,14,"Get brush colors",0,1,Config_Key[SPECIAL_GET_BRUSH_COLORS][0]); // 10
 
   // Boutons représentant les coins du brush handle: (HG,HD,C,BG,BD)
@@ -4014,6 +4031,7 @@ void Button_Brush_FX(int btn)
 
   Window_set_normal_button(  7,141, 60,14,"Load",0,1,Config_Key[SPECIAL_LOAD_BRUSH][0]); // 18
   Window_set_normal_button( 70,141, 60,14,"Save",0,1,Config_Key[SPECIAL_SAVE_BRUSH][0]); // 19
+  Window_set_normal_button(233, 99, 65,14,"Smooth",0,1,0); // 20
 
   Print_in_window( 80, 24,"Shape modifications",MC_Dark,MC_Light);
   Print_in_window( 10, 36,"Mirror",MC_Dark,MC_Light);
@@ -4146,6 +4164,9 @@ void Button_Brush_FX(int btn)
       Save_picture(CONTEXT_BRUSH);
       Hide_cursor();
       break;
+    case 20 : // Smooth
+      Smooth_brush();
+      break;
   }
 
   Display_cursor();
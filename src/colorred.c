@@ -143,3 +143,44 @@ void CT_delete(CT_Tree* tree)
 {
 	free(tree);
 }
+
+/**
+ * Builds the lookup grid of a tree.
+ *
+ * The leaves of the tree are boxes which don't overlap: each one fills the
+ * cells which are completely inside it.
+ */
+CT_Grid* CT_grid_new(CT_Tree* tree)
+{
+	const int shift = 8 - CT_GRID_BITS;
+	CT_Grid* grid = malloc(sizeof(CT_Grid));
+	int n, i;
+
+	if (grid == NULL)
+		return NULL;
+	grid->tree = tree;
+	for (i = 0; i < (1 << (3 * CT_GRID_BITS)); i++)
+		grid->cells[i] = CT_GRID_TREE;
+	for (n = 0; n < tree->nodecount; n++)
+	{
+		const CT_Node* node = &tree->nodes[n];
+		int r, g, b;
+		// First and after-last cells inside the box
+		int r0 = (node->Rmin + (1 << shift) - 1) >> shift, r1 = (node->Rmax + 1) >> shift;
+		int g0 = (node->Gmin + (1 << shift) - 1) >> shift, g1 = (node->Gmax + 1) >> shift;
+		int b0 = (node->Bmin + (1 << shift) - 1) >> shift, b1 = (node->Bmax + 1) >> shift;
+
+		if (node->children[0] != 0)
+			continue; // not a leaf
+		for (r = r0; r < r1; r++)
+			for (g = g0; g < g1; g++)
+				for (b = b0; b < b1; b++)
+					grid->cells[(((r << CT_GRID_BITS) | g) << CT_GRID_BITS) | b] = node->children[1];
+	}
+	return grid;
+}
+
+void CT_grid_delete(CT_Grid* grid)
+{
+	free(grid);
+}
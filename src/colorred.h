@@ -79,4 +79,33 @@ byte CT_get(CT_Tree* t,byte r,byte g,byte b);
 void CT_set(CT_Tree* colorTree, byte Rmin, byte Gmin, byte Bmin,
 	byte Rmax, byte Gmax, byte Bmax, byte index);
 
+/// Precision of the cells of a ::CT_Grid
+#define CT_GRID_BITS 6
+/// Value of the cells of a ::CT_Grid which are cut by a box of the tree
+#define CT_GRID_TREE 0x100
+/// Index of the cell of a color in a ::CT_Grid
+#define CT_GRID_INDEX(r,g,b) ((((r) >> (8 - CT_GRID_BITS)) << (2 * CT_GRID_BITS)) \
+                             | (((g) >> (8 - CT_GRID_BITS)) << CT_GRID_BITS) \
+                             | ((b) >> (8 - CT_GRID_BITS)))
+
+/**
+ * Dense lookup grid of a Color Tree.
+ *
+ * Each cell of the RGB cube which is inside a single box of the tree holds
+ * its palette index: then CT_get() is one memory load. The other cells
+ * hold ::CT_GRID_TREE, to walk the tree:
+ *
+ *   word index = grid->cells[CT_GRID_INDEX(r, g, b)];
+ *   if (index == CT_GRID_TREE)
+ *     index = CT_get(grid->tree, r, g, b);
+ */
+typedef struct
+{
+	CT_Tree * tree;
+	word cells[1 << (3 * CT_GRID_BITS)];
+} CT_Grid;
+
+CT_Grid* CT_grid_new(CT_Tree* t);
+void CT_grid_delete(CT_Grid* grid);
+
 #endif
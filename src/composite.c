@@ -0,0 +1,203 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file composite.c
+/// Masked overlay of layers, with SIMD versions.
+
+#include <stddef.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OVERLAY_SSE2
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+  && (defined(__clang__) || __GNUC__ >= 5)
+#include <immintrin.h>
+#define OVERLAY_AVX2
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OVERLAY_NEON
+#endif
+
+#include "struct.h"
+#include "composite.h"
+#include "gfx2log.h"
+
+/// Portable version, also used for the ends of the rows.
+static void Overlay_row_scalar(byte * dest, byte * depth, const byte * src, long width, byte transparent, byte layer)
+{
+  long i;
+
+  if (dest != NULL && depth != NULL)
+  {
+    for (i=0; i<width; i++)
+    {
+      if (src[i] != transparent)
+      {
+        dest[i] = src[i];
+        depth[i] = layer;
+      }
+    }
+  }
+  else if (dest != NULL)
+  {
+    for (i=0; i<width; i++)
+      if (src[i] != transparent)
+        dest[i] = src[i];
+  }
+  else if (depth != NULL)
+  {
+    for (i=0; i<width; i++)
+      if (src[i] != transparent)
+        depth[i] = layer;
+  }
+}
+
+#ifdef OVERLAY_SSE2
+static void Overlay_row_sse2(byte * dest, byte * depth, const byte * src, long width, byte transparent, byte layer)
+{
+  const __m128i key = _mm_set1_epi8((char)transparent);
+  const __m128i index = _mm_set1_epi8((char)layer);
+  long i;
+
+  for (i=0; i+16<=width; i+=16)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i));
+    // 0xFF where the destination is kept
+    __m128i keep = _mm_cmpeq_epi8(pixels, key);
+
+    if (_mm_movemask_epi8(keep) == 0xFFFF)
+      continue; // Nothing to copy, the most usual case for upper layers
+    if (dest != NULL)
+    {
+      __m128i old = _mm_loadu_si128((const __m128i *)(dest + i));
+      _mm_storeu_si128((__m128i *)(dest + i),
+        _mm_or_si128(_mm_and_si128(keep, old), _mm_andnot_si128(keep, pixels)));
+    }
+    if (depth != NULL)
+    {
+      __m128i old = _mm_loadu_si128((const __m128i *)(depth + i));
+      _mm_storeu_si128((__m128i *)(depth + i),
+        _mm_or_si128(_mm_and_si128(keep, old), _mm_andnot_si128(keep, index)));
+    }
+  }
+  Overlay_row_scalar(dest != NULL ? dest + i : NULL, depth != NULL ? depth + i : NULL,
+                     src + i, width - i, transparent, layer);
+}
+#endif
+
+#ifdef OVERLAY_AVX2
+__attribute__((target("avx2")))
+static void Overlay_row_avx2(byte * dest, byte * depth, const byte * src, long width, byte transparent, byte layer)
+{
+  const __m256i key = _mm256_set1_epi8((char)transparent);
+  const __m256i index = _mm256_set1_epi8((char)layer);
+  long i;
+
+  for (i=0; i+32<=width; i+=32)
+  {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i keep = _mm256_cmpeq_epi8(pixels, key);
+
+    if (_mm256_movemask_epi8(keep) == -1)
+      continue;
+    if (dest != NULL)
+    {
+      __m256i old = _mm256_loadu_si256((const __m256i *)(dest + i));
+      _mm256_storeu_si256((__m256i *)(dest + i), _mm256_blendv_epi8(pixels, old, keep));
+    }
+    if (depth != NULL)
+    {
+      __m256i old = _mm256_loadu_si256((const __m256i *)(depth + i));
+      _mm256_storeu_si256((__m256i *)(depth + i), _mm256_blendv_epi8(index, old, keep));
+    }
+  }
+  Overlay_row_scalar(dest != NULL ? dest + i : NULL, depth != NULL ? depth + i : NULL,
+                     src + i, width - i, transparent, layer);
+}
+#endif
+
+#ifdef OVERLAY_NEON
+static void Overlay_row_neon(byte * dest, byte * depth, const byte * src, long width, byte transparent, byte layer)
+{
+  const uint8x16_t key = vdupq_n_u8(transparent);
+  const uint8x16_t index = vdupq_n_u8(layer);
+  long i;
+
+  for (i=0; i+16<=width; i+=16)
+  {
+    uint8x16_t pixels = vld1q_u8(src + i);
+    uint8x16_t keep = vceqq_u8(pixels, key);
+
+#if defined(__aarch64__)
+    if (vminvq_u8(keep) == 0xFF)
+      continue;
+#endif
+    if (dest != NULL)
+      vst1q_u8(dest + i, vbslq_u8(keep, vld1q_u8(dest + i), pixels));
+    if (depth != NULL)
+      vst1q_u8(depth + i, vbslq_u8(keep, vld1q_u8(depth + i), index));
+  }
+  Overlay_row_scalar(dest != NULL ? dest + i : NULL, depth != NULL ? depth + i : NULL,
+                     src + i, width - i, transparent, layer);
+}
+#endif
+
+const T_Overlay_implementation * Overlay_implementations(void)
+{
+  static T_Overlay_implementation list[5];
+
+  if (list[0].Name == NULL)
+  {
+    int n = 0;
+
+    list[n].Name = "scalar";
+    list[n++].Function = Overlay_row_scalar;
+#ifdef OVERLAY_SSE2
+    list[n].Name = "SSE2";
+    list[n++].Function = Overlay_row_sse2;
+#endif
+#ifdef OVERLAY_AVX2
+    if (__builtin_cpu_supports("avx2"))
+    {
+      list[n].Name = "AVX2";
+      list[n++].Function = Overlay_row_avx2;
+    }
+#endif
+#ifdef OVERLAY_NEON
+    list[n].Name = "NEON";
+    list[n++].Function = Overlay_row_neon;
+#endif
+    list[n].Name = NULL;
+  }
+  return list;
+}
+
+Func_overlay_row Overlay_row = Overlay_row_scalar;
+
+void Init_overlay_row(void)
+{
+  const T_Overlay_implementation * implementation = Overlay_implementations();
+
+  while (implementation[1].Name != NULL)
+    implementation++;
+  GFX2_Log(GFX2_DEBUG, "Layers overlay : %s\n", implementation->Name);
+  Overlay_row = implementation->Function;
+}
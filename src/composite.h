@@ -0,0 +1,69 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file composite.h
+/// Copy of the opaque pixels of a layer over another image ("masked
+/// overlay"), used to flatten the layers.
+///
+/// Several implementations exist (SSE2, AVX2, NEON and a portable one).
+/// The fastest one the CPU can run is chosen by Init_overlay_row().
+
+#ifndef COMPOSITE_H_INCLUDED
+#define COMPOSITE_H_INCLUDED
+
+/**
+ * Copies the pixels of a layer which are not transparent over another image,
+ * and writes the layer index in a depth buffer where they are copied.
+ *
+ * @param dest the image to draw on, or NULL to only update the depth buffer
+ * @param depth the depth buffer, or NULL
+ * @param src pixels of the layer
+ * @param width number of pixels
+ * @param transparent the transparent color of the layer
+ * @param layer value written in the depth buffer
+ */
+typedef void (* Func_overlay_row) (byte * dest, byte * depth, const byte * src, long width, byte transparent, byte layer);
+
+/// The fastest implementation for this CPU, the portable one until Init_overlay_row() is called.
+extern Func_overlay_row Overlay_row;
+
+/**
+ * Chooses the fastest implementation of Overlay_row() for this CPU.
+ *
+ * Must be called at startup, before the worker threads use Overlay_row().
+ */
+void Init_overlay_row(void);
+
+/// An implementation of ::Func_overlay_row
+typedef struct
+{
+  const char * Name;
+  Func_overlay_row Function;
+} T_Overlay_implementation;
+
+/**
+ * The implementations which can run on this CPU, for tests and benchmarks.
+ *
+ * The portable one comes first, the fastest one last. The list ends with
+ * a NULL Name.
+ */
+const T_Overlay_implementation * Overlay_implementations(void);
+
+#endif
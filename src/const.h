@@ -58,6 +58,7 @@
 #define MAX_DISPLAYABLE_PATH      37    ///< Max number of characters to display directory name, in Save/Load screens.
 #define COMMENT_SIZE              32    ///< Max number of characters for a comment in PKM or PNG file.
 #define NB_MAX_PAGES_UNDO         99    ///< Max number of undo pages
+#define NB_MAX_PAGES_UNDO_BUDGET 999    ///< Max number of undo pages when the history is limited by T_Config::Undo_memory_budget
 #define DEFAULT_ZOOM_FACTOR        4    ///< Initial zoom factor for the magnifier.
 #define MAX_PATH_CHARACTERS PATH_MAX    ///< Number of characters for a file+complete path. Adapt to your OS...
 #define NB_BOOKMARKS               4    ///< Number of bookmark buttons in Save/Load screen.
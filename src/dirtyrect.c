@@ -0,0 +1,251 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file dirtyrect.c
+/// Tracking of the modified parts of the screen, shared by the display
+/// backends.
+
+#include "struct.h"
+#include "dirtyrect.h"
+
+static long Area(const T_Dirty_rect * r)
+{
+  return (long)r->Width * r->Height;
+}
+
+/// Tells if a contains b
+static int Contains(const T_Dirty_rect * a, const T_Dirty_rect * b)
+{
+  return a->X <= b->X && a->Y <= b->Y
+      && a->X + a->Width >= b->X + b->Width
+      && a->Y + a->Height >= b->Y + b->Height;
+}
+
+/// Number of pixels in both a and b
+static long Overlap(const T_Dirty_rect * a, const T_Dirty_rect * b)
+{
+  int left = a->X > b->X ? a->X : b->X;
+  int top = a->Y > b->Y ? a->Y : b->Y;
+  int right = a->X + a->Width < b->X + b->Width ? a->X + a->Width : b->X + b->Width;
+  int bottom = a->Y + a->Height < b->Y + b->Height ? a->Y + a->Height : b->Y + b->Height;
+
+  if (right <= left || bottom <= top)
+    return 0;
+  return (long)(right - left) * (bottom - top);
+}
+
+/// Smallest rectangle which contains a and b
+static T_Dirty_rect Union(const T_Dirty_rect * a, const T_Dirty_rect * b)
+{
+  T_Dirty_rect u;
+  int right = a->X + a->Width > b->X + b->Width ? a->X + a->Width : b->X + b->Width;
+  int bottom = a->Y + a->Height > b->Y + b->Height ? a->Y + a->Height : b->Y + b->Height;
+
+  u.X = a->X < b->X ? a->X : b->X;
+  u.Y = a->Y < b->Y ? a->Y : b->Y;
+  u.Width = right - u.X;
+  u.Height = bottom - u.Y;
+  return u;
+}
+
+/// Number of unchanged pixels which would be sent if a and b were replaced
+/// by their union
+static long Merge_waste(const T_Dirty_rect * a, const T_Dirty_rect * b)
+{
+  T_Dirty_rect u = Union(a, b);
+
+  return Area(&u) - Area(a) - Area(b) + Overlap(a, b);
+}
+
+static void Remove_rect(T_Dirty_region * region, int i)
+{
+  region->Rects[i] = region->Rects[--region->Nb_rects];
+}
+
+/// Tells if the union u of r and the rectangle i overlaps no rectangle that
+/// r didn't already overlap. Otherwise the merges and the splits could undo
+/// each other forever.
+static int Merge_is_clean(const T_Dirty_region * region, int i, const T_Dirty_rect * r, const T_Dirty_rect * u)
+{
+  int j;
+
+  for (j = 0; j < region->Nb_rects; j++)
+    if (j != i && Overlap(region->Rects + j, u) && !Overlap(region->Rects + j, r))
+      return 0;
+  return 1;
+}
+
+static void Add_piece(T_Dirty_region * region, int x, int y, int width, int height);
+
+static void Add_rect(T_Dirty_region * region, T_Dirty_rect r)
+{
+  int i;
+
+restart:
+  for (i = 0; i < region->Nb_rects; i++)
+  {
+    if (Contains(region->Rects + i, &r))
+      return;
+  }
+  for (i = 0; i < region->Nb_rects; i++)
+  {
+    if (Contains(&r, region->Rects + i))
+      Remove_rect(region, i--);
+  }
+  // Merge with the neighbours when it costs less than a transfer
+  for (i = 0; i < region->Nb_rects; i++)
+  {
+    if (Merge_waste(region->Rects + i, &r) <= DIRTY_RECT_COST)
+    {
+      T_Dirty_rect u = Union(region->Rects + i, &r);
+
+      if (Merge_is_clean(region, i, &r, &u))
+      {
+        r = u;
+        Remove_rect(region, i);
+        goto restart;
+      }
+    }
+  }
+  if (region->Nb_rects == DIRTY_RECTS_MAX)
+  {
+    // No room: merge with the rectangle which wastes the fewest pixels,
+    // then with all the ones the union overlaps, so the list shrinks.
+    int best = 0;
+
+    for (i = 1; i < region->Nb_rects; i++)
+      if (Merge_waste(region->Rects + i, &r) < Merge_waste(region->Rects + best, &r))
+        best = i;
+    r = Union(region->Rects + best, &r);
+    Remove_rect(region, best);
+    for (i = 0; i < region->Nb_rects; i++)
+    {
+      if (Overlap(region->Rects + i, &r))
+      {
+        r = Union(region->Rects + i, &r);
+        Remove_rect(region, i);
+        i = -1;
+      }
+    }
+    region->Rects[region->Nb_rects++] = r;
+    return;
+  }
+  // Keep only the parts which are outside the other rectangles:
+  // the bands above and below e, then the parts on its left and right.
+  for (i = 0; i < region->Nb_rects; i++)
+  {
+    if (Overlap(region->Rects + i, &r))
+    {
+      T_Dirty_rect e = region->Rects[i];
+      int top = r.Y > e.Y ? r.Y : e.Y;
+      int bottom = r.Y + r.Height < e.Y + e.Height ? r.Y + r.Height : e.Y + e.Height;
+
+      Add_piece(region, r.X, r.Y, r.Width, e.Y - r.Y);
+      Add_piece(region, r.X, e.Y + e.Height, r.Width, r.Y + r.Height - e.Y - e.Height);
+      Add_piece(region, r.X, top, e.X - r.X, bottom - top);
+      Add_piece(region, e.X + e.Width, top, r.X + r.Width - e.X - e.Width, bottom - top);
+      return;
+    }
+  }
+  region->Rects[region->Nb_rects++] = r;
+}
+
+static void Add_piece(T_Dirty_region * region, int x, int y, int width, int height)
+{
+  T_Dirty_rect r;
+
+  if (width <= 0 || height <= 0)
+    return;
+  r.X = x;
+  r.Y = y;
+  r.Width = width;
+  r.Height = height;
+  Add_rect(region, r);
+}
+
+void Dirty_region_add(T_Dirty_region * region, int x, int y, int width, int height)
+{
+  Add_piece(region, x, y, width, height);
+}
+
+void Dirty_region_add_colors(T_Dirty_region * region, const byte * pixels, int pitch, int width, int height, const byte * colors)
+{
+  int band_top = -1;
+  int band_left = 0;
+  int band_right = 0;
+  int y;
+
+  for (y = 0; y < height; y++, pixels += pitch)
+  {
+    int left = 0;
+    int right = width;
+
+    while (left < width && !colors[pixels[left]])
+      left++;
+    if (left < width)
+    {
+      while (!colors[pixels[right - 1]])
+        right--;
+      if (band_top < 0)
+      {
+        band_top = y;
+        band_left = left;
+        band_right = right;
+      }
+      else
+      {
+        if (left < band_left)
+          band_left = left;
+        if (right > band_right)
+          band_right = right;
+      }
+    }
+    else if (band_top >= 0)
+    {
+      Dirty_region_add(region, band_left, band_top, band_right - band_left, y - band_top);
+      band_top = -1;
+    }
+  }
+  if (band_top >= 0)
+    Dirty_region_add(region, band_left, band_top, band_right - band_left, height - band_top);
+}
+
+long Dirty_region_flush(T_Dirty_region * region, int width, int height, Func_dirty_rect update)
+{
+  long pixels = 0;
+  int i;
+
+  for (i = 0; i < region->Nb_rects; i++)
+  {
+    const T_Dirty_rect * r = region->Rects + i;
+    int left = r->X > 0 ? r->X : 0;
+    int top = r->Y > 0 ? r->Y : 0;
+    int right = r->X + r->Width < width ? r->X + r->Width : width;
+    int bottom = r->Y + r->Height < height ? r->Y + r->Height : height;
+
+    if (right <= left || bottom <= top)
+      continue;
+    update(left, top, right - left, bottom - top);
+    pixels += (long)(right - left) * (bottom - top);
+  }
+  region->Nb_rects = 0;
+  region->Pixels_flushed = pixels;
+  return pixels;
+}
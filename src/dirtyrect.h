@@ -0,0 +1,92 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file dirtyrect.h
+/// List of the rectangles of the screen which must be sent to the display.
+///
+/// The rectangles never overlap, so no pixel is sent twice. Close
+/// rectangles are merged when sending a few unchanged pixels costs less
+/// than one more transfer, and the list never grows beyond
+/// ::DIRTY_RECTS_MAX rectangles.
+
+#ifndef DIRTYRECT_H_INCLUDED
+#define DIRTYRECT_H_INCLUDED
+
+/// Maximum number of rectangles in a ::T_Dirty_region
+#define DIRTY_RECTS_MAX 16
+
+/// Cost of one more transfer, counted in pixels. Two rectangles are merged
+/// when their union adds fewer unchanged pixels than this.
+#define DIRTY_RECT_COST 1024
+
+typedef struct
+{
+  int X;
+  int Y;
+  int Width;
+  int Height;
+} T_Dirty_rect;
+
+typedef struct
+{
+  int Nb_rects;
+  T_Dirty_rect Rects[DIRTY_RECTS_MAX];
+  long Pixels_flushed; ///< Number of pixels sent by the last Dirty_region_flush()
+} T_Dirty_region;
+
+/**
+ * Sends a rectangle of the screen to the display.
+ *
+ * It receives the rectangles of a region, clipped to the screen.
+ */
+typedef void (* Func_dirty_rect) (int x, int y, int width, int height);
+
+/**
+ * Marks a rectangle as modified.
+ *
+ * Empty rectangles are ignored.
+ */
+void Dirty_region_add(T_Dirty_region * region, int x, int y, int width, int height);
+
+/**
+ * Marks the parts of an 8-bit screen which use some colors, after a change
+ * of these colors in the palette.
+ *
+ * Each band of consecutive rows which use them is added, from the leftmost
+ * to the rightmost of their pixels. The other parts keep their previous
+ * conversion.
+ * @param pixels the screen
+ * @param pitch byte distance between two rows
+ * @param width, height the size of the screen
+ * @param colors non-zero for the colors to look for
+ */
+void Dirty_region_add_colors(T_Dirty_region * region, const byte * pixels, int pitch, int width, int height, const byte * colors);
+
+/**
+ * Sends all the modified rectangles, and empties the region.
+ *
+ * @param width the screen width: the rectangles are clipped to it
+ * @param height the screen height
+ * @param update called for each rectangle
+ * @return the number of pixels sent, also stored in T_Dirty_region::Pixels_flushed
+ */
+long Dirty_region_flush(T_Dirty_region * region, int width, int height, Func_dirty_rect update);
+
+#endif
@@ -51,7 +51,7 @@
 #include "factory.h"
 #include "loadsave.h"
 #include "io.h"
-#include "pxsimple.h"
+#include "pxrender.h"
 #include "oldies.h"
 #include "palette.h"
 #include "unicode.h"
@@ -1185,6 +1185,7 @@ void Main_handler(void)
                 break;
               case SPECIAL_EXCLUDE_COLORS_MENU : // Exclude colors menu
                 Menu_tag_colors("Tag colors to exclude",Exclude_color,&temp,1, NULL, SPECIAL_EXCLUDE_COLORS_MENU);
+                Palette_changed();
                 action++;
                 break;
               case SPECIAL_INVERT_SIEVE :
@@ -239,6 +239,8 @@ void Backup_if_necessary(lua_State* L, int layer)
       // Already OK
       return;
     }
+    if (layer != Main.current_layer)
+      Invalidate_layers_planes();
     if (Dup_layer_if_shared(Main.backups->Pages, layer))
     {
       // Depth buffer etc to modify too ?
@@ -809,6 +811,7 @@ int L_SetColor(lua_State* L)
   Main.palette[c].R=Round_palette_component(clamp_byte(r));
   Main.palette[c].G=Round_palette_component(clamp_byte(g));
   Main.palette[c].B=Round_palette_component(clamp_byte(b));
+  Palette_changed();
   // Set_color(c, r, g, b); Not needed. Update screen when script is finished
   Palette_has_changed=1;
   return 0;
@@ -1944,6 +1947,8 @@ int L_SelectSpareLayer(lua_State* L)
 int L_SelectLayer(lua_State* L)
 {
   int nb_args=lua_gettop(L);
+  int old_current_layer = Main.current_layer;
+  dword old_layers_visible = Main.layers_visible;
   
   LUA_ARG_LIMIT (1, "selectlayer");
   LUA_ARG_NUMBER(1, "selectlayer", Main.current_layer, 0, Main.backups->Pages->Nb_layers - 1);
@@ -1952,15 +1957,9 @@ int L_SelectLayer(lua_State* L)
   // 
   if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
   {
-    if (! ((1 << Main.current_layer) & Main.layers_visible))
-    {
-      Main.layers_visible |= (1 << Main.current_layer);
-      Redraw_layered_image();
-    }
-    else
-    {
-      Update_depth_buffer(); // Only need the depth buffer
-    }
+    Main.layers_visible |= (1 << Main.current_layer);
+    // Only the area of the layers involved is updated
+    Redraw_after_layers_change(old_layers_visible, old_current_layer);
   }
   return 0;
 }
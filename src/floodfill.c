@@ -0,0 +1,140 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file floodfill.c
+/// Scanline flood fill.
+///
+/// The filled area is made of horizontal spans. A stack holds the points
+/// from which a span still has to be searched: each filled span pushes the
+/// start of the spans of color 1 which touch it on the rows above and below.
+
+#include <stdlib.h>
+#include <string.h>
+#include "struct.h"
+#include "floodfill.h"
+#include "gfx2log.h"
+
+/// A point from which a span is searched
+typedef struct
+{
+  short X;
+  short Y;
+} T_Fill_seed;
+
+/// Stack of the points to process
+typedef struct
+{
+  T_Fill_seed * Seeds;
+  long Size;
+  long Allocated;
+} T_Fill_stack;
+
+static int Push_seed(T_Fill_stack * stack, short x, short y)
+{
+  if (stack->Size >= stack->Allocated)
+  {
+    long new_size = stack->Allocated ? stack->Allocated * 2 : 1024;
+    T_Fill_seed * new_seeds = (T_Fill_seed *)realloc(stack->Seeds, new_size * sizeof(T_Fill_seed));
+    if (new_seeds == NULL)
+      return 0;
+    stack->Seeds = new_seeds;
+    stack->Allocated = new_size;
+  }
+  stack->Seeds[stack->Size].X = x;
+  stack->Seeds[stack->Size].Y = y;
+  stack->Size++;
+  return 1;
+}
+
+/// Pushes the start of each span of color 1 of a row, between 2 columns
+static int Push_spans(T_Fill_stack * stack, const byte * row, short start_x, short end_x, short y)
+{
+  short x;
+
+  for (x = start_x; x <= end_x; x++)
+  {
+    if (row[x] == 1)
+    {
+      if (!Push_seed(stack, x, y))
+        return 0;
+      // Skip the rest of the span
+      for (x++; x <= end_x && row[x] == 1; x++)
+        ;
+    }
+  }
+  return 1;
+}
+
+int Flood_fill(byte * pixels, long pitch,
+               short limit_left, short limit_top, short limit_right, short limit_bottom,
+               short x, short y,
+               short * top_reached, short * bottom_reached,
+               short * left_reached, short * right_reached)
+{
+  T_Fill_stack stack;
+  int ok = 1;
+
+  *top_reached = *bottom_reached = y;
+  *left_reached = *right_reached = x;
+  stack.Seeds = NULL;
+  stack.Size = stack.Allocated = 0;
+
+  // The starting point is filled whatever its color
+  pixels[x + (long)y * pitch] = 1;
+  if (!Push_seed(&stack, x, y))
+    ok = 0;
+
+  while (ok && stack.Size > 0)
+  {
+    T_Fill_seed seed = stack.Seeds[--stack.Size];
+    byte * row = pixels + (long)seed.Y * pitch;
+    short start_x = seed.X;
+    short end_x = seed.X;
+
+    // Already filled from another seed
+    if (row[seed.X] != 1)
+      continue;
+
+    // Find the whole span, and fill it
+    while (start_x > limit_left && row[start_x - 1] == 1)
+      start_x--;
+    while (end_x < limit_right && row[end_x + 1] == 1)
+      end_x++;
+    memset(row + start_x, 2, end_x - start_x + 1);
+
+    if (start_x < *left_reached)
+      *left_reached = start_x;
+    if (end_x > *right_reached)
+      *right_reached = end_x;
+    if (seed.Y < *top_reached)
+      *top_reached = seed.Y;
+    if (seed.Y > *bottom_reached)
+      *bottom_reached = seed.Y;
+
+    if (seed.Y > limit_top && !Push_spans(&stack, row - pitch, start_x, end_x, seed.Y - 1))
+      ok = 0;
+    if (seed.Y < limit_bottom && !Push_spans(&stack, row + pitch, start_x, end_x, seed.Y + 1))
+      ok = 0;
+  }
+  if (!ok)
+    GFX2_Log(GFX2_ERROR, "Flood_fill() : out of memory, the fill is incomplete\n");
+  free(stack.Seeds);
+  return ok;
+}
@@ -0,0 +1,55 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file floodfill.h
+/// Scanline flood fill, used by the Fill tool.
+
+#ifndef FLOODFILL_H_INCLUDED
+#define FLOODFILL_H_INCLUDED
+
+/**
+ * Replaces by 2 all the pixels of color 1 which are 4-connected to a
+ * starting point, without going out of a rectangle.
+ *
+ * Each pixel is visited a bounded number of times whatever the shape of
+ * the area, so spirals and mazes are filled in linear time.
+ * The starting point is painted with 2 whatever its color.
+ * @param pixels the image, whose pixels are all 1 or something else
+ * @param pitch byte width of a row of the image
+ * @param limit_left the rectangle the fill must not leave (inclusive)
+ * @param limit_top the rectangle the fill must not leave (inclusive)
+ * @param limit_right the rectangle the fill must not leave (inclusive)
+ * @param limit_bottom the rectangle the fill must not leave (inclusive)
+ * @param x the starting point, in the rectangle
+ * @param y the starting point, in the rectangle
+ * @param top_reached the top of the pixels painted with 2
+ * @param bottom_reached the bottom of the pixels painted with 2
+ * @param left_reached the left of the pixels painted with 2
+ * @param right_reached the right of the pixels painted with 2
+ * @return 1 if OK, 0 if out of memory: the fill is then incomplete, but
+ *         the rectangle reached is still right.
+ */
+int Flood_fill(byte * pixels, long pitch,
+               short limit_left, short limit_top, short limit_right, short limit_bottom,
+               short x, short y,
+               short * top_reached, short * bottom_reached,
+               short * left_reached, short * right_reached);
+
+#endif
@@ -74,3 +74,46 @@ void Set_GFX2_Surface_pixel(T_GFX2_Surface * surface, int x, int y, byte value)
   }
   surface->pixels[x + surface->w * y] = value;
 }
+
+int Palette_to_ARGB(dword * argb, const T_Components * palette, int first_color, int count, byte alpha, byte * changed)
+{
+  int i;
+  int nb_changed = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    dword value = (dword)alpha << 24 | (dword)palette[i].R << 16
+                | (dword)palette[i].G << 8 | palette[i].B;
+
+    if (argb[first_color + i] != value)
+    {
+      argb[first_color + i] = value;
+      if (changed != NULL)
+        changed[first_color + i] = 1;
+      nb_changed++;
+    }
+  }
+  return nb_changed;
+}
+
+void Pixels_to_ARGB(dword * dest, const byte * src, int width, const dword * argb)
+{
+  int x;
+
+  // 4 pixels at a time: the table stays in the L1 cache, and the 4 lookups
+  // are done before the stores so they don't wait for each other.
+  for (x = 0; x + 4 <= width; x += 4)
+  {
+    dword c0 = argb[src[x]];
+    dword c1 = argb[src[x + 1]];
+    dword c2 = argb[src[x + 2]];
+    dword c3 = argb[src[x + 3]];
+
+    dest[x] = c0;
+    dest[x + 1] = c1;
+    dest[x + 2] = c2;
+    dest[x + 3] = c3;
+  }
+  for (; x < width; x++)
+    dest[x] = argb[src[x]];
+}
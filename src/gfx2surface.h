@@ -67,4 +67,26 @@ byte Get_GFX2_Surface_pixel(const T_GFX2_Surface * surface, int x, int y);
  */
 void Set_GFX2_Surface_pixel(T_GFX2_Surface * surface, int x, int y, byte value);
 
+/**
+ * Fills a table of 32-bit colors (0xAARRGGBB) from palette entries.
+ * @param argb the table to fill, indexed by color
+ * @param palette the colors first_color to first_color + count - 1
+ * @param first_color, count the palette entries to convert
+ * @param alpha the value of the AA byte
+ * @param changed if not NULL, the entries of the colors whose value changed
+ *        are set to 1, the others are left as they are
+ * @return the number of colors whose value changed
+ */
+int Palette_to_ARGB(dword * argb, const T_Components * palette, int first_color, int count, byte alpha, byte * changed);
+
+/**
+ * Converts a row of 8 bits pixels to 32 bits, in one pass.
+ * It is used to display the screen with the true color backends.
+ * @param dest receives width 32-bit pixels
+ * @param src the 8 bits pixels
+ * @param width number of pixels
+ * @param argb the 32-bit value of each color, see Palette_to_ARGB()
+ */
+void Pixels_to_ARGB(dword * dest, const byte * src, int width, const dword * argb);
+
 #endif
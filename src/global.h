@@ -196,6 +196,8 @@ GFX2_GLOBAL Func_procsline Display_line_fast;
 GFX2_GLOBAL Func_procsline Read_line;
 /// Redraw all magnified part on screen, without overwriting the menu.
 GFX2_GLOBAL Func_display_zoom Display_zoomed_screen;
+/// Redraw some columns (in image pixels) and some rows (in screen pixels) of the magnified part of screen.
+GFX2_GLOBAL Func_display_zoom_area Display_zoomed_area;
 /// Display part of the brush on the magnified part of screen, color mode.
 GFX2_GLOBAL Func_display_brush_color_zoom Display_brush_color_zoom;
 /// Display part of the brush on the magnified part of screen, monochrome mode.
@@ -436,6 +438,11 @@ GFX2_GLOBAL Func_effect Effect_function;
 /// ::Best_color()
 GFX2_GLOBAL byte Exclude_color[256];
 
+/// Changes each time the palette or ::Exclude_color change, see
+/// Palette_changed(). The caches which depend on them keep the value they
+/// were filled with.
+GFX2_GLOBAL dword Palette_generation;
+
 // -- Smear mode
 
 /// Smear mode is activated
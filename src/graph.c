@@ -37,19 +37,13 @@
 #include "graph.h"
 #include "misc.h"
 #include "osdep.h"
-#include "pxsimple.h"
-#include "pxtall.h"
-#include "pxwide.h"
-#include "pxdouble.h"
-#include "pxtriple.h"
-#include "pxwide2.h"
-#include "pxtall2.h"
-#include "pxtall3.h"
-#include "pxquad.h"
+#include "pxrender.h"
 #include "windows.h"
 #include "input.h"
 #include "brush.h"
 #include "tiles.h"
+#include "gfx2mem.h"
+#include "floodfill.h"
 #if defined(USE_SDL) || defined(USE_SDL2)
 #include "sdlscreen.h"
 #endif
@@ -415,7 +409,6 @@ try_again:
     {
         default:
         case PIXEL_SIMPLE:
-#define Display_line_on_screen_fast_simple Display_line_on_screen_simple
 #define SETPIXEL(x) \
             Pixel = Pixel_##x ; \
             Read_pixel= Read_pixel_##x ; \
@@ -433,6 +426,7 @@ try_again:
             Display_line_fast = Display_line_on_screen_fast_##x ; \
             Read_line = Read_line_screen_##x ; \
             Display_zoomed_screen = Display_part_of_screen_scaled_##x ; \
+            Display_zoomed_area = Display_part_of_screen_scaled_area_##x ; \
             Display_brush_color_zoom = Display_brush_color_zoom_##x ; \
             Display_brush_mono_zoom = Display_brush_mono_zoom_##x ; \
             Clear_brush_scaled = Clear_brush_scaled_##x ; \
@@ -440,7 +434,6 @@ try_again:
 			SETPIXEL(simple)
         break;
         case PIXEL_TALL:
-#define Display_line_on_screen_fast_tall Display_line_on_screen_tall
 			SETPIXEL(tall)
         break;
         case PIXEL_WIDE:
@@ -737,6 +730,8 @@ void Get_colors_from_brush(void)
       }
     }
   }
+  // The brush is remapped to the new colors before Set_palette()
+  Palette_changed();
   Remap_brush();
 
   Set_palette(Main.palette);
@@ -770,183 +765,11 @@ void Fill(short * top_reached  , short * bottom_reached,
 //   Cette fonction ne doit pas être directement appelée.
 //
 {
-  short x_pos;   // Abscisse de balayage du segment, utilisée lors de l'"affichage"
-  short line;   // Ordonnée de la ligne en cours de traitement
-  short start_x; // Abscisse de départ du segment traité
-  short end_x;   // Abscisse de fin du segment traité
-  int   changes_made;    // Booléen "On a fait une modif dans le dernier passage"
-  int   can_propagate; // Booléen "On peut propager la couleur dans le segment"
-  short current_limit_bottom;  // Intervalle vertical restreint
-  short current_limit_top;
-  int   line_is_modified;       // Booléen "On a fait une modif dans la ligne"
-
-  changes_made=1;
-  current_limit_top=Paintbrush_Y;
-  current_limit_bottom =Min(Paintbrush_Y+1,Limit_bottom);
-  *left_reached=Paintbrush_X;
-  *right_reached=Paintbrush_X+1;
-  Pixel_in_current_layer(Paintbrush_X,Paintbrush_Y,2);
-
-  while (changes_made)
-  {
-    changes_made=0;
-
-    for (line=current_limit_top;line<=current_limit_bottom;line++)
-    {
-      line_is_modified=0;
-      // On va traiter le cas de la ligne n° line.
-
-      // On commence le traitement à la gauche de l'écran
-      start_x=Limit_left;
-
-      // Pour chaque segment de couleur 1 que peut contenir la ligne
-      while (start_x<=Limit_right)
-      {
-        // On cherche son début
-        while((start_x<=Limit_right) &&
-                (Read_pixel_from_current_layer(start_x,line)!=1))
-             start_x++;
-
-        if (start_x<=Limit_right)
-        {
-          // Un segment de couleur 1 existe et commence à la position start_x.
-          // On va donc en chercher la fin.
-          for (end_x=start_x+1;(end_x<=Limit_right) &&
-               (Read_pixel_from_current_layer(end_x,line)==1);end_x++);
-
-          //   On sait qu'il existe un segment de couleur 1 qui commence en
-          // start_x et qui se termine en end_x-1.
-
-          //   On va maintenant regarder si une couleur sur la périphérie
-          // permet de colorier ce segment avec la couleur 2.
-
-          can_propagate=(
-            // Test de la présence d'un point à gauche du segment
-            ((start_x>Limit_left) &&
-             (Read_pixel_from_current_layer(start_x-1,line)==2)) ||
-            // Test de la présence d'un point à droite du segment
-            ((end_x-1<Limit_right) &&
-             (Read_pixel_from_current_layer(end_x    ,line)==2))
-                               );
-
-          // Test de la présence d'un point en haut du segment
-          if (!can_propagate && (line>Limit_top))
-            for (x_pos=start_x;x_pos<end_x;x_pos++)
-              if (Read_pixel_from_current_layer(x_pos,line-1)==2)
-              {
-                can_propagate=1;
-                break;
-              }
-
-          if (can_propagate)
-          {
-            if (start_x<*left_reached)
-              *left_reached=start_x;
-            if (end_x>*right_reached)
-              *right_reached=end_x;
-            // On remplit le segment de start_x à end_x-1.
-            for (x_pos=start_x;x_pos<end_x;x_pos++)
-              Pixel_in_current_layer(x_pos,line,2);
-            // On vient d'effectuer des modifications.
-            changes_made=1;
-            line_is_modified=1;
-          }
-
-          start_x=end_x+1;
-        }
-      }
-
-      // Si on est en bas, et qu'on peut se propager vers le bas...
-      if ( (line==current_limit_bottom) &&
-           (line_is_modified) &&
-           (current_limit_bottom<Limit_bottom) )
-        current_limit_bottom++; // On descend cette limite vers le bas
-    }
-
-    // Pour le prochain balayage vers le haut, on va se permettre d'aller
-    // voir une ligne plus haut.
-    // Si on ne le fait pas, et que la première ligne (current_limit_top)
-    // n'était pas modifiée, alors cette limite ne serait pas remontée, donc
-    // le filler ne progresserait pas vers le haut.
-    if (current_limit_top>Limit_top)
-      current_limit_top--;
-
-    for (line=current_limit_bottom;line>=current_limit_top;line--)
-    {
-      line_is_modified=0;
-      // On va traiter le cas de la ligne n° line.
-
-      // On commence le traitement à la gauche de l'écran
-      start_x=Limit_left;
-
-      // Pour chaque segment de couleur 1 que peut contenir la ligne
-      while (start_x<=Limit_right)
-      {
-        // On cherche son début
-        for (;(start_x<=Limit_right) &&
-             (Read_pixel_from_current_layer(start_x,line)!=1);start_x++);
-
-        if (start_x<=Limit_right)
-        {
-          // Un segment de couleur 1 existe et commence à la position start_x.
-          // On va donc en chercher la fin.
-          for (end_x=start_x+1;(end_x<=Limit_right) &&
-               (Read_pixel_from_current_layer(end_x,line)==1);end_x++);
-
-          //   On sait qu'il existe un segment de couleur 1 qui commence en
-          // start_x et qui se termine en end_x-1.
-
-          //   On va maintenant regarder si une couleur sur la périphérie
-          // permet de colorier ce segment avec la couleur 2.
-
-          can_propagate=(
-            // Test de la présence d'un point à gauche du segment
-            ((start_x>Limit_left) &&
-             (Read_pixel_from_current_layer(start_x-1,line)==2)) ||
-            // Test de la présence d'un point à droite du segment
-            ((end_x-1<Limit_right) &&
-             (Read_pixel_from_current_layer(end_x    ,line)==2))
-                               );
-
-          // Test de la présence d'un point en bas du segment
-          if (!can_propagate && (line<Limit_bottom))
-            for (x_pos=start_x;x_pos<end_x;x_pos++)
-              if (Read_pixel_from_current_layer(x_pos,line+1)==2)
-              {
-                can_propagate=1;
-                break;
-              }
-
-          if (can_propagate)
-          {
-            if (start_x<*left_reached)
-              *left_reached=start_x;
-            if (end_x>*right_reached)
-              *right_reached=end_x;
-            // On remplit le segment de start_x à end_x-1.
-            for (x_pos=start_x;x_pos<end_x;x_pos++)
-              Pixel_in_current_layer(x_pos,line,2);
-            // On vient d'effectuer des modifications.
-            changes_made=1;
-            line_is_modified=1;
-          }
-
-          start_x=end_x+1;
-        }
-      }
-
-      // Si on est en haut, et qu'on peut se propager vers le haut...
-      if ( (line==current_limit_top) &&
-           (line_is_modified) &&
-           (current_limit_top>Limit_top) )
-        current_limit_top--; // On monte cette limite vers le haut
-    }
-  }
-
-  *top_reached=current_limit_top;
-  *bottom_reached =current_limit_bottom;
-  (*right_reached)--;
-} // end de la routine de remplissage "Fill"
+  Flood_fill(Main.backups->Pages->Image[Main.current_layer].Pixels, Main.image_width,
+             Limit_left, Limit_top, Limit_right, Limit_bottom,
+             Paintbrush_X, Paintbrush_Y,
+             top_reached, bottom_reached, left_reached, right_reached);
+}
 
 byte Read_pixel_from_backup_layer(word x,word y)
 {
@@ -1157,6 +980,26 @@ void Fill_general(byte fill_color)
     Display_pixel(x_pos,y_pos,color);
   }
 
+  /// Draws the pixels x1 to x2 of row y with ::Pixel_figure, as a single
+  /// span when it is ::Pixel_clipped.
+  static void Figure_span(short x1, short x2, short y, byte color)
+  {
+    if (Pixel_figure == Pixel_clipped)
+    {
+      if (y<Limit_top || y>Limit_bottom)
+        return;
+      if (x1<Limit_left)
+        x1=Limit_left;
+      if (x2>Limit_right)
+        x2=Limit_right;
+      if (x1<=x2)
+        Display_span(x1,x2,y,color);
+    }
+    else
+      for (; x1<=x2; x1++)
+        Pixel_figure(x1,y,color);
+  }
+
   // Affichage d'un point pour une preview
   void Pixel_figure_preview(word x_pos,word y_pos,byte color)
   {
@@ -1331,7 +1174,7 @@ void Draw_filled_circle(short center_x,short center_y,long sqradius,byte color)
   short y_pos;
   short end_x;
   short end_y;
-  long x, y;
+  long y;
   short radius = sqrt(sqradius);
 
   start_x=center_x-radius;
@@ -1349,11 +1192,19 @@ void Draw_filled_circle(short center_x,short center_y,long sqradius,byte color)
   if (end_x>Limit_right)
     end_x=Limit_right;
 
-  // Affichage du cercle
+  // Affichage du cercle: the pixels of a row are contiguous, so each row
+  // is drawn as a single span
   for (y_pos=start_y,y=(long)start_y-center_y;y_pos<=end_y;y_pos++,y++)
-    for (x_pos=start_x,x=(long)start_x-center_x;x_pos<=end_x;x_pos++,x++)
-      if (Pixel_in_circle(x, y, sqradius))
-        Display_pixel(x_pos,y_pos,color);
+  {
+    short last_x;
+
+    for (x_pos=start_x;x_pos<=end_x && !Pixel_in_circle((long)x_pos-center_x, y, sqradius);x_pos++)
+      ;
+    for (last_x=end_x;last_x>=x_pos && !Pixel_in_circle((long)last_x-center_x, y, sqradius);last_x--)
+      ;
+    if (x_pos<=last_x)
+      Display_span(x_pos,last_x,y_pos,color);
+  }
 
   Update_part_of_screen(start_x,start_y,end_x+1-start_x,end_y+1-start_y);
 }
@@ -1515,6 +1366,32 @@ static void Draw_inscribed_ellipse_general(short x1, short y1, short x2, short y
       if (((qword)sq_dbl_x * sq_dbl_y_radius + (qword)sq_dbl_y * sq_dbl_x_radius) < sq_dbl_radius_product)
       {
         short x_pos_backup = x_pos;
+        if (filled && Pixel_figure == Pixel_clipped)
+        {
+          // Same pixels as below, drawn as spans, and only once each
+          short x_end = dbl_center_x >> 1;
+          if (x_end > right - 1)
+            x_end = right - 1;
+          if (x_end < x_pos)
+            x_end = x_pos;
+          if (dbl_center_x - x_end <= x_end + 1)
+          {
+            Figure_span(x_pos, dbl_center_x - x_pos, y_pos, color);
+            if (dbl_center_y - y_pos != y_pos)
+              Figure_span(x_pos, dbl_center_x - x_pos, dbl_center_y - y_pos, color);
+          }
+          else
+          {
+            Figure_span(x_pos, x_end, y_pos, color);
+            Figure_span(dbl_center_x - x_end, dbl_center_x - x_pos, y_pos, color);
+            if (dbl_center_y - y_pos != y_pos)
+            {
+              Figure_span(x_pos, x_end, dbl_center_y - y_pos, color);
+              Figure_span(dbl_center_x - x_end, dbl_center_x - x_pos, dbl_center_y - y_pos, color);
+            }
+          }
+          break;
+        }
         do
         {
           Pixel_figure(x_pos,y_pos,color);
@@ -1590,7 +1467,7 @@ void Draw_filled_ellipse(short center_x,short center_y,short horizontal_radius,s
   short y_pos;
   short end_x;
   short end_y;
-  long x, y;
+  long y;
   T_Ellipse_limits Ellipse;
 
   start_x=center_x-horizontal_radius;
@@ -1611,11 +1488,18 @@ void Draw_filled_ellipse(short center_x,short center_y,short horizontal_radius,s
   if (end_x>Limit_right)
     end_x=Limit_right;
 
-  // Affichage de l'ellipse
+  // Affichage de l'ellipse, one span per row
   for (y_pos=start_y,y=start_y-center_y;y_pos<=end_y;y_pos++,y++)
-    for (x_pos=start_x,x=start_x-center_x;x_pos<=end_x;x_pos++,x++)
-      if (Pixel_in_ellipse(x, y, &Ellipse))
-        Display_pixel(x_pos,y_pos,color);
+  {
+    short last_x;
+
+    for (x_pos=start_x;x_pos<=end_x && !Pixel_in_ellipse(x_pos-center_x, y, &Ellipse);x_pos++)
+      ;
+    for (last_x=end_x;last_x>=x_pos && !Pixel_in_ellipse(last_x-center_x, y, &Ellipse);last_x--)
+      ;
+    if (x_pos<=last_x)
+      Display_span(x_pos,last_x,y_pos,color);
+  }
   Update_part_of_screen(center_x-horizontal_radius,center_y-vertical_radius,2*horizontal_radius+1,2*vertical_radius+1);
 }
 
@@ -1945,7 +1829,6 @@ void Draw_empty_rectangle(short start_x,short start_y,short end_x,short end_y,by
 void Draw_filled_rectangle(short start_x,short start_y,short end_x,short end_y,byte color)
 {
   short temp;
-  short x_pos;
   short y_pos;
 
 
@@ -1969,12 +1852,10 @@ void Draw_filled_rectangle(short start_x,short start_y,short end_x,short end_y,b
   if (end_y>Limit_bottom)
     end_y=Limit_bottom;
 
-  // On trace le rectangle:
+  // On trace le rectangle, ligne par ligne: Display_span falls back to
+  // Display_pixel for the effects which need it (smear, ...)
   for (y_pos=start_y;y_pos<=end_y;y_pos++)
-    for (x_pos=start_x;x_pos<=end_x;x_pos++)
-      // Display_pixel traite chaque pixel avec tous les effets ! (smear, ...)
-      // Donc on ne peut pas otimiser en traçant ligne par ligne avec memset :(
-      Display_pixel(x_pos,y_pos,color);
+    Display_span(start_x,end_x,y_pos,color);
   Update_part_of_screen(start_x,start_y,end_x-start_x,end_y-start_y);
 
 }
@@ -2326,6 +2207,57 @@ void Gradient_extra_dithered(long index,short x_pos,short y_pos)
 }
 
 
+/// Colors of the gradient pixels waiting to be drawn as a span
+static byte * Gradient_span_colors = NULL;
+static word Gradient_span_x;
+static word Gradient_span_y;
+static word Gradient_span_width = 0;
+
+/// Draws the gradient pixels collected by Gradient_pixel_in_span()
+static void Flush_gradient_span(void)
+{
+  if (Gradient_span_width)
+    Display_span_colors(Gradient_span_x, Gradient_span_y, Gradient_span_width, Gradient_span_colors);
+  Gradient_span_width = 0;
+}
+
+/// ::Gradient_pixel which collects the contiguous pixels of a row
+static void Gradient_pixel_in_span(word x, word y, byte color)
+{
+  if (Gradient_span_width && (y != Gradient_span_y || x != Gradient_span_x + Gradient_span_width))
+    Flush_gradient_span();
+  if (Gradient_span_width == 0)
+  {
+    Gradient_span_x = x;
+    Gradient_span_y = y;
+  }
+  Gradient_span_colors[Gradient_span_width++] = color;
+}
+
+/// Makes the gradient fills draw rows of pixels instead of single pixels,
+/// when they are drawn with Display_pixel().
+/// @return 1 if End_gradient_spans() will have to flush the last row
+static int Begin_gradient_spans(void)
+{
+  if (Gradient_pixel != Display_pixel)
+    return 0;
+  Gradient_span_colors = GFX2_malloc(Main.image_width);
+  if (Gradient_span_colors == NULL)
+    return 0;
+  Gradient_span_width = 0;
+  Gradient_pixel = Gradient_pixel_in_span;
+  return 1;
+}
+
+static void End_gradient_spans(int active)
+{
+  if (!active)
+    return;
+  Flush_gradient_span();
+  free(Gradient_span_colors);
+  Gradient_span_colors = NULL;
+  Gradient_pixel = Display_pixel;
+}
 
   // -- Tracer un cercle degradé (une sphère) --
 
@@ -2340,6 +2272,7 @@ void Draw_grad_circle(short center_x,short center_y,long sqradius,short spot_x,s
   long distance_x; // Distance (au carré) sur les X du point en cours au centre d'éclairage
   long distance_y; // Distance (au carré) sur les Y du point en cours au centre d'éclairage
   long x, y;
+  int spans;
   short radius = sqrt(sqradius);
 
   start_x=center_x-radius;
@@ -2368,6 +2301,7 @@ void Draw_grad_circle(short center_x,short center_y,long sqradius,short spot_x,s
     Gradient_total_range=1;
 
   // Affichage du cercle
+  spans=Begin_gradient_spans();
   for (y_pos=start_y,y=(long)start_y-center_y;y_pos<=end_y;y_pos++,y++)
   {
     distance_y =(y_pos-spot_y);
@@ -2380,6 +2314,7 @@ void Draw_grad_circle(short center_x,short center_y,long sqradius,short spot_x,s
         Gradient_function(distance_x+distance_y,x_pos,y_pos);
       }
   }
+  End_gradient_spans(spans);
 
   Update_part_of_screen(center_x-radius,center_y-radius,2*radius+1,2*radius+1);
 }
@@ -2398,6 +2333,7 @@ void Draw_grad_ellipse(short center_x,short center_y,short horizontal_radius,sho
   long distance_x; // Distance (au carré) sur les X du point en cours au centre d'éclairage
   long distance_y; // Distance (au carré) sur les Y du point en cours au centre d'éclairage
   long x, y;
+  int spans;
   T_Ellipse_limits Ellipse;
 
   start_x=center_x-horizontal_radius;
@@ -2435,6 +2371,7 @@ void Draw_grad_ellipse(short center_x,short center_y,short horizontal_radius,sho
     end_x=Limit_right;
 
   // Affichage de l'ellipse
+  spans=Begin_gradient_spans();
   for (y_pos=start_y,y=start_y-center_y;y_pos<=end_y;y_pos++,y++)
   {
     distance_y =(y_pos-spot_y);
@@ -2447,6 +2384,7 @@ void Draw_grad_ellipse(short center_x,short center_y,short horizontal_radius,sho
         Gradient_function(distance_x+distance_y,x_pos,y_pos);
       }
   }
+  End_gradient_spans(spans);
 
   Update_part_of_screen(start_x,start_y,end_x-start_x+1,end_y-start_y+1);
 }
@@ -2465,6 +2403,7 @@ void Draw_grad_inscribed_ellipse(short x1, short y1, short x2, short y2, short s
   short y_pos;
   long sq_dist_x; // Square horizontal distance with the lightning point
   long sq_dist_y; // Square vertical distance with the lightning point
+  int spans;
 
   if (x1 > x2)
   {
@@ -2523,6 +2462,7 @@ void Draw_grad_inscribed_ellipse(short x1, short y1, short x2, short y2, short s
   if (bottom > Limit_bottom)
     bottom = Limit_bottom;
 
+  spans = Begin_gradient_spans();
   for (y_pos = top; y_pos <= bottom; y_pos++)
   {
     long dbl_y = 2*y_pos - dbl_center_y;
@@ -2541,6 +2481,7 @@ void Draw_grad_inscribed_ellipse(short x1, short y1, short x2, short y2, short s
       }
     }
   }
+  End_gradient_spans(spans);
 
   Update_part_of_screen(left, top, right-left+1, bottom-top+1);
 }
@@ -2549,6 +2490,7 @@ void Draw_grad_inscribed_ellipse(short x1, short y1, short x2, short y2, short s
 void Draw_grad_rectangle(short rax,short ray,short rbx,short rby,short vax,short vay, short vbx, short vby)
 {
     short y_pos, x_pos;
+    int spans;
 
     // On commence par s'assurer que le rectangle est à l'endroit
     if(rbx < rax)
@@ -2580,10 +2522,11 @@ void Draw_grad_rectangle(short rax,short ray,short rbx,short rby,short vax,short
       // Le vecteur est vertical, donc on évite la partie en dessous qui foirerait avec une division par 0...
       if (vby == vay) return;  // L'utilisateur fait n'importe quoi
       Gradient_total_range = abs(vby - vay);
+      spans = Begin_gradient_spans();
       for(y_pos=ray;y_pos<=rby;y_pos++)
         for(x_pos=rax;x_pos<=rbx;x_pos++)
           Gradient_function(abs(vby - y_pos),x_pos,y_pos);
-
+      End_gradient_spans(spans);
     }
     else
     {
@@ -2595,6 +2538,7 @@ void Draw_grad_rectangle(short rax,short ray,short rbx,short rby,short vax,short
       a = (float)(vby - vay)/(float)(vbx - vax);
       b = vay - a*vax;
 
+      spans = Begin_gradient_spans();
       for (y_pos=ray;y_pos<=rby;y_pos++)
         for (x_pos = rax;x_pos<=rbx;x_pos++)
         {
@@ -2604,6 +2548,7 @@ void Draw_grad_rectangle(short rax,short ray,short rbx,short rby,short vax,short
 
           Gradient_function((int)sqrt(distance_x - distance_y),x_pos,y_pos);
         }
+      End_gradient_spans(spans);
     }
     Update_part_of_screen(rax,ray,rbx,rby);
 }
@@ -2798,8 +2743,7 @@ void Polyfill_general(int vertices, short * points, int color)
           x_pos=Limit_left;
         if (end_x>Limit_right)
           end_x=Limit_right;
-        for (; x_pos<=end_x; x_pos++)
-          Pixel_figure(x_pos,c,color);
+        Figure_span(x_pos,end_x,c,color);
         edge = edge->next->next;
       }
     }
@@ -2995,6 +2939,83 @@ void Display_pixel(word x,word y,byte color)
   }
 }
 
+/// Number of pixels handled at once by Display_span_colors()
+#define SPAN_CHUNK 256
+
+/// Tells if Display_span_colors() can work on whole spans: the effect must
+/// only depend on the pixel it's applied to, not on the ones drawn before.
+static int Span_effect_is_local(void)
+{
+  if (Sieve_mode || Stencil_mode || Mask_mode || Main.tilemap_mode)
+    return 0;
+  return Effect_function == No_effect
+    || Effect_function == Effect_shade
+    || Effect_function == Effect_quick_shade
+    || Effect_function == Effect_tiling
+    || Effect_function == Effect_layer_copy
+    || Effect_function == Effect_interpolated_colorize
+    || Effect_function == Effect_additive_colorize
+    || Effect_function == Effect_substractive_colorize
+    || Effect_function == Effect_alpha_colorize
+    // Smooth reads the neighbours, which must not be drawn before
+    || (Effect_function == Effect_smooth
+      && FX_feedback_screen != Main.backups->Pages->Image[Main.current_layer].Pixels);
+}
+
+void Display_span_colors(word x, word y, word width, const byte * colors)
+{
+  byte chunk[SPAN_CHUNK];
+  word done;
+
+  if (!Span_effect_is_local())
+  {
+    // The effects need to see the pixels drawn before
+    for (done=0; done<width; done++)
+      Display_pixel(x+done, y, colors[done]);
+    return;
+  }
+  for (done=0; done<width; done+=SPAN_CHUNK)
+  {
+    word length = (width-done < SPAN_CHUNK) ? width-done : SPAN_CHUNK;
+    word i;
+
+    if (Effect_function == No_effect)
+    {
+      Span_in_current_screen_with_opt_preview(x+done, y, length, colors+done, 1);
+      continue;
+    }
+    if (Effect_function == Effect_smooth)
+    {
+      for (i=0; i<length; i++)
+        chunk[i] = Read_pixel_from_current_screen(x+done+i, y);
+      if (!Smooth_area(FX_feedback_screen, Main.image_width, Main.image_width, Main.image_height,
+                       x+done, y, length, 1, chunk, length, -1))
+        for (i=0; i<length; i++)
+          chunk[i] = Effect_smooth(x+done+i, y, colors[done+i]);
+    }
+    else if (Effect_function == Effect_shade)
+    {
+      const byte * feedback = FX_feedback_screen + x + done + (long)y*Main.image_width;
+      for (i=0; i<length; i++)
+        chunk[i] = Shade_table[feedback[i]];
+    }
+    else
+      for (i=0; i<length; i++)
+        chunk[i] = Effect_function(x+done+i, y, colors[done+i]);
+    Span_in_current_screen_with_opt_preview(x+done, y, length, chunk, 1);
+  }
+}
+
+void Display_span(word x1, word x2, word y, byte color)
+{
+  byte colors[SPAN_CHUNK];
+  long x;
+
+  memset(colors, color, SPAN_CHUNK);
+  for (x=x1; x<=x2; x+=SPAN_CHUNK)
+    Display_span_colors(x, y, (x2-x+1 < SPAN_CHUNK) ? x2-x+1 : SPAN_CHUNK, colors);
+}
+
 
 
 // -- Calcul des différents effets -------------------------------------------
@@ -3077,6 +3098,161 @@ byte Effect_tiling(word x,word y,byte color)
 
   // -- Effet de Smooth --
 
+/// Unpacks the palette components of the pixels x-1 to x+width of a row,
+/// and whether they count (1) or not (0). The pixels outside of the source
+/// and the transparent ones are 0, so they don't count.
+static void Unpack_smooth_row(int * red, int * green, int * blue, int * counted, const byte * src_row,
+                              short src_width, short x, short width, int transparent_color)
+{
+  short i;
+
+  for (i=0; i<width+2; i++)
+  {
+    short src_x = x-1+i;
+    if (src_row == NULL || src_x<0 || src_x>=src_width || src_row[src_x] == transparent_color)
+      red[i] = green[i] = blue[i] = counted[i] = 0;
+    else
+    {
+      byte c = src_row[src_x];
+      red[i] = Main.palette[c].R;
+      green[i] = Main.palette[c].G;
+      blue[i] = Main.palette[c].B;
+      counted[i] = 1;
+    }
+  }
+}
+
+/// Sum of a row of 3 weighted components: vectorized by the compiler
+static void Accumulate_smooth_row(int * sum, const int * plane, int weight_left, int weight, int weight_right, short width)
+{
+  short i;
+
+  for (i=0; i<width; i++)
+    sum[i] += weight_left*plane[i] + weight*plane[i+1] + weight_right*plane[i+2];
+}
+
+int Smooth_area(const byte * src, long src_pitch, short src_width, short src_height,
+                short x, short y, short width, short height, byte * dest, long dest_pitch,
+                int transparent_color)
+{
+  // 3 source rows (above, current, below) of R, G, B and "counted", then the sums
+  int * buffer;
+  int * planes[3][4];
+  int * sums[4];
+  short row, i, c;
+
+  if (width<=0 || height<=0)
+    return 1;
+  buffer = (int *)GFX2_malloc(16 * (width+2) * sizeof(int));
+  if (buffer == NULL)
+    return 0;
+  for (row=0; row<3; row++)
+    for (c=0; c<4; c++)
+      planes[row][c] = buffer + (row*4+c)*(width+2);
+  for (c=0; c<4; c++)
+    sums[c] = buffer + (12+c)*(width+2);
+
+  Unpack_smooth_row(planes[0][0], planes[0][1], planes[0][2], planes[0][3], y>0 ? src+(long)(y-1)*src_pitch : NULL, src_width, x, width, transparent_color);
+  Unpack_smooth_row(planes[1][0], planes[1][1], planes[1][2], planes[1][3], src+(long)y*src_pitch, src_width, x, width, transparent_color);
+
+  for (row=0; row<height; row++)
+  {
+    short line = y+row;
+    int has_top = line>0;
+    int has_bottom = line+1<src_height;
+    int weights[3][3]; // Smooth_matrix, without the missing rows
+    int * first_plane[4];
+
+    Unpack_smooth_row(planes[2][0], planes[2][1], planes[2][2], planes[2][3], has_bottom ? src+(long)(line+1)*src_pitch : NULL, src_width, x, width, transparent_color);
+
+    // Same rules as Effect_smooth(): the lower corners need the upper row too
+    for (i=0; i<3; i++)
+    {
+      weights[i][0] = has_top ? Smooth_matrix[i][0] : 0;
+      weights[i][1] = Smooth_matrix[i][1];
+      weights[i][2] = (has_bottom && (i==1 || has_top)) ? Smooth_matrix[i][2] : 0;
+    }
+
+    // The weights of the pixels which count are summed like their components
+    for (c=0; c<4; c++)
+    {
+      memset(sums[c], 0, width*sizeof(int));
+      Accumulate_smooth_row(sums[c], planes[0][c], weights[0][0], weights[1][0], weights[2][0], width);
+      Accumulate_smooth_row(sums[c], planes[1][c], weights[0][1], weights[1][1], weights[2][1], width);
+      Accumulate_smooth_row(sums[c], planes[2][c], weights[0][2], weights[1][2], weights[2][2], width);
+    }
+
+    for (i=0; i<width; i++)
+    {
+      int weight = sums[3][i];
+
+      if (weight)
+        dest[(long)row*dest_pitch+i] = Best_color(Round_div(sums[0][i],weight),
+                                                  Round_div(sums[1][i],weight),
+                                                  Round_div(sums[2][i],weight));
+    }
+
+    // Next row: rotate the source rows
+    for (c=0; c<4; c++)
+      first_plane[c] = planes[0][c];
+    for (c=0; c<4; c++)
+    {
+      planes[0][c] = planes[1][c];
+      planes[1][c] = planes[2][c];
+      planes[2][c] = first_plane[c];
+    }
+  }
+  free(buffer);
+  return 1;
+}
+
+/// Smoothed colors of an area, computed at once by Prepare_smooth_area()
+static struct
+{
+  short X;
+  short Y;
+  short Width;
+  short Height;
+  byte * Colors;
+  long Size;
+} Smooth_cache;
+
+void Prepare_smooth_area(short x, short y, short width, short height)
+{
+  short i, j;
+
+  Smooth_cache.Width = 0;
+  // With the feedback, each smoothed pixel changes the next ones
+  if (Effect_function != Effect_smooth || width<=0 || height<=0
+    || FX_feedback_screen == Main.backups->Pages->Image[Main.current_layer].Pixels)
+    return;
+  if ((long)width*height > Smooth_cache.Size)
+  {
+    free(Smooth_cache.Colors);
+    Smooth_cache.Size = 0;
+    Smooth_cache.Colors = GFX2_malloc((long)width*height);
+    if (Smooth_cache.Colors == NULL)
+      return;
+    Smooth_cache.Size = (long)width*height;
+  }
+  // Effect_smooth() leaves the pixels unchanged when all weights are 0
+  for (j=0; j<height; j++)
+    for (i=0; i<width; i++)
+      Smooth_cache.Colors[(long)j*width+i] = Read_pixel_from_current_screen(x+i, y+j);
+  if (!Smooth_area(FX_feedback_screen, Main.image_width, Main.image_width, Main.image_height,
+                   x, y, width, height, Smooth_cache.Colors, width, -1))
+    return;
+  Smooth_cache.X = x;
+  Smooth_cache.Y = y;
+  Smooth_cache.Width = width;
+  Smooth_cache.Height = height;
+}
+
+void Forget_smooth_area(void)
+{
+  Smooth_cache.Width = 0;
+}
+
 byte Effect_smooth(word x,word y,byte color)
 {
   int r,g,b;
@@ -3086,6 +3262,10 @@ byte Effect_smooth(word x,word y,byte color)
   byte y2=((y+1)<Main.image_height);
   (void)color; // unused
 
+  if (x>=Smooth_cache.X && x<Smooth_cache.X+Smooth_cache.Width
+    && y>=Smooth_cache.Y && y<Smooth_cache.Y+Smooth_cache.Height)
+    return Smooth_cache.Colors[(long)(y-Smooth_cache.Y)*Smooth_cache.Width + x-Smooth_cache.X];
+
   // On commence par le pixel central
   c=Read_pixel_from_feedback_screen(x,y);
   total_weight=Smooth_matrix[1][1];
@@ -3182,44 +3362,6 @@ byte Effect_layer_copy(word x,word y,byte color)
   return Read_pixel_from_feedback_screen(x,y);
 }
 
-void Horizontal_grid_line(word x_pos,word y_pos,word width)
-{
-  int x;
-
-  for (x=!(x_pos&1);x<width;x+=2)
-    Pixel(x_pos+x, y_pos, xor_lut[Get_Screen_pixel((x_pos+x)*Pixel_width, (y_pos-1)*Pixel_height)]);
-}
-
-void Vertical_grid_line(word x_pos,word y_pos,word height)
-{
-  int y;
-
-  for (y=!(y_pos&1);y<height;y+=2)
-    Pixel(x_pos, y_pos+y, xor_lut[Get_Screen_pixel(x_pos*Pixel_width-1, (y_pos+y)*Pixel_height)]);
-}
-
-// Tile Grid
-void Redraw_grid(short x, short y, unsigned short w, unsigned short h)
-{
-  int row, col;
-  if (!Show_grid)
-    return;
-
-  row=y+((Snap_height*1000-(y-0)/Main.magnifier_factor-Main.magnifier_offset_Y+Snap_offset_Y-1)%Snap_height)*Main.magnifier_factor+Main.magnifier_factor-1;
-  while (row < y+h)
-  {
-    Horizontal_grid_line(x, row, w);
-    row+= Snap_height*Main.magnifier_factor;
-  }
-
-  col=x+((Snap_width*1000-(x-Main.X_zoom)/Main.magnifier_factor-Main.magnifier_offset_X+Snap_offset_X-1)%Snap_width)*Main.magnifier_factor+Main.magnifier_factor-1;
-  while (col < x+w)
-  {
-    Vertical_grid_line(col, y, h);
-    col+= Snap_width*Main.magnifier_factor;
-  }
-}
-
 byte Read_pixel_from_current_screen(word x,word y)
 {
   byte depth;
@@ -3269,6 +3411,83 @@ static void Pixel_in_screen_layered_with_opt_preview(word x,word y,byte color, i
   }
 }
 
+/// Paint a a single pixel in image and on optionnaly on screen : using the
+/// flattened layers under and over the current one, when they are available.
+static void Pixel_in_screen_flattened_with_opt_preview(word x,word y,byte color, int preview)
+{
+  long offset = x+y*Main.image_width;
+
+  if (!Layers_planes_ready())
+  {
+    Pixel_in_screen_layered_with_opt_preview(x, y, color, preview);
+    return;
+  }
+  Pixel_in_current_layer(x, y, color);
+  if (Main_layers_above.Image[offset] != Main.backups->Pages->Transparent_color)
+    return; // hidden by an upper layer
+  if (color == Main.backups->Pages->Transparent_color)
+    color = Main_layers_below.Image[offset];
+  Main_screen[offset]=color;
+
+  if (preview)
+    Pixel_preview(x,y,color);
+}
+
+/// Paint a span of pixels in image and optionnaly on screen, one by one:
+/// for the image modes with constraints.
+static void Span_in_screen_pixels_with_opt_preview(word x, word y, word width, const byte * colors, int preview)
+{
+  word i;
+
+  for (i=0; i<width; i++)
+    Pixel_in_current_screen_with_opt_preview(x+i, y, colors[i], preview);
+}
+
+/// Paint a span of pixels in image and optionnaly on screen: as-is.
+static void Span_in_screen_direct_with_opt_preview(word x, word y, word width, const byte * colors, int preview)
+{
+  word i;
+
+  if (Main.current_layer == Main_shared_backup_layer)
+    Unshare_backup_area(x, y, width, 1);
+  memcpy(Main.backups->Pages->Image[Main.current_layer].Pixels + x + (long)y*Main.image_width, colors, width);
+  if (preview)
+    for (i=0; i<width; i++)
+      Pixel_preview(x+i, y, colors[i]);
+}
+
+/// Paint a span of pixels in image and optionnaly on screen: using the
+/// flattened layers under and over the current one.
+static void Span_in_screen_flattened_with_opt_preview(word x, word y, word width, const byte * colors, int preview)
+{
+  long offset = x + (long)y*Main.image_width;
+  const byte * above;
+  const byte * below;
+  byte * visible = Main_screen + offset;
+  byte transparent = Main.backups->Pages->Transparent_color;
+  word i;
+
+  if (!Layers_planes_ready())
+  {
+    Span_in_screen_pixels_with_opt_preview(x, y, width, colors, preview);
+    return;
+  }
+  above = Main_layers_above.Image + offset;
+  below = Main_layers_below.Image + offset;
+  if (Main.current_layer == Main_shared_backup_layer)
+    Unshare_backup_area(x, y, width, 1);
+  memcpy(Main.backups->Pages->Image[Main.current_layer].Pixels + offset, colors, width);
+  for (i=0; i<width; i++)
+  {
+    if (above[i] == transparent)
+    {
+      visible[i] = (colors[i] == transparent) ? below[i] : colors[i];
+      if (preview)
+        Pixel_preview(x+i, y, visible[i]);
+    }
+  }
+}
+
 /// Paint in a specific layer and update optionnaly the screen
 static void Pixel_in_layer_with_opt_preview(int layer, word x,word y,byte color, int preview)
 {
@@ -3867,6 +4086,7 @@ static void Pixel_in_screen_dhgr_color_with_opt_preview(word x,word y,byte color
 /// @}
 
 Func_pixel_opt_preview Pixel_in_current_screen_with_opt_preview=Pixel_in_screen_direct_with_opt_preview;
+Func_span_opt_preview Span_in_current_screen_with_opt_preview=Span_in_screen_direct_with_opt_preview;
 
 /**
  * Put a pixel in the current layer of a "Document"
@@ -3888,6 +4108,8 @@ void Pixel_in_spare(word x,word y, byte color)
 
 void Pixel_in_current_layer(word x,word y, byte color)
 {
+  if (Main.current_layer == Main_shared_backup_layer)
+    Unshare_backup_area(x, y, 1, 1);
   Pixel_in_document_current_layer(&Main, x, y, color);
 }
 
@@ -3895,6 +4117,8 @@ void Pixel_in_current_layer(word x,word y, byte color)
 void Pixel_in_layer(int layer, word x,word y, byte color)
 {
   T_Document * doc = &Main;
+  if (layer == Main_shared_backup_layer)
+    Unshare_backup_area(x, y, 1, 1);
   doc->backups->Pages->Image[layer].Pixels[x + y*doc->image_width] = color;
 }
 
@@ -3911,6 +4135,18 @@ byte Read_pixel_from_layer(int layer, word x,word y)
 
 void Update_pixel_renderer(void)
 {
+  switch (Main.backups->Pages->Image_mode)
+  {
+  case IMAGE_MODE_ANIMATION:
+    Span_in_current_screen_with_opt_preview = Span_in_screen_direct_with_opt_preview;
+    break;
+  case IMAGE_MODE_LAYERED:
+    Span_in_current_screen_with_opt_preview = Span_in_screen_flattened_with_opt_preview;
+    break;
+  default:
+    // Constraints, or special layers: let the pixel function deal with it
+    Span_in_current_screen_with_opt_preview = Span_in_screen_pixels_with_opt_preview;
+  }
   switch (Main.backups->Pages->Image_mode)
   {
   case IMAGE_MODE_ANIMATION:
@@ -3919,7 +4155,7 @@ void Update_pixel_renderer(void)
     break;
   case IMAGE_MODE_LAYERED:
     // layered
-    Pixel_in_current_screen_with_opt_preview = Pixel_in_screen_layered_with_opt_preview;
+    Pixel_in_current_screen_with_opt_preview = Pixel_in_screen_flattened_with_opt_preview;
     break;
   case IMAGE_MODE_EGX:
   case IMAGE_MODE_EGX2:
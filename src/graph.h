@@ -40,12 +40,39 @@ byte Effect_shade(word x,word y,byte color);
 byte Effect_quick_shade(word x,word y,byte color);
 byte Effect_tiling(word x,word y,byte color);
 byte Effect_smooth(word x,word y,byte color);
+
+/**
+ * Applies ::Smooth_matrix on a rectangle of an image, the same way as
+ * Effect_smooth() does pixel by pixel.
+ *
+ * The pixels whose weights total 0 are left unchanged in dest.
+ * @param src the image, in the colors of the main palette
+ * @param src_pitch byte width of a row of src
+ * @param src_width the width of src: pixels outside of it don't count
+ * @param src_height the height of src: pixels outside of it don't count
+ * @param dest where to write the smoothed colors of the rectangle
+ * @param dest_pitch byte width of a row of dest
+ * @param transparent_color a color of src whose pixels don't count, or -1
+ * @return 0 if out of memory
+ */
+int Smooth_area(const byte * src, long src_pitch, short src_width, short src_height,
+                short x, short y, short width, short height, byte * dest, long dest_pitch,
+                int transparent_color);
+/// Computes at once the Smooth effect of an area about to be drawn, when
+/// it is the current effect. Effect_smooth() then reads the result.
+void Prepare_smooth_area(short x, short y, short width, short height);
+/// Ends the use of the area of Prepare_smooth_area(), before the image changes.
+void Forget_smooth_area(void);
 byte Effect_layer_copy(word x,word y,byte color);
 
 void Display_foreback(void);
 
 
 void Display_pixel(word x,word y,byte color);
+/// Same as Display_pixel() on the pixels x1 to x2 of row y, with the same color.
+void Display_span(word x1, word x2, word y, byte color);
+/// Same as Display_pixel() on a horizontal span, with one color per pixel.
+void Display_span_colors(word x, word y, word width, const byte * colors);
 
 void Display_paintbrush(short x,short y,byte color);
 void Draw_paintbrush(short x,short y,byte color);
@@ -146,9 +173,13 @@ byte Read_pixel_from_layer(int layer, word x,word y);
 /// Paint a single pixel in image AND optionnaly on screen.
 extern Func_pixel_opt_preview Pixel_in_current_screen_with_opt_preview;
 
+/// Paint a horizontal span of pixels in image AND optionnaly on screen.
+extern Func_span_opt_preview Span_in_current_screen_with_opt_preview;
+
 /// Update the pixel functions according to the current Image_mode.
 /// Sets ::Pixel_in_current_screen and ::Pixel_in_current_screen_with_preview
-/// through ::Pixel_in_current_screen_with_opt_preview
+/// through ::Pixel_in_current_screen_with_opt_preview, and
+/// ::Span_in_current_screen_with_opt_preview
 void Update_pixel_renderer(void);
 
 void Update_color_hgr_pixel(word x, word y, int preview);
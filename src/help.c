@@ -729,9 +729,9 @@ void Button_Stats(int btn)
 
 #if defined(USE_SDL) || defined(USE_SDL2)
 // 2 lines more
-#define WIN_HEIGHT 190+8
+#define WIN_HEIGHT 190+32
 #else
-#define WIN_HEIGHT 174+8
+#define WIN_HEIGHT 174+32
 #endif
   Open_window(310,WIN_HEIGHT,"Statistics");
 
@@ -891,6 +891,30 @@ void Button_Stats(int btn)
   else
         sprintf(buffer,"%ld (%ld Kb)",Stats_pages_number, (long)(Stats_pages_memory/1024));
   Print_in_window(162,y,buffer,STATS_DATA_COLOR,MC_Black);
+  y+=8;
+  // Memory shared between several history steps
+  Print_in_window(18,y,"shared by undo steps:",STATS_TITLE_COLOR,MC_Black);
+  if(Stats_pages_shared_memory > (100*1024*1024))
+        sprintf(buffer,"%ld Mb",(long)(Stats_pages_shared_memory/(1024*1024)));
+  else
+        sprintf(buffer,"%ld Kb",(long)(Stats_pages_shared_memory/1024));
+  Print_in_window(194,y,buffer,STATS_DATA_COLOR,MC_Black);
+  y+=8;
+  // Size of the same bitmaps, without compression
+  Print_in_window(18,y,"when unpacked:",STATS_TITLE_COLOR,MC_Black);
+  if(Stats_pages_unpacked_memory > (100*1024*1024))
+        sprintf(buffer,"%ld Mb",(long)(Stats_pages_unpacked_memory/(1024*1024)));
+  else
+        sprintf(buffer,"%ld Kb",(long)(Stats_pages_unpacked_memory/1024));
+  Print_in_window(194,y,buffer,STATS_DATA_COLOR,MC_Black);
+  y+=8;
+  // Old history steps moved to the Undo scratch file
+  Print_in_window(18,y,"swapped to disk:",STATS_TITLE_COLOR,MC_Black);
+  if(Stats_pages_spilled_memory > (100*1024*1024))
+        sprintf(buffer,"%ld Mb",(long)(Stats_pages_spilled_memory/(1024*1024)));
+  else
+        sprintf(buffer,"%ld Kb",(long)(Stats_pages_spilled_memory/1024));
+  Print_in_window(194,y,buffer,STATS_DATA_COLOR,MC_Black);
   
   y+=8;
 
@@ -956,7 +980,7 @@ void Button_Stats(int btn)
   sprintf(buffer,"%dx%d",Screen_width,Screen_height);
   Print_in_window(106,y,buffer,STATS_DATA_COLOR,MC_Black);
   
-  Update_window_area(0,0,310,174);
+  Update_window_area(0,0,310,174+24);
 
   Display_cursor();
 
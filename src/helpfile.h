@@ -1396,6 +1396,11 @@ static const T_Help_table helptable_brush_fx[] =
   HELP_TEXT ("looks like it would in the spare page, using")
   HELP_TEXT ("the current palette.")
   HELP_TEXT ("")
+  HELP_TEXT ("- Smooth:")
+  HELP_TEXT ("Smoothes the brush with the matrix of the")
+  HELP_TEXT ("Smooth effect. The transparent pixels are")
+  HELP_TEXT ("not changed.")
+  HELP_TEXT ("")
   HELP_LINK ("- Get brush colors: (Key:%s)",SPECIAL_GET_BRUSH_COLORS)
   HELP_TEXT ("Transfers the spare")
   HELP_TEXT ("page's colors used by the brush to the")
@@ -2533,6 +2538,29 @@ static const T_Help_table helptable_settings_details[] =
   HELP_TEXT ("You should set the same value as in Palette")
   HELP_TEXT ("setup window, with 16 RGB Scale.")
   HELP_TEXT ("")
+  HELP_BOLD ("  True-color palette")
+  HELP_TEXT ("How the 256 colors are chosen when a picture")
+  HELP_TEXT ("with more colors is loaded: 'Median' (median")
+  HELP_TEXT ("cut) or 'Wu' (Xiaolin Wu's method, faster,")
+  HELP_TEXT ("and often with closer colors).")
+  HELP_TEXT ("")
+  HELP_BOLD ("  k-means passes")
+  HELP_TEXT ("Number of passes which then improve these")
+  HELP_TEXT ("colors, by moving each one to the mean of")
+  HELP_TEXT ("the pixels it stands for. 0 disables them.")
+  HELP_TEXT ("")
+  HELP_BOLD ("  k-means time")
+  HELP_TEXT ("The passes stop after this number of")
+  HELP_TEXT ("milliseconds. 0 for no limit.")
+  HELP_TEXT ("")
+  HELP_BOLD ("  Dithering")
+  HELP_TEXT ("How the pixels of these pictures are drawn")
+  HELP_TEXT ("with the 256 colors: 'None' takes the")
+  HELP_TEXT ("nearest color, 'Bayer' and 'Blue noise' mix")
+  HELP_TEXT ("colors with a regular or a random-looking")
+  HELP_TEXT ("pattern, 'Floyd-S.' and 'Sierra' spread the")
+  HELP_TEXT ("error of each pixel on its neighbors.")
+  HELP_TEXT ("")
   HELP_TEXT ("")
   HELP_TITLE("GUI")
   HELP_TEXT ("")
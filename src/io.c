@@ -595,6 +595,26 @@ unsigned long File_length_file(FILE * file)
 #endif
 }
 
+// Last modification time, in seconds since 1970 on all platforms
+unsigned long File_modification_time(const char * fname)
+{
+#if defined(WIN32)
+  WIN32_FILE_ATTRIBUTE_DATA infos;
+  ULARGE_INTEGER time;
+  if (!GetFileAttributesExA(fname, GetFileExInfoStandard, &infos))
+    return 0;
+  // 100 ns units since 1601 to seconds since 1970
+  time.LowPart = infos.ftLastWriteTime.dwLowDateTime;
+  time.HighPart = infos.ftLastWriteTime.dwHighDateTime;
+  return (unsigned long)((time.QuadPart - 116444736000000000ULL) / 10000000);
+#else
+  struct stat infos_fichier;
+  if (stat(fname,&infos_fichier))
+    return 0;
+  return (unsigned long)infos_fichier.st_mtime;
+#endif
+}
+
 void For_each_file(const char * directory_name, void Callback(const char *, const char *))
 {
 #if defined(WIN32)
@@ -128,6 +128,9 @@ int Position_last_dot_unicode(const word * fname);
 /// Size of a file, in bytes. Returns 0 in case of error.
 unsigned long File_length(const char *fname);
 
+/// Last modification time of a file or directory, in seconds since 1970. Returns 0 in case of error.
+unsigned long File_modification_time(const char * fname);
+
 /// Returns true if a file passed as a parameter exists in the current directory.
 int File_exists(const char * fname);
 
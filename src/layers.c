@@ -40,12 +40,14 @@
 void Layer_activate(int layer, short side)
 {
   dword old_layers;
+  int old_current_layer;
 
   if (layer >= Main.backups->Pages->Nb_layers)
     return;
   
   // Keep a copy of which layers were visible
   old_layers = Main.layers_visible;
+  old_current_layer = Main.current_layer;
   
   if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
   {
@@ -93,10 +95,7 @@ void Layer_activate(int layer, short side)
   }
 
   Hide_cursor();
-  if (Main.layers_visible != old_layers)
-    Redraw_layered_image();
-  else
-    Update_depth_buffer(); // Only need the depth buffer
+  Redraw_after_layers_change(old_layers, old_current_layer);
   //Download_infos_page_main(Main.backups->Pages);
   //Update_FX_feedback(Config.FX_Feedback);
   Update_pixel_renderer();
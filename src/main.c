@@ -110,6 +110,10 @@
 #include "buttons.h"
 #include "engine.h"
 #include "pages.h"
+#include "undofile.h"
+#include "workers.h"
+#include "composite.h"
+#include "pxzoom.h"
 #include "loadsave.h"
 #include "loadsavefuncs.h"
 #include "screen.h"
@@ -899,6 +903,9 @@ int Init_program(int argc,char * argv[])
   temp=Load_INI(&Config);
   if (temp)
     Error(temp);
+  Init_overlay_row();
+  Init_zoom_line();
+  Init_workers(Config.Threads);
 
   if(!Config.Allow_multi_shortcuts)
   {
@@ -1274,11 +1281,14 @@ void Program_shutdown(void)
 
   // Free all images
   Set_number_of_backups(-1); // even delete the main page
+  Undo_file_close();
+  Close_workers();
 
   FREE_POINTER(Main.visible_image.Image);
   FREE_POINTER(Spare.visible_image.Image);
   FREE_POINTER(Main_visible_image_backup.Image);
   FREE_POINTER(Main_visible_image_depth_buffer.Image);
+  Free_layers_planes();
 
   FREE_POINTER(Main.backups);
   FREE_POINTER(Spare.backups);
@@ -37,29 +37,29 @@
 #include "input.h"
 #include "graph.h"
 #include "pages.h"
+#include "workers.h"
 
 ///Count used palette indexes in the whole picture
 ///Return the total number of different colors
 ///Fill in "usage" with the count for each color
-word Count_used_colors(dword* usage)
+/// Job for Run_rows_in_parallel(): counts the colors of rows of all layers,
+/// in a table of 256 counters per band.
+static void Count_used_colors_rows(void * data, int band, int first_row, int end_row)
 {
-  int nb_pixels = 0;
+  dword * usage = (dword *)data + 256 * band;
+  long nb_pixels = (long)(end_row - first_row) * Main.image_width;
   byte* current_pixel;
   byte color;
-  word nb_colors = 0;
-  int i;
+  long i;
   int layer;
 
   for (i = 0; i < 256; i++) usage[i]=0;
 
-  // Compute total number of pixels in the picture
-  nb_pixels = Main.image_height * Main.image_width;
-
   // For each layer
   for (layer = 0; layer < Main.backups->Pages->Nb_layers; layer++)
   {
-    current_pixel = Main.backups->Pages->Image[layer].Pixels;
-    // For each pixel in picture
+    current_pixel = Main.backups->Pages->Image[layer].Pixels + (long)first_row * Main.image_width;
+    // For each pixel in the rows
     for (i = 0; i < nb_pixels; i++)
     {
       color=*current_pixel; // get color in picture for this pixel
@@ -70,6 +70,25 @@ word Count_used_colors(dword* usage)
       current_pixel++;
     }
   }
+}
+
+word Count_used_colors(dword* usage)
+{
+  static dword band_usage[WORKERS_MAX_BANDS][256];
+  word nb_colors = 0;
+  int nb_bands;
+  int band;
+  int i;
+
+  // Each band counts in its own table, they are added afterwards
+  nb_bands = Rows_bands(Main.image_height);
+  Run_rows_in_parallel(Count_used_colors_rows, band_usage, Main.image_height);
+  for (i = 0; i < 256; i++)
+  {
+    usage[i] = 0;
+    for (band = 0; band < nb_bands; band++)
+      usage[i] += band_usage[band][i];
+  }
 
   // count the total number of unique used colors
   for (i = 0; i < 256; i++)
@@ -173,6 +192,7 @@ void Set_palette(T_Palette palette)
     palette[i].B = Round_palette_component(palette[i].B);
   }
   GFX2_SetPalette(palette, 0, 256);
+  Palette_changed();
 }
 
 void Set_color(byte color, byte red, byte green, byte blue)
@@ -181,6 +201,16 @@ void Set_color(byte color, byte red, byte green, byte blue)
   Current_palette[color].G = green;
   Current_palette[color].B = blue;
   GFX2_SetPalette(Current_palette + color, color, 1);
+  Palette_changed();
+}
+
+/// Empties the caches of colors computed from the palette (Best_color(),
+/// colorize effects). Set_palette() and Set_color() call it; the code which
+/// writes Main.palette or ::Exclude_color and searches colors before calling
+/// them must call it too.
+void Palette_changed(void)
+{
+  Palette_generation++;
 }
 
 void Wait_end_of_click(void)
@@ -326,6 +356,108 @@ void Remap_general_lowlevel(byte * conversion_table,byte * in_buffer, byte *out_
   }
 }
 
+void Remap_zone_highlevel(short x1, short y1, short x2, short y2,
+                     byte * conversion_table)
+// Attention: Remappe une zone de coins x1,y1 et x2-1,y2-1 !!!
+{
+  short x_pos;
+  short y_pos;
+
+  for (y_pos=y1;y_pos<y2;y_pos++)
+    for (x_pos=x1;x_pos<x2;x_pos++)
+    {
+      if ((y_pos>=Window_pos_Y) && (y_pos<Window_pos_Y+(Window_height*Menu_factor_Y)) &&
+          (x_pos>=Window_pos_X) && (x_pos<Window_pos_X+(Window_width*Menu_factor_X)) )
+        x_pos=Window_pos_X+(Window_width*Menu_factor_X)-1;
+      else
+        Pixel(x_pos,y_pos,conversion_table[Read_pixel(x_pos,y_pos)]);
+    }
+}
+
+/// Job for Run_rows_in_parallel(): remaps rows of all layers, and of the
+/// flattened image view when it's not made by a raster layer.
+static void Remap_image_rows(void * data, int band, int first_row, int end_row)
+{
+  byte * conversion_table = (byte *)data;
+  long start = (long)first_row * Main.image_width;
+  int layer;
+
+  (void)band;
+  // Remap the flatenned image view
+  if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION
+      && Main.backups->Pages->Image_mode != IMAGE_MODE_MODE5
+      && Main.backups->Pages->Image_mode != IMAGE_MODE_RASTER)
+  {
+    Remap_general_lowlevel(conversion_table,Main.visible_image.Image+start,Main.visible_image.Image+start,
+                         Main.image_width,end_row-first_row,Main.image_width);
+  }
+  // Remap all layers
+  for (layer=0; layer<Main.backups->Pages->Nb_layers; layer++)
+    Remap_general_lowlevel(conversion_table,Main.backups->Pages->Image[layer].Pixels+start,Main.backups->Pages->Image[layer].Pixels+start,Main.image_width,end_row-first_row,Main.image_width);
+}
+
+void Remap_image_highlevel(byte * conversion_table)
+{
+  short end_x;
+  short end_y;
+  short end_x_mag=0;
+  short end_y_mag=0;
+
+  Run_rows_in_parallel(Remap_image_rows, conversion_table, Main.image_height);
+  Invalidate_layers_planes();
+
+  // Remap transparent color
+  Main.backups->Pages->Transparent_color =
+    conversion_table[Main.backups->Pages->Transparent_color];
+
+  // On calcule les limites à l'écran de l'image
+  if (Main.image_height>=Menu_Y_before_window)
+    end_y=Menu_Y_before_window;
+  else
+    end_y=Main.image_height;
+
+  if (!Main.magnifier_mode)
+  {
+    if (Main.image_width>=Screen_width)
+      end_x=Screen_width;
+    else
+      end_x=Main.image_width;
+
+  }
+  else
+  {
+    if (Main.image_width>=Main.separator_position)
+      end_x=Main.separator_position;
+    else
+      end_x=Main.image_width;
+
+    if ((Main.X_zoom+(Main.image_width*Main.magnifier_factor))>=Screen_width)
+      end_x_mag=Screen_width;
+    else
+      end_x_mag=(Main.X_zoom+(Main.image_width*Main.magnifier_factor));
+
+    if (Main.image_height*Main.magnifier_factor>=Menu_Y_before_window)
+      end_y_mag=Menu_Y_before_window;
+    else
+      end_y_mag=Main.image_height*Main.magnifier_factor;
+  }
+
+  // On doit maintenant faire la traduction à l'écran
+  Remap_zone_highlevel(0,0,end_x,end_y,conversion_table);
+
+  if (Main.magnifier_mode)
+  {
+    Remap_zone_highlevel(Main.separator_position,0,end_x_mag,end_y_mag,conversion_table);
+    // Il peut encore rester le bas de la barre de split à remapper si la
+    // partie zoomée ne descend pas jusqu'en bas...
+    Remap_zone_highlevel(Main.separator_position,end_y_mag,
+                    (Main.separator_position+(SEPARATOR_WIDTH*Menu_factor_X)),
+                    Menu_Y_before_window,conversion_table);
+  }
+  // Remappe tous les fonds de fenetre (qui doivent contenir un bout d'écran)
+  Remap_window_backgrounds(conversion_table, 0, Menu_Y_before_window);
+}
+
 void Copy_image_to_brush(short start_x,short start_y,short Brush_width,short Brush_height,word image_width)
 {
   byte* src=start_y*image_width+start_x+Main.backups->Pages->Image[Main.current_layer].Pixels; //Adr départ image (ESI)
@@ -384,83 +516,121 @@ byte Read_pixel_from_backup_screen (word x,word y)
   return *(Screen_backup + x + Main.image_width * y);
 }
 
-byte Effect_interpolated_colorize  (word x,word y,byte color)
+/// Result of a colorize effect for a color painted over another one.
+/// The effect functions are only used as identifiers.
+static byte Colorize_result(Func_effect effect, byte color, byte color_under)
 {
-  // factor_a = 256*(100-Colorize_opacity)/100
-  // factor_b = 256*(    Colorize_opacity)/100
-  //
-  // (Couleur_dessous*factor_a+color*facteur_B)/256
-  //
-
-  // On place dans ESI 3*Couleur_dessous ( = position de cette couleur dans la
-  // palette des teintes) et dans EDI, 3*color.
-  byte color_under = Read_pixel_from_feedback_screen(x,y);
   byte blue_under=Main.palette[color_under].B;
-  byte blue=Main.palette[color].B;
   byte green_under=Main.palette[color_under].G;
-  byte green=Main.palette[color].G;
   byte red_under=Main.palette[color_under].R;
+  byte blue=Main.palette[color].B;
+  byte green=Main.palette[color].G;
   byte red=Main.palette[color].R;
 
-  // On récupère les 3 composantes RVB
+  if (effect == Effect_interpolated_colorize)
+  {
+    // factor_a = 256*(100-Colorize_opacity)/100
+    // factor_b = 256*(    Colorize_opacity)/100
+    //
+    // (Couleur_dessous*factor_a+color*facteur_B)/256
+    //
+    blue = (Factors_inv_table[blue]
+        + Factors_table[blue_under]) / 256;
+    green = (Factors_inv_table[green]
+        + Factors_table[green_under]) / 256;
+    red = (Factors_inv_table[red]
+        + Factors_table[red_under]) / 256;
+    return Search_best_color(red,green,blue);
+  }
+  else if (effect == Effect_additive_colorize)
+    return Search_best_color(
+      red>red_under?red:red_under,
+      green>green_under?green:green_under,
+      blue>blue_under?blue:blue_under);
+  else if (effect == Effect_substractive_colorize)
+    return Search_best_color(
+      red<red_under?red:red_under,
+      green<green_under?green:green_under,
+      blue<blue_under?blue:blue_under);
+  else // Effect_alpha_colorize
+  {
+    int factor=(red*76 + green*151 + blue*28)/255;
 
-  // blue
-  blue = (Factors_inv_table[blue]
-      + Factors_table[blue_under]) / 256;
-  green = (Factors_inv_table[green]
-      + Factors_table[green_under]) / 256;
-  red = (Factors_inv_table[red]
-      + Factors_table[red_under]) / 256;
-  return Best_color(red,green,blue);
+    return Search_best_color(
+      (Main.palette[Fore_color].R*factor + red_under*(255-factor))/255,
+      (Main.palette[Fore_color].G*factor + green_under*(255-factor))/255,
+      (Main.palette[Fore_color].B*factor + blue_under*(255-factor))/255);
+  }
+}
+
+/// Results of the current colorize effect, for each color painted over
+/// each color under it.
+///
+/// A row (a painted color) is computed when first used, and all rows are
+/// forgotten when the effect, the opacity, the palette, the excluded colors
+/// (see Palette_changed()) or, for the alpha effect, the Fore color change.
+static struct
+{
+  Func_effect Effect;
+  byte Opacity;
+  byte Fore_color;
+  dword Palette_generation;
+  byte Row_ready[256];
+  byte Result[256][256];
+} Colorize_table;
+
+/// Job for Run_rows_in_parallel(): computes a row of ::Colorize_table,
+/// for the colors under between first_row and end_row.
+static void Colorize_table_rows(void * data, int band, int first_row, int end_row)
+{
+  byte color = *(const byte *)data;
+  int color_under;
+  (void)band;
 
+  for (color_under = first_row; color_under < end_row; color_under++)
+    Colorize_table.Result[color][color_under] = Colorize_result(Colorize_table.Effect, color, color_under);
 }
 
-byte Effect_additive_colorize    (word x,word y,byte color)
+/// Result of a colorize effect, from ::Colorize_table
+static byte Colorize_lookup(Func_effect effect, byte color, byte color_under)
 {
-  byte color_under = Read_pixel_from_feedback_screen(x,y);
-  byte blue_under=Main.palette[color_under].B;
-  byte green_under=Main.palette[color_under].G;
-  byte red_under=Main.palette[color_under].R;
-  byte blue=Main.palette[color].B;
-  byte green=Main.palette[color].G;
-  byte red=Main.palette[color].R;
+  if (Colorize_table.Effect != effect
+    || Colorize_table.Opacity != Colorize_opacity
+    || (effect == Effect_alpha_colorize && Colorize_table.Fore_color != Fore_color)
+    || Colorize_table.Palette_generation != Palette_generation)
+  {
+    Colorize_table.Effect = effect;
+    Colorize_table.Opacity = Colorize_opacity;
+    Colorize_table.Fore_color = Fore_color;
+    Colorize_table.Palette_generation = Palette_generation;
+    memset(Colorize_table.Row_ready, 0, sizeof(Colorize_table.Row_ready));
+  }
+  if (!Colorize_table.Row_ready[color])
+  {
+    Run_rows_in_parallel(Colorize_table_rows, &color, 256);
+    Colorize_table.Row_ready[color] = 1;
+  }
+  return Colorize_table.Result[color][color_under];
+}
 
-  return Best_color(
-    red>red_under?red:red_under,
-    green>green_under?green:green_under,
-    blue>blue_under?blue:blue_under);
+byte Effect_interpolated_colorize  (word x,word y,byte color)
+{
+  return Colorize_lookup(Effect_interpolated_colorize, color, Read_pixel_from_feedback_screen(x,y));
 }
 
-byte Effect_substractive_colorize(word x,word y,byte color)
+byte Effect_additive_colorize    (word x,word y,byte color)
 {
-  byte color_under = Read_pixel_from_feedback_screen(x,y);
-  byte blue_under=Main.palette[color_under].B;
-  byte green_under=Main.palette[color_under].G;
-  byte red_under=Main.palette[color_under].R;
-  byte blue=Main.palette[color].B;
-  byte green=Main.palette[color].G;
-  byte red=Main.palette[color].R;
+  return Colorize_lookup(Effect_additive_colorize, color, Read_pixel_from_feedback_screen(x,y));
+}
 
-  return Best_color(
-    red<red_under?red:red_under,
-    green<green_under?green:green_under,
-    blue<blue_under?blue:blue_under);
+byte Effect_substractive_colorize(word x,word y,byte color)
+{
+  return Colorize_lookup(Effect_substractive_colorize, color, Read_pixel_from_feedback_screen(x,y));
 }
 
 byte Effect_alpha_colorize    (word x,word y,byte color)
 {
-  byte color_under = Read_pixel_from_feedback_screen(x,y);
-  byte blue_under=Main.palette[color_under].B;
-  byte green_under=Main.palette[color_under].G;
-  byte red_under=Main.palette[color_under].R;
-  int factor=(Main.palette[color].R*76 +
-    Main.palette[color].G*151 +
-    Main.palette[color].B*28)/255;
-
-  return Best_color(
-    (Main.palette[Fore_color].R*factor + red_under*(255-factor))/255,
-    (Main.palette[Fore_color].G*factor + green_under*(255-factor))/255,
-    (Main.palette[Fore_color].B*factor + blue_under*(255-factor))/255);
+  return Colorize_lookup(Effect_alpha_colorize, color, Read_pixel_from_feedback_screen(x,y));
 }
 
 void Check_timer(void)
@@ -657,24 +827,6 @@ void Scroll_picture(byte * main_src, byte * main_dest, short x_offset,short y_of
   Update_rect(0,0,0,0);
 }
 
-void Zoom_a_line(byte* original_line, byte* zoomed_line,
-    word factor, word width
-    )
-{
-  byte color;
-  word x;
-
-  // Pour chaque pixel
-  for(x=0;x<width;x++){
-    color = *original_line;
-
-    memset(zoomed_line,color,factor);
-    zoomed_line+=factor;
-
-    original_line++;
-  }
-}
-
 /*############################################################################*/
 
 // Arrondir un nombre réel à la valeur entière la plus proche
@@ -40,11 +40,16 @@
 
 void Copy_image_to_brush(short start_x,short start_y,short Brush_width,short Brush_height,word image_width);
 void Remap_general_lowlevel(byte * conversion_table,byte * in_buffer, byte *out_buffer,short width,short height,short buffer_width);
+/// Remaps the pixels of the screen from (x1,y1) to (x2-1,y2-1), except the window.
+void Remap_zone_highlevel(short x1, short y1, short x2, short y2, byte * conversion_table);
+/// Remaps all the layers of the image, and the screen.
+void Remap_image_highlevel(byte * conversion_table);
 void Scroll_picture(byte * main_src, byte * main_dest, short x_offset,short y_offset);
 void Wait_end_of_click(void);
 void Set_color(byte color, byte red, byte green, byte blue);
 const T_Components * Get_current_palette(void);
 void Set_palette(T_Palette palette);
+void Palette_changed(void);
 void Clear_current_image(byte color);
 void Clear_current_image_with_stencil(byte color, byte * stencil);
 dword Round_div(dword numerator,dword divisor);
@@ -115,7 +120,6 @@ void Rotate_180_deg_lowlevel(byte *src, short width, short height);
 /// @param y_flipped  Boolean, true to flip the image vertically
 void Rescale(byte *src_buffer, short src_width, short src_height, byte *dst_buffer, short dst_width, short dst_height, short x_flipped, short y_flipped);
 
-void Zoom_a_line(byte * original_line,byte * zoomed_line,word factor,word width);
 void Copy_part_of_image_to_another(byte * source,word source_x,word source_y,word width,word height,word source_width,byte * dest,word dest_x,word dest_y,word destination_width);
 
 // -- Gestion du chrono --
@@ -31,6 +31,10 @@
 #include "op_c.h"
 #include "errors.h"
 #include "colorred.h"
+#include "workers.h"
+#include "global.h"
+#include "osdep.h"
+#include "gfx2log.h"
 
 // If GRAFX2_QUANTIZE_CLUSTER_POPULATION_SPLIT is defined,
 // the clusters are splitted in two half of equal (pixel) population.
@@ -196,24 +200,111 @@ long Perceptual_lightness(T_Components *color)
 // source 24bit image. These count are then used by the median cut algorithm to
 // decide which cluster to split.
 
+/// Number of entries of a new occurrence table
+#define OT_INITIAL_SIZE 4096
+/// Number of colors added to a table at once, after fetching their entries
+#define OT_PENDING_SIZE 32
+
+#if defined(__GNUC__)
+#define OT_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define OT_PREFETCH(address)
+#endif
+
+static int OT_add(T_Occurrence_table * t, dword color, int count);
+
+/// Number of colors a table can hold: the colors of its slice of red
+static int OT_slice_colors(const T_Occurrence_table * t)
+{
+  return (t->r_end - t->r_min) * t->rng_g * t->rng_b;
+}
+
+/// Free the counts of a direct table
+static void OT_free_counts(T_Occurrence_table * t)
+{
+  int r;
+
+  if (t->counts == NULL)
+    return;
+  for (r = 0; r < t->rng_r; r++)
+    free(t->counts[r]);
+  free(t->counts);
+  t->counts = NULL;
+}
+
+/// Make a table count each color directly, instead of in a hash table.
+///
+/// The direct tables given, which hold other slices of red, give their rows
+/// of counts to the table instead of copying them, and are left empty.
+/// @return 0 if out of memory
+static int OT_make_direct(T_Occurrence_table * t, T_Occurrence_table * const * slices, int nb_slices)
+{
+  T_Occurrence * old_table = t->table;
+  int old_nb_colors = t->nb_colors;
+  int i, r;
+
+  t->counts = (int **)calloc(t->rng_r, sizeof(int *));
+  if (t->counts == NULL)
+    return 0;
+  t->nb_colors = 0;
+  for (i = 0; i < nb_slices; i++)
+  {
+    if (slices[i] == NULL || slices[i]->counts == NULL)
+      continue;
+    for (r = slices[i]->r_min; r < slices[i]->r_end; r++)
+    {
+      t->counts[r] = slices[i]->counts[r];
+      slices[i]->counts[r] = NULL;
+    }
+    t->nb_colors += slices[i]->nb_colors;
+    slices[i]->nb_colors = 0;
+  }
+  for (r = t->r_min; r < t->r_end; r++)
+    if (t->counts[r] == NULL
+        && (t->counts[r] = (int *)calloc(t->rng_g * t->rng_b, sizeof(int))) == NULL)
+    {
+      OT_free_counts(t);
+      t->nb_colors = old_nb_colors;
+      return 0;
+    }
+  t->table = NULL;
+  if (old_table != NULL)
+  {
+    for (i = 0; i < t->size; i++)
+      if (old_table[i].count != 0)
+        OT_add(t, old_table[i].color, old_table[i].count);
+    free(old_table);
+  }
+  return 1;
+}
+
 /// Initialize an occurrence table
 void OT_init(T_Occurrence_table * t)
 {
-  int size;
+  int r;
 
-  size=(t->rng_r)*(t->rng_g)*(t->rng_b)*sizeof(int);
-  memset(t->table,0,size); // Set it to 0
+  if (t->counts != NULL)
+  {
+    for (r = t->r_min; r < t->r_end; r++)
+      memset(t->counts[r], 0, t->rng_g * t->rng_b * sizeof(int));
+  }
+  else
+    memset(t->table,0,t->size*sizeof(T_Occurrence)); // Set it to 0
+  t->nb_colors=0;
+  free(t->colors);
+  t->colors=NULL;
 }
 
-/// Allocate an occurrence table for given number of bits
-T_Occurrence_table * OT_new(int nbb_r,int nbb_g,int nbb_b)
+/// Allocate an occurrence table for the colors which red is in [r_min, r_end)
+static T_Occurrence_table * OT_new_slice(int nbb_r,int nbb_g,int nbb_b,int r_min,int r_end)
 {
   T_Occurrence_table * n;
-  int size;
 
   n=(T_Occurrence_table *)malloc(sizeof(T_Occurrence_table));
   if (n!=0)
   {
+    int ok;
+
     // Copy passed parameters
     n->nbb_r=nbb_r;
     n->nbb_g=nbb_g;
@@ -229,11 +320,24 @@ T_Occurrence_table * OT_new(int nbb_r,int nbb_g,int nbb_b)
     n->red_r=8-nbb_r;
     n->red_g=8-nbb_g;
     n->red_b=8-nbb_b;
-
-    // Allocate the table
-    size=(n->rng_r)*(n->rng_g)*(n->rng_b);
-    n->table=(int *)calloc(size, sizeof(int));
-    if (n->table == NULL)
+    n->r_min=r_min;
+    n->r_end=r_end;
+
+    n->size=OT_INITIAL_SIZE;
+    n->table=NULL;
+    n->counts=NULL;
+    n->nb_colors=0;
+    n->colors=NULL;
+    // A table of few colors counts them directly. The others start with a
+    // hash table, which grows with the number of colors.
+    if (OT_slice_colors(n) <= OT_INITIAL_SIZE)
+      ok=OT_make_direct(n, NULL, 0);
+    else
+    {
+      n->table=(T_Occurrence *)calloc(n->size, sizeof(T_Occurrence));
+      ok=n->table!=NULL;
+    }
+    if (!ok)
     {
       // Not enough memory !
       free(n);
@@ -244,31 +348,145 @@ T_Occurrence_table * OT_new(int nbb_r,int nbb_g,int nbb_b)
   return n;
 }
 
+/// Allocate an occurrence table for given number of bits
+T_Occurrence_table * OT_new(int nbb_r,int nbb_g,int nbb_b)
+{
+  return OT_new_slice(nbb_r, nbb_g, nbb_b, 0, 1 << nbb_r);
+}
+
 
 /// Delete a table and free the memory
 void OT_delete(T_Occurrence_table * t)
 {
+  OT_free_counts(t);
+  free(t->colors);
   free(t->table);
   free(t);
   t = NULL;
 }
 
 
+/// First entry of the hash table where a packed color is searched
+static dword OT_hash(const T_Occurrence_table * t, dword color)
+{
+  dword index;
+
+  index = color * 2654435761UL; // Knuth's multiplicative hash
+  return (index ^ (index >> 15)) & (t->size - 1);
+}
+
+
+/// Find the entry of a packed color, or the unused entry where it belongs
+static T_Occurrence * OT_find(const T_Occurrence_table * t, dword color)
+{
+  dword mask = t->size - 1;
+  dword index = OT_hash(t, color);
+
+  while (t->table[index].count != 0 && t->table[index].color != color)
+    index = (index + 1) & mask;
+  return t->table + index;
+}
+
+
+/// Change the number of entries of a hash table, keeping its colors
+/// @return 0 if out of memory
+static int OT_resize(T_Occurrence_table * t, int size)
+{
+  T_Occurrence * old_table = t->table;
+  int old_size = t->size;
+  int i;
+
+  t->table = (T_Occurrence *)calloc(size, sizeof(T_Occurrence));
+  if (t->table == NULL)
+  {
+    t->table = old_table;
+    return 0;
+  }
+  t->size = size;
+  for (i = 0; i < old_size; i++)
+  {
+    // Fetch the new entries of the next colors in advance
+    if ((i & (OT_PENDING_SIZE - 1)) == 0)
+    {
+      int j;
+      for (j = i; j < i + OT_PENDING_SIZE && j < old_size; j++)
+        if (old_table[j].count != 0)
+          OT_PREFETCH(t->table + OT_hash(t, old_table[j].color));
+    }
+    if (old_table[i].count != 0)
+      *OT_find(t, old_table[i].color) = old_table[i];
+  }
+  free(old_table);
+  return 1;
+}
+
+
+/// Number of entries of a hash table after it grows, or 0 when the table
+/// should rather count each color directly.
+///
+/// The hash table never gets more entries than a sixteenth of the colors:
+/// 8 bytes for each entry, so at most an eighth of the memory of the counts.
+static int OT_next_size(const T_Occurrence_table * t, int size)
+{
+  if (size * 32 > OT_slice_colors(t))
+    return 0;
+  return size * 2;
+}
+
+
+/// Add some pixels to the count of a packed color
+/// @return 0 if out of memory
+static int OT_add(T_Occurrence_table * t, dword color, int count)
+{
+  T_Occurrence * entry;
+
+  if (t->counts != NULL)
+  {
+    int * total = t->counts[color >> t->dec_r] + (color & ((1 << t->dec_r) - 1));
+
+    if (*total == 0)
+      t->nb_colors++;
+    *total += count;
+    return 1;
+  }
+  entry = OT_find(t, color);
+  if (entry->count == 0)
+  {
+    // Keep the table at most half full, so the searches stay short
+    if (t->nb_colors >= t->size / 2)
+    {
+      int size = OT_next_size(t, t->size);
+
+      if (size == 0 ? !OT_make_direct(t, NULL, 0) : !OT_resize(t, size))
+        return 0;
+      return OT_add(t, color, count);
+    }
+    entry->color = color;
+    t->nb_colors++;
+  }
+  entry->count += count;
+  return 1;
+}
+
+
 /// Get number of occurrences for a given color
 int OT_get(T_Occurrence_table * t, byte r, byte g, byte b)
 {
-  int index;
+  dword color;
 
   // Drop bits as needed
-  index=(r<<t->dec_r) | (g<<t->dec_g) | (b<<t->dec_b);
-  return t->table[index];
+  color=(r<<t->dec_r) | (g<<t->dec_g) | (b<<t->dec_b);
+  if (t->counts != NULL)
+    return t->counts[r][color & ((1 << t->dec_r) - 1)];
+  return OT_find(t, color)->count;
 }
 
 
 /// Add 1 to the count for a color
-void OT_inc(T_Occurrence_table * t,byte r,byte g,byte b)
+/// @return 0 if out of memory
+int OT_inc(T_Occurrence_table * t,byte r,byte g,byte b)
 {
-  int index;
+  dword color;
 
   // Drop bits as needed
   r=(r>>t->red_r);
@@ -276,36 +494,276 @@ void OT_inc(T_Occurrence_table * t,byte r,byte g,byte b)
   b=(b>>t->red_b);
 
   // Compute the address
-  index=(r<<t->dec_r) | (g<<t->dec_g) | (b<<t->dec_b);
-  t->table[index]++;
+  color=(r<<t->dec_r) | (g<<t->dec_g) | (b<<t->dec_b);
+  return OT_add(t, color, 1);
 }
 
 
-/// Count the use of each color in a 24bit picture and fill in the table
-void OT_count_occurrences(T_Occurrence_table* t, T_Bitmap24B image, int size)
+/// Number of entries of the cache of OT_count_pixels(): (1 << OT_CACHE_BITS)
+#define OT_CACHE_BITS 14
+#define OT_CACHE_SIZE (1 << OT_CACHE_BITS)
+/// Maximum number of slices of red of OT_count_occurrences()
+#define OT_COUNT_SLICES 32
+/// Smallest picture which colors are counted by the worker threads
+#define OT_COUNT_PARALLEL_PIXELS (256*1024)
+
+/// Count the pixels of the slice of red of a direct table: no hash, the
+/// counts of the close colors are as close as in the picture.
+static void OT_count_pixels_direct(T_Occurrence_table * t, T_Bitmap24B ptr, int size)
 {
-  T_Bitmap24B ptr;
-  int index;
+  int * const * counts = t->counts;
+  int nb_colors = t->nb_colors;
+  int r_min = t->r_min, r_end = t->r_end;
+  int red_r = t->red_r, red_g = t->red_g, red_b = t->red_b;
+  int dec_g = t->dec_g, dec_b = t->dec_b;
+
+  for (; size > 0; size--, ptr++)
+  {
+    int r = ptr->R >> red_r;
+    if (r >= r_min && r < r_end)
+    {
+      int * count = counts[r] + ((ptr->G >> red_g) << dec_g | (ptr->B >> red_b) << dec_b);
+      if ((*count)++ == 0)
+        nb_colors++;
+    }
+  }
+  t->nb_colors = nb_colors;
+}
+
+/// Add a group of colors to a table
+/// @return 0 if out of memory
+static int OT_add_all(T_Occurrence_table * t, const T_Occurrence * colors, int nb)
+{
+  int i;
+
+  for (i = 0; i < nb; i++)
+    if (colors[i].count != 0 && !OT_add(t, colors[i].color, colors[i].count))
+      return 0;
+  return 1;
+}
+
+/// Add the colors of a table to another one
+/// @return 0 if out of memory
+static int OT_add_table(T_Occurrence_table * t, const T_Occurrence_table * from)
+{
+  int r, i;
+
+  if (from->counts == NULL)
+    return OT_add_all(t, from->table, from->size);
+  for (r = from->r_min; r < from->r_end; r++)
+  {
+    if (from->counts[r] == NULL)
+      continue;
+    for (i = 0; i < from->rng_g * from->rng_b; i++)
+      if (from->counts[r][i] != 0 && !OT_add(t, (dword)r << from->dec_r | i, from->counts[r][i]))
+        return 0;
+  }
+  return 1;
+}
+
+/// Count the pixels of the slice of red of the table, at the precision of the table
+/// @return 0 if out of memory
+static int OT_count_pixels(T_Occurrence_table * t, T_Bitmap24B image, int size)
+{
+  // The close pixels often have the same colors: they are first counted in
+  // a small cache, which stays in the processor cache unlike the table.
+  // The colors which leave the cache are added to the table by groups, so
+  // the memory can fetch their entries at the same time.
+  T_Occurrence * cache;
+  T_Occurrence pending[OT_PENDING_SIZE];
+  int nb_pending = 0;
+  int r_min = t->r_min, r_end = t->r_end;
+  int red_r = t->red_r, red_g = t->red_g, red_b = t->red_b;
+  int dec_r = t->dec_r, dec_g = t->dec_g, dec_b = t->dec_b;
+  T_Bitmap24B ptr = image;
+  int index = size;
+  int ok = 1;
+
+  if (t->counts == NULL)
+  {
+    cache = (T_Occurrence *)calloc(OT_CACHE_SIZE, sizeof(T_Occurrence));
+    if (cache == NULL)
+      return 0;
+    for (; index > 0; index--, ptr++)
+    {
+      int r = ptr->R >> red_r;
+      if (r >= r_min && r < r_end)
+      {
+        dword color = (dword)r << dec_r | (dword)(ptr->G >> red_g) << dec_g | (dword)(ptr->B >> red_b) << dec_b;
+        T_Occurrence * entry = cache + ((dword)(color * 2654435761UL) >> (32 - OT_CACHE_BITS));
+
+        if (entry->color != color)
+        {
+          if (entry->count != 0)
+          {
+            if (nb_pending == OT_PENDING_SIZE)
+            {
+              ok = OT_add_all(t, pending, nb_pending);
+              nb_pending = 0;
+              // Stop when the table counts each color directly
+              if (!ok || t->counts != NULL)
+                break;
+            }
+            OT_PREFETCH(t->table + OT_hash(t, entry->color));
+            pending[nb_pending++] = *entry;
+          }
+          entry->color = color;
+          entry->count = 0;
+        }
+        entry->count++;
+      }
+    }
+    ok = ok && OT_add_all(t, pending, nb_pending) && OT_add_all(t, cache, OT_CACHE_SIZE);
+    free(cache);
+  }
+  // The pixels left, if any, are counted directly in the table
+  if (ok && index > 0)
+    OT_count_pixels_direct(t, ptr, index);
+  return ok;
+}
+
+/// Work shared by the bands of OT_count_occurrences()
+typedef struct
+{
+  const T_Occurrence_table * t;
+  T_Bitmap24B image;
+  int size;
+  T_Occurrence_table * band_tables[WORKERS_MAX_BANDS]; ///< The colors counted by each band
+  int failed[WORKERS_MAX_BANDS]; ///< Set by a band when out of memory
+  int nb_slices; ///< Number of slices of red
+} T_Occurrence_count;
+
+/// Job for Run_rows_in_parallel(): counts, in the table of the band, all the pixels which red is in some slices.
+static void OT_count_slices(void * data, int band, int first_row, int end_row)
+{
+  T_Occurrence_count * count = (T_Occurrence_count *)data;
+  const T_Occurrence_table * t = count->t;
+  T_Occurrence_table * table;
+
+  // The table of the band only holds the colors of its slices, so the
+  // tables of all the bands are never bigger than a table of all the colors
+  table = OT_new_slice(t->nbb_r, t->nbb_g, t->nbb_b,
+                       first_row * t->rng_r / count->nb_slices, end_row * t->rng_r / count->nb_slices);
+  count->band_tables[band] = table;
+  count->failed[band] = table == NULL || !OT_count_pixels(table, count->image, count->size);
+}
 
-  for (index = size, ptr = image; index > 0; index--, ptr++)
-    OT_inc(t, ptr->R, ptr->G, ptr->B);
+/// Count the use of each color in a 24bit picture and fill in the table
+///
+/// The work is shared by the worker threads, the counts are the same.
+/// @return 0 if out of memory
+int OT_count_occurrences(T_Occurrence_table* t, T_Bitmap24B image, int size)
+{
+  T_Occurrence_count count;
+  int nb_bands;
+
+  count.t = t;
+  count.image = image;
+  count.size = size;
+  count.nb_slices = t->rng_r < OT_COUNT_SLICES ? t->rng_r : OT_COUNT_SLICES;
+  // Each band reads all the pixels: not worth it for the small pictures,
+  // and one band per thread is enough.
+  nb_bands = size >= OT_COUNT_PARALLEL_PIXELS ? Thread_bands(count.nb_slices) : 1;
+  if (nb_bands > 1)
+  {
+    int band;
+    int ok = 1;
+    int direct = t->counts != NULL;
+    int nb_colors;
+    int new_size;
+
+    // Each band reads all the pixels, but only counts the colors of its
+    // slices of red, in its own table: the tables have no color in common.
+    // Thread_bands() gives the same number of bands for the same job
+    Run_thread_bands(OT_count_slices, &count, count.nb_slices);
+
+    nb_colors = t->nb_colors;
+    for (band = 0; band < nb_bands; band++)
+    {
+      if (count.failed[band])
+        ok = 0;
+      else
+      {
+        nb_colors += count.band_tables[band]->nb_colors;
+        if (count.band_tables[band]->counts != NULL)
+          direct = 1;
+      }
+    }
+    // Make room for all the colors at once. A direct table takes the rows
+    // of counts of the direct tables of the bands, so the counts are never
+    // in memory twice.
+    new_size = t->size;
+    while (!direct && new_size / 2 < nb_colors)
+    {
+      new_size = OT_next_size(t, new_size);
+      direct = new_size == 0;
+    }
+    if (ok && direct && t->counts == NULL)
+      ok = OT_make_direct(t, count.band_tables, nb_bands);
+    else if (ok && !direct && new_size != t->size)
+      ok = OT_resize(t, new_size);
+    for (band = 0; band < nb_bands; band++)
+    {
+      if (count.band_tables[band] == NULL)
+        continue;
+      if (ok)
+        ok = OT_add_table(t, count.band_tables[band]);
+      OT_delete(count.band_tables[band]);
+    }
+    return ok;
+  }
+  return OT_count_pixels(t, image, size);
 }
 
 
-/// Count the total number of pixels in an occurrence table
+/// Count the number of different colors in an occurrence table
 int OT_count_colors(T_Occurrence_table * t)
 {
-  int val; // Computed return value
-  int nb; // Number of colors to test
-  int i; // Loop index
+  return t->nb_colors;
+}
 
-  val = 0;
-  nb=(t->rng_r)*(t->rng_g)*(t->rng_b);
-  for (i = 0; i < nb; i++)
-    if (t->table[i]>0)
-      val++;
 
-  return val;
+/// Pack the used entries of a table in T_Occurrence_table::colors, for the clusters
+/// @return 0 if out of memory
+int OT_list_colors(T_Occurrence_table * t)
+{
+  int i, nb;
+
+  free(t->colors);
+  t->colors = (T_Occurrence *)malloc((t->nb_colors > 0 ? t->nb_colors : 1) * sizeof(T_Occurrence));
+  if (t->colors == NULL)
+    return 0;
+  nb = 0;
+  if (t->counts != NULL)
+  {
+    int r;
+
+    for (r = t->r_min; r < t->r_end; r++)
+      for (i = 0; i < t->rng_g * t->rng_b; i++)
+        if (t->counts[r][i] != 0)
+        {
+          t->colors[nb].color = (dword)r << t->dec_r | i;
+          t->colors[nb++].count = t->counts[r][i];
+        }
+  }
+  else
+  {
+    for (i = 0; i < t->size; i++)
+      if (t->table[i].count != 0)
+        t->colors[nb++] = t->table[i];
+  }
+  return 1;
+}
+
+
+/// Component of a packed color of an occurrence table: 0 red, 1 green, 2 blue
+static int OT_component(const T_Occurrence_table * const to, dword color, int hue)
+{
+  if (hue == 0)
+    return color >> to->dec_r;
+  if (hue == 1)
+    return (color >> to->dec_g) & (to->rng_g - 1);
+  return color & (to->rng_b - 1);
 }
 
 
@@ -328,121 +786,34 @@ void Cluster_pack(T_Cluster * c,const T_Occurrence_table * const to)
 {
   int rmin,rmax,vmin,vmax,bmin,bmax;
   int r,g,b;
+  int i;
 
-  // Find min. and max. values actually used for each component in this cluster
-
-  // Pre-shift everything to avoid using OT_Get and be faster.
-  // GIMP use only 6 bits for G and B components in this table.
-  rmin=c->rmax << to->dec_r; rmax=c->rmin << to->dec_r;
-  vmin=c->vmax << to->dec_g; vmax=c->vmin << to->dec_g;
-  bmin=c->bmax << to->dec_b; bmax=c->bmin << to->dec_b;
+  // Find min. and max. values actually used for each component in this cluster,
+  // and count the occurrences at the same time: run over the colors of the
+  // cluster instead of its whole box.
+  rmin=c->rmax; rmax=c->rmin;
+  vmin=c->vmax; vmax=c->vmin;
+  bmin=c->bmax; bmax=c->bmin;
   c->occurences=0;
 
-  // Unoptimized code kept here for documentation purpose because the optimized
-  // one is unreadable : run over the whole cluster and find the min and max,
-  // and count the occurrences at the same time.
-  /*
-  for (r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-    for (g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-      for (b=c->bmin;b<=c->bmax;b++)
-      {
-        nbocc=to->table[r + g + b]; // OT_get
-        if (nbocc)
-        {
-          if (r<rmin) rmin=r;
-          else if (r>rmax) rmax=r;
-          if (g<vmin) vmin=g;
-          else if (g>vmax) vmax=g;
-          if (b<bmin) bmin=b;
-          else if (b>bmax) bmax=b;
-          c->occurrences+=nbocc;
-        }
-      }
-  */
-  
-  // Optimized version : find the extremums one at a time, so we can reduce the
-  // area to seek for the next one. Start at the edges of the cluster and go to
-  // the center until we find a pixel.
-
-  for(r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-      for(g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                rmin=r;
-                goto RMAX;
-            }
-          }
-RMAX:
-  for(r=c->rmax<<to->dec_r;r>=rmin;r-=1<<to->dec_r)
-      for(g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                rmax=r;
-                goto VMIN;
-            }
-          }
-VMIN:
-  for(g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                vmin=g;
-                goto VMAX;
-            }
-          }
-VMAX:
-  for(g=c->vmax<<to->dec_g;g>=vmin;g-=1<<to->dec_g)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                vmax=g;
-                goto BMIN;
-            }
-          }
-BMIN:
-  for(b=c->bmin;b<=c->bmax;b++)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(g=vmin;g<=vmax;g+=1<<to->dec_g)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                bmin=b;
-                goto BMAX;
-            }
-          }
-BMAX:
-  for(b=c->bmax;b>=bmin;b--)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(g=vmin;g<=vmax;g+=1<<to->dec_g)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                bmax=b;
-                goto ENDCRUSH;
-            }
-          }
-ENDCRUSH:
-  // We still need to seek the internal part of the cluster to count pixels
-  // inside it
-  for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-      for(g=vmin;g<=vmax;g+=1<<to->dec_g)
-          for(b=bmin;b<=bmax;b++)
-          {
-            c->occurences+=to->table[r + g + b]; // OT_get
-          }
+  for (i=c->first;i<c->end;i++)
+  {
+    r=OT_component(to,to->colors[i].color,0);
+    g=OT_component(to,to->colors[i].color,1);
+    b=OT_component(to,to->colors[i].color,2);
+    if (r<rmin) rmin=r;
+    if (r>rmax) rmax=r;
+    if (g<vmin) vmin=g;
+    if (g>vmax) vmax=g;
+    if (b<bmin) bmin=b;
+    if (b>bmax) bmax=b;
+    c->occurences+=to->colors[i].count;
+  }
 
-  // Unshift the values and put them in the cluster info
-  c->rmin=rmin>>to->dec_r; c->rmax=rmax>>to->dec_r;
-  c->vmin=vmin>>to->dec_g; c->vmax=vmax>>to->dec_g;
-  c->bmin=bmin;     c->bmax=bmax;
+  // Put them in the cluster info
+  c->rmin=rmin; c->rmax=rmax;
+  c->vmin=vmin; c->vmax=vmax;
+  c->bmin=bmin; c->bmax=bmax;
   
   // Find the longest axis to know which way to split the cluster
   r = c->rmax-c->rmin;
@@ -483,11 +854,36 @@ ENDCRUSH:
 }
 
 
+/// Give the colors of a cluster to its two halves after a split: the colors
+/// which component is below the split value go first.
+static void Cluster_partition(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue, int value,
+  const T_Occurrence_table * const to)
+{
+  int first = c->first;
+  int end = c->end;
+
+  while (first < end)
+  {
+    if (OT_component(to, to->colors[first].color, hue) < value)
+      first++;
+    else
+    {
+      T_Occurrence swap = to->colors[--end];
+      to->colors[end] = to->colors[first];
+      to->colors[first] = swap;
+    }
+  }
+  c1->first = c->first; c1->end = first;
+  c2->first = first;    c2->end = c->end;
+}
+
+
 #ifndef GRAFX2_QUANTIZE_CLUSTER_POPULATION_SPLIT
 /// Split a cluster on its longest axis.
 /// c = source cluster, c1, c2 = output after split
 /// the two output cluster have half volume (and not half population)
-void Cluster_split_volume(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue)
+void Cluster_split_volume(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
+  const T_Occurrence_table * const to)
 {
   int r,g,b;
   if (hue == 0) // split on red
@@ -541,6 +937,7 @@ void Cluster_split_volume(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue
     c2->Bmin=b+1;     c2->Bmax=c->Bmax;
     c2->bmin=b+1;     c2->bmax=c->bmax;
   }
+  Cluster_partition(c, c1, c2, hue, hue == 0 ? c2->rmin : hue == 1 ? c2->vmin : c2->bmin, to);
 }
 
 #else // GRAFX2_QUANTIZE_CLUSTER_POPULATION_SPLIT
@@ -553,33 +950,32 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
   int limit;
   int cumul;
   int r, g, b;
+  int value;
+  int count[256];
+  int i;
 
   // Split criterion: each of the cluster will have the same number of pixels
   limit = c->occurences / 2;
   cumul = 0;
-  if (hue == 0) // split on red
+
+  // Run over the cluster until we reach the requested number of pixels:
+  // count the pixels for each value of the component, then cumulate them
+  // from the lowest value.
+  memset(count, 0, sizeof(count));
+  for (i = c->first; i < c->end; i++)
+    count[OT_component(to, to->colors[i].color, hue)] += to->colors[i].count;
+  value = hue == 0 ? c->rmin : hue == 1 ? c->vmin : c->bmin;
+  for (;;)
   {
-    // Run over the cluster until we reach the requested number of pixels
-    for (r = c->rmin<<to->dec_r; r<=c->rmax<<to->dec_r; r+=1<<to->dec_r)
-    {
-      for (g = c->vmin<<to->dec_g; g<=c->vmax<<to->dec_g; g+=1<<to->dec_g)
-      {
-        for (b = c->bmin; b<=c->bmax; b++)
-        {
-          cumul+=to->table[r + g + b];
-          if (cumul>=limit)
-            break;
-        }
-        if (cumul>=limit)
-          break;
-      }
-      if (cumul>=limit)
-        break;
-    }
+    cumul += count[value];
+    if (cumul >= limit)
+      break;
+    value++;
+  }
+  r = g = b = value;
 
-    r>>=to->dec_r;
-    g>>=to->dec_g;
-    
+  if (hue == 0) // split on red
+  {
     // More than half of the cluster pixel have r = rmin. Ensure we split somewhere anyway.
     if (r == c->rmin) r++;
 
@@ -600,26 +996,6 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
   else
   if (hue==1) // split on green
   {
-
-    for (g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-    {
-      for (r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-      {
-        for (b=c->bmin;b<=c->bmax;b++)
-        {
-          cumul+=to->table[r + g + b];
-          if (cumul>=limit)
-            break;
-        }
-        if (cumul>=limit)
-          break;
-      }
-      if (cumul>=limit)
-        break;
-    }
-
-    r>>=to->dec_r; g>>=to->dec_g;
-    
     if (g == c->vmin) g++;
 
     c1->Rmin=c->Rmin; c1->Rmax=c->Rmax;
@@ -638,26 +1014,6 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
   }
   else // split on blue
   {
-
-    for (b=c->bmin;b<=c->bmax;b++)
-    {
-      for (g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-      {
-        for (r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-        {
-          cumul+=to->table[r + g + b];
-          if (cumul>=limit)
-            break;
-        }
-        if (cumul>=limit)
-          break;
-      }
-      if (cumul>=limit)
-        break;
-    }
-
-    r>>=to->dec_r; g>>=to->dec_g;
-    
     if (b == c->bmin) b++;
 
     c1->Rmin=c->Rmin; c1->Rmax=c->Rmax;
@@ -674,6 +1030,7 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
     c2->Bmin=b;       c2->Bmax=c->Bmax;
     c2->bmin=b;       c2->bmax=c->bmax;
   }
+  Cluster_partition(c, c1, c2, hue, hue == 0 ? c2->rmin : hue == 1 ? c2->vmin : c2->bmin, to);
 }
 #endif // GRAFX2_QUANTIZE_CLUSTER_POPULATION_SPLIT
 
@@ -682,25 +1039,20 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
 void Cluster_compute_hue(T_Cluster * c,T_Occurrence_table * to)
 {
   int cumul_r,cumul_g,cumul_b;
-  int r,g,b;
+  int i;
   int nbocc;
 
   byte s=0;
 
   cumul_r=cumul_g=cumul_b=0;
-  for (r=c->rmin;r<=c->rmax;r++)
-    for (g=c->vmin;g<=c->vmax;g++)
-      for (b=c->bmin;b<=c->bmax;b++)
-      {
-        nbocc=OT_get(to,r,g,b);
-        if (nbocc)
-        {
-          cumul_r+=r*nbocc;
-          cumul_g+=g*nbocc;
-          cumul_b+=b*nbocc;
-        }
-      }
-  
+  for (i=c->first;i<c->end;i++)
+  {
+    nbocc=to->colors[i].count;
+    cumul_r+=OT_component(to,to->colors[i].color,0)*nbocc;
+    cumul_g+=OT_component(to,to->colors[i].color,1)*nbocc;
+    cumul_b+=OT_component(to,to->colors[i].color,2)*nbocc;
+  }
+
   c->data.pal.r=(cumul_r<<to->red_r)/c->occurences;
   c->data.pal.g=(cumul_g<<to->red_g)/c->occurences;
   c->data.pal.b=(cumul_b<<to->red_b)/c->occurences;
@@ -766,6 +1118,8 @@ void CS_Init(T_Cluster_set * cs, T_Occurrence_table * to)
   cs->clusters->Rmax = cs->clusters->rmax = to->rng_r - 1;
   cs->clusters->Vmax = cs->clusters->vmax = to->rng_g - 1;
   cs->clusters->Bmax = cs->clusters->bmax = to->rng_b - 1;
+  cs->clusters->first = 0;
+  cs->clusters->end = to->nb_colors;
   cs->clusters->next = NULL;
   Cluster_pack(cs->clusters, to);
   cs->nb = 1;
@@ -789,13 +1143,14 @@ T_Cluster_set * CS_New(int nbmax, T_Occurrence_table * to)
       n->nb_max = nbmax;
     }
 
-    // Allocate the first cluster
+    // Allocate the first cluster, with all the colors
     n->clusters=(T_Cluster *)malloc(sizeof(T_Cluster));
-    if (n->clusters != NULL)
+    if (n->clusters != NULL && OT_list_colors(to))
       CS_Init(n, to);
     else
     {
       // No memory free ! Sorry !
+      free(n->clusters);
       free(n);
       n = NULL;
     }
@@ -901,7 +1256,7 @@ int CS_Generate(T_Cluster_set * cs, const T_Occurrence_table * const to, CT_Tree
     	break;
     }
 #ifndef GRAFX2_QUANTIZE_CLUSTER_POPULATION_SPLIT
-    Cluster_split_volume(current, &Nouveau1, &Nouveau2, current->data.cut.plus_large);
+    Cluster_split_volume(current, &Nouveau1, &Nouveau2, current->data.cut.plus_large, to);
 #else
     Cluster_split(current, &Nouveau1, &Nouveau2, current->data.cut.plus_large, to);
 #endif
@@ -1148,8 +1503,9 @@ void GS_Generate(T_Gradient_set * ds,T_Cluster_set * cs)
 /// @param r Resolution for red
 /// @param g Resolution for green
 /// @param b Resolution for blue
+/// @param nb_colors number of colors in the generated palette
 CT_Tree* Optimize_palette(T_Bitmap24B image, int size,
-  T_Components * palette, int r, int g, int b)
+  T_Components * palette, int r, int g, int b, int * nb_colors)
 {
   T_Occurrence_table * to;
   CT_Tree* tc;
@@ -1172,16 +1528,21 @@ CT_Tree* Optimize_palette(T_Bitmap24B image, int size,
   }
 
   // Count pixels for each color
-  OT_count_occurrences(to, image, size);
-
-  cs = CS_New(256, to);
-  if (cs == NULL)
+  if (!OT_count_occurrences(to, image, size))
   {
     CT_delete(tc);
     OT_delete(to);
     return NULL;
   }
-  //CS_Check(cs);
+
+  cs = CS_New(256, to);
+  if (cs == NULL)
+  {
+    CT_delete(tc);
+    OT_delete(to);
+    return NULL;
+  }
+  //CS_Check(cs);
   // Ok, everything was allocated
 
   // Generate the cluster set with median cut algorithm
@@ -1212,6 +1573,7 @@ CT_Tree* Optimize_palette(T_Bitmap24B image, int size,
   // And finally generate the conversion table to map RGB > pal. index
   CS_Generate_color_table_and_palette(cs, tc, palette, to);
   //CS_Check(cs);
+  *nb_colors = cs->nb;
   
   CS_Delete(cs);
   OT_delete(to);
@@ -1331,43 +1693,70 @@ void Convert_24b_bitmap_to_256_Floyd_Steinberg(T_Bitmap256 dest,T_Bitmap24B sour
 }
 
 
-/// Converts from 24b to 256c without dithering, using given conversion table
-void Convert_24b_bitmap_to_256_nearest_neighbor(T_Bitmap256 dest,
-  T_Bitmap24B source, int width, int height, T_Components * palette,
-  CT_Tree* tc)
+/// Work shared by the bands of Convert_24b_bitmap_to_256_nearest_neighbor()
+typedef struct
+{
+  T_Bitmap256 dest;
+  T_Bitmap24B source;
+  int width;
+  CT_Tree* tc;
+  const CT_Grid* grid; ///< Lookup grid of tc, or NULL
+} T_Nearest_neighbor_conversion;
+
+/// Job for Run_rows_in_parallel(): converts rows without dithering
+static void Convert_24b_bitmap_to_256_nearest_neighbor_rows(void * data, int band, int first_row, int end_row)
 {
+  T_Nearest_neighbor_conversion * conversion = (T_Nearest_neighbor_conversion *)data;
   T_Bitmap24B current;
   T_Bitmap256 d;
-  int x_pos, y_pos;
-  int red, green, blue;
-  (void)palette; // unused
+  long count;
+  CT_Tree* tc = conversion->tc;
+  const CT_Grid* grid = conversion->grid;
+  (void)band; // unused
 
   // On initialise les variables de parcours:
-  current =source; // Le pixel dont on s'occupe
-
-  d =dest;
+  current = conversion->source + (long)first_row * conversion->width; // Le pixel dont on s'occupe
+  d = conversion->dest + (long)first_row * conversion->width;
+  count = (long)(end_row - first_row) * conversion->width;
 
-  // On parcours chaque pixel:
-  for (y_pos = 0; y_pos < height; y_pos++)
+  if (grid == NULL)
   {
-    for (x_pos = 0 ;x_pos < width; x_pos++)
-    {
-      // On prends la meilleure couleur de la palette qui traduit la couleur
-      // 24 bits de la source:
-      red = current->R;
-      green = current->G;
-      blue = current->B;
-      // Cherche la couleur correspondant dans la palette et la range dans
-      // l'image de destination
-      *d = CT_get(tc, red, green, blue);
+    // Cherche la couleur correspondant dans la palette et la range dans
+    // l'image de destination
+    for (; count > 0; count--, current++, d++)
+      *d = CT_get(tc, current->R, current->G, current->B);
+    return;
+  }
+  for (; count > 0; count--, current++, d++)
+  {
+    word index = grid->cells[CT_GRID_INDEX(current->R, current->G, current->B)];
 
-      // On passe au pixel suivant :
-      current++;
-      d++;
-    }
+    // Only the cells cut by the boxes of the tree need a walk in it
+    *d = index != CT_GRID_TREE ? (byte)index : CT_get(tc, current->R, current->G, current->B);
   }
 }
 
+/// Converts from 24b to 256c without dithering, using given conversion table
+void Convert_24b_bitmap_to_256_nearest_neighbor(T_Bitmap256 dest,
+  T_Bitmap24B source, int width, int height, T_Components * palette,
+  CT_Tree* tc)
+{
+  T_Nearest_neighbor_conversion conversion;
+  CT_Grid* grid = NULL;
+  (void)palette; // unused
+
+  // Not worth it for small pictures
+  if ((long)width * height >= (1l << (3 * CT_GRID_BITS)))
+    grid = CT_grid_new(tc);
+  conversion.dest = dest;
+  conversion.source = source;
+  conversion.width = width;
+  conversion.tc = tc;
+  conversion.grid = grid;
+  Run_rows_in_parallel(Convert_24b_bitmap_to_256_nearest_neighbor_rows, &conversion, height);
+  CT_grid_delete(grid);
+}
+
 
 // Count colors and convert if 256 colors or less are used
 // return 0 for success
@@ -1422,51 +1811,1180 @@ static const byte precision_24b[]=
  3,3,2};
 
 
+/// Median cut: the palette generator of ::COLOR_REDUCTION_MEDIAN_CUT
+static CT_Tree * Median_cut_reduction(T_Bitmap24B image, int size, T_Components * palette, int * nb_colors)
+{
+  CT_Tree* table = NULL;
+  int ip; // index de précision pour la conversion
+
+  // On essaye d'obtenir une table de conversion qui loge en mémoire, avec la
+  // meilleure précision possible.
+  // The occurrence table only grows with the number of colors, so the full
+  // precision fits unless the memory is really short.
+  for (ip = 0; ip < (10*3) && table == NULL; ip += 3)
+    table = Optimize_palette(image, size, palette,
+                             precision_24b[ip], precision_24b[ip+1], precision_24b[ip+2], nb_colors);
+  return table;
+}
+
+
+/// Sums of the colors of a 24bit picture, by cells of the RGB cube.
+///
+/// Index 0 of each axis is an empty row, so the cumulated moments of Wu's
+/// method don't need special cases at the borders.
+typedef struct
+{
+  int bits;       ///< Precision of the components
+  int side;       ///< Number of cells on each axis: (1 << bits) + 1
+  double * weight; ///< Number of pixels
+  double * red;    ///< Sum of the red values
+  double * green;  ///< Sum of the green values
+  double * blue;   ///< Sum of the blue values
+  double * square; ///< Sum of the r²+g²+b², or NULL when not needed
+  T_Bitmap24B image;
+  int size;
+  int nb_slices;
+} T_Color_histogram;
+
+/// Index of a cell of a ::T_Color_histogram, from 1 to (1 << bits) on each axis
+#define HISTOGRAM_INDEX(h,r,g,b) ((((long)(r) * (h)->side) + (g)) * (h)->side + (b))
+
+/// Number of slices of red of Color_histogram_count()
+#define HISTOGRAM_SLICES 32
+
+/// Job for Run_thread_bands(): sums all the pixels which red is in some slices of the histogram.
+static void Color_histogram_slices(void * data, int band, int first_row, int end_row)
+{
+  T_Color_histogram * h = (T_Color_histogram *)data;
+  T_Bitmap24B ptr;
+  int index;
+  int shift = 8 - h->bits;
+  int r_min = 1 + (first_row << h->bits) / h->nb_slices;
+  int r_end = 1 + (end_row << h->bits) / h->nb_slices;
+  (void)band; // unused
+
+  for (index = h->size, ptr = h->image; index > 0; index--, ptr++)
+  {
+    int r = (ptr->R >> shift) + 1;
+    if (r >= r_min && r < r_end)
+    {
+      long i = HISTOGRAM_INDEX(h, r, (ptr->G >> shift) + 1, (ptr->B >> shift) + 1);
+
+      h->weight[i]++;
+      h->red[i] += ptr->R;
+      h->green[i] += ptr->G;
+      h->blue[i] += ptr->B;
+      if (h->square != NULL)
+        h->square[i] += ptr->R * ptr->R + ptr->G * ptr->G + ptr->B * ptr->B;
+    }
+  }
+}
+
+/// Allocates the cells of a histogram, and sums the pixels of a picture in them
+///
+/// All the sums are integer values, so they are the same whatever the number of threads.
+/// @return 0 if out of memory
+static int Color_histogram_count(T_Color_histogram * h, int bits, int with_square, T_Bitmap24B image, int size)
+{
+  long cells;
+
+  h->bits = bits;
+  h->side = (1 << bits) + 1;
+  cells = (long)h->side * h->side * h->side;
+  h->weight = (double *)calloc(cells * (with_square ? 5 : 4), sizeof(double));
+  if (h->weight == NULL)
+    return 0;
+  h->red = h->weight + cells;
+  h->green = h->red + cells;
+  h->blue = h->green + cells;
+  h->square = with_square ? h->blue + cells : NULL;
+  h->image = image;
+  h->size = size;
+  // Each band reads all the pixels, but only writes in its own part of the
+  // cells: one band per thread, and only one for the small pictures.
+  h->nb_slices = HISTOGRAM_SLICES;
+  if (size >= OT_COUNT_PARALLEL_PIXELS)
+    Run_thread_bands(Color_histogram_slices, h, h->nb_slices);
+  else
+    Color_histogram_slices(h, 0, 0, h->nb_slices);
+  return 1;
+}
+
+
+// Xiaolin Wu's color quantizer (Graphics Gems vol. II, p. 126)
+// The colors are counted in a 32x32x32 histogram, which is turned in
+// cumulated moments: then the sums of any box are computed from its 8
+// corners. The boxes are cut where the sum of the variances of the two
+// halves is the smallest, and the box with the biggest variance is cut
+// next, until there are 256 boxes.
+
+/// Precision of the histogram of Wu's method
+#define WU_BITS 5
+
+/// Axis of a cut of Wu's method
+enum WU_AXIS { WU_RED, WU_GREEN, WU_BLUE };
+
+/// A box of Wu's method: the cells from (r0,g0,b0) excluded to (r1,g1,b1) included
+typedef struct
+{
+  int r0, r1;
+  int g0, g1;
+  int b0, b1;
+  int volume;
+} T_Wu_box;
+
+/// Sum of a moment in a box
+static double Wu_volume(const T_Color_histogram * h, const T_Wu_box * box, const double * m)
+{
+  return m[HISTOGRAM_INDEX(h, box->r1, box->g1, box->b1)]
+       - m[HISTOGRAM_INDEX(h, box->r1, box->g1, box->b0)]
+       - m[HISTOGRAM_INDEX(h, box->r1, box->g0, box->b1)]
+       + m[HISTOGRAM_INDEX(h, box->r1, box->g0, box->b0)]
+       - m[HISTOGRAM_INDEX(h, box->r0, box->g1, box->b1)]
+       + m[HISTOGRAM_INDEX(h, box->r0, box->g1, box->b0)]
+       + m[HISTOGRAM_INDEX(h, box->r0, box->g0, box->b1)]
+       - m[HISTOGRAM_INDEX(h, box->r0, box->g0, box->b0)];
+}
+
+/// Part of Wu_volume() which doesn't depend on the position of a cut
+static double Wu_bottom(const T_Color_histogram * h, const T_Wu_box * box, int axis, const double * m)
+{
+  switch (axis)
+  {
+    case WU_RED:
+      return - m[HISTOGRAM_INDEX(h, box->r0, box->g1, box->b1)]
+             + m[HISTOGRAM_INDEX(h, box->r0, box->g1, box->b0)]
+             + m[HISTOGRAM_INDEX(h, box->r0, box->g0, box->b1)]
+             - m[HISTOGRAM_INDEX(h, box->r0, box->g0, box->b0)];
+    case WU_GREEN:
+      return - m[HISTOGRAM_INDEX(h, box->r1, box->g0, box->b1)]
+             + m[HISTOGRAM_INDEX(h, box->r1, box->g0, box->b0)]
+             + m[HISTOGRAM_INDEX(h, box->r0, box->g0, box->b1)]
+             - m[HISTOGRAM_INDEX(h, box->r0, box->g0, box->b0)];
+    default:
+      return - m[HISTOGRAM_INDEX(h, box->r1, box->g1, box->b0)]
+             + m[HISTOGRAM_INDEX(h, box->r1, box->g0, box->b0)]
+             + m[HISTOGRAM_INDEX(h, box->r0, box->g1, box->b0)]
+             - m[HISTOGRAM_INDEX(h, box->r0, box->g0, box->b0)];
+  }
+}
+
+/// Part of Wu_volume() which depends on the position of a cut
+static double Wu_top(const T_Color_histogram * h, const T_Wu_box * box, int axis, int pos, const double * m)
+{
+  switch (axis)
+  {
+    case WU_RED:
+      return m[HISTOGRAM_INDEX(h, pos, box->g1, box->b1)]
+           - m[HISTOGRAM_INDEX(h, pos, box->g1, box->b0)]
+           - m[HISTOGRAM_INDEX(h, pos, box->g0, box->b1)]
+           + m[HISTOGRAM_INDEX(h, pos, box->g0, box->b0)];
+    case WU_GREEN:
+      return m[HISTOGRAM_INDEX(h, box->r1, pos, box->b1)]
+           - m[HISTOGRAM_INDEX(h, box->r1, pos, box->b0)]
+           - m[HISTOGRAM_INDEX(h, box->r0, pos, box->b1)]
+           + m[HISTOGRAM_INDEX(h, box->r0, pos, box->b0)];
+    default:
+      return m[HISTOGRAM_INDEX(h, box->r1, box->g1, pos)]
+           - m[HISTOGRAM_INDEX(h, box->r1, box->g0, pos)]
+           - m[HISTOGRAM_INDEX(h, box->r0, box->g1, pos)]
+           + m[HISTOGRAM_INDEX(h, box->r0, box->g0, pos)];
+  }
+}
+
+/// Weighted variance of the colors of a box
+static double Wu_variance(const T_Color_histogram * h, const T_Wu_box * box)
+{
+  double dr = Wu_volume(h, box, h->red);
+  double dg = Wu_volume(h, box, h->green);
+  double db = Wu_volume(h, box, h->blue);
+
+  return Wu_volume(h, box, h->square) - (dr*dr + dg*dg + db*db) / Wu_volume(h, box, h->weight);
+}
+
+/// Finds the best cut of a box on an axis
+/// @return the (negated) variance of the two halves, and *cut = -1 when the box can't be cut
+static double Wu_maximize(const T_Color_histogram * h, const T_Wu_box * box, int axis, int first, int last, int * cut,
+  double whole_r, double whole_g, double whole_b, double whole_w)
+{
+  double base_r = Wu_bottom(h, box, axis, h->red);
+  double base_g = Wu_bottom(h, box, axis, h->green);
+  double base_b = Wu_bottom(h, box, axis, h->blue);
+  double base_w = Wu_bottom(h, box, axis, h->weight);
+  double max = 0.0;
+  int i;
+
+  *cut = -1;
+  for (i = first; i < last; i++)
+  {
+    double half_r = base_r + Wu_top(h, box, axis, i, h->red);
+    double half_g = base_g + Wu_top(h, box, axis, i, h->green);
+    double half_b = base_b + Wu_top(h, box, axis, i, h->blue);
+    double half_w = base_w + Wu_top(h, box, axis, i, h->weight);
+    double temp;
+
+    if (half_w == 0)
+      continue; // never split into an empty box
+    temp = (half_r*half_r + half_g*half_g + half_b*half_b) / half_w;
+    half_r = whole_r - half_r;
+    half_g = whole_g - half_g;
+    half_b = whole_b - half_b;
+    half_w = whole_w - half_w;
+    if (half_w == 0)
+      continue;
+    temp += (half_r*half_r + half_g*half_g + half_b*half_b) / half_w;
+    if (temp > max)
+    {
+      max = temp;
+      *cut = i;
+    }
+  }
+  return max;
+}
+
+/// Cuts box1 in two: box1 keeps the first half, box2 gets the second one
+/// @return 0 if the box can't be cut
+static int Wu_cut(const T_Color_histogram * h, T_Wu_box * box1, T_Wu_box * box2)
+{
+  double whole_r = Wu_volume(h, box1, h->red);
+  double whole_g = Wu_volume(h, box1, h->green);
+  double whole_b = Wu_volume(h, box1, h->blue);
+  double whole_w = Wu_volume(h, box1, h->weight);
+  double max_r, max_g, max_b;
+  int cut_r, cut_g, cut_b;
+
+  max_r = Wu_maximize(h, box1, WU_RED, box1->r0 + 1, box1->r1, &cut_r, whole_r, whole_g, whole_b, whole_w);
+  max_g = Wu_maximize(h, box1, WU_GREEN, box1->g0 + 1, box1->g1, &cut_g, whole_r, whole_g, whole_b, whole_w);
+  max_b = Wu_maximize(h, box1, WU_BLUE, box1->b0 + 1, box1->b1, &cut_b, whole_r, whole_g, whole_b, whole_w);
+
+  *box2 = *box1;
+  if (max_r >= max_g && max_r >= max_b)
+  {
+    if (cut_r < 0)
+      return 0; // no cut is possible on any axis
+    box2->r0 = box1->r1 = cut_r;
+  }
+  else if (max_g >= max_r && max_g >= max_b)
+    box2->g0 = box1->g1 = cut_g;
+  else
+    box2->b0 = box1->b1 = cut_b;
+  box1->volume = (box1->r1 - box1->r0) * (box1->g1 - box1->g0) * (box1->b1 - box1->b0);
+  box2->volume = (box2->r1 - box2->r0) * (box2->g1 - box2->g0) * (box2->b1 - box2->b0);
+  return 1;
+}
+
+/// Puts a box of Wu's method in the conversion tree
+static void Wu_set_tree(CT_Tree * tc, const T_Wu_box * box, byte index)
+{
+  CT_set(tc, box->r0 << (8 - WU_BITS), box->g0 << (8 - WU_BITS), box->b0 << (8 - WU_BITS),
+         (box->r1 << (8 - WU_BITS)) - 1, (box->g1 << (8 - WU_BITS)) - 1, (box->b1 << (8 - WU_BITS)) - 1, index);
+}
+
+/// A palette entry of Wu's method, before sorting
+typedef struct
+{
+  T_Components color;
+  long lightness;
+  int box;
+} T_Wu_color;
+
+/// Compares two ::T_Wu_color for qsort(), darkest first
+static int Wu_compare_colors(const void * a, const void * b)
+{
+  const T_Wu_color * c1 = (const T_Wu_color *)a;
+  const T_Wu_color * c2 = (const T_Wu_color *)b;
+
+  if (c1->lightness != c2->lightness)
+    return c1->lightness < c2->lightness ? -1 : 1;
+  return c1->box - c2->box;
+}
+
+/// Wu's method: the palette generator of ::COLOR_REDUCTION_WU
+static CT_Tree * Wu_reduction(T_Bitmap24B image, int size, T_Components * palette, int * nb_colors)
+{
+  T_Color_histogram h;
+  T_Wu_box boxes[256];
+  double variance[256];
+  T_Wu_color colors[256];
+  CT_Tree * tc;
+  int nb_boxes = 256;
+  int next = 0;
+  int i, r, g, b;
+
+  tc = CT_new();
+  if (tc == NULL)
+    return NULL;
+  if (!Color_histogram_count(&h, WU_BITS, 1, image, size))
+  {
+    CT_delete(tc);
+    return NULL;
+  }
+
+  // Turn the histogram into cumulated moments
+  for (r = 1; r < h.side; r++)
+  {
+    double area_w[(1 << WU_BITS) + 1], area_r[(1 << WU_BITS) + 1], area_g[(1 << WU_BITS) + 1];
+    double area_b[(1 << WU_BITS) + 1], area_2[(1 << WU_BITS) + 1];
+
+    memset(area_w, 0, sizeof(area_w));
+    memset(area_r, 0, sizeof(area_r));
+    memset(area_g, 0, sizeof(area_g));
+    memset(area_b, 0, sizeof(area_b));
+    memset(area_2, 0, sizeof(area_2));
+    for (g = 1; g < h.side; g++)
+    {
+      double line_w = 0, line_r = 0, line_g = 0, line_b = 0, line_2 = 0;
+
+      for (b = 1; b < h.side; b++)
+      {
+        long index = HISTOGRAM_INDEX(&h, r, g, b);
+        long previous = HISTOGRAM_INDEX(&h, r - 1, g, b);
+
+        line_w += h.weight[index];
+        line_r += h.red[index];
+        line_g += h.green[index];
+        line_b += h.blue[index];
+        line_2 += h.square[index];
+        area_w[b] += line_w;
+        area_r[b] += line_r;
+        area_g[b] += line_g;
+        area_b[b] += line_b;
+        area_2[b] += line_2;
+        h.weight[index] = h.weight[previous] + area_w[b];
+        h.red[index] = h.red[previous] + area_r[b];
+        h.green[index] = h.green[previous] + area_g[b];
+        h.blue[index] = h.blue[previous] + area_b[b];
+        h.square[index] = h.square[previous] + area_2[b];
+      }
+    }
+  }
+
+  boxes[0].r0 = boxes[0].g0 = boxes[0].b0 = 0;
+  boxes[0].r1 = boxes[0].g1 = boxes[0].b1 = h.side - 1;
+  variance[0] = 0;
+  for (i = 1; i < nb_boxes; i++)
+  {
+    T_Wu_box parent = boxes[next];
+    double max;
+    int k;
+
+    if (Wu_cut(&h, &boxes[next], &boxes[i]))
+    {
+      // The cut box is in the tree before its halves, with a NULL index
+      Wu_set_tree(tc, &parent, 0);
+      variance[next] = boxes[next].volume > 1 ? Wu_variance(&h, &boxes[next]) : 0.0;
+      variance[i] = boxes[i].volume > 1 ? Wu_variance(&h, &boxes[i]) : 0.0;
+    }
+    else
+    {
+      variance[next] = 0.0; // don't try to cut this one again
+      i--;
+    }
+    next = 0;
+    max = variance[0];
+    for (k = 1; k <= i; k++)
+      if (variance[k] > max)
+      {
+        max = variance[k];
+        next = k;
+      }
+    if (max <= 0.0)
+    {
+      nb_boxes = i + 1;
+      break;
+    }
+  }
+
+  // Each box gives the mean of its colors
+  for (i = 0; i < nb_boxes; i++)
+  {
+    double weight = Wu_volume(&h, &boxes[i], h.weight);
+
+    if (weight > 0)
+    {
+      colors[i].color.R = (byte)(Wu_volume(&h, &boxes[i], h.red) / weight + 0.5);
+      colors[i].color.G = (byte)(Wu_volume(&h, &boxes[i], h.green) / weight + 0.5);
+      colors[i].color.B = (byte)(Wu_volume(&h, &boxes[i], h.blue) / weight + 0.5);
+    }
+    else
+      colors[i].color.R = colors[i].color.G = colors[i].color.B = 0;
+    colors[i].lightness = Perceptual_lightness(&colors[i].color);
+    colors[i].box = i;
+  }
+  free(h.weight);
+
+  qsort(colors, nb_boxes, sizeof(T_Wu_color), Wu_compare_colors);
+  for (i = 0; i < nb_boxes; i++)
+  {
+    palette[i] = colors[i].color;
+    Wu_set_tree(tc, &boxes[colors[i].box], (byte)i);
+  }
+  *nb_colors = nb_boxes;
+  return tc;
+}
+
+
+/// A palette generator: chooses the colors and builds the conversion tree
+typedef CT_Tree * (* Func_color_reduction)(T_Bitmap24B image, int size, T_Components * palette, int * nb_colors);
+
+/// Palette generators, by ::COLOR_REDUCTION_METHOD
+static const Func_color_reduction Color_reduction_methods[COLOR_REDUCTION_METHODS] =
+{
+  Median_cut_reduction,
+  Wu_reduction,
+};
+
+
+// k-means refinement
+// The pixels are summed in a 64x64x64 histogram. Each cell gives the mean
+// color of its pixels, with their count as weight. Each pass gives each
+// cell the nearest palette entry, then moves each palette entry to the mean
+// of its cells: this can only lower the total error.
+
+/// Precision of the cells of the k-means refinement
+#define KMEANS_BITS 6
+/// Number of cells of the histogram of the k-means refinement
+#define KMEANS_CELLS (((1l << KMEANS_BITS) + 1) * ((1l << KMEANS_BITS) + 1) * ((1l << KMEANS_BITS) + 1))
+
+/// A non-empty cell of the k-means refinement
+typedef struct
+{
+  byte R, G, B;  ///< Mean color of the pixels
+  byte Index;    ///< Nearest palette entry
+  double Count;  ///< Number of pixels
+  long Cell;     ///< Index in the histogram
+} T_KMeans_color;
+
+/// Work shared by the bands of a k-means pass
+typedef struct
+{
+  T_KMeans_color * colors;
+  const T_Components * palette;
+  int nb_colors;
+  double (* sums)[256][4]; ///< For each band, R, G, B and count of the pixels of each palette entry
+  int changes[WORKERS_MAX_BANDS]; ///< For each band, number of cells which changed of palette entry
+} T_KMeans;
+
+/// Nearest palette entry of a color
+static byte Nearest_palette_color(const T_Components * palette, int nb_colors, int r, int g, int b)
+{
+  long best_distance = 3*256*256;
+  int best = 0;
+  int i;
+
+  for (i = 0; i < nb_colors; i++)
+  {
+    long distance = (palette[i].R - r) * (palette[i].R - r);
+
+    if (distance >= best_distance)
+      continue;
+    distance += (palette[i].G - g) * (palette[i].G - g);
+    if (distance >= best_distance)
+      continue;
+    distance += (palette[i].B - b) * (palette[i].B - b);
+    if (distance < best_distance)
+    {
+      best_distance = distance;
+      best = i;
+    }
+  }
+  return (byte)best;
+}
+
+/// Job for Run_rows_in_parallel(): gives a palette entry to cells, and sums them by entry
+static void KMeans_assign_rows(void * data, int band, int first_row, int end_row)
+{
+  T_KMeans * km = (T_KMeans *)data;
+  double (* sums)[4] = km->sums[band];
+  int changes = 0;
+  int i;
+
+  memset(sums, 0, 256 * sizeof(sums[0]));
+  for (i = first_row; i < end_row; i++)
+  {
+    T_KMeans_color * c = km->colors + i;
+    byte index = Nearest_palette_color(km->palette, km->nb_colors, c->R, c->G, c->B);
+
+    if (index != c->Index)
+    {
+      c->Index = index;
+      changes++;
+    }
+    sums[index][0] += c->R * c->Count;
+    sums[index][1] += c->G * c->Count;
+    sums[index][2] += c->B * c->Count;
+    sums[index][3] += c->Count;
+  }
+  km->changes[band] = changes;
+}
+
+/// Work shared by the bands of KMeans_map_rows()
+typedef struct
+{
+  T_Bitmap256 dest;
+  T_Bitmap24B source;
+  int width;
+  const T_Color_histogram * h;
+  const byte * map; ///< Palette entry of each cell of the histogram
+} T_KMeans_map;
+
+/// Job for Run_rows_in_parallel(): converts rows with the palette entries of the cells
+static void KMeans_map_rows(void * data, int band, int first_row, int end_row)
+{
+  T_KMeans_map * m = (T_KMeans_map *)data;
+  T_Bitmap24B current = m->source + (long)first_row * m->width;
+  T_Bitmap256 d = m->dest + (long)first_row * m->width;
+  long count = (long)(end_row - first_row) * m->width;
+  int shift = 8 - m->h->bits;
+  (void)band; // unused
+
+  for (; count > 0; count--, current++, d++)
+    *d = m->map[HISTOGRAM_INDEX(m->h, (current->R >> shift) + 1, (current->G >> shift) + 1, (current->B >> shift) + 1)];
+}
+
 /**
- * Converts a 24 bit picture to 256 color (color reduction)
- * @param[out] dest The converted 8bpp picture
- * @param[in] source the 24bpp picture
- * @param[in] width the width of the picture
- * @param[in] height the height of the picture
- * @param[out] palette the palette of the converted 8bpp picture
- * @return 0 for OK, 1 for error
+ * Improves a palette with k-means passes, then converts the picture with it.
+ *
+ * The results are the same whatever the number of threads.
+ * @return 0 if out of memory: then the palette and dest are unchanged
  */
-int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette)
+static int Refine_palette(T_Bitmap256 dest, T_Bitmap24B source, int width, int height,
+  T_Components * palette, int nb_colors, const T_Color_reduction * settings)
 {
-#if !(defined(__GP2X__) || defined(__gp2x__) || defined(__WIZ__) || defined(__CAANOO__))
-  CT_Tree* table; // table de conversion
-  int                ip;    // index de précision pour la conversion
-#endif
+  T_Color_histogram h;
+  T_KMeans km;
+  T_KMeans_map m;
+  byte * map;
+  long cell;
+  int nb_cells = 0;
+  int nb_bands;
+  int pass, i, band;
+  dword start = GFX2_GetTicks();
+
+  if (!Color_histogram_count(&h, KMEANS_BITS, 0, source, width * height))
+    return 0;
+  for (cell = 0; cell < KMEANS_CELLS; cell++)
+    if (h.weight[cell] > 0)
+      nb_cells++;
+  km.colors = (T_KMeans_color *)malloc(nb_cells * sizeof(T_KMeans_color));
+  km.sums = (double (*)[256][4])malloc(WORKERS_MAX_BANDS * sizeof(km.sums[0]));
+  map = (byte *)malloc(KMEANS_CELLS);
+  if (km.colors == NULL || km.sums == NULL || map == NULL)
+  {
+    free(km.colors);
+    free(km.sums);
+    free(map);
+    free(h.weight);
+    return 0;
+  }
+  for (cell = 0, i = 0; cell < KMEANS_CELLS; cell++)
+  {
+    double count = h.weight[cell];
 
-  if (Try_Convert_to_256_Without_Loss(dest, source, width, height, palette) == 0)
+    if (count > 0)
+    {
+      km.colors[i].R = (byte)(h.red[cell] / count + 0.5);
+      km.colors[i].G = (byte)(h.green[cell] / count + 0.5);
+      km.colors[i].B = (byte)(h.blue[cell] / count + 0.5);
+      km.colors[i].Index = 0;
+      km.colors[i].Count = count;
+      km.colors[i].Cell = cell;
+      i++;
+    }
+  }
+  km.palette = palette;
+  km.nb_colors = nb_colors;
+
+  // Rows_bands() gives the same number of bands for the same job
+  nb_bands = Rows_bands(nb_cells);
+  for (pass = 0; ; pass++)
+  {
+    int changes = 0;
+
+    Run_rows_in_parallel(KMeans_assign_rows, &km, nb_cells);
+    for (band = 0; band < nb_bands; band++)
+      changes += km.changes[band];
+    if (pass >= settings->Refine_passes || changes == 0
+        || (settings->Refine_time > 0 && GFX2_GetTicks() - start >= (dword)settings->Refine_time))
+      break;
+    // Move each palette entry to the mean of its pixels
+    for (i = 0; i < nb_colors; i++)
+    {
+      double sum[4] = {0, 0, 0, 0};
+
+      // The sums are integer values: their order doesn't change the result
+      for (band = 0; band < nb_bands; band++)
+      {
+        sum[0] += km.sums[band][i][0];
+        sum[1] += km.sums[band][i][1];
+        sum[2] += km.sums[band][i][2];
+        sum[3] += km.sums[band][i][3];
+      }
+      if (sum[3] > 0)
+      {
+        palette[i].R = (byte)(sum[0] / sum[3] + 0.5);
+        palette[i].G = (byte)(sum[1] / sum[3] + 0.5);
+        palette[i].B = (byte)(sum[2] / sum[3] + 0.5);
+      }
+    }
+  }
+  GFX2_Log(GFX2_DEBUG, "Refine_palette() %d colors, %d cells, %d passes in %ums\n",
+           nb_colors, nb_cells, pass, GFX2_GetTicks() - start);
+
+  for (i = 0; i < nb_cells; i++)
+    map[km.colors[i].Cell] = km.colors[i].Index;
+  m.dest = dest;
+  m.source = source;
+  m.width = width;
+  m.h = &h;
+  m.map = map;
+  Run_rows_in_parallel(KMeans_map_rows, &m, height);
+
+  free(km.colors);
+  free(km.sums);
+  free(map);
+  free(h.weight);
+  return 1;
+}
+
+
+// Dithering
+// All the methods look the colors up in a grid of the RGB cube, which
+// gives the nearest palette entry of each cell.
+// The ordered dithering adds a threshold, from a matrix repeated over the
+// picture, to each pixel. The error diffusion gives the error of each pixel
+// to the next ones: the picture is cut in blocks of columns, slanted so each
+// pixel only gets errors from its own block or the blocks on its left. The
+// bands of rows work on waves of blocks: band b works on block w-2b during
+// wave w, so a band always runs two blocks behind the band above it. With a
+// single block between them, the last row of a band and the first row of the
+// band below would give errors to the same pixels during the same wave.
+
+/// Precision of the palette lookup grid of the dithering
+#define DITHER_GRID_BITS 6
+/// Index of a color in the palette lookup grid of the dithering
+#define DITHER_GRID_INDEX(r,g,b) ((((r) >> (8 - DITHER_GRID_BITS)) << (2 * DITHER_GRID_BITS)) \
+                                 | (((g) >> (8 - DITHER_GRID_BITS)) << DITHER_GRID_BITS) \
+                                 | ((b) >> (8 - DITHER_GRID_BITS)))
+
+/// Size of the matrix of the ordered dithering of ::DITHERING_BAYER
+#define BAYER_BITS 3
+/// Size of the matrix of the ordered dithering of ::DITHERING_BLUE_NOISE
+#define BLUE_NOISE_BITS 6
+
+/// Number of columns of the blocks of the error diffusion
+#define DIFFUSION_BLOCK 64
+/// Number of columns of the errors kept for each row. It must be more than the columns of 3 blocks and the width of the kernel.
+#define DIFFUSION_WINDOW 256
+/// Sum of the weights of an error diffusion kernel
+#define DIFFUSION_DIVISOR 32
+
+/// An entry of an error diffusion kernel: the pixel at (x+dx, y+dy) gets weight/::DIFFUSION_DIVISOR of the error
+typedef struct
+{
+  int dx;
+  int dy;
+  int weight;
+} T_Diffusion;
+
+/// Floyd-Steinberg, ends with a 0 weight
+static const T_Diffusion Floyd_Steinberg_kernel[] =
+{
+  {1, 0, 14}, {-1, 1, 6}, {0, 1, 10}, {1, 1, 2}, {0, 0, 0}
+};
+
+/// Sierra (three rows), ends with a 0 weight
+static const T_Diffusion Sierra_kernel[] =
+{
+  {1, 0, 5}, {2, 0, 3},
+  {-2, 1, 2}, {-1, 1, 4}, {0, 1, 5}, {1, 1, 4}, {2, 1, 2},
+  {-1, 2, 2}, {0, 2, 3}, {1, 2, 2}, {0, 0, 0}
+};
+
+/// Thresholds of ::DITHERING_BLUE_NOISE, made on first use
+static byte Blue_noise[1 << (2 * BLUE_NOISE_BITS)];
+static int Blue_noise_ready = 0;
+
+/// Work shared by the bands of Dither_24b_bitmap_to_256()
+typedef struct
+{
+  T_Bitmap256 dest;
+  T_Bitmap24B source;
+  int width;
+  int height;
+  const T_Components * palette;
+  int nb_colors;
+  byte * grid;                  ///< Nearest palette entry of each cell
+  // Ordered dithering
+  const byte * thresholds;      ///< Matrix of thresholds, from 0 to 255
+  int matrix_bits;              ///< The matrix has (1 << matrix_bits) columns and rows
+  int spread;                   ///< Amplitude of the thresholds
+  // Error diffusion
+  const T_Diffusion * kernel;
+  int skew;                     ///< Each row of a block starts this number of columns before the row above
+  int nb_blocks;
+  int wave;
+  short * errors;               ///< For each row, R, G and B errors of ::DIFFUSION_WINDOW columns, multiplied by ::DIFFUSION_DIVISOR
+} T_Dithering;
+
+/// Job for Run_rows_in_parallel(): fills the palette lookup grid, by blocks of 4x4x4 cells.
+///
+/// Only the palette entries which can be the nearest one of a point of the
+/// block are searched for its cells: those which are not further than the
+/// furthest point of the nearest entry. The result is the same as searching
+/// the whole palette.
+static void Dither_grid_rows(void * data, int band, int first_row, int end_row)
+{
+  T_Dithering * d = (T_Dithering *)data;
+  const int shift = 8 - DITHER_GRID_BITS;
+  const int half = 1 << (shift - 1);
+  T_Components candidates[256];
+  byte candidates_index[256];
+  int br, bg, bb, r, g, b, i;
+  (void)band; // unused
+
+  for (br = first_row; br < end_row; br++)
+    for (bg = 0; bg < (1 << (DITHER_GRID_BITS - 2)); bg++)
+      for (bb = 0; bb < (1 << (DITHER_GRID_BITS - 2)); bb++)
+      {
+        // Centers of the first and last cells of the block
+        int low[3] = { (br << (shift + 2)) + half, (bg << (shift + 2)) + half, (bb << (shift + 2)) + half };
+        int nb_candidates = 0;
+        long nearest_max = 3*256*256;
+        long min_distance[256];
+
+        for (i = 0; i < d->nb_colors; i++)
+        {
+          const byte component[3] = { d->palette[i].R, d->palette[i].G, d->palette[i].B };
+          long min = 0, max = 0;
+          int c;
+
+          for (c = 0; c < 3; c++)
+          {
+            int high = low[c] + (3 << shift);
+            int near = component[c] < low[c] ? low[c] - component[c] : (component[c] > high ? component[c] - high : 0);
+            int far = component[c] - low[c] > high - component[c] ? component[c] - low[c] : high - component[c];
+            min += near * near;
+            max += far * far;
+          }
+          min_distance[i] = min;
+          if (max < nearest_max)
+            nearest_max = max;
+        }
+        for (i = 0; i < d->nb_colors; i++)
+          if (min_distance[i] <= nearest_max)
+          {
+            candidates[nb_candidates] = d->palette[i];
+            candidates_index[nb_candidates++] = (byte)i;
+          }
+        for (r = br * 4; r < br * 4 + 4; r++)
+          for (g = bg * 4; g < bg * 4 + 4; g++)
+            for (b = bb * 4; b < bb * 4 + 4; b++)
+              d->grid[(((r << DITHER_GRID_BITS) | g) << DITHER_GRID_BITS) | b] = candidates_index[
+                Nearest_palette_color(candidates, nb_candidates, (r << shift) + half, (g << shift) + half, (b << shift) + half)];
+      }
+}
+
+/// Makes a Bayer matrix of thresholds
+static void Make_Bayer_matrix(byte * thresholds, int bits)
+{
+  int x, y, bit;
+
+  for (y = 0; y < (1 << bits); y++)
+    for (x = 0; x < (1 << bits); x++)
+    {
+      int rank = 0;
+
+      // Interleave the bits of x^y and y, in reverse order
+      for (bit = 0; bit < bits; bit++)
+        rank = (rank << 2) | ((((x ^ y) >> bit) & 1) << 1) | ((y >> bit) & 1);
+      thresholds[(y << bits) | x] = (byte)((rank * 256 + 128) >> (2 * bits));
+    }
+}
+
+/// Distance after which the energy of a point of the blue noise pattern is negligible
+#define BLUE_NOISE_RADIUS 6
+
+/// Adds (sign 1) or removes (sign -1) a point of the blue noise pattern, and updates the energy of the points around
+static void Blue_noise_energy(float * energy, const float * kernel, int point, int sign)
+{
+  const int mask = (1 << BLUE_NOISE_BITS) - 1;
+  int px = point & mask;
+  int py = point >> BLUE_NOISE_BITS;
+  int dx, dy;
+
+  for (dy = -BLUE_NOISE_RADIUS; dy <= BLUE_NOISE_RADIUS; dy++)
+    for (dx = -BLUE_NOISE_RADIUS; dx <= BLUE_NOISE_RADIUS; dx++)
+      energy[(((py + dy) & mask) << BLUE_NOISE_BITS) | ((px + dx) & mask)] +=
+        sign * kernel[((dy & mask) << BLUE_NOISE_BITS) | (dx & mask)];
+}
+
+/// Point of the pattern (value 1) with the highest energy, or the hole (value 0) with the lowest one
+static int Blue_noise_find(const float * energy, const byte * pattern, int value)
+{
+  int best = -1;
+  int i;
+
+  for (i = 0; i < (1 << (2 * BLUE_NOISE_BITS)); i++)
+    if (pattern[i] == value && (best < 0 || (value ? energy[i] > energy[best] : energy[i] < energy[best])))
+      best = i;
+  return best;
+}
+
+/**
+ * Makes the thresholds of ::DITHERING_BLUE_NOISE, with Ulichney's
+ * void-and-cluster method.
+ * @return 0 if out of memory
+ */
+static int Make_blue_noise(void)
+{
+  const int size = 1 << BLUE_NOISE_BITS;
+  const int n = size * size;
+  float * kernel;
+  float * energy;
+  float * initial_energy;
+  byte * pattern;
+  byte * initial_pattern;
+  int * rank;
+  int nb_points = n / 10;
+  dword seed = 1;
+  int i, x, y;
+
+  kernel = (float *)malloc(3 * n * sizeof(float));
+  pattern = (byte *)malloc(2 * n);
+  rank = (int *)malloc(n * sizeof(int));
+  if (kernel == NULL || pattern == NULL || rank == NULL)
+  {
+    free(kernel);
+    free(pattern);
+    free(rank);
     return 0;
+  }
+  energy = kernel + n;
+  initial_energy = energy + n;
+  initial_pattern = pattern + n;
 
-  #if defined(__GP2X__) || defined(__gp2x__) || defined(__WIZ__) || defined(__CAANOO__)
-  return Convert_24b_bitmap_to_256_fast(dest, source, width, height, palette);  
+  // Gaussian filter, on a torus
+  for (y = 0; y < size; y++)
+    for (x = 0; x < size; x++)
+    {
+      int dx = x < size / 2 ? x : size - x;
+      int dy = y < size / 2 ? y : size - y;
+      kernel[y * size + x] = (float)exp(-(dx * dx + dy * dy) / (2 * 1.5 * 1.5));
+    }
 
-  #else
-  // On essaye d'obtenir une table de conversion qui loge en mémoire, avec la
-  // meilleure précision possible
-  for (ip=0;ip<(10*3);ip+=3)
+  // Random points, then move the tightest cluster to the largest void until it's stable
+  memset(pattern, 0, n);
+  memset(energy, 0, n * sizeof(float));
+  for (i = 0; i < nb_points; )
   {
-    table = Optimize_palette(source,width*height,palette,
-                             precision_24b[ip], precision_24b[ip+1], precision_24b[ip+2]);
-    if (table != NULL) {
+    int point;
+
+    seed = seed * 1103515245 + 12345;
+    point = (seed >> 8) % n;
+    if (pattern[point])
+      continue;
+    pattern[point] = 1;
+    Blue_noise_energy(energy, kernel, point, 1);
+    i++;
+  }
+  for (i = 0; i < n; i++)
+  {
+    int cluster = Blue_noise_find(energy, pattern, 1);
+    int hole;
+
+    pattern[cluster] = 0;
+    Blue_noise_energy(energy, kernel, cluster, -1);
+    hole = Blue_noise_find(energy, pattern, 0);
+    pattern[hole] = 1;
+    Blue_noise_energy(energy, kernel, hole, 1);
+    if (hole == cluster)
       break;
+  }
+  memcpy(initial_pattern, pattern, n);
+  memcpy(initial_energy, energy, n * sizeof(float));
+
+  // The points of the pattern are ranked by removing the tightest clusters,
+  for (i = nb_points - 1; i >= 0; i--)
+  {
+    int cluster = Blue_noise_find(energy, pattern, 1);
+
+    pattern[cluster] = 0;
+    Blue_noise_energy(energy, kernel, cluster, -1);
+    rank[cluster] = i;
+  }
+  // then the others by filling the largest voids
+  memcpy(pattern, initial_pattern, n);
+  memcpy(energy, initial_energy, n * sizeof(float));
+  for (i = nb_points; i < n; i++)
+  {
+    int hole = Blue_noise_find(energy, pattern, 0);
+
+    pattern[hole] = 1;
+    Blue_noise_energy(energy, kernel, hole, 1);
+    rank[hole] = i;
+  }
+  for (i = 0; i < n; i++)
+    Blue_noise[i] = (byte)((rank[i] * 256 + 128) / n);
+
+  free(kernel);
+  free(pattern);
+  free(rank);
+  return 1;
+}
+
+/// Mean distance from each palette entry to the nearest other one: the amplitude of the ordered dithering
+static int Palette_spread(const T_Components * palette, int nb_colors)
+{
+  double sum = 0;
+  int i, j;
+
+  for (i = 0; i < nb_colors; i++)
+  {
+    long nearest = 3*256*256;
+
+    for (j = 0; j < nb_colors; j++)
+    {
+      long distance = (palette[i].R - palette[j].R) * (palette[i].R - palette[j].R)
+                    + (palette[i].G - palette[j].G) * (palette[i].G - palette[j].G)
+                    + (palette[i].B - palette[j].B) * (palette[i].B - palette[j].B);
+      if (j != i && distance < nearest)
+        nearest = distance;
     }
+    sum += sqrt((double)nearest);
   }
+  return nb_colors > 1 ? (int)(sum / nb_colors + 0.5) : 0;
+}
+
+/// Adds a threshold to a component, with proper ceiling and flooring
+static int Dither_threshold(int value, int threshold, int spread)
+{
+  return Modified_value(value, (2 * threshold - 255) * spread / 512);
+}
+
+/// Job for Run_rows_in_parallel(): converts rows with ordered dithering
+static void Dither_ordered_rows(void * data, int band, int first_row, int end_row)
+{
+  T_Dithering * d = (T_Dithering *)data;
+  const int mask = (1 << d->matrix_bits) - 1;
+  int x, y;
+  (void)band; // unused
 
-  if (table!=NULL)
+  for (y = first_row; y < end_row; y++)
   {
-    //Convert_24b_bitmap_to_256_Floyd_Steinberg(dest,source,width,height,palette,table);
-    Convert_24b_bitmap_to_256_nearest_neighbor(dest,source,width,height,palette,table);
-    CT_delete(table);
+    T_Bitmap24B current = d->source + (long)y * d->width;
+    T_Bitmap256 dest = d->dest + (long)y * d->width;
+    const byte * thresholds = d->thresholds + ((y & mask) << d->matrix_bits);
+
+    for (x = 0; x < d->width; x++, current++)
+    {
+      int threshold = thresholds[x & mask];
+      int r = Dither_threshold(current->R, threshold, d->spread);
+      // The same threshold for the 3 components, so gray stays gray
+      int g = Dither_threshold(current->G, threshold, d->spread);
+      int b = Dither_threshold(current->B, threshold, d->spread);
+
+      dest[x] = d->grid[DITHER_GRID_INDEX(r, g, b)];
+    }
+  }
+}
+
+/// Divides an error by ::DIFFUSION_DIVISOR, rounding to the nearest integer
+static int Diffusion_error(int error)
+{
+  if (error >= 0)
+    return (error + DIFFUSION_DIVISOR / 2) / DIFFUSION_DIVISOR;
+  return -((-error + DIFFUSION_DIVISOR / 2) / DIFFUSION_DIVISOR);
+}
+
+/// Job for Run_rows_in_parallel(): converts the rows of a block with error diffusion
+static void Dither_diffusion_rows(void * data, int band, int first_row, int end_row)
+{
+  T_Dithering * d = (T_Dithering *)data;
+  int block = d->wave - 2 * band;
+  int y;
+
+  if (block < 0 || block >= d->nb_blocks)
+    return;
+  for (y = first_row; y < end_row; y++)
+  {
+    short * errors = d->errors + (long)y * 3 * DIFFUSION_WINDOW;
+    int x = block * DIFFUSION_BLOCK - d->skew * y;
+    int end = x + DIFFUSION_BLOCK;
+
+    if (x < 0)
+      x = 0;
+    if (end > d->width)
+      end = d->width;
+    for (; x < end; x++)
+    {
+      T_Bitmap24B current = d->source + (long)y * d->width + x;
+      int i = x & (DIFFUSION_WINDOW - 1);
+      int r = Modified_value(current->R, Diffusion_error(errors[i]));
+      int g = Modified_value(current->G, Diffusion_error(errors[DIFFUSION_WINDOW + i]));
+      int b = Modified_value(current->B, Diffusion_error(errors[2 * DIFFUSION_WINDOW + i]));
+      byte index = d->grid[DITHER_GRID_INDEX(r, g, b)];
+      const T_Diffusion * k;
+
+      // The column is free for the columns DIFFUSION_WINDOW further on the right
+      errors[i] = errors[DIFFUSION_WINDOW + i] = errors[2 * DIFFUSION_WINDOW + i] = 0;
+      d->dest[(long)y * d->width + x] = index;
+      r -= d->palette[index].R;
+      g -= d->palette[index].G;
+      b -= d->palette[index].B;
+      for (k = d->kernel; k->weight != 0; k++)
+      {
+        short * target;
+        int j;
+
+        if (x + k->dx < 0 || x + k->dx >= d->width || y + k->dy >= d->height)
+          continue;
+        target = d->errors + (long)(y + k->dy) * 3 * DIFFUSION_WINDOW;
+        j = (x + k->dx) & (DIFFUSION_WINDOW - 1);
+        target[j] += r * k->weight;
+        target[DIFFUSION_WINDOW + j] += g * k->weight;
+        target[2 * DIFFUSION_WINDOW + j] += b * k->weight;
+      }
+    }
+  }
+}
+
+/**
+ * Converts a 24b picture to a given palette, with dithering.
+ *
+ * The results are the same whatever the number of threads.
+ * @param method one of ::DITHERING_METHOD, but ::DITHERING_NONE
+ * @return 0 if out of memory
+ */
+static int Dither_24b_bitmap_to_256(T_Bitmap256 dest, T_Bitmap24B source, int width, int height,
+  const T_Components * palette, int nb_colors, int method)
+{
+  T_Dithering d;
+  byte bayer[1 << (2 * BAYER_BITS)];
+  dword start = GFX2_GetTicks();
+
+  d.dest = dest;
+  d.source = source;
+  d.width = width;
+  d.height = height;
+  d.palette = palette;
+  d.nb_colors = nb_colors;
+  d.grid = (byte *)malloc(1 << (3 * DITHER_GRID_BITS));
+  if (d.grid == NULL)
     return 0;
+  Run_rows_in_parallel(Dither_grid_rows, &d, 1 << (DITHER_GRID_BITS - 2));
+
+  if (method == DITHERING_FLOYD_STEINBERG || method == DITHERING_SIERRA)
+  {
+    const T_Diffusion * k;
+    int nb_waves;
+
+    d.kernel = method == DITHERING_SIERRA ? Sierra_kernel : Floyd_Steinberg_kernel;
+    // A pixel must not give errors to a block on its left
+    d.skew = 0;
+    for (k = d.kernel; k->weight != 0; k++)
+      if (k->dy > 0 && (-k->dx + k->dy - 1) / k->dy > d.skew)
+        d.skew = (-k->dx + k->dy - 1) / k->dy;
+    d.nb_blocks = (width - 1 + d.skew * (height - 1)) / DIFFUSION_BLOCK + 1;
+    d.errors = (short *)calloc((size_t)height * 3 * DIFFUSION_WINDOW, sizeof(short));
+    if (d.errors == NULL)
+    {
+      free(d.grid);
+      return 0;
+    }
+    // Rows_bands() gives the same number of bands for the same job
+    nb_waves = d.nb_blocks + 2 * (Rows_bands(height) - 1);
+    for (d.wave = 0; d.wave < nb_waves; d.wave++)
+      Run_rows_in_parallel(Dither_diffusion_rows, &d, height);
+    free(d.errors);
   }
   else
+  {
+    if (method == DITHERING_BLUE_NOISE && (Blue_noise_ready || (Blue_noise_ready = Make_blue_noise())))
+    {
+      d.thresholds = Blue_noise;
+      d.matrix_bits = BLUE_NOISE_BITS;
+    }
+    else
+    {
+      Make_Bayer_matrix(bayer, BAYER_BITS);
+      d.thresholds = bayer;
+      d.matrix_bits = BAYER_BITS;
+    }
+    d.spread = Palette_spread(palette, nb_colors);
+    Run_rows_in_parallel(Dither_ordered_rows, &d, height);
+  }
+  free(d.grid);
+  GFX2_Log(GFX2_DEBUG, "Dither_24b_bitmap_to_256() method %d, %dx%d in %ums\n",
+           method, width, height, GFX2_GetTicks() - start);
+  return 1;
+}
+
+
+/**
+ * Converts a 24 bit picture to 256 color (color reduction), with the
+ * method chosen in the settings
+ * @param[out] dest The converted 8bpp picture
+ * @param[in] source the 24bpp picture
+ * @param[in] width the width of the picture
+ * @param[in] height the height of the picture
+ * @param[out] palette the palette of the converted 8bpp picture
+ * @param[in] settings the color reduction and dithering methods
+ * @return 0 for OK, 1 for error
+ */
+int Reduce_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,const T_Color_reduction * settings)
+{
+  CT_Tree* table; // table de conversion
+  int nb_colors = 256;
+  int method = settings->Method;
+  int refined;
+
+  if (Try_Convert_to_256_Without_Loss(dest, source, width, height, palette) == 0)
+    return 0;
+
+  if (method < 0 || method >= COLOR_REDUCTION_METHODS)
+    method = COLOR_REDUCTION_MEDIAN_CUT;
+  table = Color_reduction_methods[method](source, width*height, palette, &nb_colors);
+  if (table == NULL)
     return 1;
 
-  #endif
+  // The refinement converts the picture, in case the dithering fails
+  refined = settings->Refine_passes > 0
+      && Refine_palette(dest, source, width, height, palette, nb_colors, settings);
+  if ((settings->Dithering <= DITHERING_NONE || settings->Dithering >= DITHERING_METHODS
+       || !Dither_24b_bitmap_to_256(dest, source, width, height, palette, nb_colors, settings->Dithering))
+      && !refined)
+    Convert_24b_bitmap_to_256_nearest_neighbor(dest,source,width,height,palette,table);
+  CT_delete(table);
+  return 0;
+}
+
+/**
+ * Converts a 24 bit picture to 256 color (color reduction), with the
+ * method of the configuration
+ * @param[out] dest The converted 8bpp picture
+ * @param[in] source the 24bpp picture
+ * @param[in] width the width of the picture
+ * @param[in] height the height of the picture
+ * @param[out] palette the palette of the converted 8bpp picture
+ * @return 0 for OK, 1 for error
+ */
+int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette)
+{
+#if defined(__GP2X__) || defined(__gp2x__) || defined(__WIZ__) || defined(__CAANOO__)
+  if (Try_Convert_to_256_Without_Loss(dest, source, width, height, palette) == 0)
+    return 0;
+
+  return Convert_24b_bitmap_to_256_fast(dest, source, width, height, palette);
+#else
+  T_Color_reduction settings;
+
+  settings.Method = Config.Color_reduction;
+  settings.Refine_passes = Config.Color_reduction_passes;
+  settings.Refine_time = Config.Color_reduction_time;
+  settings.Dithering = Config.Color_reduction_dithering;
+  return Reduce_24b_bitmap_to_256(dest, source, width, height, palette, &settings);
+#endif
 }
 
 
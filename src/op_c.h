@@ -39,12 +39,28 @@ typedef byte * T_Bitmap256;
 
 ///////////////////////////////////////// Définition d'une table d'occurences
 
+/**
+ * A color of an occurrence table, and its number of pixels.
+ */
+typedef struct
+{
+  dword color; ///< Components at the precision of the table, packed like (r<<dec_r) | (g<<dec_g) | (b<<dec_b)
+  int count;   ///< Number of pixels, 0 for an unused entry
+} T_Occurrence;
+
 /**
  * Occurence table.
  *
  * This table is used to count the occurrence of an (RGB) pixel value in the
  * source 24bit image. These count are then used by the median cut algorithm to
  * decide which cluster to split.
+ *
+ * It is an open-addressed hash table of the colors, which grows with the
+ * number of different colors, so even the full 8 bits precision only takes
+ * memory for the colors actually used. When the hash table would hold more
+ * than a sixteenth of the possible colors, the table counts each color
+ * directly instead: 4 bytes for each possible color, in a row of greens and
+ * blues for each red.
  */
 typedef struct
 {
@@ -64,7 +80,16 @@ typedef struct
   int red_g; // Coefficient réducteur de traduction d'une couleur verte (= 8-nbb_g)
   int red_b; // Coefficient réducteur de traduction d'une couleur bleue (= 8-nbb_b)
 
-  int * table;
+  T_Occurrence * table; ///< Hash table of the colors, with linear probing, NULL when the table counts each color directly
+  int size;             ///< Number of entries of the hash table, a power of 2
+  int ** counts;        ///< For each red, the number of pixels of each green and blue; NULL while the table uses a hash table
+  int r_min;            ///< The table only holds the colors which red is in [r_min, r_end)
+  int r_end;
+  int nb_colors;        ///< Number of used entries
+
+  /// The used entries, packed by OT_list_colors(): each cluster of the
+  /// median cut holds a range of them.
+  T_Occurrence * colors;
 } T_Occurrence_table;
 
 
@@ -106,6 +131,7 @@ typedef struct S_Cluster
 {
   struct S_Cluster* next;
   int occurences; // Numbers of pixels in picture part of this cluster
+  int first, end; ///< Range of the colors of the cluster in T_Occurrence_table::colors
   
   // Narrow covering (remove margins that don't hold any pixel)
   byte rmin,rmax;
@@ -173,8 +199,9 @@ void OT_init(T_Occurrence_table * t);
 T_Occurrence_table * OT_new(int nbb_r,int nbb_g,int nbb_b);
 void OT_delete(T_Occurrence_table * t);
 int OT_get(T_Occurrence_table * t,byte r,byte g,byte b);
-void OT_inc(T_Occurrence_table * t,byte r,byte g,byte b);
-void OT_count_occurrences(T_Occurrence_table * t,T_Bitmap24B image,int size);
+int OT_inc(T_Occurrence_table * t,byte r,byte g,byte b);
+int OT_count_occurrences(T_Occurrence_table * t,T_Bitmap24B image,int size);
+int OT_list_colors(T_Occurrence_table * t);
 
 
 
@@ -210,5 +237,39 @@ T_Gradient_set * GS_New(T_Cluster_set * cs);
 void GS_Delete(T_Gradient_set * ds);
 void GS_Generate(T_Gradient_set * ds,T_Cluster_set * cs);
 
+/////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////// Réduction des couleurs //
+/////////////////////////////////////////////////////////////////////////////
+
+/// Methods which choose the palette of a 24bit picture
+enum COLOR_REDUCTION_METHOD
+{
+  COLOR_REDUCTION_MEDIAN_CUT = 0, ///< Median cut on the occurrence table
+  COLOR_REDUCTION_WU,             ///< Xiaolin Wu's cuts of least variance
+  COLOR_REDUCTION_METHODS         ///< Number of methods
+};
+
+/// Dithering of a 24bit picture reduced to 256 colors
+enum DITHERING_METHOD
+{
+  DITHERING_NONE = 0,        ///< Nearest color
+  DITHERING_BAYER,           ///< Ordered dithering with a 8x8 Bayer matrix
+  DITHERING_BLUE_NOISE,      ///< Ordered dithering with a 64x64 blue noise matrix
+  DITHERING_FLOYD_STEINBERG, ///< Floyd-Steinberg error diffusion
+  DITHERING_SIERRA,          ///< Sierra (three rows) error diffusion
+  DITHERING_METHODS          ///< Number of methods
+};
+
+/// How a 24bit picture is reduced to 256 colors
+typedef struct
+{
+  int Method;        ///< One of ::COLOR_REDUCTION_METHOD
+  int Refine_passes; ///< Maximum number of k-means passes which improve the palette, 0 for none
+  int Refine_time;   ///< Time allowed for the k-means passes, in milliseconds, 0 for no limit
+  int Dithering;     ///< One of ::DITHERING_METHOD
+} T_Color_reduction;
+
+CT_Tree* Optimize_palette(T_Bitmap24B image, int size, T_Components * palette, int r, int g, int b, int * nb_colors);
+int Reduce_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,const T_Color_reduction * settings);
 int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette);
 #endif
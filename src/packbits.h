@@ -35,11 +35,24 @@
  */
 int PackBits_unpack_from_file(FILE * f, byte * dest, unsigned int count);
 
+/**
+ * Unpack a PackBits stream stored in memory
+ *
+ * @param src packed data
+ * @param src_size byte size of packed data
+ * @param dest output buffer
+ * @param count number of bytes to unpack
+ * @return PACKBITS_UNPACK_OK or PACKBITS_UNPACK_READ_ERROR or PACKBITS_UNPACK_OVERFLOW_ERROR
+ */
+int PackBits_unpack_from_memory(const byte * src, size_t src_size, byte * dest, unsigned int count);
+
 /**
  * Data used by the PackBits packer
  */
 typedef struct {
   FILE * f;
+  byte * output;        ///< memory output, used when f is NULL
+  size_t output_size;   ///< size of the memory output
   int output_count;
   byte list_size;
   byte repetition_mode;
@@ -76,4 +89,15 @@ int PackBits_pack_flush(T_PackBits_data * data);
  */
 int PackBits_pack_buffer(FILE * f, const byte * buffer, size_t size);
 
+/**
+ * Pack a full buffer to memory
+ * @param dest output buffer
+ * @param dest_size byte size of output buffer
+ * @param buffer input buffer
+ * @param size byte size of input buffer
+ * @return -1 for error (including when the output buffer is too small),
+ *         or the size of the packed stream
+ */
+int PackBits_pack_buffer_to_memory(byte * dest, size_t dest_size, const byte * buffer, size_t size);
+
 #endif
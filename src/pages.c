@@ -39,6 +39,11 @@
 #include "graph.h"
 #include "layers.h"
 #include "unicode.h"
+#include "packbits.h"
+#include "gfx2log.h"
+#include "undofile.h"
+#include "composite.h"
+#include "workers.h"
 
 // -- Layers data
 
@@ -47,6 +52,14 @@
 T_Bitmap Main_visible_image_backup;
 T_Bitmap Main_visible_image_depth_buffer;
 //T_Bitmap Spare_visible_image;
+T_Bitmap Main_layers_below;
+T_Bitmap Main_layers_above;
+int Main_layers_planes_layer = -1;
+int Main_shared_backup_layer = -1;
+/// Transparent color of ::Main_layers_below and ::Main_layers_above
+static byte Layers_planes_transparent_color;
+/// Visible layers of ::Main_layers_below and ::Main_layers_above
+static dword Layers_planes_visible;
 
   ///
   /// GESTION DES PAGES
@@ -59,6 +72,47 @@ static dword Last_backed_up_layers=0;
 long Stats_pages_number=0;
 /// Total memory used by bitmaps (layers, animation frames, backups)
 long long Stats_pages_memory=0;
+/// Part of ::Stats_pages_memory used by more than one history step
+long long Stats_pages_shared_memory=0;
+/// Memory that the bitmaps would use without compression
+long long Stats_pages_unpacked_memory=0;
+/// Memory of the bitmaps moved to the Undo scratch file (not counted in ::Stats_pages_memory)
+long long Stats_pages_spilled_memory=0;
+
+/// Page of Main.backups whose layer ::Main_shared_backup_layer still shares
+/// some tiles with the current page (NULL entries of its Tiles), see Backup().
+static T_Page * Shared_backup_page=NULL;
+
+/// Tiles of the layer ::Modified_layer which changed from the step
+/// ::Modified_page to the older one: recorded when a backup made by Backup()
+/// becomes an old step, so the next one shares the other tiles without
+/// comparing them.
+static byte * Modified_tiles=NULL;
+/// Newer step of ::Modified_tiles, or NULL when they aren't known
+static T_Page * Modified_page=NULL;
+/// Layer of ::Modified_tiles
+static int Modified_layer=0;
+
+/// Side, in pixels, of the tiles used to store the layers of old history steps
+#define UNDO_TILE_SIZE 64
+/// Size in bytes of one tile
+#define UNDO_TILE_BYTES (UNDO_TILE_SIZE*UNDO_TILE_SIZE)
+
+/// A freed layer, kept aside so the next New_layer() of the same size can avoid a fresh allocation.
+/// It stays counted in ::Stats_pages_memory, but not in the memory of a list of pages.
+static short * Recycled_layer=NULL;
+/// Size in pixels of ::Recycled_layer
+static long Recycled_layer_size=0;
+
+/// Releases ::Recycled_layer
+static void Free_recycled_layer(void)
+{
+  if (Recycled_layer==NULL)
+    return;
+  free(Recycled_layer);
+  Recycled_layer=NULL;
+  Stats_pages_memory-=Recycled_layer_size;
+}
 
 /// Allocate and initialize a new page.
 T_Page * New_page(int nb_layers)
@@ -72,6 +126,7 @@ T_Page * New_page(int nb_layers)
     for (i=0; i<nb_layers; i++)
     {
       page->Image[i].Pixels = NULL;
+      page->Image[i].Tiles = NULL;
       page->Image[i].Duration = 100;
     }
     page->Width=0;
@@ -103,52 +158,531 @@ T_Page * New_page(int nb_layers)
 // and only when it reaches zero the pixel data is freed.
 // ==============================================================
 
-/// Allocate a new layer
-byte * New_layer(long pixel_size)
+/// Allocate a new layer for a page of the list
+byte * New_layer(T_List_of_pages * list, long pixel_size)
 {
-  short * ptr = GFX2_malloc(sizeof(short)+pixel_size);
-  if (ptr==NULL)
-    return NULL;
+  short * ptr;
+
+  if (Recycled_layer!=NULL && Recycled_layer_size==pixel_size)
+  {
+    ptr = Recycled_layer;
+    Recycled_layer=NULL;
+    Stats_pages_memory-=pixel_size; // Counted again below
+  }
+  else
+  {
+    // Don't keep an unusable bitmap around while allocating another one
+    Free_recycled_layer();
+    ptr = GFX2_malloc(sizeof(short)+pixel_size);
+    if (ptr==NULL)
+      return NULL;
+  }
     
   // Stats
   Stats_pages_number++;
   Stats_pages_memory+=pixel_size;
+  Stats_pages_unpacked_memory+=pixel_size;
+  list->Memory+=pixel_size;
   
   *ptr = 1;
   return (byte *)(ptr+1);
 }
 
-/// Free a layer
-void Free_layer(T_Page * page, int layer)
+static void Free_tiles(T_List_of_pages * list, T_Page * page, int layer);
+static int Spill_old_pages(T_List_of_pages * list, long long max_memory);
+
+/// Free a layer of a page of the list
+void Free_layer(T_List_of_pages * list, T_Page * page, int layer)
 {
   short * ptr;
+  if (page->Image[layer].Tiles!=NULL)
+  {
+    Free_tiles(list, page, layer);
+    return;
+  }
   if (page->Image[layer].Pixels==NULL)
     return;
     
   ptr = (short *)(page->Image[layer].Pixels);
   if (-- (*(ptr-1))) // Users--
+  {
+    if (*(ptr-1) == 1)
+      Stats_pages_shared_memory-=page->Width * page->Height;
     return;
-  else {
-    free(ptr-1);
   }
+  // Keep it for the next New_layer()
+  Free_recycled_layer();
+  Recycled_layer = ptr-1;
+  Recycled_layer_size = page->Width * page->Height;
+  list->Memory-=Recycled_layer_size;
     
   // Stats
   Stats_pages_number--;
-  Stats_pages_memory-=page->Width * page->Height;
+  Stats_pages_unpacked_memory-=page->Width * page->Height;
 }
 
 /// Duplicate a layer (new reference)
-byte * Dup_layer(byte * layer)
+byte * Dup_layer(byte * layer, long pixel_size)
 {
   short * ptr = (short *)(layer);
   
   if (layer==NULL)
     return NULL;
   
-  (*(ptr-1)) ++; // Users ++
+  if ((*(ptr-1)) ++ == 1) // Users ++
+    Stats_pages_shared_memory+=pixel_size;
   return layer;
 }
 
+// ==============================================================
+// Tiled layers.
+//
+// Only the two most recent steps of a list of pages (the current
+// image and its backup) are accessed by the drawing code. The
+// layers of all older steps are cut in tiles of UNDO_TILE_SIZE
+// pixels square, with a "number of users" like the layers.
+// A tile which didn't change from one step to the older one is
+// shared instead of copied, so a history step only costs the
+// memory of the tiles that were actually modified.
+// The backup made by Backup() is tiled from the start: its working
+// layer has no tile of its own (NULL: same as the current page), and
+// gets a copy of each tile just before the current page modifies it,
+// see Unshare_backup_area().
+// In memory-budget mode (Config.Undo_memory_budget), the tiles
+// are also compressed with PackBits, and the tiles of the oldest
+// steps are moved to a memory-mapped scratch file (undofile.c)
+// instead of being destroyed when the budget is exceeded.
+// The same happens in any mode when a new bitmap can't be allocated.
+// When a step becomes recent again (Undo/Redo), its layers are
+// re-assembled by Layer_pixels().
+// ==============================================================
+
+/// A tile of a layer of an old history step.
+typedef struct T_Undo_tile
+{
+  byte * Data;       ///< Pixels, raw or packed. NULL when moved to the scratch file.
+  long  Record;      ///< Record of the Undo scratch file which holds the pixels when Data is NULL
+  short Users;       ///< Number of history steps using this tile
+  word  Packed_size; ///< Size of the PackBits stream, or 0 for raw pixels
+} T_Undo_tile;
+
+/// Pixel data of a tile, in memory or in the scratch file
+#define TILE_DATA(tile) ((tile)->Data ? (tile)->Data : Undo_file_data((tile)->Record))
+
+/// Size of the pixel data of a tile
+#define TILE_DATA_SIZE(tile) ((tile)->Packed_size ? (tile)->Packed_size : UNDO_TILE_BYTES)
+
+/// Allocate a new tile for a page of the list, from the pixels (UNDO_TILE_SIZE per row) of the buffer
+static T_Undo_tile * New_tile(T_List_of_pages * list, const byte * pixels)
+{
+  T_Undo_tile * tile;
+  byte packed[UNDO_TILE_BYTES];
+  int packed_size = -1;
+
+  if (Config.Undo_memory_budget)
+    packed_size = PackBits_pack_buffer_to_memory(packed, sizeof(packed), pixels, UNDO_TILE_BYTES);
+  if (packed_size <= 0 || packed_size >= UNDO_TILE_BYTES)
+    packed_size = 0; // Not worth it
+
+  tile = (T_Undo_tile *)GFX2_malloc(sizeof(T_Undo_tile));
+  if (tile==NULL)
+    return NULL;
+  tile->Data = GFX2_malloc(packed_size ? packed_size : UNDO_TILE_BYTES);
+  if (tile->Data==NULL)
+  {
+    free(tile);
+    return NULL;
+  }
+  tile->Record = -1;
+  tile->Users = 1;
+  tile->Packed_size = packed_size;
+  memcpy(tile->Data, packed_size ? packed : pixels, TILE_DATA_SIZE(tile));
+
+  Stats_pages_memory+=TILE_DATA_SIZE(tile);
+  Stats_pages_unpacked_memory+=UNDO_TILE_BYTES;
+  list->Memory+=TILE_DATA_SIZE(tile);
+  return tile;
+}
+
+/// Duplicate a tile (new reference)
+static T_Undo_tile * Dup_tile(T_Undo_tile * tile)
+{
+  if (tile->Users++ == 1 && tile->Data!=NULL)
+    Stats_pages_shared_memory+=TILE_DATA_SIZE(tile);
+  return tile;
+}
+
+/// Free a tile of a page of the list
+static void Free_tile(T_List_of_pages * list, T_Undo_tile * tile)
+{
+  switch (--tile->Users)
+  {
+    case 0:
+      Stats_pages_unpacked_memory-=UNDO_TILE_BYTES;
+      if (tile->Data==NULL)
+      {
+        Stats_pages_spilled_memory-=TILE_DATA_SIZE(tile);
+        Undo_file_free(tile->Record);
+      }
+      else
+      {
+        Stats_pages_memory-=TILE_DATA_SIZE(tile);
+        list->Memory-=TILE_DATA_SIZE(tile);
+        free(tile->Data);
+      }
+      free(tile);
+      break;
+    case 1:
+      if (tile->Data!=NULL)
+        Stats_pages_shared_memory-=TILE_DATA_SIZE(tile);
+      break;
+  }
+}
+
+/// Moves the pixels of a tile of a page of the list to the Undo scratch file.
+/// Returns 0 if the scratch file can't take it.
+static int Spill_tile(T_List_of_pages * list, T_Undo_tile * tile)
+{
+  if (tile->Data==NULL)
+    return 1; // Already done
+  tile->Record = Undo_file_store(tile->Data, TILE_DATA_SIZE(tile));
+  if (tile->Record < 0)
+    return 0;
+  Stats_pages_memory-=TILE_DATA_SIZE(tile);
+  Stats_pages_spilled_memory+=TILE_DATA_SIZE(tile);
+  list->Memory-=TILE_DATA_SIZE(tile);
+  if (tile->Users > 1)
+    Stats_pages_shared_memory-=TILE_DATA_SIZE(tile);
+  free(tile->Data);
+  tile->Data = NULL;
+  return 1;
+}
+
+/// Returns the raw pixels of a tile, unpacking them in buffer if needed
+static const byte * Tile_pixels(const T_Undo_tile * tile, byte * buffer)
+{
+  if (tile->Packed_size==0)
+    return TILE_DATA(tile);
+  if (PackBits_unpack_from_memory(TILE_DATA(tile), tile->Packed_size, buffer, UNDO_TILE_BYTES) != PACKBITS_UNPACK_OK)
+    GFX2_Log(GFX2_ERROR, "Corrupted undo tile\n");
+  return buffer;
+}
+
+/// Number of tiles needed for a layer of the page
+static int Nb_tiles(const T_Page * page)
+{
+  return ((page->Width+UNDO_TILE_SIZE-1)/UNDO_TILE_SIZE)
+       * ((page->Height+UNDO_TILE_SIZE-1)/UNDO_TILE_SIZE);
+}
+
+/// Free all the tiles of a layer of a page of the list
+static void Free_tiles(T_List_of_pages * list, T_Page * page, int layer)
+{
+  int i;
+  int nb_tiles = Nb_tiles(page);
+
+  for (i=0; i<nb_tiles; i++)
+    if (page->Image[layer].Tiles[i]!=NULL)
+      Free_tile(list, page->Image[layer].Tiles[i]);
+  free(page->Image[layer].Tiles);
+  page->Image[layer].Tiles=NULL;
+  if (page==Shared_backup_page && layer==Main_shared_backup_layer)
+  {
+    Shared_backup_page=NULL;
+    Main_shared_backup_layer=-1;
+  }
+}
+
+/// Operations of Tile_and_bitmap()
+enum TILE_OPERATION
+{
+  TILE_COMPARE,     ///< Returns 1 if the tile has the same pixels as the bitmap
+  TILE_TO_BITMAP,   ///< Copies the tile to the bitmap
+  TILE_FROM_BITMAP, ///< Copies the bitmap to the tile buffer
+};
+
+/// Compares or copies pixels between a tile buffer (UNDO_TILE_SIZE per row)
+/// and the matching area of a layer bitmap.
+static int Tile_and_bitmap(byte * tile, byte * pixels, int width, int height, int tile_index, enum TILE_OPERATION operation)
+{
+  int tiles_x = (width+UNDO_TILE_SIZE-1)/UNDO_TILE_SIZE;
+  int tx = tile_index % tiles_x;
+  int ty = tile_index / tiles_x;
+  int w = Min(UNDO_TILE_SIZE, width - tx*UNDO_TILE_SIZE);
+  int h = Min(UNDO_TILE_SIZE, height - ty*UNDO_TILE_SIZE);
+  byte * bitmap = pixels + (long)ty*UNDO_TILE_SIZE*width + tx*UNDO_TILE_SIZE;
+  int y;
+
+  if (operation == TILE_FROM_BITMAP && (w < UNDO_TILE_SIZE || h < UNDO_TILE_SIZE))
+    memset(tile, 0, UNDO_TILE_BYTES); // Unused part of the edge tiles
+  for (y=0; y<h; y++, tile+=UNDO_TILE_SIZE, bitmap+=width)
+  {
+    switch (operation)
+    {
+      case TILE_COMPARE:
+        if (memcmp(bitmap, tile, w))
+          return 0;
+        break;
+      case TILE_TO_BITMAP:
+        memcpy(bitmap, tile, w);
+        break;
+      case TILE_FROM_BITMAP:
+        memcpy(tile, bitmap, w);
+        break;
+    }
+  }
+  return 1;
+}
+
+/// Returns the tiles of the step older than page, when ::Modified_tiles
+/// tells which of them are the same in page, or NULL.
+static T_Undo_tile ** Unmodified_older_tiles(T_Page * page, int layer)
+{
+  T_Page * older = page->Next;
+
+  if (page!=Modified_page || layer!=Modified_layer
+    || older->Nb_layers <= layer || older->Image[layer].Tiles==NULL
+    || older->Width!=page->Width || older->Height!=page->Height)
+    return NULL;
+  return older->Image[layer].Tiles;
+}
+
+/// Gives a tile to the backup made by Backup(), from the pixels of the newer step.
+/// Returns 0 on allocation failure.
+static int Unshare_tile(T_List_of_pages * list, T_Page * page, int layer, int tile_index)
+{
+  byte buffer[UNDO_TILE_BYTES];
+  T_Undo_tile * tile;
+
+  Tile_and_bitmap(buffer, page->Prev->Image[layer].Pixels, page->Width, page->Height, tile_index, TILE_FROM_BITMAP);
+  tile = New_tile(list, buffer);
+  // Out of memory: the old steps can go to the scratch file
+  if (tile==NULL && Spill_old_pages(list, 0))
+    tile = New_tile(list, buffer);
+  page->Image[layer].Tiles[tile_index] = tile;
+  return tile!=NULL;
+}
+
+/// Completes the layer of a backup made by Backup() when it becomes an old
+/// step: the tiles it still shares with the newer step are taken from the
+/// older step when ::Modified_tiles says they are the same there, and
+/// copied otherwise. The tiles it already has are the ones that the newer
+/// step modified: they become the new ::Modified_tiles.
+/// Returns 0 on allocation failure.
+static int Close_shared_layer(T_List_of_pages * list, T_Page * page, int layer)
+{
+  T_Undo_tile ** tiles = page->Image[layer].Tiles;
+  T_Undo_tile ** older_tiles = Unmodified_older_tiles(page, layer);
+  int nb_tiles = Nb_tiles(page);
+  byte * modified;
+  int i;
+
+  modified = (byte *)realloc(Modified_tiles, nb_tiles);
+  if (modified==NULL)
+    return 0;
+  Modified_tiles = modified;
+  for (i=0; i<nb_tiles; i++)
+  {
+    int unmodified = older_tiles!=NULL && !Modified_tiles[i];
+
+    Modified_tiles[i] = tiles[i]!=NULL;
+    if (tiles[i]!=NULL)
+      continue;
+    if (unmodified)
+      tiles[i] = Dup_tile(older_tiles[i]);
+    else if (!Unshare_tile(list, page, layer, i))
+    {
+      Modified_page = NULL;
+      return 0;
+    }
+  }
+  Shared_backup_page = NULL;
+  Main_shared_backup_layer = -1;
+  Modified_page = page->Prev;
+  Modified_layer = layer;
+  return 1;
+}
+
+/// Cuts a layer of an old history step in tiles.
+/// The older steps which share the same bitmap are converted too. The tiles
+/// that ::Modified_tiles gives as unchanged since the older step are shared
+/// with it, the other ones are copied: the layers aren't compared.
+/// Returns 0 on allocation failure, in which case the layer is left untouched.
+static int Tile_layer(T_List_of_pages * list, T_Page * page, int layer)
+{
+  byte * pixels = page->Image[layer].Pixels;
+  T_Undo_tile ** tiles;
+  T_Undo_tile ** older_tiles = NULL;
+  byte buffer[UNDO_TILE_BYTES];
+  T_Page * last;
+  int nb_tiles;
+  int i;
+
+  if (page==Shared_backup_page && layer==Main_shared_backup_layer)
+    return Close_shared_layer(list, page, layer);
+  if (pixels==NULL)
+    return 1; // Already done
+  // A more recent step uses the same bitmap: cutting it would only waste memory.
+  if (page->Prev->Nb_layers > layer && page->Prev->Image[layer].Pixels==pixels)
+    return 1;
+
+  // The run of older steps sharing this bitmap
+  last = page;
+  while (last->Next!=list->Pages && last->Next->Nb_layers > layer
+      && last->Next->Image[layer].Pixels==pixels)
+    last = last->Next;
+  if (last==page)
+    older_tiles = Unmodified_older_tiles(page, layer);
+
+  nb_tiles = Nb_tiles(page);
+  tiles = (T_Undo_tile **)GFX2_malloc(nb_tiles*sizeof(T_Undo_tile *));
+  if (tiles==NULL)
+    return 0;
+  for (i=0; i<nb_tiles; i++)
+  {
+    if (older_tiles!=NULL && !Modified_tiles[i])
+    {
+      tiles[i] = Dup_tile(older_tiles[i]);
+      continue;
+    }
+    Tile_and_bitmap(buffer, pixels, page->Width, page->Height, i, TILE_FROM_BITMAP);
+    tiles[i] = New_tile(list, buffer);
+    if (tiles[i]==NULL)
+    {
+      while (i-- > 0)
+        Free_tile(list, tiles[i]);
+      free(tiles);
+      return 0;
+    }
+  }
+  if (page==Modified_page)
+    Modified_page = NULL;
+
+  // Give the tiles to every step of the run
+  for (;;)
+  {
+    T_Page * next = page->Next;
+    T_Undo_tile ** page_tiles = tiles;
+
+    if (page!=last)
+    {
+      page_tiles = (T_Undo_tile **)GFX2_malloc(nb_tiles*sizeof(T_Undo_tile *));
+      if (page_tiles==NULL)
+      {
+        // Not fatal: this step keeps its bitmap
+        page = next;
+        continue;
+      }
+      for (i=0; i<nb_tiles; i++)
+        page_tiles[i] = Dup_tile(tiles[i]);
+    }
+    Free_layer(list, page, layer);
+    page->Image[layer].Pixels = NULL;
+    page->Image[layer].Tiles = page_tiles;
+    if (page==last)
+      break;
+    page = next;
+  }
+  return 1;
+}
+
+/// Cuts in tiles the layers of a step which is leaving the two most recent
+/// steps. Each step is cut once: the steps further in the list are already
+/// tiled, or share their bitmaps with this one.
+static void Tile_page(T_List_of_pages * list, T_Page * page)
+{
+  int i;
+
+  for (i=0; i<page->Nb_layers; i++)
+    if (!Tile_layer(list, page, i))
+      return; // Out of memory: keep going with plain bitmaps
+}
+
+/// Returns the pixels of a layer as a plain bitmap, re-assembling it from
+/// its tiles if needed. Returns NULL on allocation failure.
+byte * Layer_pixels(T_List_of_pages * list, T_Page * page, int layer)
+{
+  T_Image * image = &page->Image[layer];
+  long pixel_size = (long)page->Width*page->Height;
+  byte * pixels = NULL;
+  byte buffer[UNDO_TILE_BYTES];
+  int shared = page==Shared_backup_page && layer==Main_shared_backup_layer;
+  int nb_tiles;
+  int i;
+
+  if (image->Pixels!=NULL || image->Tiles==NULL)
+    return image->Pixels;
+
+  nb_tiles = Nb_tiles(page);
+  // Often, an adjacent step has the very same pixels. Not for a backup
+  // made by Backup(): the newer step is the current page, which changes.
+  for (i=0; i<2 && pixels==NULL && !shared; i++)
+  {
+    T_Page * other = i ? page->Next : page->Prev;
+    if (other!=page && other->Nb_layers > layer && other->Image[layer].Pixels!=NULL
+        && other->Width==page->Width && other->Height==page->Height)
+    {
+      int t;
+      for (t=0; t<nb_tiles; t++)
+        if (!Tile_and_bitmap((byte *)Tile_pixels(image->Tiles[t], buffer), other->Image[layer].Pixels, page->Width, page->Height, t, TILE_COMPARE))
+          break;
+      if (t==nb_tiles)
+        pixels = Dup_layer(other->Image[layer].Pixels, pixel_size);
+    }
+  }
+  if (pixels==NULL)
+  {
+    pixels = New_layer(list, pixel_size);
+    if (pixels==NULL)
+      return NULL;
+    for (i=0; i<nb_tiles; i++)
+    {
+      if (image->Tiles[i]==NULL) // Still shared with the newer step
+        Tile_and_bitmap(buffer, page->Prev->Image[layer].Pixels, page->Width, page->Height, i, TILE_FROM_BITMAP);
+      Tile_and_bitmap((byte *)(image->Tiles[i]==NULL ? buffer : Tile_pixels(image->Tiles[i], buffer)), pixels, page->Width, page->Height, i, TILE_TO_BITMAP);
+    }
+  }
+  Free_tiles(list, page, layer);
+  image->Pixels = pixels;
+  return pixels;
+}
+
+/// Makes sure all layers of a page of the list are plain bitmaps.
+/// Returns 0 on allocation failure.
+static int Untile_page(T_List_of_pages * list, T_Page * page)
+{
+  int i;
+
+  for (i=0; i<page->Nb_layers; i++)
+    if (Layer_pixels(list, page, i)==NULL && page->Image[i].Tiles!=NULL)
+      return 0;
+  return 1;
+}
+
+void Unshare_backup_area(short x, short y, short width, short height)
+{
+  T_Page * page = Shared_backup_page;
+  int layer = Main_shared_backup_layer;
+  int tiles_x, tx, ty;
+
+  if (page==NULL || width<=0 || height<=0)
+    return;
+  tiles_x = (page->Width+UNDO_TILE_SIZE-1)/UNDO_TILE_SIZE;
+  for (ty=y/UNDO_TILE_SIZE; ty<=(y+height-1)/UNDO_TILE_SIZE; ty++)
+    for (tx=x/UNDO_TILE_SIZE; tx<=(x+width-1)/UNDO_TILE_SIZE; tx++)
+    {
+      if (page->Image[layer].Tiles[ty*tiles_x+tx]!=NULL)
+        continue;
+      if (!Unshare_tile(Main.backups, page, layer, ty*tiles_x+tx))
+      {
+        // Out of memory: last chance, with a plain bitmap
+        if (Layer_pixels(Main.backups, page, layer)==NULL)
+          GFX2_Log(GFX2_ERROR, "Not enough memory to keep the Undo step\n");
+        return;
+      }
+    }
+}
+
 // ==============================================================
 
 /// Adds a shared reference to the gradient data of another page. Pass NULL for new.
@@ -183,6 +717,7 @@ void Download_infos_page_main(T_Page * page)
     Main.image_width=page->Width;
     Main.image_height=page->Height;
     memcpy(Main.palette,page->Palette,sizeof(T_Palette));
+    Palette_changed();
     Main.fileformat=page->File_format;
 
     if (size_is_modified)
@@ -201,77 +736,259 @@ void Download_infos_page_main(T_Page * page)
   
 }
 
+/// Restricts a rectangle to the main image. Returns 0 if nothing is left.
+static int Clip_to_main_image(short * x, short * y, short * width, short * height)
+{
+  if (*x < 0)
+  {
+    *width += *x;
+    *x = 0;
+  }
+  if (*y < 0)
+  {
+    *height += *y;
+    *y = 0;
+  }
+  if (*x + *width > Main.image_width)
+    *width = Main.image_width - *x;
+  if (*y + *height > Main.image_height)
+    *height = Main.image_height - *y;
+  return *width > 0 && *height > 0;
+}
+
+/// Rectangle of the main image processed by Run_rows_in_parallel()
+typedef struct
+{
+  short X;
+  short Y;
+  short Width;
+} T_Rows_area;
+
+/// Re-computes a row span of ::Main_layers_below and ::Main_layers_above.
+static void Update_layers_planes_span(long start, short width)
+{
+  byte * below = Main_layers_below.Image + start;
+  byte * above = Main_layers_above.Image + start;
+  byte transparent = Main.backups->Pages->Transparent_color;
+  int first = 1;
+  int layer;
+
+  memset(below, transparent, width);
+  memset(above, transparent, width);
+  for (layer=0; layer<Main.backups->Pages->Nb_layers; layer++)
+  {
+    const byte * pixels;
+
+    if (!((1<<layer) & Main.layers_visible))
+      continue;
+    if (layer == Main.current_layer)
+    {
+      // The layers below can't hide any pixel now
+      first = 0;
+      continue;
+    }
+    pixels = Main.backups->Pages->Image[layer].Pixels + start;
+    if (first)
+    {
+      // The lowest visible layer is drawn with its transparent pixels
+      memcpy(below, pixels, width);
+      first = 0;
+      continue;
+    }
+    Overlay_row(layer < Main.current_layer ? below : above, NULL, pixels, width, transparent, layer);
+  }
+}
+
+/// Job for Run_rows_in_parallel(): Update_layers_planes_span() on rows of a ::T_Rows_area
+static void Update_layers_planes_rows(void * data, int band, int first_row, int end_row)
+{
+  const T_Rows_area * area = (const T_Rows_area *)data;
+  int row;
+
+  (void)band;
+  for (row=area->Y+first_row; row<area->Y+end_row; row++)
+    Update_layers_planes_span((long)row*Main.image_width + area->X, area->Width);
+}
+
+void Free_layers_planes(void)
+{
+  free(Main_layers_below.Image);
+  Main_layers_below.Image = NULL;
+  free(Main_layers_above.Image);
+  Main_layers_above.Image = NULL;
+  Main_layers_below.Width = Main_layers_above.Width = 0;
+  Main_layers_below.Height = Main_layers_above.Height = 0;
+  Main_layers_planes_layer = -1;
+}
+
+/// Returns 1 if ::Main_layers_below and ::Main_layers_above match the
+/// current layer and the other layers of the main image
+static int Layers_planes_up_to_date(void)
+{
+  return Main_layers_planes_layer == Main.current_layer
+    && Main_layers_below.Width == Main.image_width
+    && Main_layers_below.Height == Main.image_height
+    && Layers_planes_transparent_color == Main.backups->Pages->Transparent_color
+    && Layers_planes_visible == Main.layers_visible;
+}
+
+void Invalidate_layers_planes(void)
+{
+  Main_layers_planes_layer = -1;
+}
+
+int Layers_planes_ready(void)
+{
+  T_Rows_area area;
+
+  if (Layers_planes_up_to_date())
+    return 1;
+  Main_layers_planes_layer = -1;
+  if (Main.backups->Pages->Image_mode != IMAGE_MODE_LAYERED
+    || Main.backups->Pages->Nb_layers < 2)
+  {
+    Free_layers_planes();
+    return 0;
+  }
+  if (!((1<<Main.current_layer) & Main.layers_visible))
+    return 0; // Drawing doesn't show: let the depth buffer deal with it
+  if (Main_layers_below.Width * Main_layers_below.Height != Main.image_width * Main.image_height)
+  {
+    Free_layers_planes();
+    Main_layers_below.Image = (byte *)GFX2_malloc((long)Main.image_width * Main.image_height);
+    Main_layers_above.Image = (byte *)GFX2_malloc((long)Main.image_width * Main.image_height);
+    if (Main_layers_below.Image == NULL || Main_layers_above.Image == NULL)
+    {
+      // Not fatal, the depth buffer is used instead
+      Free_layers_planes();
+      return 0;
+    }
+  }
+  Main_layers_below.Width = Main_layers_above.Width = Main.image_width;
+  Main_layers_below.Height = Main_layers_above.Height = Main.image_height;
+  // Completely: the layers which move from one side of the current layer
+  // to the other can be anywhere.
+  area.X = 0;
+  area.Y = 0;
+  area.Width = Main.image_width;
+  Run_rows_in_parallel(Update_layers_planes_rows, &area, Main.image_height);
+  Main_layers_planes_layer = Main.current_layer;
+  Layers_planes_transparent_color = Main.backups->Pages->Transparent_color;
+  Layers_planes_visible = Main.layers_visible;
+  return 1;
+}
+
+void Update_layers_planes_area(short x, short y, short width, short height)
+{
+  T_Rows_area area;
+
+  if (Main.backups->Pages->Image_mode != IMAGE_MODE_LAYERED)
+  {
+    Free_layers_planes();
+    return;
+  }
+  if (!Layers_planes_up_to_date())
+  {
+    // Re-computed completely by Layers_planes_ready(), when drawing needs them
+    Main_layers_planes_layer = -1;
+    return;
+  }
+  if (!Clip_to_main_image(&x, &y, &width, &height))
+    return;
+  area.X = x;
+  area.Y = y;
+  area.Width = width;
+  Run_rows_in_parallel(Update_layers_planes_rows, &area, height);
+}
+
 void Redraw_layered_image(void)
 {
-  if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
+  Redraw_layered_image_area(0, 0, Main.image_width, Main.image_height);
+}
+
+/// Job for Run_rows_in_parallel(): composes the visible image and the
+/// depth buffer on rows of a ::T_Rows_area
+static void Redraw_layered_rows(void * data, int band, int first_row, int end_row)
+{
+  const T_Rows_area * area = (const T_Rows_area *)data;
+  short width = area->Width;
+  byte layer;
+  byte first_layer=0;
+  int row;
+
+  (void)band;
+  for (row=area->Y+first_row; row<area->Y+end_row; row++)
   {
-    // Re-construct the image with the visible layers
-    byte layer=0;  
+    long start = (long)row*Main.image_width + area->X;
+    byte * visible = Main.visible_image.Image + start;
+    byte * depth = Main_visible_image_depth_buffer.Image + start;
+    int i;
+
     // First layer
     if ((Main.backups->Pages->Image_mode == IMAGE_MODE_MODE5
-		|| Main.backups->Pages->Image_mode == IMAGE_MODE_RASTER) && Main.layers_visible & (1<<4))
+    || Main.backups->Pages->Image_mode == IMAGE_MODE_RASTER) && Main.layers_visible & (1<<4))
     {
       // The raster result layer is visible: start there
+      const byte * raster = Main.backups->Pages->Image[4].Pixels + start;
       // Copy it in Main_visible_image
-      int i;
-      for (i=0; i< Main.image_width*Main.image_height; i++)
+      for (i=0; i<width; i++)
       {
-        layer = *(Main.backups->Pages->Image[4].Pixels+i);
+        layer = raster[i];
         if (Main.layers_visible & (1 << layer))
-          Main.visible_image.Image[i]=*(Main.backups->Pages->Image[layer].Pixels+i);
+          visible[i]=*(Main.backups->Pages->Image[layer].Pixels+start+i);
         else
-          Main.visible_image.Image[i] = layer;
+          visible[i] = layer;
       }
-        
       // Copy it to the depth buffer
-      memcpy(Main_visible_image_depth_buffer.Image,
-        Main.backups->Pages->Image[4].Pixels,
-        Main.image_width*Main.image_height);
-        
+      memcpy(depth, raster, width);
       // Next
-      layer= (1<<4)+1;
+      first_layer= (1<<4)+1;
     }
     else
     {
-      for (layer=0; layer<Main.backups->Pages->Nb_layers; layer++)
+      for (first_layer=0; first_layer<Main.backups->Pages->Nb_layers; first_layer++)
       {
-        if ((1<<layer) & Main.layers_visible)
+        if ((1<<first_layer) & Main.layers_visible)
         {
            // Copy it in Main_visible_image
-           memcpy(Main.visible_image.Image,
-             Main.backups->Pages->Image[layer].Pixels,
-             Main.image_width*Main.image_height);
-           
+           memcpy(visible, Main.backups->Pages->Image[first_layer].Pixels+start, width);
            // Initialize the depth buffer
-           memset(Main_visible_image_depth_buffer.Image,
-             layer,
-             Main.image_width*Main.image_height);
-           
+           memset(depth, first_layer, width);
            // skip all other layers
-           layer++;
+           first_layer++;
            break;
         }
       }
     }
     // subsequent layer(s)
-    for (; layer<Main.backups->Pages->Nb_layers; layer++)
+    for (layer=first_layer; layer<Main.backups->Pages->Nb_layers; layer++)
     {
       if ((1<<layer) & Main.layers_visible)
-      {
-        int i;
-        for (i=0; i<Main.image_width*Main.image_height; i++)
-        {
-          byte color = *(Main.backups->Pages->Image[layer].Pixels+i);
-          if (color != Main.backups->Pages->Transparent_color) // transparent color
-          {
-            *(Main.visible_image.Image+i) = color;
-            if (layer != Main.current_layer)
-              *(Main_visible_image_depth_buffer.Image+i) = layer;
-          }
-        }
-      }
+        Overlay_row(visible, layer != Main.current_layer ? depth : NULL,
+          Main.backups->Pages->Image[layer].Pixels + start, width,
+          Main.backups->Pages->Transparent_color, layer);
     }
   }
+}
+
+void Redraw_layered_image_area(short x, short y, short width, short height)
+{
+  if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
+  {
+    // Re-construct the image with the visible layers, by bands of rows
+    T_Rows_area area;
+
+    if (!Clip_to_main_image(&x, &y, &width, &height))
+    {
+      Update_FX_feedback(Config.FX_Feedback);
+      return;
+    }
+    Update_layers_planes_area(x, y, width, height);
+    area.X = x;
+    area.Y = y;
+    area.Width = width;
+    Run_rows_in_parallel(Redraw_layered_rows, &area, height);
+  }
   else
   {
     Update_screen_targets();
@@ -279,25 +996,144 @@ void Redraw_layered_image(void)
   Update_FX_feedback(Config.FX_Feedback);
 }
 
+int Layer_used_area(int layer, short * x, short * y, short * width, short * height)
+{
+  const byte * pixels = Main.backups->Pages->Image[layer].Pixels;
+  byte transparent = Main.backups->Pages->Transparent_color;
+  short min_x = Main.image_width;
+  short max_x = -1;
+  short min_y = -1;
+  short max_y = -1;
+  short row;
+
+  for (row=0; row<Main.image_height; row++, pixels+=Main.image_width)
+  {
+    short i;
+
+    for (i=0; i<Main.image_width && pixels[i]==transparent; i++)
+      ;
+    if (i==Main.image_width)
+      continue; // Fully transparent row
+    if (i<min_x)
+      min_x = i;
+    // From the right, no need to go further than the known limit
+    for (i=Main.image_width-1; i>max_x && pixels[i]==transparent; i--)
+      ;
+    if (i>max_x)
+      max_x = i;
+    if (min_y<0)
+      min_y = row;
+    max_y = row;
+  }
+  if (min_y<0)
+    return 0;
+  *x = min_x;
+  *y = min_y;
+  *width = max_x - min_x + 1;
+  *height = max_y - min_y + 1;
+  return 1;
+}
+
+/// Index of the lowest layer in a set of visible layers, or -1
+static int Lowest_layer(dword layers)
+{
+  int layer;
+
+  for (layer=0; layer<Main.backups->Pages->Nb_layers; layer++)
+    if (layers & (1<<layer))
+      return layer;
+  return -1;
+}
+
+void Redraw_after_layers_change(dword old_layers_visible, int old_current_layer)
+{
+  dword changed = old_layers_visible ^ Main.layers_visible;
+  int layer;
+  short x, y, width, height;
+  // Bounding box of the layers involved, empty when area_x2 <= area_x1
+  short area_x1 = 0, area_y1 = 0, area_x2 = 0, area_y2 = 0;
+
+  if (Main.backups->Pages->Image_mode == IMAGE_MODE_ANIMATION)
+  {
+    Redraw_layered_image();
+    return;
+  }
+  // The lowest visible layer is drawn with its transparent pixels, and the
+  // raster layers refer to the others: it's all or nothing.
+  if (Lowest_layer(old_layers_visible) != Lowest_layer(Main.layers_visible)
+    || Main.backups->Pages->Image_mode == IMAGE_MODE_MODE5
+    || Main.backups->Pages->Image_mode == IMAGE_MODE_RASTER)
+  {
+    if (changed)
+      Redraw_layered_image();
+    else
+      Update_depth_buffer();
+    return;
+  }
+  // Otherwise, only the opaque pixels of the layers involved can change
+  for (layer=0; layer<Main.backups->Pages->Nb_layers; layer++)
+  {
+    if ((changed & (1<<layer))
+      || (old_current_layer != Main.current_layer
+        && (layer == old_current_layer || layer == Main.current_layer)))
+    {
+      if (!Layer_used_area(layer, &x, &y, &width, &height))
+        continue;
+      if (area_x2 <= area_x1)
+      {
+        area_x1 = x;
+        area_y1 = y;
+        area_x2 = x + width;
+        area_y2 = y + height;
+      }
+      else
+      {
+        area_x1 = Min(area_x1, x);
+        area_y1 = Min(area_y1, y);
+        area_x2 = Max(area_x2, x + width);
+        area_y2 = Max(area_y2, y + height);
+      }
+    }
+  }
+  if (area_x2 > area_x1 && changed)
+    Redraw_layered_image_area(area_x1, area_y1, area_x2 - area_x1, area_y2 - area_y1);
+  else if (area_x2 > area_x1)
+  {
+    // The visible image is the same, only the depth buffer changes
+    Update_depth_buffer_area(area_x1, area_y1, area_x2 - area_x1, area_y2 - area_y1);
+  }
+  else
+  {
+    if (old_current_layer != Main.current_layer)
+      Update_layers_planes_area(0, 0, Main.image_width, Main.image_height);
+    Update_FX_feedback(Config.FX_Feedback);
+  }
+}
+
 void Update_depth_buffer(void)
 {
-  if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
+  Update_depth_buffer_area(0, 0, Main.image_width, Main.image_height);
+}
+
+/// Job for Run_rows_in_parallel(): computes the depth buffer on rows of a ::T_Rows_area
+static void Update_depth_buffer_rows(void * data, int band, int first_row, int end_row)
+{
+  const T_Rows_area * area = (const T_Rows_area *)data;
+  int row;
+
+  (void)band;
+  for (row=area->Y+first_row; row<area->Y+end_row; row++)
   {
-    // Re-construct the depth buffer with the visible layers.
-    // This function doesn't touch the visible buffer, it assumes
-    // that it was already up-to-date. (Ex. user only changed active layer)
-  
-    int layer;  
+    long start = (long)row*Main.image_width + area->X;
+    byte * depth = Main_visible_image_depth_buffer.Image + start;
+    int layer;
     // First layer
     for (layer=0; layer<Main.backups->Pages->Nb_layers; layer++)
     {
       if ((1<<layer) & Main.layers_visible)
       {
          // Initialize the depth buffer
-         memset(Main_visible_image_depth_buffer.Image,
-           layer,
-           Main.image_width*Main.image_height);
-         
+         memset(depth, layer, area->Width);
          // skip all other layers
          layer++;
          break;
@@ -309,21 +1145,30 @@ void Update_depth_buffer(void)
       // skip the current layer, whenever we reach it
       if (layer == Main.current_layer)
         continue;
-        
+
       if ((1<<layer) & Main.layers_visible)
-      {
-        int i;
-        for (i=0; i<Main.image_width*Main.image_height; i++)
-        {
-          byte color = *(Main.backups->Pages->Image[layer].Pixels+i);
-          if (color != Main.backups->Pages->Transparent_color) // transparent color
-          {
-            *(Main_visible_image_depth_buffer.Image+i) = layer;
-          }
-        }
-      }
+        Overlay_row(NULL, depth, Main.backups->Pages->Image[layer].Pixels + start, area->Width,
+          Main.backups->Pages->Transparent_color, layer);
     }
   }
+}
+
+void Update_depth_buffer_area(short x, short y, short width, short height)
+{
+  if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION
+    && Clip_to_main_image(&x, &y, &width, &height))
+  {
+    // Re-construct the depth buffer with the visible layers.
+    // This function doesn't touch the visible buffer, it assumes
+    // that it was already up-to-date. (Ex. user only changed active layer)
+    T_Rows_area area;
+
+    Update_layers_planes_area(x, y, width, height);
+    area.X = x;
+    area.Y = y;
+    area.Width = width;
+    Run_rows_in_parallel(Update_depth_buffer_rows, &area, height);
+  }
   Update_FX_feedback(Config.FX_Feedback);
 }
 
@@ -357,19 +1202,9 @@ void Redraw_spare_image(void)
     for (; layer<Spare.backups->Pages->Nb_layers; layer++)
     {
       if ((1<<layer) & Spare.layers_visible)
-      {
-        int i;
-        for (i=0; i<Spare.image_width*Spare.image_height; i++)
-        {
-          byte color = *(Spare.backups->Pages->Image[layer].Pixels+i);
-          if (color != Spare.backups->Pages->Transparent_color) // transparent color
-          {
-            *(Spare.visible_image.Image+i) = color;
-            //if (layer != Spare.current_layer)
-            //  *(Spare_visible_image_depth_buffer.Image+i) = layer;
-          }
-        }
-      }
+        // No depth buffer in the spare
+        Overlay_row(Spare.visible_image.Image, NULL, Spare.backups->Pages->Image[layer].Pixels,
+          (long)Spare.image_width*Spare.image_height, Spare.backups->Pages->Transparent_color, layer);
     }
   }
 }
@@ -426,19 +1261,23 @@ byte * FX_feedback_screen;
 void Update_FX_feedback(byte with_feedback)
 {
 
-  if (with_feedback)
-    FX_feedback_screen=Main.backups->Pages->Image[Main.current_layer].Pixels;
-  else
-    FX_feedback_screen=Main.backups->Pages->Next->Image[Main.current_layer].Pixels;
+  if (!with_feedback)
+  {
+    // The effects read the backup as a plain bitmap
+    FX_feedback_screen=Layer_pixels(Main.backups, Main.backups->Pages->Next, Main.current_layer);
+    if (FX_feedback_screen!=NULL)
+      return;
+  }
+  FX_feedback_screen=Main.backups->Pages->Image[Main.current_layer].Pixels;
 }
 
-void Clear_page(T_Page * page)
+void Clear_page(T_List_of_pages * list, T_Page * page)
 {
   // On peut appeler cette fonction sur une page non allouée.
   int i;
   for (i=0; i<page->Nb_layers; i++)
   {
-    Free_layer(page, i);
+    Free_layer(list, page, i);
     page->Image[i].Pixels=NULL;
     page->Image[i].Duration=0;
   }
@@ -481,6 +1320,7 @@ void Init_list_of_pages(T_List_of_pages * list)
 
   list->List_size=0;
   list->Pages=NULL;
+  list->Memory=0;
 }
 
 int Allocate_list_of_pages(T_List_of_pages * list)
@@ -509,7 +1349,7 @@ int Allocate_list_of_pages(T_List_of_pages * list)
 }
 
 
-void Backward_in_list_of_pages(T_List_of_pages * list)
+int Backward_in_list_of_pages(T_List_of_pages * list)
 {
   // Cette fonction fait l'équivalent d'un "Undo" dans la liste de pages.
   // Elle effectue une sorte de ROL (Rotation Left) sur la liste:
@@ -544,12 +1384,29 @@ void Backward_in_list_of_pages(T_List_of_pages * list)
       page0->Prev = page1;
       page1->Next = page0;
       list->Pages = page0;
-      return;
+      return 1;
   }
+  // The history is walked back: the steps can be modified again
+  Modified_page = NULL;
   list->Pages = list->Pages->Next;
+  // The new current page and its backup must be plain bitmaps
+  if (!Untile_page(list, list->Pages) || !Untile_page(list, list->Pages->Next))
+  {
+    // Not enough memory: stay on the current step
+    list->Pages = list->Pages->Prev;
+    if (list->List_size > 2)
+      Tile_page(list, list->Pages->Next->Next);
+    return 0;
+  }
+  // The former current page is now the oldest step (the Redo step)
+  if (list->List_size > 2)
+    Tile_page(list, list->Pages->Prev);
+  if (Config.Undo_memory_budget)
+    Spill_old_pages(list, (long long)Config.Undo_memory_budget*1024*1024);
+  return 1;
 }
 
-void Advance_in_list_of_pages(T_List_of_pages * list)
+int Advance_in_list_of_pages(T_List_of_pages * list)
 {
   // Cette fonction fait l'équivalent d'un "Redo" dans la liste de pages.
   // Elle effectue une sorte de ROR (Rotation Right) sur la liste:
@@ -583,9 +1440,23 @@ void Advance_in_list_of_pages(T_List_of_pages * list)
       page0->Next = page1;
       page1->Prev = page0;
       list->Pages = page1;
-      return;
+      return 1;
   }
+  Modified_page = NULL;
   list->Pages = list->Pages->Prev;
+  // The new current page must be a plain bitmap, its backup already is
+  if (!Untile_page(list, list->Pages))
+  {
+    // Not enough memory: stay on the current step
+    list->Pages = list->Pages->Next;
+    return 0;
+  }
+  // The former backup is now an old step
+  if (list->List_size > 2)
+    Tile_page(list, list->Pages->Next->Next);
+  if (Config.Undo_memory_budget)
+    Spill_old_pages(list, (long long)Config.Undo_memory_budget*1024*1024);
+  return 1;
 }
 
 void Free_last_page_of_list(T_List_of_pages * list)
@@ -597,10 +1468,12 @@ void Free_last_page_of_list(T_List_of_pages * list)
         T_Page * page;
         // The last page is the one before first
         page = list->Pages->Prev;
+        if (page==Modified_page || page->Prev==Modified_page)
+          Modified_page = NULL;
         
         page->Next->Prev = page->Prev;
         page->Prev->Next = page->Next;
-        Clear_page(page);
+        Clear_page(list, page);
         free(page->File_directory);
         free(page->Filename);
         free(page->Filename_unicode);
@@ -611,6 +1484,77 @@ void Free_last_page_of_list(T_List_of_pages * list)
   }
 }
 
+/// Maximum number of pages in a list, including the current one.
+static int Max_pages_in_list(void)
+{
+  if (Config.Undo_memory_budget)
+    return NB_MAX_PAGES_UNDO_BUDGET+1;
+  return Config.Max_undo_pages+1;
+}
+
+/// Moves the tiles of the old steps to the Undo scratch file, starting with
+/// the step which is the farthest from the current page, until the memory
+/// used by the list is at most max_memory.
+/// Returns 0 if nothing could be moved.
+static int Spill_old_pages(T_List_of_pages * list, long long max_memory)
+{
+  long long memory_before = list->Memory;
+  T_Page * page;
+  int i, t;
+
+  if (!Undo_file_open(Config_directory))
+    return 0;
+  // The current page and its backup are never tiled
+  for (page=list->Pages->Prev; page!=list->Pages->Next && page!=list->Pages; page=page->Prev)
+  {
+    for (i=0; i<page->Nb_layers; i++)
+    {
+      if (page->Image[i].Tiles==NULL)
+        continue;
+      for (t=0; t<Nb_tiles(page); t++)
+        if (!Spill_tile(list, page->Image[i].Tiles[t]))
+          return list->Memory < memory_before; // Disk full
+    }
+    if (list->Memory <= max_memory)
+      break;
+  }
+  return list->Memory < memory_before;
+}
+
+/// In memory-budget mode, moves the oldest steps of the list to the
+/// scratch file until the memory used by the list fits in
+/// Config.Undo_memory_budget: each image has its own budget. If it's not
+/// enough, the oldest steps are destroyed. The current page and its backup
+/// are always kept.
+static void Free_pages_over_budget(T_List_of_pages * list)
+{
+  long long budget = (long long)Config.Undo_memory_budget*1024*1024;
+
+  if (!Config.Undo_memory_budget)
+    return;
+  if (list->Memory > budget)
+    Free_recycled_layer();
+  if (list->Memory > budget)
+    Spill_old_pages(list, budget);
+  while (list->List_size > 2 && list->Memory > budget)
+    Free_last_page_of_list(list);
+}
+
+/// Makes room for a new bitmap after an allocation failure: moves all the
+/// old steps to the scratch file, or else destroys the oldest one.
+/// Returns 0 when there is nothing left to release.
+static int Release_old_pages(T_List_of_pages * list)
+{
+  if (Spill_old_pages(list, 0))
+    return 1;
+  if (list->List_size > 1)
+  {
+    Free_last_page_of_list(list);
+    return 1;
+  }
+  return 0;
+}
+
 // layer tells which layers have to be fresh copies instead of references :
 // it's a layer number (>=0) or LAYER_NONE or LAYER_ALL
 int Create_new_page(T_Page * new_page, T_List_of_pages * list, int layer)
@@ -620,25 +1564,30 @@ int Create_new_page(T_Page * new_page, T_List_of_pages * list, int layer)
 // based on the pages's attributes (width,height,...)
 // then pushes it on front of a Page list.
 
-  if (list->List_size >= (Config.Max_undo_pages+1))
+  if (list->List_size >= Max_pages_in_list())
   {
     // List is full.
-    // If some other memory-limit was to be implemented, here would
-    // be the right place to do it.
-    // For example, we could rely on Stats_pages_memory, 
-    // because it's the sum of all bitmaps in use (in bytes).
-    
     // Destroy the latest page
     Free_last_page_of_list(list);
   }
+  // The current backup is about to become an old step.
+  // This is done first, so the bitmaps it frees can be re-used just below.
+  if (list->List_size > 1)
+    Tile_page(list, list->Pages->Next);
   {
     int i;
     for (i=0; i<new_page->Nb_layers; i++)
     {
       if (layer == LAYER_ALL || i == layer)
-        new_page->Image[i].Pixels=New_layer(new_page->Height*new_page->Width);
+      {
+        new_page->Image[i].Pixels=New_layer(list, new_page->Height*new_page->Width);
+        // Out of memory: the old steps make room rather than the new one failing
+        while (new_page->Image[i].Pixels==NULL && Release_old_pages(list))
+          new_page->Image[i].Pixels=New_layer(list, new_page->Height*new_page->Width);
+      }
       else
-        new_page->Image[i].Pixels=Dup_layer(list->Pages->Image[i].Pixels);
+        new_page->Image[i].Pixels=Dup_layer(list->Pages->Image[i].Pixels, new_page->Height*new_page->Width);
+      new_page->Image[i].Tiles=NULL;
       new_page->Image[i].Duration=list->Pages->Image[i].Duration;
     }
   }
@@ -651,6 +1600,8 @@ int Create_new_page(T_Page * new_page, T_List_of_pages * list, int layer)
   list->Pages->Prev = new_page;
   list->Pages = new_page;
   list->List_size++;
+
+  Free_pages_over_budget(list);
   
   return 1;
 }
@@ -672,7 +1623,11 @@ void Free_page_of_a_list(T_List_of_pages * list)
   {
     // On fait faire un undo à la liste, comme ça, la nouvelle page courante
     // est la page précédente
-    Backward_in_list_of_pages(Main.backups);
+    if (!Backward_in_list_of_pages(Main.backups))
+    {
+      Error(0);
+      return;
+    }
 
     // Puis on détruit la dernière page, qui est l'ancienne page courante
     Free_last_page_of_list(list);
@@ -794,7 +1749,7 @@ int Init_all_backup_lists(enum IMAGE_MODES image_mode, int width, int height)
 
   for (i=0; i<Main.backups->Pages->Nb_layers; i++)
   {
-    Main.backups->Pages->Image[i].Pixels=New_layer(width*height);
+    Main.backups->Pages->Image[i].Pixels=New_layer(Main.backups, width*height);
     if (! Main.backups->Pages->Image[i].Pixels)
       return 0;
     memset(Main.backups->Pages->Image[i].Pixels, 0, width*height);
@@ -826,6 +1781,7 @@ int Init_all_backup_lists(enum IMAGE_MODES image_mode, int width, int height)
     memset(Spare.visible_image.Image, 0, width*height);
 
   Download_infos_page_main(Main.backups->Pages);
+  Invalidate_layers_planes();
   Update_FX_feedback(Config.FX_Feedback);
 
   // Default values for spare page
@@ -847,7 +1803,7 @@ int Init_all_backup_lists(enum IMAGE_MODES image_mode, int width, int height)
   // Spare
   for (i=0; i<NB_LAYERS; i++)
   {
-    Spare.backups->Pages->Image[i].Pixels=New_layer(width*height);
+    Spare.backups->Pages->Image[i].Pixels=New_layer(Spare.backups, width*height);
     if (! Spare.backups->Pages->Image[i].Pixels)
       return 0;
     memset(Spare.backups->Pages->Image[i].Pixels, 0, width*height);
@@ -861,8 +1817,15 @@ int Init_all_backup_lists(enum IMAGE_MODES image_mode, int width, int height)
 
 void Set_number_of_backups(int nb_backups)
 {
+  // In memory-budget mode, the number of pages is only a safety limit
+  if (Config.Undo_memory_budget && nb_backups >= 0)
+    nb_backups = NB_MAX_PAGES_UNDO_BUDGET;
   Change_page_number_of_list(Main.backups,nb_backups+1);
   Change_page_number_of_list(Spare.backups,nb_backups+1);
+  Free_pages_over_budget(Main.backups);
+  Free_pages_over_budget(Spare.backups);
+  // Also when all the pages are destroyed, at exit
+  Free_recycled_layer();
 
   // Le +1 vient du fait que dans chaque liste, en 1ère position on retrouve
   // les infos de la page courante sur le brouillon et la page principale.
@@ -895,6 +1858,7 @@ int Backup_new_image(int layers,int width,int height)
   memset(Main_visible_image_depth_buffer.Image, 0, width*height);
   
   Download_infos_page_main(Main.backups->Pages);
+  Invalidate_layers_planes();
   
   return 1;
 }
@@ -945,6 +1909,7 @@ int Backup_with_new_dimensions(int width,int height)
   Update_buffers(width, height);
 
   Download_infos_page_main(Main.backups->Pages);
+  Invalidate_layers_planes();
   
   // Same code as in End_of_modification(),
   // Without saving a safety backup:
@@ -984,7 +1949,7 @@ int Backup_in_place(int width,int height)
   
   for (i=0; i<Main.backups->Pages->Nb_layers; i++)
   {
-    new_layer[i]=New_layer(height*width);
+    new_layer[i]=New_layer(Main.backups, height*width);
     if (!new_layer[i])
     {
       // Allocation error
@@ -1000,7 +1965,7 @@ int Backup_in_place(int width,int height)
   for (i=0; i<Main.backups->Pages->Nb_layers; i++)
   {
     // Replace layers
-    Free_layer(Main.backups->Pages,i);
+    Free_layer(Main.backups, Main.backups->Pages, i);
     Main.backups->Pages->Image[i].Pixels=new_layer[i];
     
     // Fill with transparency
@@ -1011,6 +1976,7 @@ int Backup_in_place(int width,int height)
   Main.backups->Pages->Height=height;
 
   Download_infos_page_main(Main.backups->Pages);
+  Invalidate_layers_planes();
   
   // The following is part of Update_buffers()
   // (without changing the backup buffer)
@@ -1089,11 +2055,59 @@ int Backup_and_resize_the_spare(int width,int height)
   return return_code;
 }
 
+/// Makes a backup in which the working layer shares its tiles with the
+/// new current page, see Backup(). Returns 0 when it can't be done.
+static int Backup_sharing_tiles(int layer)
+{
+  T_Page * backup = Main.backups->Pages;
+  T_Page * new_page;
+  T_Undo_tile ** tiles;
+
+  // The drawing functions of the other modes don't call Unshare_backup_area(),
+  // and a bitmap shared with an older step must not be modified.
+  if (backup->Image_mode != IMAGE_MODE_LAYERED || backup->Image[layer].Pixels==NULL
+    || *((short *)backup->Image[layer].Pixels-1) != 1)
+    return 0;
+
+  Upload_infos_page(&Main);
+  tiles = (T_Undo_tile **)calloc(Nb_tiles(backup), sizeof(T_Undo_tile *));
+  if (tiles==NULL)
+    return 0;
+  new_page=New_page(backup->Nb_layers);
+  if (!new_page)
+  {
+    free(tiles);
+    return 0;
+  }
+  Copy_S_page(new_page,backup);
+  Create_new_page(new_page,Main.backups,LAYER_NONE);
+  if (Shared_backup_page!=NULL)
+  {
+    // The previous backup couldn't be completed: it still needs this bitmap
+    free(tiles);
+    Dup_layer_if_shared(new_page, layer);
+  }
+  else
+  {
+    // The new page keeps the bitmap, the backup gets the tiles one by one
+    Free_layer(Main.backups, backup, layer);
+    backup->Image[layer].Pixels = NULL;
+    backup->Image[layer].Tiles = tiles;
+    Shared_backup_page = backup;
+    Main_shared_backup_layer = layer;
+  }
+  Download_infos_page_main(new_page);
+  Update_FX_feedback(Config.FX_Feedback);
+  Main.image_is_modified=1;
+  return 1;
+}
+
 void Backup(void)
 // Sauve la page courante comme première page de backup et crée une nouvelle page
 // pur continuer à dessiner. Utilisé par exemple pour le fill
 {
-  Backup_layers(Main.current_layer);
+  if (!Backup_sharing_tiles(Main.current_layer))
+    Backup_layers(Main.current_layer);
 }
 
 void Backup_layers(int layer)
@@ -1122,6 +2136,9 @@ void Backup_layers(int layer)
   Copy_S_page(new_page,Main.backups->Pages);
   Create_new_page(new_page,Main.backups,layer);
   Download_infos_page_main(new_page);
+  // The other layers are going to change
+  if (layer != Main.current_layer)
+    Invalidate_layers_planes();
 
   Update_FX_feedback(Config.FX_Feedback);
 
@@ -1144,7 +2161,7 @@ void Backup_layers(int layer)
   */
 }
 
-/// Backs up a layer, unless it's already different from previous history step.
+/// Backs up a layer of a page of Main.backups, unless it's already different from previous history step.
 // This function checks if a layer/frame shares the same
 // bitmap as its Undo history parent.
 // If this is the case, it instanciates a new copy, and returns true.
@@ -1153,8 +2170,8 @@ int Dup_layer_if_shared(T_Page * page, int layer)
 {
   if (page->Image[layer].Pixels == page->Next->Image[layer].Pixels)
   {
-    Free_layer(page, layer);
-    page->Image[layer].Pixels=New_layer(page->Height*page->Width);
+    Free_layer(Main.backups, page, layer);
+    page->Image[layer].Pixels=New_layer(Main.backups, page->Height*page->Width);
     memcpy(
       page->Image[layer].Pixels,
       page->Next->Image[layer].Pixels,
@@ -1206,10 +2223,82 @@ void Check_layers_limits()
   }
 }
     
+/// Computes the rectangle where the pixels of two pages of the list can look different.
+/// Returns 0 when the whole image has to be redrawn instead.
+/// A history step made by Backup_layers() shares the bitmaps of the other
+/// layers, so usually only one layer is compared, and most of its rows by
+/// a single memcmp().
+static int Pages_difference_area(T_List_of_pages * list, T_Page * page1, T_Page * page2, short * x, short * y, short * width, short * height)
+{
+  short min_x, max_x, min_y, max_y;
+  int layer;
+
+  if (page1->Width != page2->Width || page1->Height != page2->Height
+    || Main.visible_image.Width != page1->Width || Main.visible_image.Height != page1->Height
+    || page1->Nb_layers != page2->Nb_layers
+    || page1->Image_mode != page2->Image_mode || page1->Image_mode == IMAGE_MODE_ANIMATION
+    || page1->Transparent_color != page2->Transparent_color)
+    return 0;
+
+  min_x = page1->Width;
+  max_x = -1;
+  min_y = -1;
+  max_y = -1;
+  for (layer=0; layer<page1->Nb_layers; layer++)
+  {
+    const byte * pixels1;
+    const byte * pixels2;
+    short row;
+
+    // Hidden layers don't matter, except for the raster modes
+    if (!((1<<layer) & Main.layers_visible)
+      && page1->Image_mode != IMAGE_MODE_MODE5 && page1->Image_mode != IMAGE_MODE_RASTER)
+      continue;
+    pixels1 = Layer_pixels(list, page1, layer);
+    pixels2 = Layer_pixels(list, page2, layer);
+    if (pixels1==NULL || pixels2==NULL)
+      return 0;
+    if (pixels1==pixels2)
+      continue; // Shared bitmap: no change at all
+    for (row=0; row<page1->Height; row++, pixels1+=page1->Width, pixels2+=page1->Width)
+    {
+      short i;
+
+      if (!memcmp(pixels1, pixels2, page1->Width))
+        continue;
+      for (i=0; i<min_x && pixels1[i]==pixels2[i]; i++)
+        ;
+      min_x = i;
+      for (i=page1->Width-1; i>max_x && pixels1[i]==pixels2[i]; i--)
+        ;
+      max_x = i;
+      if (min_y<0 || row<min_y)
+        min_y = row;
+      if (row>max_y)
+        max_y = row;
+    }
+  }
+  if (min_y<0)
+  {
+    // Identical
+    *x = *y = *width = *height = 0;
+    return 1;
+  }
+  *x = min_x;
+  *y = min_y;
+  *width = max_x - min_x + 1;
+  *height = max_y - min_y + 1;
+  return 1;
+}
+
 void Undo(void)
 {
   int width = Main.image_width;
   int height = Main.image_height;
+  dword layers_visible = Main.layers_visible;
+  int current_layer = Main.current_layer;
+  short x, y, area_width, area_height;
+  int partial_redraw;
 
   if (Last_backed_up_layers)
   {
@@ -1220,20 +2309,32 @@ void Undo(void)
   // On remet à jour l'état des infos de la page courante (pour pouvoir les
   // retrouver plus tard)
   Upload_infos_page(&Main);
+  // Only the area where the two steps differ will be re-composed
+  partial_redraw = Pages_difference_area(Main.backups, Main.backups->Pages, Main.backups->Pages->Next,
+    &x, &y, &area_width, &area_height);
   // On fait faire un undo à la liste des backups de la page principale
-  Backward_in_list_of_pages(Main.backups);
+  if (!Backward_in_list_of_pages(Main.backups))
+  {
+    // Not enough memory to re-assemble the step: nothing changed
+    Error(0);
+    return;
+  }
 
   Update_buffers(Main.backups->Pages->Width, Main.backups->Pages->Height);
 
   // On extrait ensuite les infos sur la nouvelle page courante
   Download_infos_page_main(Main.backups->Pages);
+  Invalidate_layers_planes();
   // Note: le backup n'a pas obligatoirement les mêmes dimensions ni la même
   //       palette que la page courante. Mais en temps normal, le backup
   //       n'est pas utilisé à la suite d'un Undo. Donc ça ne devrait pas
   //       poser de problèmes.
   
   Check_layers_limits();
-  Redraw_layered_image();
+  if (partial_redraw && layers_visible == Main.layers_visible && current_layer == Main.current_layer)
+    Redraw_layered_image_area(x, y, area_width, area_height);
+  else
+    Redraw_layered_image();
   End_of_modification();
 
   if (width != Main.image_width || height != Main.image_height)
@@ -1244,6 +2345,10 @@ void Redo(void)
 {
   int width = Main.image_width;
   int height = Main.image_height;
+  dword layers_visible = Main.layers_visible;
+  int current_layer = Main.current_layer;
+  short x, y, area_width, area_height;
+  int partial_redraw;
 
   if (Last_backed_up_layers)
   {
@@ -1253,20 +2358,32 @@ void Redo(void)
   // On remet à jour l'état des infos de la page courante (pour pouvoir les
   // retrouver plus tard)
   Upload_infos_page(&Main);
+  // Only the area where the two steps differ will be re-composed
+  partial_redraw = Pages_difference_area(Main.backups, Main.backups->Pages, Main.backups->Pages->Prev,
+    &x, &y, &area_width, &area_height);
   // On fait faire un redo à la liste des backups de la page principale
-  Advance_in_list_of_pages(Main.backups);
+  if (!Advance_in_list_of_pages(Main.backups))
+  {
+    // Not enough memory to re-assemble the step: nothing changed
+    Error(0);
+    return;
+  }
 
   Update_buffers(Main.backups->Pages->Width, Main.backups->Pages->Height);
 
   // On extrait ensuite les infos sur la nouvelle page courante
   Download_infos_page_main(Main.backups->Pages);
+  Invalidate_layers_planes();
   // Note: le backup n'a pas obligatoirement les mêmes dimensions ni la même
   //       palette que la page courante. Mais en temps normal, le backup
   //       n'est pas utilisé à la suite d'un Redo. Donc ça ne devrait pas
   //       poser de problèmes.
   
   Check_layers_limits();
-  Redraw_layered_image();
+  if (partial_redraw && layers_visible == Main.layers_visible && current_layer == Main.current_layer)
+    Redraw_layered_image_area(x, y, area_width, area_height);
+  else
+    Redraw_layered_image();
   End_of_modification();
 
   if (width != Main.image_width || height != Main.image_height)
@@ -1280,6 +2397,7 @@ void Free_current_page(void)
   
   // On extrait ensuite les infos sur la nouvelle page courante
   Download_infos_page_main(Main.backups->Pages);
+  Invalidate_layers_planes();
   // Note: le backup n'a pas obligatoirement les mêmes dimensions ni la même
   //       palette que la page courante. Mais en temps normal, le backup
   //       n'est pas utilisé à la suite d'une destruction de page. Donc ça ne
@@ -1336,13 +2454,15 @@ byte Add_layer(T_List_of_pages *list, int layer)
 
   if (list->Pages->Nb_layers >= Layers_max(list->Pages->Image_mode)) // MAX_NB_LAYERS
     return 1;
+  if (list == Main.backups)
+    Invalidate_layers_planes();
    
   // Keep the position reasonable
   if (layer > list->Pages->Nb_layers)
     layer = list->Pages->Nb_layers;
    
   // Allocate the pixel data
-  new_image = New_layer(list->Pages->Height*list->Pages->Width);
+  new_image = New_layer(list, list->Pages->Height*list->Pages->Width);
   if (! new_image)
   {
     Error(0);
@@ -1371,6 +2491,7 @@ byte Add_layer(T_List_of_pages *list, int layer)
     new_page->Image[i]=new_page->Image[i-1];
   }
   new_page->Image[layer].Pixels=new_image;
+  new_page->Image[layer].Tiles=NULL;
   if (list->Pages->Nb_layers==0)
     duration=100;
   else if (layer>0)
@@ -1423,6 +2544,8 @@ byte Delete_layer(T_List_of_pages *list, int layer)
     layer = list->Pages->Nb_layers - 1;
   if (list->Pages->Nb_layers == 1)
     return 1;
+  if (list == Main.backups)
+    Invalidate_layers_planes();
    
   // For simplicity, we won't actually shrink the page in terms of allocation.
   // It would only save the size of a pointer, and anyway, as the user draws,
@@ -1430,7 +2553,7 @@ byte Delete_layer(T_List_of_pages *list, int layer)
   // and so it will be cleared anyway.
   
   // Smart freeing of the pixel data
-  Free_layer(list->Pages, layer);
+  Free_layer(list, list->Pages, layer);
   
   list->Pages->Nb_layers--;
   // Move around the pointers. This part is going to be tricky when we
@@ -1482,13 +2605,9 @@ byte Delete_layer(T_List_of_pages *list, int layer)
 /// Merges the current layer onto the one below it.
 byte Merge_layer(void)
 {
-  int i;
-  for (i=0; i<Main.image_width*Main.image_height; i++)
-  {
-    byte color = *(Main.backups->Pages->Image[Main.current_layer].Pixels+i);
-    if (color != Main.backups->Pages->Transparent_color) // transparent color
-      *(Main.backups->Pages->Image[Main.current_layer-1].Pixels+i) = color;
-  }
+  Overlay_row(Main.backups->Pages->Image[Main.current_layer-1].Pixels, NULL,
+    Main.backups->Pages->Image[Main.current_layer].Pixels,
+    (long)Main.image_width*Main.image_height, Main.backups->Pages->Transparent_color, 0);
   return Delete_layer(Main.backups,Main.current_layer);
 }
 
@@ -1499,6 +2618,7 @@ void Switch_layer_mode(enum IMAGE_MODES new_mode)
     return;
 
   Main.backups->Pages->Image_mode = new_mode;
+  Invalidate_layers_planes();
 
   if (new_mode != IMAGE_MODE_ANIMATION)
   {
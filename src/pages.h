@@ -45,11 +45,35 @@ extern T_Bitmap Main_visible_image_backup;
  * Points to the right layer.
  */
 extern T_Bitmap Main_visible_image_depth_buffer;
+/** The visible layers under the current one, flattened.
+ *
+ * Transparent color where the current layer is the lowest visible one.
+ * Only kept in ::IMAGE_MODE_LAYERED, see ::Main_layers_planes_layer.
+ */
+extern T_Bitmap Main_layers_below;
+/** The visible layers over the current one, flattened.
+ *
+ * Transparent color where all of them are transparent.
+ */
+extern T_Bitmap Main_layers_above;
+/// Layer for which ::Main_layers_below and ::Main_layers_above were
+/// computed, or -1 when they can't be used. See Layers_planes_ready().
+extern int Main_layers_planes_layer;
+/// Layer of the backup of the current page which still shares the tiles
+/// that weren't modified since Backup(), or -1.
+/// The pixels of this layer of the current page must be written after a
+/// call to Unshare_backup_area().
+extern int Main_shared_backup_layer;
 
 ///
 /// INDIVIDUAL PAGES
 ///
 
+/// Allocate and initialize a new page.
+T_Page * New_page(int nb_layers);
+/// Allocate a new layer for a page of the list
+byte * New_layer(T_List_of_pages * list, long pixel_size);
+void Copy_S_page(T_Page * dest, T_Page * source);
 void Download_infos_page_main(T_Page * page);
 /// Add a new layer to latest page of a list. Returns 0 on success.
 byte Add_layer(T_List_of_pages *list, int layer);
@@ -57,8 +81,13 @@ byte Add_layer(T_List_of_pages *list, int layer);
 byte Delete_layer(T_List_of_pages *list, int layer);
 /// Merges the current layer onto the one below it.
 byte Merge_layer(void);
-/// Backs up a layer, unless it's already different from previous history step.
+/// Backs up a layer of the current page of Main.backups, unless it's already different from previous history step.
 int Dup_layer_if_shared(T_Page * page, int layer);
+/// Returns the pixels of a layer as a plain bitmap, re-assembling it from its tiles if needed.
+byte * Layer_pixels(T_List_of_pages * list, T_Page * page, int layer);
+/// Gives the backup its own copy of the tiles of an area of the layer
+/// ::Main_shared_backup_layer, before they are modified in the current page.
+void Unshare_backup_area(short x, short y, short width, short height);
 
 void Upload_infos_page(T_Document * doc);
 
@@ -70,8 +99,10 @@ void Upload_infos_page(T_Document * doc);
 void Init_list_of_pages(T_List_of_pages * list);
 // private
 int Allocate_list_of_pages(T_List_of_pages * list);
-void Backward_in_list_of_pages(T_List_of_pages * list);
-void Advance_in_list_of_pages(T_List_of_pages * list);
+/// Undo in a list of pages. Returns 0 if out of memory: the list is unchanged.
+int Backward_in_list_of_pages(T_List_of_pages * list);
+/// Redo in a list of pages. Returns 0 if out of memory: the list is unchanged.
+int Advance_in_list_of_pages(T_List_of_pages * list);
 void Free_last_page_of_list(T_List_of_pages * list);
 int Create_new_page(T_Page * new_page,T_List_of_pages * current_list, int layer);
 void Change_page_number_of_list(T_List_of_pages * list,int number);
@@ -98,7 +129,11 @@ int Backup_in_place(int width,int height);
 /// Backup the spare image, the one you don't see.
 void Backup_the_spare(int layer);
 int Backup_and_resize_the_spare(int width,int height);
-/// Backup with a new copy for the working layer, and references for all others.
+/// Backup of the working layer, and references for all others.
+/// In ::IMAGE_MODE_LAYERED, the backup shares the tiles of the working layer
+/// until the pixel functions of graph.c modify them. Code which writes in
+/// the layer by other means, or reads the backup directly, uses
+/// Backup_layers(Main.current_layer) instead.
 void Backup(void);
 /// Backup with a new copy of some layers (the others are references).
 void Backup_layers(int layer);
@@ -110,6 +145,29 @@ void End_of_modification(void);
 void Update_depth_buffer(void);
 void Redraw_layered_image(void);
 void Redraw_current_layer(void);
+/// Re-composes the visible image and the depth buffer, only in a rectangle of the main image.
+void Redraw_layered_image_area(short x, short y, short width, short height);
+/// Re-computes the depth buffer, only in a rectangle of the main image.
+void Update_depth_buffer_area(short x, short y, short width, short height);
+/// Re-computes ::Main_layers_below and ::Main_layers_above in a rectangle
+/// of the main image, when they are up to date elsewhere.
+/// Called by Redraw_layered_image_area() and Update_depth_buffer_area().
+void Update_layers_planes_area(short x, short y, short width, short height);
+/// Marks ::Main_layers_below and ::Main_layers_above as out of date: to call
+/// when a layer other than the current one changes without a redraw.
+void Invalidate_layers_planes(void);
+/// Re-computes ::Main_layers_below and ::Main_layers_above if they are out
+/// of date. Returns 0 if they can't be used.
+int Layers_planes_ready(void);
+/// Releases ::Main_layers_below and ::Main_layers_above.
+void Free_layers_planes(void);
+/// Bounding box of the non-transparent pixels of a layer of the main image.
+/// Returns 0 if the layer is fully transparent.
+int Layer_used_area(int layer, short * x, short * y, short * width, short * height);
+/// Updates the visible image and the depth buffer after a change of
+/// Main.layers_visible and/or Main.current_layer, only where the
+/// layers involved have pixels.
+void Redraw_after_layers_change(dword old_layers_visible, int old_current_layer);
 
 void Update_screen_targets(void);
 /// Update all the special image buffers, if necessary.
@@ -131,5 +189,11 @@ void Switch_layer_mode(enum IMAGE_MODES new_mode);
 extern long  Stats_pages_number;
 /// Total memory used by bitmaps (layers, animation frames, backups)
 extern long long  Stats_pages_memory;
+/// Part of ::Stats_pages_memory used by more than one history step
+extern long long  Stats_pages_shared_memory;
+/// Memory that the bitmaps would use without compression
+extern long long  Stats_pages_unpacked_memory;
+/// Memory of the bitmaps moved to the Undo scratch file
+extern long long  Stats_pages_spilled_memory;
 
 #endif
@@ -319,97 +319,6 @@ void Update_color_count(short * used_colors, dword * color_usage)
   Display_cursor();
 }
 
-void Remap_zone_highlevel(short x1, short y1, short x2, short y2,
-                     byte * conversion_table)
-// Attention: Remappe une zone de coins x1,y1 et x2-1,y2-1 !!!
-{
-  short x_pos;
-  short y_pos;
-
-  for (y_pos=y1;y_pos<y2;y_pos++)
-    for (x_pos=x1;x_pos<x2;x_pos++)
-    {
-      if ((y_pos>=Window_pos_Y) && (y_pos<Window_pos_Y+(Window_height*Menu_factor_Y)) &&
-          (x_pos>=Window_pos_X) && (x_pos<Window_pos_X+(Window_width*Menu_factor_X)) )
-        x_pos=Window_pos_X+(Window_width*Menu_factor_X)-1;
-      else
-        Pixel(x_pos,y_pos,conversion_table[Read_pixel(x_pos,y_pos)]);
-    }
-}
-
-void Remap_image_highlevel(byte * conversion_table)
-{
-  short end_x;
-  short end_y;
-  short end_x_mag=0;
-  short end_y_mag=0;
-  int layer;
-
-  // Remap the flatenned image view
-  if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION
-      && Main.backups->Pages->Image_mode != IMAGE_MODE_MODE5
-      && Main.backups->Pages->Image_mode != IMAGE_MODE_RASTER)
-  {
-    Remap_general_lowlevel(conversion_table,Main.visible_image.Image,Main.visible_image.Image,
-                         Main.image_width,Main.image_height,Main.image_width);
-  }
-  // Remap all layers
-  for (layer=0; layer<Main.backups->Pages->Nb_layers; layer++)
-    Remap_general_lowlevel(conversion_table,Main.backups->Pages->Image[layer].Pixels,Main.backups->Pages->Image[layer].Pixels,Main.image_width,Main.image_height,Main.image_width);
-
-  // Remap transparent color
-  Main.backups->Pages->Transparent_color =
-    conversion_table[Main.backups->Pages->Transparent_color];
-
-  // On calcule les limites à l'écran de l'image
-  if (Main.image_height>=Menu_Y_before_window)
-    end_y=Menu_Y_before_window;
-  else
-    end_y=Main.image_height;
-
-  if (!Main.magnifier_mode)
-  {
-    if (Main.image_width>=Screen_width)
-      end_x=Screen_width;
-    else
-      end_x=Main.image_width;
-
-  }
-  else
-  {
-    if (Main.image_width>=Main.separator_position)
-      end_x=Main.separator_position;
-    else
-      end_x=Main.image_width;
-
-    if ((Main.X_zoom+(Main.image_width*Main.magnifier_factor))>=Screen_width)
-      end_x_mag=Screen_width;
-    else
-      end_x_mag=(Main.X_zoom+(Main.image_width*Main.magnifier_factor));
-
-    if (Main.image_height*Main.magnifier_factor>=Menu_Y_before_window)
-      end_y_mag=Menu_Y_before_window;
-    else
-      end_y_mag=Main.image_height*Main.magnifier_factor;
-  }
-
-  // On doit maintenant faire la traduction à l'écran
-  Remap_zone_highlevel(0,0,end_x,end_y,conversion_table);
-
-  if (Main.magnifier_mode)
-  {
-    Remap_zone_highlevel(Main.separator_position,0,end_x_mag,end_y_mag,conversion_table);
-    // Il peut encore rester le bas de la barre de split à remapper si la
-    // partie zoomée ne descend pas jusqu'en bas...
-    Remap_zone_highlevel(Main.separator_position,end_y_mag,
-                    (Main.separator_position+(SEPARATOR_WIDTH*Menu_factor_X)),
-                    Menu_Y_before_window,conversion_table);
-  }
-  // Remappe tous les fonds de fenetre (qui doivent contenir un bout d'écran)
-  Remap_window_backgrounds(conversion_table, 0, Menu_Y_before_window);
-}
-
-
 void Swap(int with_remap,short block_1_start,short block_2_start,short block_size,T_Palette palette, dword * color_usage)
 {
   short pos_1;
@@ -568,6 +477,7 @@ void Set_nice_menu_colors(dword * color_usage,int not_picture)
     Main.palette[color].G=Round_palette_component(target_rgb->G);
     Main.palette[color].B=Round_palette_component(target_rgb->B);
   }
+  Palette_changed();
 
   //   Maintenant qu'on a placé notre nouvelle palette, on va chercher quelles
   // sont les couleurs qui peuvent remplacer les anciennes
@@ -3058,6 +2968,7 @@ void Button_Secondary_palette(int btn)
   if (clicked_button==1)
   {
     Menu_tag_colors("Tag colors to exclude",Exclude_color,&dummy,1, NULL, SPECIAL_EXCLUDE_COLORS_MENU);
+    Palette_changed();
   }
   else if (clicked_button==2)
   {
@@ -0,0 +1,220 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file pxrender.c
+/// The renderers for all sizes of pixels, built from pxtemplate.h.
+
+#include <string.h>
+#include <stdlib.h>
+#include "global.h"
+#include "screen.h"
+#include "misc.h"
+#include "graph.h"
+#include "composite.h"
+#include "pxzoom.h"
+#include "pxrender.h"
+
+/// Writes a color in @p count consecutive screen pixels
+static void Put_zoomed_pixel(byte * dest, int count, byte color)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+    dest[i] = color;
+}
+
+/// Copies the @p width screen pixels at (x, y) in the rows below, to make
+/// @p count identical rows.
+static void Repeat_row(int x, int y, int width, int count)
+{
+  int i;
+
+  for (i = 1; i < count; i++)
+    memcpy(Get_Screen_pixel_ptr(x, y + i), Get_Screen_pixel_ptr(x, y), width);
+}
+
+#define PX_NAME(name, suffix) name##_##suffix
+#define PX_EXPAND(name, suffix) PX_NAME(name, suffix)
+#define PX(name) PX_EXPAND(name, PX_SUFFIX)
+
+#define ZOOMX 1
+#define ZOOMY 1
+#define PX_SUFFIX simple
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 1
+#define ZOOMY 2
+#define PX_SUFFIX tall
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 2
+#define ZOOMY 1
+#define PX_SUFFIX wide
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 2
+#define ZOOMY 2
+#define PX_SUFFIX double
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 3
+#define ZOOMY 3
+#define PX_SUFFIX triple
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 4
+#define ZOOMY 2
+#define PX_SUFFIX wide2
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 2
+#define ZOOMY 4
+#define PX_SUFFIX tall2
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 3
+#define ZOOMY 4
+#define PX_SUFFIX tall3
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+#define ZOOMX 4
+#define ZOOMY 4
+#define PX_SUFFIX quad
+#include "pxtemplate.h"
+#undef ZOOMX
+#undef ZOOMY
+#undef PX_SUFFIX
+
+static void Horizontal_grid_line(word x_pos,word y_pos,word width)
+{
+  int x;
+
+  for (x=!(x_pos&1);x<width;x+=2)
+    Pixel(x_pos+x, y_pos, xor_lut[Get_Screen_pixel((x_pos+x)*Pixel_width, (y_pos-1)*Pixel_height)]);
+}
+
+static void Vertical_grid_line(word x_pos,word y_pos,word height)
+{
+  int y;
+
+  for (y=!(y_pos&1);y<height;y+=2)
+    Pixel(x_pos, y_pos+y, xor_lut[Get_Screen_pixel(x_pos*Pixel_width-1, (y_pos+y)*Pixel_height)]);
+}
+
+// Tile Grid
+void Redraw_grid(short x, short y, unsigned short w, unsigned short h)
+{
+  int row, col;
+  if (!Show_grid)
+    return;
+
+  row=y-y%Main.magnifier_factor+((Snap_height*1000-(y-0)/Main.magnifier_factor-Main.magnifier_offset_Y+Snap_offset_Y-1)%Snap_height)*Main.magnifier_factor+Main.magnifier_factor-1;
+  while (row < y+h)
+  {
+    Horizontal_grid_line(x, row, w);
+    row+= Snap_height*Main.magnifier_factor;
+  }
+
+  col=x-(x-Main.X_zoom)%Main.magnifier_factor+((Snap_width*1000-(x-Main.X_zoom)/Main.magnifier_factor-Main.magnifier_offset_X+Snap_offset_X-1)%Snap_width)*Main.magnifier_factor+Main.magnifier_factor-1;
+  while (col < x+w)
+  {
+    Vertical_grid_line(col, y, h);
+    col+= Snap_width*Main.magnifier_factor;
+  }
+}
+
+/// Moves the pixels of a rectangle of the screen by (dx, dy).
+/// The pixels moved out of the rectangle are lost, the ones uncovered are
+/// left as they are.
+static void Move_screen_area(int x, int y, int width, int height, int dx, int dy)
+{
+  int length = (width - abs(dx)) * Pixel_width;
+  int dest_x = (x + (dx > 0 ? dx : 0)) * Pixel_width;
+  int src_x = (x + (dx < 0 ? -dx : 0)) * Pixel_width;
+  int row;
+
+  y *= Pixel_height;
+  height *= Pixel_height;
+  dy *= Pixel_height;
+  // Rows are copied in the order which doesn't overwrite the ones to read
+  if (dy <= 0)
+  {
+    for (row = y; row < y + height + dy; row++)
+      memmove(Get_Screen_pixel_ptr(dest_x, row), Get_Screen_pixel_ptr(src_x, row - dy), length);
+  }
+  else
+  {
+    for (row = y + height - 1; row >= y + dy; row--)
+      memmove(Get_Screen_pixel_ptr(dest_x, row), Get_Screen_pixel_ptr(src_x, row - dy), length);
+  }
+}
+
+void Scroll_zoomed_screen(int dx, int dy)
+{
+  int factor = Main.magnifier_factor;
+  int top, bottom;
+
+  Move_screen_area(Main.X_zoom, 0, Main.magnifier_width * factor, Menu_Y, -dx * factor, -dy * factor);
+  Update_rect(Main.X_zoom, 0, Main.magnifier_width * factor, Menu_Y);
+  // The uncovered rows, on the whole width. They start on a row of the
+  // image, so the grid is the same as on a complete redraw.
+  top = 0;
+  bottom = Menu_Y;
+  if (dy > 0)
+  {
+    bottom = Menu_Y - dy * factor;
+    bottom -= bottom % factor;
+    Display_zoomed_area(0, Main.magnifier_width, bottom, Menu_Y, Main.image_width, Horizontal_line_buffer);
+  }
+  else if (dy < 0)
+  {
+    top = -dy * factor;
+    Display_zoomed_area(0, Main.magnifier_width, 0, top, Main.image_width, Horizontal_line_buffer);
+  }
+  // The uncovered columns, on the other rows
+  if (dx > 0)
+    Display_zoomed_area(Main.magnifier_width - dx, dx, top, bottom, Main.image_width, Horizontal_line_buffer);
+  else if (dx < 0)
+    Display_zoomed_area(0, -dx, top, bottom, Main.image_width, Horizontal_line_buffer);
+}
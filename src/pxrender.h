@@ -0,0 +1,77 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file pxrender.h
+/// Renderers for the different sizes of pixels (see ::PIXEL_RATIO).
+///
+/// All of them are built in pxrender.c from the same code, pxtemplate.h,
+/// specialized for each size. Init_mode_video() picks the one of the
+/// current ::Pixel_ratio.
+
+#ifndef PXRENDER_H_INCLUDED
+#define PXRENDER_H_INCLUDED
+
+#include "struct.h"
+
+/// Declares the functions of a renderer, with their names ending with _suffix
+#define DECLARE_PIXEL_RENDERER(suffix) \
+  void Pixel_##suffix                      (word x,word y,byte color); \
+  byte Read_pixel_##suffix                 (word x,word y); \
+  void Block_##suffix                      (word start_x,word start_y,word width,word height,byte color); \
+  void Pixel_preview_normal_##suffix       (word x,word y,byte color); \
+  void Pixel_preview_magnifier_##suffix    (word x,word y,byte color); \
+  void Horizontal_XOR_line_##suffix        (word x_pos,word y_pos,word width); \
+  void Vertical_XOR_line_##suffix          (word x_pos,word y_pos,word height); \
+  void Display_brush_color_##suffix        (word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,word brush_width); \
+  void Display_brush_mono_##suffix         (word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,byte color,word brush_width); \
+  void Clear_brush_##suffix                (word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,word image_width); \
+  void Remap_screen_##suffix               (word x_pos,word y_pos,word width,word height,byte * conversion_table); \
+  void Display_part_of_screen_##suffix     (word width,word height,word image_width); \
+  void Display_line_on_screen_##suffix     (word x_pos,word y_pos,word width,byte * line); \
+  void Display_line_on_screen_fast_##suffix(word x_pos,word y_pos,word width,byte * line); \
+  void Read_line_screen_##suffix           (word x_pos,word y_pos,word width,byte * line); \
+  void Display_part_of_screen_scaled_##suffix(word width,word height,word image_width,byte * buffer); \
+  void Display_part_of_screen_scaled_area_##suffix(word x,word width,word top,word bottom,word image_width,byte * buffer); \
+  void Display_brush_color_zoom_##suffix   (word x_pos,word y_pos,word x_offset,word y_offset,word width,word end_y_pos,byte transp_color,word brush_width,byte * buffer); \
+  void Display_brush_mono_zoom_##suffix    (word x_pos,word y_pos,word x_offset,word y_offset,word width,word end_y_pos,byte transp_color,byte color,word brush_width,byte * buffer); \
+  void Clear_brush_scaled_##suffix         (word x_pos,word y_pos,word x_offset,word y_offset,word width,word end_y_pos,byte transp_color,word image_width,byte * buffer); \
+  void Display_brush_##suffix              (byte * brush, word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,word brush_width);
+
+DECLARE_PIXEL_RENDERER(simple)
+DECLARE_PIXEL_RENDERER(tall)
+DECLARE_PIXEL_RENDERER(wide)
+DECLARE_PIXEL_RENDERER(double)
+DECLARE_PIXEL_RENDERER(triple)
+DECLARE_PIXEL_RENDERER(wide2)
+DECLARE_PIXEL_RENDERER(tall2)
+DECLARE_PIXEL_RENDERER(tall3)
+DECLARE_PIXEL_RENDERER(quad)
+
+/**
+ * Updates the magnifier after its offsets moved by (dx, dy) image pixels.
+ *
+ * The zoomed pixels which stay visible are moved on the screen, and only
+ * the uncovered rows and columns are drawn, with Display_zoomed_area().
+ * The image must fill the magnifier before and after, and with the grid,
+ * dx and dy times the factor must be even, so the dots stay in place.
+ */
+void Scroll_zoomed_screen(int dx, int dy);
+
+#endif
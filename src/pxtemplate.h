@@ -0,0 +1,351 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file pxtemplate.h
+/// Code of the renderers, included by pxrender.c once per size of pixels.
+///
+/// Before each inclusion, ZOOMX and ZOOMY give the number of screen pixels
+/// per pixel, and PX(name) gives the name of a function of this renderer.
+/// The sizes being constants, the compiler makes a specialized version of
+/// each loop.
+
+void PX(Pixel) (word x,word y,byte color)
+/* Affiche un pixel de la color aux coords x;y à l'écran */
+{
+  int dx, dy;
+
+  for (dy = 0; dy < ZOOMY; dy++)
+    for (dx = 0; dx < ZOOMX; dx++)
+      Set_Screen_pixel(x * ZOOMX + dx, y * ZOOMY + dy, color);
+}
+
+byte PX(Read_pixel) (word x,word y)
+/* On retourne la couleur du pixel aux coords données */
+{
+  return Get_Screen_pixel(x * ZOOMX, y * ZOOMY);
+}
+
+void PX(Block) (word start_x,word start_y,word width,word height,byte color)
+/* On affiche un rectangle de la couleur donnée */
+{
+  Screen_FillRect(start_x * ZOOMX, start_y * ZOOMY, width * ZOOMX, height * ZOOMY, color);
+}
+
+void PX(Display_part_of_screen) (word width,word height,word image_width)
+/* Afficher une partie de l'image telle quelle sur l'écran */
+{
+  const byte * src = Main.offset_Y * image_width + Main.offset_X + Main_screen;
+  int y;
+
+  for (y = 0; y < height; y++)
+  {
+    Zoom_line(src, Get_Screen_pixel_ptr(0, y * ZOOMY), ZOOMX, width);
+    Repeat_row(0, y * ZOOMY, width * ZOOMX, ZOOMY);
+    src += image_width;
+  }
+}
+
+void PX(Pixel_preview_normal) (word x,word y,byte color)
+/* Affichage d'un pixel dans l'écran, par rapport au décalage de l'image
+ * dans l'écran, en mode normal (pas en mode loupe) */
+{
+  PX(Pixel)(x - Main.offset_X, y - Main.offset_Y, color);
+}
+
+void PX(Pixel_preview_magnifier) (word x,word y,byte color)
+{
+  // Affiche le pixel dans la partie non zoomée
+  PX(Pixel)(x - Main.offset_X, y - Main.offset_Y, color);
+
+  // Regarde si on doit aussi l'afficher dans la partie zoomée
+  if (y >= Limit_top_zoom && y <= Limit_visible_bottom_zoom
+          && x >= Limit_left_zoom && x <= Limit_visible_right_zoom)
+  {
+    int height;
+    int y_zoom = Main.magnifier_factor * (y-Main.magnifier_offset_Y);
+
+    if (Menu_Y - y_zoom < Main.magnifier_factor)
+      // On ne doit dessiner qu'un morceau du pixel
+      // sinon on dépasse sur le menu
+      height = Menu_Y - y_zoom;
+    else
+      height = Main.magnifier_factor;
+
+    PX(Block)(
+      Main.magnifier_factor * (x-Main.magnifier_offset_X) + Main.X_zoom,
+      y_zoom, Main.magnifier_factor, height, color
+      );
+  }
+}
+
+void PX(Horizontal_XOR_line) (word x_pos,word y_pos,word width)
+{
+  byte * dest = Get_Screen_pixel_ptr(x_pos * ZOOMX, y_pos * ZOOMY);
+  int x;
+
+  for (x = 0; x < width * ZOOMX; x += ZOOMX)
+    Put_zoomed_pixel(dest + x, ZOOMX, xor_lut[dest[x]]);
+  Repeat_row(x_pos * ZOOMX, y_pos * ZOOMY, width * ZOOMX, ZOOMY);
+}
+
+void PX(Vertical_XOR_line) (word x_pos,word y_pos,word height)
+{
+  int y;
+
+  for (y = y_pos; y < y_pos + height; y++)
+    PX(Pixel)(x_pos, y, xor_lut[Get_Screen_pixel(x_pos * ZOOMX, y * ZOOMY)]);
+}
+
+/// Copies the pixels of a row which are not transparent, each one ZOOMX
+/// times in the ZOOMY rows of the screen.
+static void PX(Display_transparent_row) (word x_pos,word y_pos,word width,const byte * src,byte transp_color)
+{
+  int x, dy;
+
+  for (dy = 0; dy < ZOOMY; dy++)
+  {
+    byte * dest = Get_Screen_pixel_ptr(x_pos * ZOOMX, y_pos * ZOOMY + dy);
+
+    for (x = 0; x < width; x++)
+      if (src[x] != transp_color)
+        Put_zoomed_pixel(dest + x * ZOOMX, ZOOMX, src[x]);
+  }
+}
+
+void PX(Display_brush_color) (word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,word brush_width)
+{
+  PX(Display_brush)(Brush, x_pos, y_pos, x_offset, y_offset, width, height, transp_color, brush_width);
+  Update_rect(x_pos,y_pos,width,height);
+}
+
+void PX(Display_brush_mono) (word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,byte color,word brush_width)
+/* On affiche la brosse en monochrome */
+{
+  const byte * src = Brush + y_offset * brush_width + x_offset;
+  int x, y, dy;
+
+  for (y = 0; y < height; y++)
+  {
+    for (dy = 0; dy < ZOOMY; dy++)
+    {
+      byte * dest = Get_Screen_pixel_ptr(x_pos * ZOOMX, (y_pos + y) * ZOOMY + dy);
+
+      for (x = 0; x < width; x++)
+        if (src[x] != transp_color)
+          Put_zoomed_pixel(dest + x * ZOOMX, ZOOMX, color);
+    }
+    src += brush_width;
+  }
+  Update_rect(x_pos,y_pos,width,height);
+}
+
+void PX(Clear_brush) (word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,word image_width)
+{
+  const byte * src = (y_pos + Main.offset_Y) * image_width + x_pos + Main.offset_X + Main_screen;
+  int y;
+  (void)x_offset; // unused
+  (void)y_offset; // unused
+  (void)transp_color; // unused
+
+  for (y = 0; y < height; y++)
+  {
+    Zoom_line(src, Get_Screen_pixel_ptr(x_pos * ZOOMX, (y_pos + y) * ZOOMY), ZOOMX, width);
+    Repeat_row(x_pos * ZOOMX, (y_pos + y) * ZOOMY, width * ZOOMX, ZOOMY);
+    src += image_width;
+  }
+  Update_rect(x_pos,y_pos,width,height);
+}
+
+// Affiche une brosse (arbitraire) à l'écran
+void PX(Display_brush) (byte * brush, word x_pos,word y_pos,word x_offset,word y_offset,word width,word height,byte transp_color,word brush_width)
+{
+  const byte * src = brush + y_offset * brush_width + x_offset;
+  int y;
+
+  for (y = 0; y < height; y++)
+  {
+    PX(Display_transparent_row)(x_pos, y_pos + y, width, src, transp_color);
+    src += brush_width;
+  }
+}
+
+void PX(Remap_screen) (word x_pos,word y_pos,word width,word height,byte * conversion_table)
+{
+  int x, y;
+
+  for (y = 0; y < height; y++)
+  {
+    byte * dest = Get_Screen_pixel_ptr(x_pos * ZOOMX, (y_pos + y) * ZOOMY);
+
+    for (x = 0; x < width * ZOOMX; x += ZOOMX)
+      Put_zoomed_pixel(dest + x, ZOOMX, conversion_table[dest[x]]);
+    Repeat_row(x_pos * ZOOMX, (y_pos + y) * ZOOMY, width * ZOOMX, ZOOMY);
+  }
+  Update_rect(x_pos,y_pos,width,height);
+}
+
+void PX(Display_line_on_screen) (word x_pos,word y_pos,word width,byte * line)
+/* Displays a row of pixels, enlarging them. */
+{
+  byte * dest = Get_Screen_pixel_ptr(x_pos * ZOOMX, y_pos * ZOOMY);
+
+  if (dest == NULL)
+    return;
+  Zoom_line(line, dest, ZOOMX, width);
+  Repeat_row(x_pos * ZOOMX, y_pos * ZOOMY, width * ZOOMX, ZOOMY);
+}
+
+void PX(Display_line_on_screen_fast) (word x_pos,word y_pos,word width,byte * line)
+/* Displays a row of pixels as is, in the ZOOMY rows of the screen. */
+/* Used when the buffer already has the pixels repeated ZOOMX times. */
+{
+  int dy;
+
+  for (dy = 0; dy < ZOOMY; dy++)
+    memcpy(Get_Screen_pixel_ptr(x_pos * ZOOMX, y_pos * ZOOMY + dy), line, width * ZOOMX);
+}
+
+void PX(Read_line_screen) (word x_pos,word y_pos,word width,byte * line)
+{
+  memcpy(line, Get_Screen_pixel_ptr(x_pos * ZOOMX, y_pos * ZOOMY), width * ZOOMX);
+}
+
+void PX(Display_part_of_screen_scaled) (
+        word width, // width non zoomée
+        word height, // height zoomée
+        word image_width,byte * buffer)
+{
+  PX(Display_part_of_screen_scaled_area)(0, width, 0, height, image_width, buffer);
+}
+
+/// Displays the columns x to x+width-1 of the magnifier (in image pixels),
+/// on the rows top to bottom-1 of the screen, with their grid.
+void PX(Display_part_of_screen_scaled_area) (word x, word width,
+        word top, word bottom,
+        word image_width,byte * buffer)
+{
+  const byte * src = Main_screen
+                   + (Main.magnifier_offset_Y + top / Main.magnifier_factor) * image_width
+                   + Main.magnifier_offset_X + x;
+  word x_pos = Main.X_zoom + x * Main.magnifier_factor;
+  int y = top;
+
+  // Pour chaque ligne à zoomer
+  while (y < bottom)
+  {
+    int rows;
+
+    Zoom_line(src, buffer, Main.magnifier_factor * ZOOMX, width);
+    // On l'affiche Facteur fois, sur des lignes consécutives
+    for (rows = Main.magnifier_factor - y % Main.magnifier_factor; rows > 0 && y < bottom; rows--, y++)
+      PX(Display_line_on_screen_fast)(x_pos, y, width * Main.magnifier_factor, buffer);
+    src += image_width;
+  }
+  Redraw_grid(x_pos,top,
+    width*Main.magnifier_factor,bottom-top);
+  Update_rect(x_pos,top,
+    width*Main.magnifier_factor,bottom-top);
+}
+
+// Affiche une partie de la brosse couleur zoomée
+void PX(Display_brush_color_zoom) (word x_pos,word y_pos,
+        word x_offset,word y_offset,
+        word width, // width non zoomée
+        word end_y_pos,byte transp_color,
+        word brush_width, // width réelle de la brosse
+        byte * buffer)
+{
+  const byte * src = Brush + y_offset * brush_width + x_offset;
+  int zoomed_width = width * Main.magnifier_factor * ZOOMX;
+  int y = y_pos;
+
+  while (y < end_y_pos)
+  {
+    int rows;
+
+    Zoom_line(src, buffer, Main.magnifier_factor * ZOOMX, width);
+    // On affiche facteur fois la ligne zoomée
+    for (rows = Main.magnifier_factor; rows > 0 && y < end_y_pos; rows--, y++)
+    {
+      Overlay_row(Get_Screen_pixel_ptr(x_pos * ZOOMX, y * ZOOMY), NULL, buffer, zoomed_width, transp_color, 0);
+      Repeat_row(x_pos * ZOOMX, y * ZOOMY, zoomed_width, ZOOMY);
+    }
+    src += brush_width;
+  }
+}
+
+void PX(Display_brush_mono_zoom) (word x_pos, word y_pos,
+        word x_offset, word y_offset,
+        word width, // width non zoomée
+        word end_y_pos,
+        byte transp_color, byte color,
+        word brush_width, // width réelle de la brosse
+        byte * buffer)
+{
+  const byte * src = Brush + y_offset * brush_width + x_offset;
+  int zoomed_width = width * Main.magnifier_factor * ZOOMX;
+  int y = y_pos;
+
+  while (y < end_y_pos)
+  {
+    int rows;
+
+    Zoom_line(src, buffer, Main.magnifier_factor * ZOOMX, width);
+    // On affiche la ligne Facteur fois à l'écran (sur des
+    // lignes consécutives)
+    for (rows = Main.magnifier_factor; rows > 0 && y < end_y_pos; rows--, y++)
+    {
+      byte * dest = Get_Screen_pixel_ptr(x_pos * ZOOMX, y * ZOOMY);
+      int x;
+
+      for (x = 0; x < zoomed_width; x++)
+        if (buffer[x] != transp_color)
+          dest[x] = color;
+      Repeat_row(x_pos * ZOOMX, y * ZOOMY, zoomed_width, ZOOMY);
+    }
+    src += brush_width;
+  }
+  Redraw_grid( x_pos, y_pos,
+    width * Main.magnifier_factor, end_y_pos - y_pos );
+  Update_rect( x_pos, y_pos,
+    width * Main.magnifier_factor, end_y_pos - y_pos );
+}
+
+void PX(Clear_brush_scaled) (word x_pos,word y_pos,word x_offset,word y_offset,word width,word end_y_pos,byte transp_color,word image_width,byte * buffer)
+{
+  // En fait on va recopier l'image non zoomée dans la partie zoomée !
+  const byte * src = Main_screen + y_offset * image_width + x_offset;
+  int y = y_pos;
+  (void)transp_color; // unused
+
+  while (y < end_y_pos)
+  {
+    int rows;
+
+    Zoom_line(src, buffer, Main.magnifier_factor * ZOOMX, width);
+    for (rows = Main.magnifier_factor; rows > 0 && y < end_y_pos; rows--, y++)
+      PX(Display_line_on_screen_fast)(x_pos, y, width * Main.magnifier_factor, buffer);
+    src += image_width;
+  }
+  Redraw_grid(x_pos,y_pos,
+    width*Main.magnifier_factor,end_y_pos-y_pos);
+  Update_rect(x_pos,y_pos,
+    width*Main.magnifier_factor,end_y_pos-y_pos);
+}
@@ -0,0 +1,229 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file pxzoom.c
+/// Enlargement of rows of pixels, with SIMD versions.
+
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ZOOM_SSE2
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ZOOM_NEON
+#endif
+
+#include "struct.h"
+#include "pxzoom.h"
+#include "gfx2log.h"
+
+/// Portable version, also used for the ends of the rows.
+static void Zoom_line_scalar(const byte * src, byte * dest, int factor, int width)
+{
+  int x;
+
+  if (factor == 1)
+  {
+    memcpy(dest, src, width);
+    return;
+  }
+  for (x = 0; x < width; x++)
+  {
+    memset(dest, src[x], factor);
+    dest += factor;
+  }
+}
+
+#ifdef ZOOM_SSE2
+static void Zoom_line_sse2(const byte * src, byte * dest, int factor, int width)
+{
+  int x = 0;
+
+  switch (factor)
+  {
+    case 2:
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + x));
+        byte * d = dest + 2 * x;
+
+        _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi8(pixels, pixels));
+        _mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi8(pixels, pixels));
+      }
+      break;
+    case 4:
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i lo = _mm_unpacklo_epi8(pixels, pixels);
+        __m128i hi = _mm_unpackhi_epi8(pixels, pixels);
+        byte * d = dest + 4 * x;
+
+        _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(lo, lo));
+        _mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(lo, lo));
+        _mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(hi, hi));
+        _mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(hi, hi));
+      }
+      break;
+    case 8:
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i lo = _mm_unpacklo_epi8(pixels, pixels);
+        __m128i hi = _mm_unpackhi_epi8(pixels, pixels);
+        __m128i words[4];
+        byte * d = dest + 8 * x;
+        int i;
+
+        words[0] = _mm_unpacklo_epi16(lo, lo);
+        words[1] = _mm_unpackhi_epi16(lo, lo);
+        words[2] = _mm_unpacklo_epi16(hi, hi);
+        words[3] = _mm_unpackhi_epi16(hi, hi);
+        for (i = 0; i < 4; i++)
+        {
+          _mm_storeu_si128((__m128i *)(d + 32 * i), _mm_unpacklo_epi32(words[i], words[i]));
+          _mm_storeu_si128((__m128i *)(d + 32 * i + 16), _mm_unpackhi_epi32(words[i], words[i]));
+        }
+      }
+      break;
+    default:
+      if (factor >= 16)
+      {
+        // Big magnifier factors: whole registers of the same color,
+        // the last one overlapping the previous one
+        for (; x < width; x++)
+        {
+          __m128i color = _mm_set1_epi8((char)src[x]);
+          byte * d = dest + x * factor;
+          int i;
+
+          for (i = 0; i + 16 <= factor; i += 16)
+            _mm_storeu_si128((__m128i *)(d + i), color);
+          if (i < factor)
+            _mm_storeu_si128((__m128i *)(d + factor - 16), color);
+        }
+      }
+      else if (factor > 1)
+      {
+        // Each store goes beyond the pixel, and is fixed by the next one
+        for (; (width - x) * factor >= 16; x++)
+          _mm_storeu_si128((__m128i *)(dest + x * factor), _mm_set1_epi8((char)src[x]));
+      }
+      break;
+  }
+  Zoom_line_scalar(src + x, dest + x * factor, factor, width - x);
+}
+#endif
+
+#ifdef ZOOM_NEON
+static void Zoom_line_neon(const byte * src, byte * dest, int factor, int width)
+{
+  int x = 0;
+
+  switch (factor)
+  {
+    case 2:
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16x2_t pixels;
+
+        pixels.val[0] = pixels.val[1] = vld1q_u8(src + x);
+        vst2q_u8(dest + 2 * x, pixels);
+      }
+      break;
+    case 3:
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16x3_t pixels;
+
+        pixels.val[0] = pixels.val[1] = pixels.val[2] = vld1q_u8(src + x);
+        vst3q_u8(dest + 3 * x, pixels);
+      }
+      break;
+    case 4:
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16x4_t pixels;
+
+        pixels.val[0] = pixels.val[1] = pixels.val[2] = pixels.val[3] = vld1q_u8(src + x);
+        vst4q_u8(dest + 4 * x, pixels);
+      }
+      break;
+    default:
+      if (factor >= 16)
+      {
+        for (; x < width; x++)
+        {
+          uint8x16_t color = vdupq_n_u8(src[x]);
+          byte * d = dest + x * factor;
+          int i;
+
+          for (i = 0; i + 16 <= factor; i += 16)
+            vst1q_u8(d + i, color);
+          if (i < factor)
+            vst1q_u8(d + factor - 16, color);
+        }
+      }
+      else if (factor > 1)
+      {
+        for (; (width - x) * factor >= 16; x++)
+          vst1q_u8(dest + x * factor, vdupq_n_u8(src[x]));
+      }
+      break;
+  }
+  Zoom_line_scalar(src + x, dest + x * factor, factor, width - x);
+}
+#endif
+
+const T_Zoom_line_implementation * Zoom_line_implementations(void)
+{
+  static T_Zoom_line_implementation list[4];
+
+  if (list[0].Name == NULL)
+  {
+    int n = 0;
+
+    list[n].Name = "scalar";
+    list[n++].Function = Zoom_line_scalar;
+#ifdef ZOOM_SSE2
+    list[n].Name = "SSE2";
+    list[n++].Function = Zoom_line_sse2;
+#endif
+#ifdef ZOOM_NEON
+    list[n].Name = "NEON";
+    list[n++].Function = Zoom_line_neon;
+#endif
+    list[n].Name = NULL;
+  }
+  return list;
+}
+
+Func_zoom_line Zoom_line = Zoom_line_scalar;
+
+void Init_zoom_line(void)
+{
+  const T_Zoom_line_implementation * implementation = Zoom_line_implementations();
+
+  while (implementation[1].Name != NULL)
+    implementation++;
+  GFX2_Log(GFX2_DEBUG, "Zoomed rows : %s\n", implementation->Name);
+  Zoom_line = implementation->Function;
+}
@@ -0,0 +1,67 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file pxzoom.h
+/// Enlargement of a row of pixels by an integer factor: each pixel is
+/// repeated several times. It is the inner loop of the magnifier and of the
+/// renderers for the big pixels.
+///
+/// Several implementations exist (SSE2, NEON and a portable one).
+/// The fastest one the CPU can run is chosen by Init_zoom_line().
+
+#ifndef PXZOOM_H_INCLUDED
+#define PXZOOM_H_INCLUDED
+
+/**
+ * Writes each pixel of a row @p factor times.
+ *
+ * @param src the pixels to enlarge
+ * @param dest receives width * factor pixels. It must not overlap src.
+ * @param factor number of copies of each pixel, at least 1
+ * @param width number of pixels of src
+ */
+typedef void (* Func_zoom_line) (const byte * src, byte * dest, int factor, int width);
+
+/// The fastest implementation for this CPU, the portable one until Init_zoom_line() is called.
+extern Func_zoom_line Zoom_line;
+
+/**
+ * Chooses the fastest implementation of Zoom_line() for this CPU.
+ *
+ * Must be called at startup, before the worker threads use Zoom_line().
+ */
+void Init_zoom_line(void);
+
+/// An implementation of ::Func_zoom_line
+typedef struct
+{
+  const char * Name;
+  Func_zoom_line Function;
+} T_Zoom_line_implementation;
+
+/**
+ * The implementations which can run on this CPU, for tests and benchmarks.
+ *
+ * The portable one comes first, the fastest one last. The list ends with
+ * a NULL Name.
+ */
+const T_Zoom_line_implementation * Zoom_line_implementations(void);
+
+#endif
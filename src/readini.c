@@ -36,6 +36,8 @@
 #include "windows.h"
 #include "gfx2log.h"
 #include "gfx2mem.h"
+#include "workers.h"
+#include "op_c.h"
 
 
 /**
@@ -1052,6 +1054,63 @@ int Load_INI(T_Config * conf)
   {
     conf->MOTO_gamma=(byte)values[0];
   }
+
+  conf->Undo_memory_budget=0;
+  // Optional, memory allowed for the Undo/Redo history (>=2.9)
+  if (!Load_INI_get_values (file,buffer,"Undo_memory_budget",1,values))
+  {
+    if (values[0]<0)
+      goto Erreur_ERREUR_INI_CORROMPU;
+    // Same range as the settings screen
+    if (values[0]>9999)
+      values[0]=9999;
+    conf->Undo_memory_budget=(word)values[0];
+  }
+
+  conf->Threads=0;
+  // Optional, number of threads for the whole-image operations (>=2.9)
+  if (!Load_INI_get_values (file,buffer,"Threads",1,values))
+  {
+    if ((values[0]<0) || (values[0]>WORKERS_MAX_THREADS))
+      goto Erreur_ERREUR_INI_CORROMPU;
+    conf->Threads=(byte)values[0];
+  }
+
+  conf->Color_reduction=COLOR_REDUCTION_MEDIAN_CUT;
+  // Optional, method which chooses the palette of true-color pictures (>=2.9)
+  if (!Load_INI_get_values (file,buffer,"Color_reduction",1,values))
+  {
+    if ((values[0]<0) || (values[0]>=COLOR_REDUCTION_METHODS))
+      goto Erreur_ERREUR_INI_CORROMPU;
+    conf->Color_reduction=(byte)values[0];
+  }
+
+  conf->Color_reduction_passes=0;
+  // Optional, number of k-means passes on the palette of true-color pictures (>=2.9)
+  if (!Load_INI_get_values (file,buffer,"Color_reduction_passes",1,values))
+  {
+    if ((values[0]<0) || (values[0]>99))
+      goto Erreur_ERREUR_INI_CORROMPU;
+    conf->Color_reduction_passes=(byte)values[0];
+  }
+
+  conf->Color_reduction_time=1000;
+  // Optional, time allowed for the k-means passes (>=2.9)
+  if (!Load_INI_get_values (file,buffer,"Color_reduction_time",1,values))
+  {
+    if ((values[0]<0) || (values[0]>9999))
+      goto Erreur_ERREUR_INI_CORROMPU;
+    conf->Color_reduction_time=(word)values[0];
+  }
+
+  conf->Color_reduction_dithering=DITHERING_NONE;
+  // Optional, dithering of true-color pictures (>=2.9)
+  if (!Load_INI_get_values (file,buffer,"Color_reduction_dithering",1,values))
+  {
+    if ((values[0]<0) || (values[0]>=DITHERING_METHODS))
+      goto Erreur_ERREUR_INI_CORROMPU;
+    conf->Color_reduction_dithering=(byte)values[0];
+  }
   
   // Insert new values here
 
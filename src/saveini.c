@@ -769,6 +769,30 @@ int Save_INI(const T_Config * conf)
   if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"MOTO_gamma",1,values,0)))
     goto Erreur_Retour;
 
+  values[0]=conf->Undo_memory_budget;
+  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Undo_memory_budget",1,values,0)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Threads;
+  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Threads",1,values,0)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Color_reduction;
+  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Color_reduction",1,values,0)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Color_reduction_passes;
+  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Color_reduction_passes",1,values,0)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Color_reduction_time;
+  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Color_reduction_time",1,values,0)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Color_reduction_dithering;
+  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Color_reduction_dithering",1,values,0)))
+    goto Erreur_Retour;
+
   // Insert new values here
   
   Save_INI_flush(old_file, new_file, buffer);
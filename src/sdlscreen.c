@@ -38,6 +38,8 @@
 #include "errors.h"
 #include "misc.h"
 #include "gfx2log.h"
+#include "gfx2surface.h"
+#include "dirtyrect.h"
 #include "io.h"
 
 // Update method that does a large number of small rectangles, aiming
@@ -72,6 +74,8 @@ static SDL_Surface * Screen_SDL = NULL;
 static SDL_Window * Window_SDL = NULL;
 static SDL_Renderer * Renderer_SDL = NULL;
 static SDL_Texture * Texture_SDL = NULL;
+/// 32-bit value of each color of the palette of Screen_SDL, for the texture
+static dword Screen_ARGB[256];
 static SDL_Surface * icon = NULL;
 #endif
 
@@ -193,7 +197,6 @@ static void GFX2_UpdateRect(int x, int y, int width, int height)
   byte * pixels;
   int pitch;
   int line;
-  static SDL_Surface *RGBcopy = NULL;
   SDL_Rect source_rect;
 
   source_rect.x = x;
@@ -205,26 +208,21 @@ static void GFX2_UpdateRect(int x, int y, int width, int height)
     source_rect.w = width;
     source_rect.h = height;
   }
+  if (source_rect.x + source_rect.w > Screen_SDL->w)
+    source_rect.w = Screen_SDL->w - source_rect.x;
+  if (source_rect.y + source_rect.h > Screen_SDL->h)
+    source_rect.h = Screen_SDL->h - source_rect.y;
+  if (source_rect.w <= 0 || source_rect.h <= 0)
+    return;
 
-  if (RGBcopy != NULL && (Screen_SDL->w > RGBcopy->w || Screen_SDL->h > RGBcopy->h))
-  {
-    SDL_FreeSurface(RGBcopy);
-    RGBcopy = NULL;
-  }
-
-  if (RGBcopy == NULL)
-  {
-    RGBcopy = SDL_CreateRGBSurface(0,
-    Screen_SDL->w, Screen_SDL->h,
-    32, 0, 0, 0, 0);
-  }
-  // conversion ARGB
-  SDL_BlitSurface(Screen_SDL, &source_rect, RGBcopy, &source_rect);
-  // upload texture
-  SDL_LockTexture(Texture_SDL, &source_rect, (void **)(&pixels), &pitch );
+  // conversion ARGB, directly in the texture
+  if (SDL_LockTexture(Texture_SDL, &source_rect, (void **)(&pixels), &pitch) < 0)
+    return;
   for (line = 0; line < source_rect.h; line++)
   {
-     memcpy(pixels + line * pitch, (const byte *)RGBcopy->pixels + source_rect.x * 4 + (source_rect.y+line)* RGBcopy->pitch, source_rect.w * 4 );
+    Pixels_to_ARGB((dword *)(pixels + line * pitch),
+                   (const byte *)Screen_SDL->pixels + source_rect.x + (source_rect.y+line) * Screen_SDL->pitch,
+                   source_rect.w, Screen_ARGB);
   }
   SDL_UnlockTexture(Texture_SDL);
   //SDL_RenderCopy(Renderer_SDL, Texture_SDL, &source_rect, &source_rect);
@@ -238,12 +236,17 @@ void GFX2_UpdateScreen(void)
 #endif
 
 #if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
-short Min_X=0;
-short Min_Y=0;
-short Max_X=10000;
-short Max_Y=10000;
-short Status_line_dirty_begin=0;
-short Status_line_dirty_end=0;
+/// The parts of the screen modified since the last Flush_update()
+static T_Dirty_region Dirty_region;
+
+static void Send_rect(int x, int y, int width, int height)
+{
+#if defined(USE_SDL)
+  SDL_UpdateRect(Screen_SDL, x, y, width, height);
+#else
+  GFX2_UpdateRect(x, y, width, height);
+#endif
+}
 #endif
 
 #if (UPDATE_METHOD == UPDATE_METHOD_FULL_PAGE)
@@ -266,39 +269,9 @@ void Flush_update(void)
     update_is_required=0;
   }
 #endif
-  #if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
-  if (Min_X>=Max_X || Min_Y>=Max_Y)
-  {
-    ; // Nothing to do
-  }
-  else
-  {
-    if (Min_X<0)
-      Min_X=0;
-    if (Min_Y<0)
-      Min_Y=0;
-#if defined(USE_SDL)
-    SDL_UpdateRect(Screen_SDL, Min_X*Pixel_width, Min_Y*Pixel_height, Min(Screen_width-Min_X, Max_X-Min_X)*Pixel_width, Min(Screen_height-Min_Y, Max_Y-Min_Y)*Pixel_height);
-#else
-    GFX2_UpdateRect(Min_X*Pixel_width, Min_Y*Pixel_height, Min(Screen_width-Min_X, Max_X-Min_X)*Pixel_width, Min(Screen_height-Min_Y, Max_Y-Min_Y)*Pixel_height);
-#endif
-
-    Min_X=Min_Y=10000;
-    Max_X=Max_Y=0;
-  }
-  if (Status_line_dirty_end)
-  {
-#if defined(USE_SDL)
-    SDL_UpdateRect(Screen_SDL, (18+(Status_line_dirty_begin*8))*Menu_factor_X*Pixel_width,Menu_status_Y*Pixel_height,(Status_line_dirty_end-Status_line_dirty_begin)*8*Menu_factor_X*Pixel_width,8*Menu_factor_Y*Pixel_height);
-#else
-    GFX2_UpdateRect((18+(Status_line_dirty_begin*8))*Menu_factor_X*Pixel_width,Menu_status_Y*Pixel_height,(Status_line_dirty_end-Status_line_dirty_begin)*8*Menu_factor_X*Pixel_width,8*Menu_factor_Y*Pixel_height);
+#if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
+  Dirty_region_flush(&Dirty_region, Screen_width*Pixel_width, Screen_height*Pixel_height, Send_rect);
 #endif
-  }
-  Status_line_dirty_begin=25;
-  Status_line_dirty_end=0;
-
-    #endif
-
 }
 
 void Update_rect(short x, short y, unsigned short width, unsigned short height)
@@ -313,21 +286,9 @@ void Update_rect(short x, short y, unsigned short width, unsigned short height)
 
   #if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
   if (width==0 || height==0)
-  {
-    Min_X=Min_Y=0;
-    Max_X=Max_Y=10000;
-  }
+    Dirty_region_add(&Dirty_region, 0, 0, Screen_width*Pixel_width, Screen_height*Pixel_height);
   else
-  {
-    if (x < Min_X)
-      Min_X = x;
-    if (y < Min_Y)
-      Min_Y = y;
-    if (x+width>Max_X)
-      Max_X=x+width;
-    if (y+height>Max_Y)
-      Max_Y=y+height;
-  }
+    Dirty_region_add(&Dirty_region, x*Pixel_width, y*Pixel_height, width*Pixel_width, height*Pixel_height);
   #endif
 
   #if (UPDATE_METHOD == UPDATE_METHOD_FULL_PAGE)
@@ -348,11 +309,7 @@ void Update_status_line(short char_pos, short width)
   #endif
 
   #if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
-  // Merge the ranges
-  if (Status_line_dirty_end < char_pos+width)
-    Status_line_dirty_end=char_pos+width;
-  if (Status_line_dirty_begin > char_pos)
-    Status_line_dirty_begin=char_pos;
+  Dirty_region_add(&Dirty_region, (18+char_pos*8)*Menu_factor_X*Pixel_width,Menu_status_Y*Pixel_height,width*8*Menu_factor_X*Pixel_width,8*Menu_factor_Y*Pixel_height);
   #endif
 
   #if (UPDATE_METHOD == UPDATE_METHOD_FULL_PAGE)
@@ -482,11 +439,23 @@ int GFX2_SetPalette(const T_Components * colors, int firstcolor, int ncolors)
 #if defined(USE_SDL)
   return SDL_SetPalette(Screen_SDL, SDL_PHYSPAL | SDL_LOGPAL, PaletteSDL, firstcolor, ncolors);
 #else
-  // When using SDL2, we need to force screen update so the
-  // 8bit => True color conversion will be performed
+  // When using SDL2, the parts of the screen which use the modified colors
+  // must be converted again to true color. Nothing is redrawn.
   i = SDL_SetPaletteColors(Screen_SDL->format->palette, PaletteSDL, firstcolor, ncolors);
   if (i == 0)
-    Update_rect(0, 0, Screen_SDL->w, Screen_SDL->h);
+  {
+#if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
+    byte changed[256];
+
+    memset(changed, 0, sizeof(changed));
+    if (Palette_to_ARGB(Screen_ARGB, colors, firstcolor, ncolors, 255, changed) > 0)
+      Dirty_region_add_colors(&Dirty_region, Screen_SDL->pixels, Screen_SDL->pitch,
+                              Screen_width*Pixel_width, Screen_height*Pixel_height, changed);
+#else
+    if (Palette_to_ARGB(Screen_ARGB, colors, firstcolor, ncolors, 255, NULL) > 0)
+      Update_rect(0, 0, 0, 0);
+#endif
+  }
   return i;
 #endif
 }
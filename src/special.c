@@ -343,6 +343,11 @@ void Scroll_magnifier(short delta_x,short delta_y)
   if ( (Main.magnifier_offset_X!=temp_x_offset) ||
        (Main.magnifier_offset_Y!=temp_y_offset) )
   {
+    short old_x_offset=Main.offset_X;
+    short old_y_offset=Main.offset_Y;
+    short old_magnifier_x_offset=Main.magnifier_offset_X;
+    short old_magnifier_y_offset=Main.magnifier_offset_Y;
+
     Hide_cursor();
     Main.magnifier_offset_X=temp_x_offset;
     Main.magnifier_offset_Y=temp_y_offset;
@@ -352,7 +357,8 @@ void Scroll_magnifier(short delta_x,short delta_y)
     Compute_limits();
     Compute_paintbrush_coordinates();
 
-    Display_all_screen();
+    Display_all_screen_after_scroll(old_x_offset, old_y_offset,
+                                    old_magnifier_x_offset, old_magnifier_y_offset);
     Display_cursor();
   }
 }
@@ -59,6 +59,7 @@ typedef void (* Func_action) (void); ///< An action.
 typedef void (* Func_btn_action) (int); ///< An action. Used when you click a menu button or trigger a keyboard shortcut.
 typedef void (* Func_pixel) (word,word,byte); ///< Set pixel at position (x,y) to color c. Used in load screen to write the data to brush, picture, or preview area.
 typedef void (* Func_pixel_opt_preview) (word,word,byte,int); ///< Set pixel at position (x,y) to color c. With optional preview.
+typedef void (* Func_span_opt_preview) (word,word,word,const byte *,int); ///< Set a horizontal span of pixels starting at (x,y), with one color per pixel. With optional preview.
 typedef byte (* Func_read)   (word,word); ///< Read a pixel at position (x,y) on something. Used for example in save to tell if the data is a brush or a picture
 typedef void (* Func_clear)  (byte);
 typedef void (* Func_display)   (word,word,word);
@@ -71,6 +72,7 @@ typedef void (* Func_gradient)   (long,short,short);
 typedef void (* Func_remap)     (word,word,word,word,byte *);
 typedef void (* Func_procsline) (word,word,word,byte *);
 typedef void (* Func_display_zoom) (word,word,word,byte *);
+typedef void (* Func_display_zoom_area) (word,word,word,word,word,byte *); ///< Draw some columns and rows of the magnified part of the screen
 typedef void (* Func_display_brush_color_zoom) (word,word,word,word,word,word,byte,word,byte *);
 typedef void (* Func_display_brush_mono_zoom)  (word,word,word,word,word,word,byte,byte,word,byte *);
 typedef void (* Func_draw_brush) (byte *,word,word,word,word,word,word,byte,word);
@@ -379,6 +381,12 @@ typedef struct
   byte Use_virtual_keyboard;             ///< 0: Auto, 1: On, 2: Off
   byte Default_mode_layers;              ///< Indicates if default new image has layers (alternative is animation)
   byte MOTO_gamma;                       ///< Number, 10 x the Gamma used for converting MO6/TO8/TO9 palette
+  word Undo_memory_budget;               ///< Memory, in megabytes, allowed for the Undo/Redo history of each image. 0 to limit it by ::Max_undo_pages instead.
+  byte Threads;                          ///< Number of threads for the whole-image operations. 0: one per processor
+  byte Color_reduction;                  ///< Method which chooses the palette of true-color pictures, see ::COLOR_REDUCTION_METHOD
+  byte Color_reduction_passes;           ///< Maximum number of k-means passes which improve the palette of true-color pictures. 0 for none
+  word Color_reduction_time;             ///< Time allowed for the k-means passes, in ms. 0 for no limit
+  byte Color_reduction_dithering;        ///< Dithering of true-color pictures, see ::DITHERING_METHOD
 
 } T_Config;
 
@@ -392,6 +400,7 @@ typedef struct
 typedef struct T_Image
 {
   byte * Pixels;
+  struct T_Undo_tile ** Tiles; ///< Only for old history steps: when Pixels is NULL, grid of shared tiles holding the pixels. See Layer_pixels()
   int Duration;
 } T_Image;
 
@@ -399,6 +408,8 @@ typedef struct T_Image
 /// This structure is resized dynamically to hold pointers to all of the layers in the picture.
 /// The pointed layers are just byte* holding the raw pixel data. But at Image[0]-1 you will find a short that is used as a reference counter for each layer.
 /// This way we can use the same pixel data in many undo pages when the user edit only one of the layers (which is what they usually do).
+/// The layers of the older undo pages are cut in tiles, which are reference-counted the same way,
+/// so only the parts of a layer which were really modified take memory.
 typedef struct T_Page
 {
   int       Width;   ///< Image width in pixels.
@@ -433,6 +444,7 @@ typedef struct
 {
   int      List_size;         ///< Number of ::T_Page in the vector "Pages".
   T_Page * Pages;             ///< Head of a linked list of pages, each one being a undo/redo step.
+  long long Memory;           ///< Memory used by the bitmaps and tiles of its pages, see T_Config::Undo_memory_budget
 } T_List_of_pages;
 
 /// A single image bitmap
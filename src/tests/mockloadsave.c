@@ -138,3 +138,15 @@ int Get_palette_RGB_scale(void)
 {
   return 256;
 }
+
+void Rotate_safety_backups(void)
+{
+}
+
+T_GFX2_Surface * Load_surface(const char *filename, const char * directory, T_Gradient_array *gradients)
+{
+  (void)directory;
+  (void)gradients;
+  GFX2_Log(GFX2_DEBUG, "Load_surface(\"%s\") not available in the tests\n", filename);
+  return NULL;
+}
@@ -23,7 +23,13 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#if defined(WIN32)
+#include <windows.h>
+#endif
 #include "../struct.h"
+#include "../global.h"
 
 void Warning_message(const char * message)
 {
@@ -50,6 +56,11 @@ void Warning_function(const char *message, const char *filename, int line_number
   printf("%s:%d %s(): Warning: %s\n", filename, line_number, function_name, message);
 }
 
+void Verbose_message(const char *caption, const char * message)
+{
+  printf("%s: %s\n", caption, message);
+}
+
 void Window_help(int section, const char * sub_section)
 {
   printf("Window_help(%d, %s)\n", section, sub_section);
@@ -98,6 +109,12 @@ short Window_clicked_button(void)
   return 1;
 }
 
+int Get_input(int sleep_time)
+{
+  (void)sleep_time;
+  return 0;
+}
+
 int Is_shortcut(word key, word function)
 {
   printf("Is_shortcut(%04x, %04x)\n", key, function);
@@ -108,6 +125,30 @@ void Update_rect(short x, short y, unsigned short width, unsigned short height)
 {
 }
 
+/// The screen of the functions of screen.h, set by the tests which draw
+byte * Mock_screen;
+
+byte* Get_Screen_pixel_ptr(int x, int y)
+{
+  return Mock_screen + x + y * Screen_width * Pixel_width;
+}
+
+byte Get_Screen_pixel(int x, int y)
+{
+  return *Get_Screen_pixel_ptr(x, y);
+}
+
+void Set_Screen_pixel(int x, int y, byte value)
+{
+  *Get_Screen_pixel_ptr(x, y) = value;
+}
+
+void Screen_FillRect(int x, int y, int w, int h, byte color)
+{
+  for (; h > 0; h--, y++)
+    memset(Get_Screen_pixel_ptr(x, y), color, w);
+}
+
 void Display_cursor(void)
 {
 }
@@ -116,12 +157,53 @@ void Hide_cursor(void)
 {
 }
 
-word Count_used_colors(dword * usage)
+void Compute_limits(void)
+{
+}
+
+void Remap_window_backgrounds(const byte * conversion_table, int Min_Y, int Max_Y)
+{
+}
+
+int GFX2_SetPalette(const T_Components * colors, int firstcolor, int ncolors)
+{
+  return 1;
+}
+
+byte Round_palette_component(byte comp)
+{
+  return comp;
+}
+
+byte Search_best_color(byte red,byte green,byte blue)
+{
+  return 0;
+}
+
+void Compute_paintbrush_coordinates(void)
+{
+}
+
+void Update_pixel_renderer(void)
+{
+}
+
+int Layers_max(enum IMAGE_MODES mode)
 {
-  return 256;
+  (void)mode;
+  return MAX_NB_LAYERS;
 }
 
-word Count_used_colors_area(dword* usage, word start_x, word start_y, word width, word height)
+/// Wall clock time, as the real one: clock() would count the CPU time of
+/// all the worker threads.
+dword GFX2_GetTicks(void)
 {
-  return 256;
+#if defined(WIN32)
+  return GetTickCount();
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    return 0;
+  return (dword)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
 }
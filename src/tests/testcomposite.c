@@ -0,0 +1,138 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testcomposite.c
+/// Unit tests and benchmark of the layers overlay.
+///
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../struct.h"
+#include "../composite.h"
+#include "../gfx2log.h"
+#include "../osdep.h"
+#include "../gfx2mem.h"
+#include "tests.h"
+
+#define OVERLAY_WIDTH 1024
+#define OVERLAY_HEIGHT 768
+#define OVERLAY_PASSES 20
+
+/// The loop of Redraw_layered_image() before the overlay functions
+static void Reference_overlay(byte * visible, byte * depth, const byte * pixels, long width, byte transparent, byte layer)
+{
+  long i;
+
+  for (i=0; i<width; i++)
+  {
+    byte color = pixels[i];
+    if (color != transparent) // transparent color
+    {
+      visible[i] = color;
+      depth[i] = layer;
+    }
+  }
+}
+
+/**
+ * Checks all the implementations give the same result as the original
+ * loop, on all alignments and lengths, and compares their speed.
+ */
+int Test_Overlay_row(char * errmsg)
+{
+  const T_Overlay_implementation * implementation;
+  byte * layer;
+  byte * reference[2];
+  byte * result[2];
+  long size = (long)OVERLAY_WIDTH * OVERLAY_HEIGHT;
+  long i;
+  int ok = 0;
+
+  layer = GFX2_malloc(size);
+  reference[0] = GFX2_malloc(size);
+  reference[1] = GFX2_malloc(size);
+  result[0] = GFX2_malloc(size);
+  result[1] = GFX2_malloc(size);
+  if (layer == NULL || reference[0] == NULL || reference[1] == NULL || result[0] == NULL || result[1] == NULL)
+    goto cleanup;
+  // Half transparent, with runs of both kinds like in a drawing
+  for (i=0; i<size; i++)
+    layer[i] = ((i / 37) % 2 || (i % 5) == 0) ? 0 : (byte)(i * 7);
+
+  for (implementation = Overlay_implementations(); implementation->Name != NULL; implementation++)
+  {
+    long start, width;
+    dword t0, t1;
+    int pass;
+
+    for (start = 0; start < 33; start++)
+    {
+      for (width = 0; width < 100; width += 3)
+      {
+        memset(reference[0], 1, 200);
+        memset(reference[1], 2, 200);
+        memcpy(result[0], reference[0], 200);
+        memcpy(result[1], reference[1], 200);
+        Reference_overlay(reference[0] + start, reference[1] + start, layer + 30 + start, width, 0, 5);
+        implementation->Function(result[0] + start, result[1] + start, layer + 30 + start, width, 0, 5);
+        if (memcmp(reference[0], result[0], 200) || memcmp(reference[1], result[1], 200))
+        {
+          snprintf(errmsg, ERRMSG_LENGTH, "%s: wrong result at offset %ld, width %ld", implementation->Name, start, width);
+          goto cleanup;
+        }
+        // Image only, and depth only
+        implementation->Function(result[0] + start, NULL, layer + start, width, 0, 6);
+        implementation->Function(NULL, result[1] + start, layer + start, width, 0, 6);
+        Reference_overlay(reference[0] + start, reference[1] + start, layer + start, width, 0, 6);
+        if (memcmp(reference[0], result[0], 200) || memcmp(reference[1], result[1], 200))
+        {
+          snprintf(errmsg, ERRMSG_LENGTH, "%s: wrong result with a NULL buffer at offset %ld, width %ld", implementation->Name, start, width);
+          goto cleanup;
+        }
+      }
+    }
+
+    // Benchmark, row by row as in Redraw_layered_image()
+    t0 = GFX2_GetTicks();
+    for (pass = 0; pass < OVERLAY_PASSES; pass++)
+      for (i = 0; i < size; i += OVERLAY_WIDTH)
+        Reference_overlay(reference[0] + i, reference[1] + i, layer + i, OVERLAY_WIDTH, (byte)pass, 1);
+    t1 = GFX2_GetTicks();
+    for (pass = 0; pass < OVERLAY_PASSES; pass++)
+      for (i = 0; i < size; i += OVERLAY_WIDTH)
+        implementation->Function(result[0] + i, result[1] + i, layer + i, OVERLAY_WIDTH, (byte)pass, 1);
+    GFX2_Log(GFX2_INFO, "  %-6s: %4.0fms  original loop: %4.0fms  (%d layers of %dx%d)\n",
+             implementation->Name, (double)(GFX2_GetTicks() - t1),
+             (double)(t1 - t0), OVERLAY_PASSES, OVERLAY_WIDTH, OVERLAY_HEIGHT);
+    if (memcmp(reference[0], result[0], size) || memcmp(reference[1], result[1], size))
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "%s: wrong result on the whole image", implementation->Name);
+      goto cleanup;
+    }
+  }
+  ok = 1;
+
+cleanup:
+  free(layer);
+  free(reference[0]);
+  free(reference[1]);
+  free(result[0]);
+  free(result[1]);
+  return ok;
+}
@@ -0,0 +1,173 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testdirtyrect.c
+/// Unit tests of the list of modified rectangles of the screen.
+///
+#include <stdio.h>
+#include <string.h>
+#include "../struct.h"
+#include "../dirtyrect.h"
+#include "tests.h"
+
+#define DIRTY_SCREEN_WIDTH 320
+#define DIRTY_SCREEN_HEIGHT 200
+#define DIRTY_FRAMES 2000
+
+/// Number of times each pixel was sent during a flush
+static byte Sent[DIRTY_SCREEN_HEIGHT][DIRTY_SCREEN_WIDTH];
+
+static void Send_rect(int x, int y, int width, int height)
+{
+  int i, j;
+
+  for (j = y; j < y + height; j++)
+    for (i = x; i < x + width; i++)
+      Sent[j][i]++;
+}
+
+/// Simple pseudo random generator, so the test is the same on each run
+static dword Next_random(dword * seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/**
+ * Adds random rectangles, some of them out of the screen, and checks that
+ * each flush sends all the modified pixels exactly once.
+ */
+int Test_Dirty_region(char * errmsg)
+{
+  static byte modified[DIRTY_SCREEN_HEIGHT][DIRTY_SCREEN_WIDTH];
+  T_Dirty_region region;
+  dword seed = 1234;
+  int frame;
+
+  memset(&region, 0, sizeof(region));
+  // Two far away rectangles are sent separately
+  Dirty_region_add(&region, 0, 0, 10, 10);
+  Dirty_region_add(&region, 300, 180, 20, 20);
+  memset(Sent, 0, sizeof(Sent));
+  if (Dirty_region_flush(&region, DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_HEIGHT, Send_rect) != 500
+      || region.Pixels_flushed != 500 || region.Nb_rects != 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%ld pixels sent instead of 500", region.Pixels_flushed);
+    return 0;
+  }
+
+  for (frame = 0; frame < DIRTY_FRAMES; frame++)
+  {
+    int nb = 1 + Next_random(&seed) % 40;
+    long expected = 0;
+    int i, j, x, y;
+
+    memset(modified, 0, sizeof(modified));
+    for (; nb > 0; nb--)
+    {
+      // Mostly small rectangles, like the brush or the status line
+      int big = (Next_random(&seed) % 8) == 0;
+      int w = 1 + Next_random(&seed) % (big ? 200 : 24);
+      int h = 1 + Next_random(&seed) % (big ? 150 : 24);
+      x = (int)(Next_random(&seed) % (DIRTY_SCREEN_WIDTH + 20)) - 10;
+      y = (int)(Next_random(&seed) % (DIRTY_SCREEN_HEIGHT + 20)) - 10;
+
+      Dirty_region_add(&region, x, y, w, h);
+      for (j = y; j < y + h; j++)
+        for (i = x; i < x + w; i++)
+          if (i >= 0 && j >= 0 && i < DIRTY_SCREEN_WIDTH && j < DIRTY_SCREEN_HEIGHT)
+            modified[j][i] = 1;
+      if (region.Nb_rects > DIRTY_RECTS_MAX)
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "frame %d: %d rectangles", frame, region.Nb_rects);
+        return 0;
+      }
+    }
+    memset(Sent, 0, sizeof(Sent));
+    Dirty_region_flush(&region, DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_HEIGHT, Send_rect);
+    for (y = 0; y < DIRTY_SCREEN_HEIGHT; y++)
+    {
+      for (x = 0; x < DIRTY_SCREEN_WIDTH; x++)
+      {
+        if (Sent[y][x] > 1 || (modified[y][x] && !Sent[y][x]))
+        {
+          snprintf(errmsg, ERRMSG_LENGTH, "frame %d: pixel (%d,%d) sent %d times", frame, x, y, Sent[y][x]);
+          return 0;
+        }
+        expected += Sent[y][x];
+      }
+    }
+    if (expected != region.Pixels_flushed)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "frame %d: %ld pixels counted, %ld sent", frame, region.Pixels_flushed, expected);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * After a palette change, only the parts of the screen which use the
+ * modified colors are sent.
+ */
+int Test_Dirty_region_colors(char * errmsg)
+{
+  static byte screen[DIRTY_SCREEN_HEIGHT][DIRTY_SCREEN_WIDTH];
+  byte colors[256];
+  T_Dirty_region region;
+  int x, y;
+
+  memset(&region, 0, sizeof(region));
+  memset(colors, 0, sizeof(colors));
+  // A background of color 0, and a few spots of color 1 to 8
+  memset(screen, 0, sizeof(screen));
+  for (y = 0; y < 8; y++)
+    for (x = 0; x < 8; x++)
+      screen[20 + y * 20][10 + x * 37 + y] = (byte)(1 + (x + y) % 8);
+  colors[3] = colors[5] = 1;
+  Dirty_region_add_colors(&region, screen[0], DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_HEIGHT, colors);
+  memset(Sent, 0, sizeof(Sent));
+  Dirty_region_flush(&region, DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_HEIGHT, Send_rect);
+  for (y = 0; y < DIRTY_SCREEN_HEIGHT; y++)
+  {
+    for (x = 0; x < DIRTY_SCREEN_WIDTH; x++)
+    {
+      if (Sent[y][x] > 1 || (colors[screen[y][x]] && !Sent[y][x]))
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "pixel (%d,%d) sent %d times", x, y, Sent[y][x]);
+        return 0;
+      }
+    }
+  }
+  if (region.Pixels_flushed == 0 || region.Pixels_flushed > DIRTY_SCREEN_WIDTH * DIRTY_SCREEN_HEIGHT / 4)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%ld pixels sent for 16 spots", region.Pixels_flushed);
+    return 0;
+  }
+  // The background is everywhere
+  colors[0] = 1;
+  Dirty_region_add_colors(&region, screen[0], DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_HEIGHT, colors);
+  Dirty_region_flush(&region, DIRTY_SCREEN_WIDTH, DIRTY_SCREEN_HEIGHT, Send_rect);
+  if (region.Pixels_flushed != DIRTY_SCREEN_WIDTH * DIRTY_SCREEN_HEIGHT)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%ld pixels sent instead of the whole screen", region.Pixels_flushed);
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,214 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testfloodfill.c
+/// Unit tests and benchmark of the flood fill.
+///
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../struct.h"
+#include "../floodfill.h"
+#include "../gfx2log.h"
+#include "../osdep.h"
+#include "../gfx2mem.h"
+#include "tests.h"
+
+#define FILL_SIZE 1024
+
+/// Simple pseudo random generator, so the shapes are the same on each run
+static dword Next_random(dword * seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/// Nothing to stop the fill
+static void Shape_open(byte * pixels, int size)
+{
+  memset(pixels, 1, (long)size * size);
+}
+
+/// A square spiral corridor, 1 pixel wide
+static void Shape_spiral(byte * pixels, int size)
+{
+  int left = 0, top = 0, right = size - 1, bottom = size - 1;
+  int x, y;
+
+  memset(pixels, 0, (long)size * size);
+  // Draw the corridor from the outside to the center
+  for (y = top; left <= right && top <= bottom; )
+  {
+    for (x = left; x <= right; x++)
+      pixels[(long)top * size + x] = 1;
+    for (y = top; y <= bottom; y++)
+      pixels[(long)y * size + right] = 1;
+    for (x = right; x >= left && bottom > top; x--)
+      pixels[(long)bottom * size + x] = 1;
+    for (y = bottom; y >= top + 2 && right > left; y--)
+      pixels[(long)y * size + left] = 1;
+    // The next turn is inside, 2 pixels away
+    if (left + 2 <= right - 2)
+      pixels[(long)(top + 2) * size + left + 1] = 1;
+    left += 2;
+    top += 2;
+    right -= 2;
+    bottom -= 2;
+  }
+}
+
+/// Vertical corridors, connected alternately at the top and at the bottom
+static void Shape_serpentine(byte * pixels, int size)
+{
+  int x, y;
+
+  memset(pixels, 1, (long)size * size);
+  for (x = 1; x < size; x += 2)
+    for (y = 0; y < size; y++)
+      if (((x / 2) & 1) ? y != 0 : y != size - 1)
+        pixels[(long)y * size + x] = 0;
+}
+
+/// Random noise, as in a dithered picture
+static void Shape_dithered(byte * pixels, int size)
+{
+  dword seed = 1;
+  long i;
+
+  for (i = 0; i < (long)size * size; i++)
+    pixels[i] = (Next_random(&seed) % 100) < 65;
+}
+
+/// Simple pixel by pixel fill, to check the result
+static void Reference_fill(byte * pixels, int size, int limit_left, int limit_top, int limit_right, int limit_bottom, int x, int y)
+{
+  long * queue = (long *)GFX2_malloc((long)size * size * sizeof(long));
+  long first = 0, last = 0;
+
+  pixels[(long)y * size + x] = 2;
+  queue[last++] = (long)y * size + x;
+  while (first < last)
+  {
+    long offset = queue[first++];
+    int px = offset % size;
+    int py = offset / size;
+
+    if (px > limit_left && pixels[offset - 1] == 1)
+      pixels[queue[last++] = offset - 1] = 2;
+    if (px < limit_right && pixels[offset + 1] == 1)
+      pixels[queue[last++] = offset + 1] = 2;
+    if (py > limit_top && pixels[offset - size] == 1)
+      pixels[queue[last++] = offset - size] = 2;
+    if (py < limit_bottom && pixels[offset + size] == 1)
+      pixels[queue[last++] = offset + size] = 2;
+  }
+  free(queue);
+}
+
+/**
+ * Fills shapes which were very slow to fill with the older algorithm, and
+ * checks the result is the same as a simple pixel by pixel fill.
+ */
+int Test_Flood_fill(char * errmsg)
+{
+  static const struct
+  {
+    const char * name;
+    void (*draw)(byte * pixels, int size);
+    int x, y;
+  } shapes[] = {
+    { "open", Shape_open, FILL_SIZE / 2, FILL_SIZE / 2 },
+    { "spiral", Shape_spiral, 0, 0 },
+    { "serpentine", Shape_serpentine, 0, FILL_SIZE - 1 },
+    { "dithered", Shape_dithered, 0, 0 },
+  };
+  // The whole image, then a part of it
+  static const short limits[2][4] = {
+    { 0, 0, FILL_SIZE - 1, FILL_SIZE - 1 },
+    { 100, 50, FILL_SIZE - 201, FILL_SIZE - 31 },
+  };
+  long size = (long)FILL_SIZE * FILL_SIZE;
+  byte * pixels = GFX2_malloc(size);
+  byte * expected = GFX2_malloc(size);
+  unsigned int i;
+  int l;
+  int ok = 0;
+
+  if (pixels == NULL || expected == NULL)
+    goto cleanup;
+  for (i = 0; i < sizeof(shapes)/sizeof(shapes[0]); i++)
+  {
+    for (l = 0; l < 2; l++)
+    {
+      short top, bottom, left, right;
+      short x = shapes[i].x, y = shapes[i].y;
+      long offset;
+      long min_x = FILL_SIZE, min_y = FILL_SIZE, max_x = -1, max_y = -1;
+      dword t0;
+
+      if (x < limits[l][0]) x = limits[l][0];
+      if (x > limits[l][2]) x = limits[l][2];
+      if (y < limits[l][1]) y = limits[l][1];
+      if (y > limits[l][3]) y = limits[l][3];
+      shapes[i].draw(pixels, FILL_SIZE);
+      memcpy(expected, pixels, size);
+      Reference_fill(expected, FILL_SIZE, limits[l][0], limits[l][1], limits[l][2], limits[l][3], x, y);
+
+      t0 = GFX2_GetTicks();
+      if (!Flood_fill(pixels, FILL_SIZE, limits[l][0], limits[l][1], limits[l][2], limits[l][3], x, y,
+                      &top, &bottom, &left, &right))
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "%s: out of memory", shapes[i].name);
+        goto cleanup;
+      }
+      GFX2_Log(GFX2_INFO, "  %-10s %4dx%-4d: %4.0fms\n", shapes[i].name,
+               limits[l][2] - limits[l][0] + 1, limits[l][3] - limits[l][1] + 1,
+               (double)(GFX2_GetTicks() - t0));
+
+      if (memcmp(pixels, expected, size) != 0)
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "%s: the filled pixels are wrong", shapes[i].name);
+        goto cleanup;
+      }
+      // The rectangle reached must be the one of the filled pixels
+      for (offset = 0; offset < size; offset++)
+      {
+        if (pixels[offset] == 2)
+        {
+          if (offset / FILL_SIZE < min_y) min_y = offset / FILL_SIZE;
+          if (offset / FILL_SIZE > max_y) max_y = offset / FILL_SIZE;
+          if (offset % FILL_SIZE < min_x) min_x = offset % FILL_SIZE;
+          if (offset % FILL_SIZE > max_x) max_x = offset % FILL_SIZE;
+        }
+      }
+      if (top != min_y || bottom != max_y || left != min_x || right != max_x)
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "%s: reached (%d,%d)-(%d,%d) instead of (%ld,%ld)-(%ld,%ld)",
+                 shapes[i].name, left, top, right, bottom, min_x, min_y, max_x, max_y);
+        goto cleanup;
+      }
+    }
+  }
+  ok = 1;
+
+cleanup:
+  free(pixels);
+  free(expected);
+  return ok;
+}
@@ -0,0 +1,130 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testgfx2surface.c
+/// Unit tests and benchmark of the conversion of the screen to 32 bits.
+///
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../struct.h"
+#include "../gfx2surface.h"
+#include "../gfx2log.h"
+#include "../osdep.h"
+#include "../gfx2mem.h"
+#include "tests.h"
+
+/// Size of the screen for the benchmark: 4K
+#define ARGB_SCREEN_WIDTH 3840
+#define ARGB_SCREEN_HEIGHT 2160
+#define ARGB_PITCH (ARGB_SCREEN_WIDTH * 4 + 64)
+#define ARGB_PASSES 10
+
+/**
+ * Checks Pixels_to_ARGB() against a simple loop on all lengths, then
+ * compares the speed of the conversion in one pass with the conversion in
+ * a 32-bit copy of the screen followed by the copy of the rows in the
+ * texture, like SDL_BlitSurface() and memcpy() did.
+ */
+int Test_Pixels_to_ARGB(char * errmsg)
+{
+  T_Palette palette;
+  dword argb[256];
+  byte * screen;
+  dword * copy;
+  byte * texture;
+  byte * reference;
+  long size = (long)ARGB_SCREEN_WIDTH * ARGB_SCREEN_HEIGHT;
+  dword t0, t1;
+  long i;
+  int width, line, pass;
+  int ok = 0;
+
+  screen = GFX2_malloc(size);
+  copy = GFX2_malloc(size * 4);
+  texture = GFX2_malloc((long)ARGB_PITCH * ARGB_SCREEN_HEIGHT);
+  reference = GFX2_malloc((long)ARGB_PITCH * ARGB_SCREEN_HEIGHT);
+  if (screen == NULL || copy == NULL || texture == NULL || reference == NULL)
+    goto cleanup;
+  for (i = 0; i < 256; i++)
+  {
+    palette[i].R = (byte)(i * 3);
+    palette[i].G = (byte)(i * 5 + 1);
+    palette[i].B = (byte)(255 - i);
+  }
+  memset(argb, 0, sizeof(argb));
+  Palette_to_ARGB(argb, palette, 0, 128, 255, NULL);
+  Palette_to_ARGB(argb, palette + 128, 128, 128, 255, NULL);
+  for (i = 0; i < size; i++)
+    screen[i] = (byte)(i * 7 + i / 1000);
+
+  for (width = 0; width < 40; width++)
+  {
+    dword * dest = (dword *)texture;
+
+    memset(texture, 0, 41 * 4);
+    Pixels_to_ARGB(dest, screen + width, width, argb);
+    for (i = 0; i <= width; i++)
+    {
+      const T_Components * color = palette + screen[width + i];
+      dword expected = (i == width) ? 0 :
+        0xFF000000 | (dword)color->R << 16 | (dword)color->G << 8 | color->B;
+      if (dest[i] != expected)
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "width %d: pixel %ld is %08lX instead of %08lX",
+                 width, i, (unsigned long)dest[i], (unsigned long)expected);
+        goto cleanup;
+      }
+    }
+  }
+
+  // Benchmark: full screen updates
+  t0 = GFX2_GetTicks();
+  for (pass = 0; pass < ARGB_PASSES; pass++)
+  {
+    for (i = 0; i < size; i++)
+      copy[i] = argb[screen[i]];
+    for (line = 0; line < ARGB_SCREEN_HEIGHT; line++)
+      memcpy(reference + (long)line * ARGB_PITCH, copy + (long)line * ARGB_SCREEN_WIDTH, ARGB_SCREEN_WIDTH * 4);
+  }
+  t1 = GFX2_GetTicks();
+  for (pass = 0; pass < ARGB_PASSES; pass++)
+    for (line = 0; line < ARGB_SCREEN_HEIGHT; line++)
+      Pixels_to_ARGB((dword *)(texture + (long)line * ARGB_PITCH),
+                     screen + (long)line * ARGB_SCREEN_WIDTH, ARGB_SCREEN_WIDTH, argb);
+  GFX2_Log(GFX2_INFO, "  one pass: %4.0fms  with a copy: %4.0fms  (%d screens of %dx%d)\n",
+           (double)(GFX2_GetTicks() - t1), (double)(t1 - t0),
+           ARGB_PASSES, ARGB_SCREEN_WIDTH, ARGB_SCREEN_HEIGHT);
+  for (line = 0; line < ARGB_SCREEN_HEIGHT; line++)
+  {
+    if (memcmp(texture + (long)line * ARGB_PITCH, reference + (long)line * ARGB_PITCH, ARGB_SCREEN_WIDTH * 4))
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "wrong result on line %d", line);
+      goto cleanup;
+    }
+  }
+  ok = 1;
+
+cleanup:
+  free(screen);
+  free(copy);
+  free(texture);
+  free(reference);
+  return ok;
+}
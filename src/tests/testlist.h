@@ -8,11 +8,31 @@ TEST(Read_Write_bytes)
 TEST(Realpath)
 TEST(File_exists)
 TEST(Calculate_relative_path)
+TEST(Font_index)
 
 TEST(MOTO_MAP_pack)
 TEST(CPC_compare_colors)
 TEST(Packbits)
+TEST(Packbits_memory)
+TEST(Undo_file)
+TEST(Undo_history)
+TEST(Shared_backup)
+TEST(Tilemap)
+TEST(Parallel_composite)
+TEST(Overlay_row)
+TEST(Flood_fill)
+TEST(Zoom_line)
+TEST(Scroll_zoomed_screen)
+TEST(Pixels_to_ARGB)
+TEST(Dirty_region)
+TEST(Dirty_region_colors)
 TEST(Convert_24b_bitmap_to_256)
+TEST(Parallel_color_reduction)
+TEST(Color_reduction_methods)
+TEST(Dithering)
+TEST(Dithering_bands)
+TEST(Color_tree_grid)
+TEST(Occurrence_table)
 TEST(Formats)
 TEST(Load)
 TEST(Save)
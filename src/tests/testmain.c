@@ -40,6 +40,8 @@
 #include "../global.h"
 #include "../io.h"
 #include "../gfx2log.h"
+#include "../composite.h"
+#include "../pxzoom.h"
 #include "tests.h"
 
 // random()/srandom() not available with mingw32
@@ -77,7 +79,7 @@ T_Config Config;
 T_Document Main;
 T_Document Spare;
 byte * Screen_backup;
-byte * Main_Screen;
+byte * Main_screen;
 short Screen_width;
 short Screen_height;
 short Original_screen_X;
@@ -97,6 +99,55 @@ byte Windows_open;
 
 dword Key;
 
+char * Config_directory;
+char * Data_directory;
+Func_pixel Pixel_preview;
+Func_pixel Pixel_preview_normal;
+Func_pixel_opt_preview Pixel_in_current_screen_with_opt_preview;
+
+byte MC_Black;
+byte Cursor_shape;
+short Limit_top;
+short Limit_bottom;
+short Limit_left;
+short Limit_right;
+word Snap_width;
+word Snap_height;
+word Snap_offset_X;
+word Snap_offset_Y;
+Func_pixel Pixel;
+Func_display_zoom Display_zoomed_screen;
+Func_display_zoom_area Display_zoomed_area;
+short Limit_top_zoom;
+short Limit_left_zoom;
+short Limit_visible_bottom_zoom;
+short Limit_visible_right_zoom;
+byte * Horizontal_line_buffer;
+int Pixel_width;
+int Pixel_height;
+byte xor_lut[256];
+word Menu_Y;
+byte Show_grid;
+byte * Brush;
+byte * Brush_original_pixels;
+word Brush_width;
+byte Fore_color;
+byte Mouse_K;
+Func_read Read_pixel;
+word Menu_Y_before_window;
+dword Palette_generation;
+byte Sieve[16][16];
+short Sieve_width;
+short Sieve_height;
+byte Colorize_opacity;
+word Factors_table[256];
+word Factors_inv_table[256];
+T_Video_mode Video_mode[MAX_VIDEO_MODES];
+int Nb_video_modes;
+byte Timer_state;
+dword Timer_delay;
+dword Timer_start;
+
 char tmpdir[256];
 
 static const struct {
@@ -119,6 +170,8 @@ int init(void)
   DWORD len;
 #endif
   srandom(time(NULL));
+  Init_overlay_row();
+  Init_zoom_line();
 #ifdef ENABLE_FILENAMES_ICONV
   // iconv is used to convert filenames
   cd = iconv_open(TOCODE, FROMCODE);  // From UTF8 to ANSI
@@ -27,10 +27,20 @@
 /// Unit tests.
 ///
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "tests.h"
 #include "../op_c.h"
+#include "../workers.h"
 #include "../gfx2log.h"
+#include "../osdep.h"
+
+#define REDUCTION_WIDTH 512
+#define REDUCTION_HEIGHT 512
+
+#define CORPUS_WIDTH 320
+#define CORPUS_HEIGHT 240
 
 int Test_Convert_24b_bitmap_to_256(char * msg)
 {
@@ -59,3 +69,596 @@ int Test_Convert_24b_bitmap_to_256(char * msg)
   // TODO: test a real reduction
   return 1;
 }
+
+/// Counts the colors with the given precision, using a number of threads
+static T_Occurrence_table * Count_occurrences(T_Bitmap24B image, int nb_threads, int bits)
+{
+  T_Occurrence_table * t = OT_new(bits, bits, bits);
+
+  Init_workers(nb_threads);
+  if (t != NULL)
+    OT_count_occurrences(t, image, REDUCTION_WIDTH * REDUCTION_HEIGHT);
+  return t;
+}
+
+/// Checks that two occurrence tables have the same colors, with the same counts
+static int Same_occurrences(T_Occurrence_table * t1, T_Occurrence_table * t2)
+{
+  int i;
+
+  if (t1->nb_colors != t2->nb_colors || !OT_list_colors(t1))
+    return 0;
+  for (i = 0; i < t1->nb_colors; i++)
+  {
+    dword color = t1->colors[i].color;
+    if (t1->colors[i].count != OT_get(t2, color >> t1->dec_r, (color >> t1->dec_g) & (t1->rng_g - 1), color & (t1->rng_b - 1)))
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * Reduces a picture with a single thread, then with each of the numbers of
+ * threads: the palette and the picture must be exactly the same.
+ *
+ * The result of the single thread is left in dest and palette.
+ * @param settings the reduction, or NULL for Convert_24b_bitmap_to_256()
+ * @param runs number of times each number of threads is tried
+ * @return 1 if all are the same, 0 with a message otherwise
+ */
+static int Same_reduction_with_threads(T_Bitmap256 dest, T_Components * palette, T_Bitmap24B source, int width, int height,
+                                       const T_Color_reduction * settings, const int * threads, int nb_threads, int runs,
+                                       const char * name, char * msg)
+{
+  const long size = (long)width * height;
+  byte * parallel;
+  T_Palette parallel_palette;
+  int t, run;
+  long i;
+  int ok = 0;
+
+  parallel = (byte *)malloc(size);
+  if (parallel == NULL)
+    return 0;
+  Init_workers(1);
+  memset(palette, 0, sizeof(T_Palette));
+  if ((settings != NULL ? Reduce_24b_bitmap_to_256(dest, source, width, height, palette, settings)
+                        : Convert_24b_bitmap_to_256(dest, source, width, height, palette)) != 0)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "%s: the reduction failed", name);
+    goto cleanup;
+  }
+  for (t = 0; t < nb_threads; t++)
+  {
+    Init_workers(threads[t]);
+    for (run = 0; run < runs; run++)
+    {
+      memset(parallel_palette, 0, sizeof(T_Palette));
+      if ((settings != NULL ? Reduce_24b_bitmap_to_256(parallel, source, width, height, parallel_palette, settings)
+                            : Convert_24b_bitmap_to_256(parallel, source, width, height, parallel_palette)) != 0)
+      {
+        snprintf(msg, ERRMSG_LENGTH, "%s: the reduction failed with %d threads", name, threads[t]);
+        goto cleanup;
+      }
+      if (memcmp(palette, parallel_palette, sizeof(T_Palette)))
+      {
+        snprintf(msg, ERRMSG_LENGTH, "%s: the palette is different with %d threads", name, threads[t]);
+        goto cleanup;
+      }
+      for (i = 0; i < size; i++)
+        if (parallel[i] != dest[i])
+        {
+          snprintf(msg, ERRMSG_LENGTH, "%s: pixel (%ld,%ld) is different with %d threads (%d bands)",
+                   name, i % width, i / width, threads[t], Rows_bands(height));
+          goto cleanup;
+        }
+    }
+  }
+  ok = 1;
+
+cleanup:
+  free(parallel);
+  return ok;
+}
+
+/**
+ * The colors must be counted, and the pixels mapped to the palette, with
+ * exactly the same result whatever the number of threads.
+ */
+int Test_Parallel_color_reduction(char * msg)
+{
+  static T_Components source[REDUCTION_WIDTH * REDUCTION_HEIGHT];
+  static byte serial[REDUCTION_WIDTH * REDUCTION_HEIGHT];
+  T_Palette serial_palette;
+  static const int bits[2] = { 5, 8 };
+  static const int threads[3] = { 2, 3, WORKERS_MAX_THREADS };
+  // Big enough for the histogram of Wu's method to be counted by the threads
+  static const T_Color_reduction wu = { COLOR_REDUCTION_WU, 2, 0, DITHERING_NONE };
+  dword seed = 3;
+  int x, y, i;
+  int ok = 0;
+
+  // Gradients with noise, so there are a lot more than 256 colors
+  for (y = 0; y < REDUCTION_HEIGHT; y++)
+    for (x = 0; x < REDUCTION_WIDTH; x++)
+    {
+      T_Components * pixel = source + y * REDUCTION_WIDTH + x;
+      seed = seed * 1103515245 + 12345;
+      pixel->R = (byte)(x / 2 + ((seed >> 24) & 15));
+      pixel->G = (byte)(y / 2 + ((seed >> 16) & 15));
+      pixel->B = (byte)((x + y) / 4 + ((seed >> 8) & 63));
+    }
+
+  for (i = 0; i < 2; i++)
+  {
+    T_Occurrence_table * t1 = Count_occurrences(source, 1, bits[i]);
+    int t;
+
+    for (t = 0; t < 3; t++)
+    {
+      T_Occurrence_table * t2 = Count_occurrences(source, threads[t], bits[i]);
+      int same = t1 != NULL && t2 != NULL && Same_occurrences(t1, t2);
+
+      if (t2 != NULL)
+        OT_delete(t2);
+      if (!same)
+      {
+        snprintf(msg, ERRMSG_LENGTH, "Occurrences counted with %d bits are different with %d threads", bits[i], threads[t]);
+        if (t1 != NULL)
+          OT_delete(t1);
+        goto cleanup;
+      }
+      // The slices of red are shared by all the threads, one pass over
+      // the picture per thread
+      if (Thread_bands(1 << bits[i]) != threads[t])
+      {
+        snprintf(msg, ERRMSG_LENGTH, "The colors are counted in %d bands with %d threads", Thread_bands(1 << bits[i]), threads[t]);
+        OT_delete(t1);
+        goto cleanup;
+      }
+    }
+    OT_delete(t1);
+  }
+
+  if (!Same_reduction_with_threads(serial, serial_palette, source, REDUCTION_WIDTH, REDUCTION_HEIGHT,
+                                   NULL, threads, 3, 1, "Conversion", msg))
+    goto cleanup;
+  if (!Same_reduction_with_threads(serial, serial_palette, source, REDUCTION_WIDTH, REDUCTION_HEIGHT,
+                                   &wu, threads, 3, 1, "Wu+km", msg))
+    goto cleanup;
+  ok = 1;
+
+cleanup:
+  Close_workers();
+  return ok;
+}
+
+/// Makes one of the pictures of the color reduction benchmark
+static void Corpus_picture(T_Components * picture, int number)
+{
+  dword seed = 11;
+  int x, y;
+
+  for (y = 0; y < CORPUS_HEIGHT; y++)
+    for (x = 0; x < CORPUS_WIDTH; x++)
+    {
+      T_Components * pixel = picture + y * CORPUS_WIDTH + x;
+      seed = seed * 1103515245 + 12345;
+      switch (number)
+      {
+        case 0: // Smooth gradients
+          pixel->R = (byte)(x * 255 / (CORPUS_WIDTH - 1));
+          pixel->G = (byte)(y * 255 / (CORPUS_HEIGHT - 1));
+          pixel->B = (byte)(128 + 127 * sin((x + y) / 40.0));
+          break;
+        case 1: // Plasma
+          pixel->R = (byte)(128 + 127 * sin(x / 23.0 + sin(y / 31.0) * 2));
+          pixel->G = (byte)(128 + 127 * sin(y / 17.0 + cos(x / 29.0) * 3));
+          pixel->B = (byte)(128 + 127 * cos((x - y) / 37.0 + sin(x / 13.0)));
+          break;
+        default: // Flat areas of a few hues, with grain, like a photo
+          {
+            int hue = ((x / 40) * 7 + (y / 30) * 3) % 6;
+            int grain = (seed >> 24) & 15;
+            pixel->R = (byte)(hue * 40 + grain);
+            pixel->G = (byte)(200 - hue * 30 + grain);
+            pixel->B = (byte)((hue & 1) * 120 + y / 4 + grain);
+          }
+          break;
+      }
+    }
+}
+
+/// Peak signal-to-noise ratio of a reduced picture, in dB
+static double Reduction_PSNR(const T_Components * source, const byte * dest, const T_Components * palette, long size)
+{
+  double error = 0;
+  long i;
+
+  for (i = 0; i < size; i++)
+  {
+    int dr = source[i].R - palette[dest[i]].R;
+    int dg = source[i].G - palette[dest[i]].G;
+    int db = source[i].B - palette[dest[i]].B;
+    error += dr * dr + dg * dg + db * db;
+  }
+  if (error == 0)
+    return 99.0;
+  return 10 * log10(255.0 * 255.0 * 3 * size / error);
+}
+
+/**
+ * Benchmark of the color reduction methods: time and quality (PSNR) on a
+ * fixed set of pictures.
+ *
+ * The k-means passes must not make the palette worse, and must not depend
+ * on the number of threads.
+ */
+int Test_Color_reduction_methods(char * msg)
+{
+  static T_Components source[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static T_Components work[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static byte dest[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static const struct {
+    const char * name;
+    T_Color_reduction settings;
+  } methods[] = {
+    { "Median cut", { COLOR_REDUCTION_MEDIAN_CUT, 0, 0, DITHERING_NONE } },
+    { "Median+km", { COLOR_REDUCTION_MEDIAN_CUT, 10, 0, DITHERING_NONE } },
+    { "Wu", { COLOR_REDUCTION_WU, 0, 0, DITHERING_NONE } },
+    { "Wu+km", { COLOR_REDUCTION_WU, 10, 0, DITHERING_NONE } },
+  };
+  static const char * const pictures[] = { "gradients", "plasma", "photo" };
+  static const int threads[] = { 3, WORKERS_MAX_THREADS };
+  const long size = (long)CORPUS_WIDTH * CORPUS_HEIGHT;
+  T_Palette palette;
+  int picture, m;
+
+  Init_workers(0);
+  for (picture = 0; picture < 3; picture++)
+  {
+    double psnr[4];
+
+    Corpus_picture(source, picture);
+    for (m = 0; m < 4; m++)
+    {
+      dword t0;
+
+      memcpy(work, source, sizeof(work));
+      memset(palette, 0, sizeof(T_Palette));
+      t0 = GFX2_GetTicks();
+      if (Reduce_24b_bitmap_to_256(dest, work, CORPUS_WIDTH, CORPUS_HEIGHT, palette, &methods[m].settings) != 0)
+      {
+        snprintf(msg, ERRMSG_LENGTH, "%s: %s failed", pictures[picture], methods[m].name);
+        Close_workers();
+        return 0;
+      }
+      psnr[m] = Reduction_PSNR(source, dest, palette, size);
+      GFX2_Log(GFX2_INFO, "  %-9s %-10s: %4.0fms  PSNR %5.2fdB\n", pictures[picture], methods[m].name,
+               (double)(GFX2_GetTicks() - t0), psnr[m]);
+      if (psnr[m] < 25.0)
+      {
+        snprintf(msg, ERRMSG_LENGTH, "%s: %s PSNR is only %.2fdB", pictures[picture], methods[m].name, psnr[m]);
+        Close_workers();
+        return 0;
+      }
+    }
+    if (psnr[1] < psnr[0] - 0.1 || psnr[3] < psnr[2] - 0.1)
+    {
+      snprintf(msg, ERRMSG_LENGTH, "%s: the k-means passes made the palette worse", pictures[picture]);
+      Close_workers();
+      return 0;
+    }
+  }
+  // The k-means passes share the sums of the clusters between the threads
+  Corpus_picture(source, 0);
+  memcpy(work, source, sizeof(work));
+  if (!Same_reduction_with_threads(dest, palette, work, CORPUS_WIDTH, CORPUS_HEIGHT,
+                                   &methods[3].settings, threads, 2, 1, methods[3].name, msg))
+  {
+    Close_workers();
+    return 0;
+  }
+  Close_workers();
+  return 1;
+}
+
+/// Mean of the R, G and B components of a picture
+static void Mean_color(const T_Components * source, const byte * dest, const T_Components * palette, long size, double * mean)
+{
+  long i;
+
+  mean[0] = mean[1] = mean[2] = 0;
+  for (i = 0; i < size; i++)
+  {
+    const T_Components * color = dest != NULL ? palette + dest[i] : source + i;
+    mean[0] += color->R;
+    mean[1] += color->G;
+    mean[2] += color->B;
+  }
+  mean[0] /= size;
+  mean[1] /= size;
+  mean[2] /= size;
+}
+
+/**
+ * Each dithering method must keep the mean color of the picture, and
+ * change the picture reduced without dithering.
+ */
+int Test_Dithering(char * msg)
+{
+  static T_Components source[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static byte undithered[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static byte dithered[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static const char * const names[DITHERING_METHODS] = { "None", "Bayer", "Blue noise", "Floyd-Steinberg", "Sierra" };
+  const long size = (long)CORPUS_WIDTH * CORPUS_HEIGHT;
+  T_Color_reduction settings = { COLOR_REDUCTION_WU, 0, 0, DITHERING_NONE };
+  double source_mean[3];
+  int ok = 0;
+
+  Init_workers(0);
+  Corpus_picture(source, 0);
+  Mean_color(source, NULL, NULL, size, source_mean);
+  for (settings.Dithering = 0; settings.Dithering < DITHERING_METHODS; settings.Dithering++)
+  {
+    T_Palette palette;
+    byte * dest = settings.Dithering == DITHERING_NONE ? undithered : dithered;
+    double mean[3];
+    dword t0;
+    long changed = 0;
+    long i;
+    int c;
+
+    memset(palette, 0, sizeof(T_Palette));
+    t0 = GFX2_GetTicks();
+    if (Reduce_24b_bitmap_to_256(dest, source, CORPUS_WIDTH, CORPUS_HEIGHT, palette, &settings) != 0)
+      goto cleanup;
+    GFX2_Log(GFX2_INFO, "  %-15s: %4.0fms  PSNR %5.2fdB\n", names[settings.Dithering],
+             (double)(GFX2_GetTicks() - t0), Reduction_PSNR(source, dest, palette, size));
+    Mean_color(source, dest, palette, size, mean);
+    for (c = 0; c < 3; c++)
+      if (fabs(mean[c] - source_mean[c]) > 1.0)
+      {
+        snprintf(msg, ERRMSG_LENGTH, "%s: the mean of component %d is %.2f instead of %.2f",
+                 names[settings.Dithering], c, mean[c], source_mean[c]);
+        goto cleanup;
+      }
+    if (settings.Dithering == DITHERING_NONE)
+      continue;
+    // The palette is the same: the dithering only changes the pixels
+    for (i = 0; i < size; i++)
+      if (dithered[i] != undithered[i])
+        changed++;
+    if (changed < size / 10)
+    {
+      snprintf(msg, ERRMSG_LENGTH, "%s: only %ld pixels of %ld are dithered", names[settings.Dithering], changed, size);
+      goto cleanup;
+    }
+  }
+  ok = 1;
+
+cleanup:
+  Close_workers();
+  return ok;
+}
+
+/**
+ * Each dithering method must give exactly the same result whatever the
+ * number of threads. The picture has grain everywhere, so with the error
+ * diffusion each band gets errors from the last row of the band above,
+ * for each block of columns: it's tried several times to catch a race.
+ */
+int Test_Dithering_bands(char * msg)
+{
+  static T_Components source[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static byte serial[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static const int threads[] = { 2, 3, 5, WORKERS_MAX_THREADS };
+  static const char * const names[DITHERING_METHODS] = { "None", "Bayer", "Blue noise", "Floyd-Steinberg", "Sierra" };
+  T_Color_reduction settings = { COLOR_REDUCTION_WU, 0, 0, DITHERING_NONE };
+  T_Palette serial_palette;
+  int t;
+  int ok = 0;
+
+  for (t = 0; t < (int)(sizeof(threads) / sizeof(threads[0])); t++)
+  {
+    Init_workers(threads[t]);
+    if (Rows_bands(CORPUS_HEIGHT) < 2)
+    {
+      snprintf(msg, ERRMSG_LENGTH, "only one band with %d threads", threads[t]);
+      goto cleanup;
+    }
+  }
+  Corpus_picture(source, 2);
+  for (settings.Dithering = 0; settings.Dithering < DITHERING_METHODS; settings.Dithering++)
+  {
+    int runs = settings.Dithering >= DITHERING_FLOYD_STEINBERG ? 3 : 1;
+
+    if (!Same_reduction_with_threads(serial, serial_palette, source, CORPUS_WIDTH, CORPUS_HEIGHT, &settings,
+                                     threads, (int)(sizeof(threads) / sizeof(threads[0])), runs,
+                                     names[settings.Dithering], msg))
+      goto cleanup;
+  }
+  ok = 1;
+
+cleanup:
+  Close_workers();
+  return ok;
+}
+
+/**
+ * The lookup grid of a color tree must give the same index as the tree,
+ * and faster: the time of both is reported.
+ */
+int Test_Color_tree_grid(char * msg)
+{
+  static T_Components source[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static byte walked[CORPUS_WIDTH * CORPUS_HEIGHT];
+  static byte looked_up[CORPUS_WIDTH * CORPUS_HEIGHT];
+  const long size = (long)CORPUS_WIDTH * CORPUS_HEIGHT;
+  int picture;
+
+  for (picture = 0; picture < 3; picture++)
+  {
+    T_Palette palette;
+    CT_Tree * tree;
+    CT_Grid * grid;
+    dword t0, t1, t2;
+    long i, nb_cells = 0;
+    int nb_colors;
+    int pass;
+
+    Corpus_picture(source, picture);
+    // 7 bits: some boxes of the tree don't stop at the limits of the cells
+    tree = Optimize_palette(source, size, palette, 7, 7, 7, &nb_colors);
+    if (tree == NULL)
+      return 0;
+    t0 = GFX2_GetTicks();
+    grid = CT_grid_new(tree);
+    if (grid == NULL)
+    {
+      CT_delete(tree);
+      return 0;
+    }
+    t1 = GFX2_GetTicks();
+    for (pass = 0; pass < 10; pass++)
+      for (i = 0; i < size; i++)
+      {
+        word index = grid->cells[CT_GRID_INDEX(source[i].R, source[i].G, source[i].B)];
+        looked_up[i] = index != CT_GRID_TREE ? (byte)index : CT_get(tree, source[i].R, source[i].G, source[i].B);
+      }
+    t2 = GFX2_GetTicks();
+    for (pass = 0; pass < 10; pass++)
+      for (i = 0; i < size; i++)
+        walked[i] = CT_get(tree, source[i].R, source[i].G, source[i].B);
+    for (i = 0; i < (1 << (3 * CT_GRID_BITS)); i++)
+      if (grid->cells[i] != CT_GRID_TREE)
+        nb_cells++;
+    GFX2_Log(GFX2_INFO, "  picture %d: tree %4.0fms, grid %4.0fms (built in %2.0fms, %ld%% of the cells)\n", picture,
+             (double)(GFX2_GetTicks() - t2), (double)(t2 - t1),
+             (double)(t1 - t0), nb_cells * 100 / (1 << (3 * CT_GRID_BITS)));
+    CT_grid_delete(grid);
+    CT_delete(tree);
+    for (i = 0; i < size; i++)
+      if (walked[i] != looked_up[i])
+      {
+        snprintf(msg, ERRMSG_LENGTH, "picture %d, pixel %ld: %d in the tree, %d in the grid", picture, i, walked[i], looked_up[i]);
+        return 0;
+      }
+  }
+  return 1;
+}
+
+/**
+ * The occurrence table only takes memory for the colors of the picture, even
+ * at full precision, and the median cut gives each color its own palette entry
+ * when there are less than 256.
+ */
+int Test_Occurrence_table(char * msg)
+{
+  static T_Components source[REDUCTION_WIDTH * REDUCTION_HEIGHT];
+  static byte dest[REDUCTION_WIDTH * REDUCTION_HEIGHT];
+  static T_Components noise[REDUCTION_WIDTH * REDUCTION_HEIGHT];
+  static int counts[200];
+  static int all_counts[32768];
+  const long size = (long)REDUCTION_WIDTH * REDUCTION_HEIGHT;
+  T_Components colors[200];
+  T_Palette palette;
+  T_Occurrence_table * t;
+  CT_Tree * tree;
+  dword seed = 5;
+  int nb_colors;
+  long i;
+  int c;
+  int ok = 0;
+
+  // 200 colors from all over the RGB cube, in runs of random lengths
+  for (c = 0; c < 200; c++)
+  {
+    seed = seed * 1103515245 + 12345;
+    colors[c].R = (byte)(seed >> 24);
+    colors[c].G = (byte)(seed >> 16);
+    colors[c].B = (byte)(seed >> 8);
+    // Only different colors
+    for (i = 0; i < c; i++)
+      if (!memcmp(colors + i, colors + c, sizeof(T_Components)))
+        colors[c].B ^= 1;
+  }
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < size; )
+  {
+    long run;
+    seed = seed * 1103515245 + 12345;
+    c = (seed >> 16) % 200;
+    for (run = (seed >> 8) % 8; run >= 0 && i < size; run--, i++)
+    {
+      source[i] = colors[c];
+      counts[c]++;
+    }
+  }
+
+  Init_workers(WORKERS_MAX_THREADS);
+  t = OT_new(8, 8, 8);
+  if (t == NULL || !OT_count_occurrences(t, source, size))
+    goto cleanup;
+  if (t->nb_colors != 200 || t->table == NULL || t->size > 4096)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "%d colors counted in a table of %d entries", t->nb_colors, t->size);
+    goto cleanup;
+  }
+  for (c = 0; c < 200; c++)
+    if (OT_get(t, colors[c].R, colors[c].G, colors[c].B) != counts[c])
+    {
+      snprintf(msg, ERRMSG_LENGTH, "Color %d counted %d times instead of %d", c,
+               OT_get(t, colors[c].R, colors[c].G, colors[c].B), counts[c]);
+      goto cleanup;
+    }
+
+  OT_delete(t);
+
+  // Random colors: the table ends up counting each color directly
+  t = OT_new(5, 5, 5);
+  if (t == NULL)
+    goto cleanup;
+  memset(all_counts, 0, sizeof(all_counts));
+  for (i = 0; i < size; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    noise[i].R = (byte)(seed >> 24);
+    noise[i].G = (byte)(seed >> 16);
+    noise[i].B = (byte)(seed >> 8);
+    all_counts[(noise[i].R >> 3) << 10 | (noise[i].G >> 3) << 5 | (noise[i].B >> 3)]++;
+  }
+  if (!OT_count_occurrences(t, noise, size))
+    goto cleanup;
+  if (t->counts == NULL || t->table != NULL)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "%d colors of 32768 are still in a hash table", t->nb_colors);
+    goto cleanup;
+  }
+  for (i = 0; i < 32768; i++)
+    if (OT_get(t, i >> 10, (i >> 5) & 31, i & 31) != all_counts[i])
+    {
+      snprintf(msg, ERRMSG_LENGTH, "Color %ld counted %d times instead of %d in a table of %d entries", i,
+               OT_get(t, i >> 10, (i >> 5) & 31, i & 31), all_counts[i], t->size);
+      goto cleanup;
+    }
+
+  tree = Optimize_palette(source, size, palette, 8, 8, 8, &nb_colors);
+  if (tree == NULL)
+    goto cleanup;
+  for (i = 0; i < size; i++)
+    dest[i] = CT_get(tree, source[i].R, source[i].G, source[i].B);
+  CT_delete(tree);
+  if (nb_colors != 200 || Reduction_PSNR(source, dest, palette, size) < 99.0)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "%d colors in the palette, the picture is not exact", nb_colors);
+    goto cleanup;
+  }
+  ok = 1;
+
+cleanup:
+  if (t != NULL)
+    OT_delete(t);
+  Close_workers();
+  return ok;
+}
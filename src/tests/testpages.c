@@ -0,0 +1,566 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testpages.c
+/// Unit tests of the Undo history.
+///
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../struct.h"
+#include "../global.h"
+#include "../pages.h"
+#include "../misc.h"
+#include "../undofile.h"
+#include "../workers.h"
+#include "tests.h"
+
+#define HISTORY_WIDTH 320
+#define HISTORY_HEIGHT 256
+#define HISTORY_STEPS 300
+#define SHARED_STEPS 60
+#define SPARE_STEPS 10
+
+#define COMPOSITE_WIDTH 640
+#define COMPOSITE_HEIGHT 400
+#define COMPOSITE_LAYERS 5
+
+/// Simple pseudo random generator, so the history is the same on each run
+static dword Next_random(dword * seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/// Checksum of the pixels of a layer of a page
+static dword Layer_checksum(T_Page * page, int layer)
+{
+  const byte * p = page->Image[layer].Pixels;
+  long i;
+  dword sum = 2166136261UL;
+
+  for (i = 0; i < (long)page->Width * page->Height; i++)
+    sum = (sum ^ p[i]) * 16777619UL;
+  return sum;
+}
+
+/// Checksum of the pixels of the current page
+static dword Page_checksum(T_Page * page)
+{
+  return Layer_checksum(page, 0);
+}
+
+/// Returns 1 if only the current page and its backup are plain bitmaps
+static int Only_recent_bitmaps(T_List_of_pages * list)
+{
+  T_Page * page;
+
+  if (list->Pages->Image[0].Pixels == NULL || list->Pages->Next->Image[0].Pixels == NULL)
+    return 0;
+  for (page = list->Pages->Next->Next; page != list->Pages; page = page->Next)
+    if (page->Image[0].Pixels != NULL)
+      return 0;
+  return 1;
+}
+
+/// Adds a step to a history of HISTORY_WIDTH x HISTORY_HEIGHT pixels: it
+/// fills a rectangle with noise, which can't be packed.
+/// Returns the checksum of the new step.
+static dword Draw_history_step(T_List_of_pages * list, dword * seed)
+{
+  T_Page * page = New_page(1);
+  int x, y, w, h, i;
+
+  Copy_S_page(page, list->Pages);
+  Create_new_page(page, list, 0);
+  memcpy(page->Image[0].Pixels, page->Next->Image[0].Pixels, HISTORY_WIDTH * HISTORY_HEIGHT);
+  w = 16 + Next_random(seed) % 80;
+  h = 16 + Next_random(seed) % 80;
+  x = Next_random(seed) % (HISTORY_WIDTH - w);
+  y = Next_random(seed) % (HISTORY_HEIGHT - h);
+  for (; h > 0; h--, y++)
+    for (i = 0; i < w; i++)
+      page->Image[0].Pixels[y * HISTORY_WIDTH + x + i] = (byte)Next_random(seed);
+  return Page_checksum(page);
+}
+
+/// Starts a history of HISTORY_WIDTH x HISTORY_HEIGHT pixels
+static int Start_history(T_List_of_pages * list)
+{
+  Init_list_of_pages(list);
+  if (!Allocate_list_of_pages(list))
+    return 0;
+  list->Pages->Width = HISTORY_WIDTH;
+  list->Pages->Height = HISTORY_HEIGHT;
+  list->Pages->Image[0].Pixels = New_layer(list, HISTORY_WIDTH * HISTORY_HEIGHT);
+  if (list->Pages->Image[0].Pixels == NULL)
+    return 0;
+  memset(list->Pages->Image[0].Pixels, 0, HISTORY_WIDTH * HISTORY_HEIGHT);
+  return 1;
+}
+
+#define UNDO_FILE_TEST_RECORDS 5000
+#define UNDO_FILE_TEST_MAX_SIZE 4000
+
+/// Size of a record of Test_Undo_file()
+#define UNDO_FILE_TEST_SIZE(record) (1 + (record) * 7 % UNDO_FILE_TEST_MAX_SIZE)
+/// Content of a record of Test_Undo_file()
+#define UNDO_FILE_TEST_BYTE(record, i) ((byte)((record) * 31 + (i) * 7))
+
+/**
+ * Records of different sizes must be stored one after the other in the
+ * scratch file, and the space must be reused once they are all freed.
+ */
+int Test_Undo_file(char * errmsg)
+{
+  static long records[UNDO_FILE_TEST_RECORDS];
+  byte data[UNDO_FILE_TEST_MAX_SIZE];
+  int ok = 0;
+  int pass, r, i;
+
+  if (!Undo_file_open(tmpdir))
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "Cannot create the scratch file in %s", tmpdir);
+    return 0;
+  }
+  for (pass = 0; pass < 2; pass++)
+  {
+    for (r = 0; r < UNDO_FILE_TEST_RECORDS; r++)
+    {
+      for (i = 0; i < UNDO_FILE_TEST_SIZE(r); i++)
+        data[i] = UNDO_FILE_TEST_BYTE(r + pass, i);
+      records[r] = Undo_file_store(data, UNDO_FILE_TEST_SIZE(r));
+      if (records[r] < 0)
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "Record %d of %d bytes could not be stored", r, UNDO_FILE_TEST_SIZE(r));
+        goto cleanup;
+      }
+    }
+    // About 10 MB: they fit in one chunk, the second time too.
+    // With 4 KB per record, they would take 20 MB.
+    if (Undo_file_size != (long long)UNDO_FILE_CHUNK_SIZE || Undo_file_records != UNDO_FILE_TEST_RECORDS)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "pass %d: %lld bytes in the file for %ld records",
+               pass, Undo_file_size, Undo_file_records);
+      goto cleanup;
+    }
+    for (r = 0; r < UNDO_FILE_TEST_RECORDS; r++)
+    {
+      const byte * stored = Undo_file_data(records[r]);
+
+      for (i = 0; i < UNDO_FILE_TEST_SIZE(r); i++)
+        if (stored[i] != UNDO_FILE_TEST_BYTE(r + pass, i))
+        {
+          snprintf(errmsg, ERRMSG_LENGTH, "pass %d: byte %d of record %d was overwritten", pass, i, r);
+          goto cleanup;
+        }
+    }
+    for (r = 0; r < UNDO_FILE_TEST_RECORDS; r++)
+      Undo_file_free(records[r]);
+  }
+  ok = Undo_file_records == 0;
+
+cleanup:
+  Undo_file_close();
+  return ok;
+}
+
+/**
+ * Draws a long history under a 1MB memory budget, then walks it back and
+ * forth: no step must be lost, and the memory must stay in the budget
+ * thanks to the scratch file.
+ * A short history in the spare page has its own budget: it must not lose
+ * its steps because of the main one, nor make the main one lose its steps.
+ */
+int Test_Undo_history(char * errmsg)
+{
+  T_List_of_pages list;
+  T_List_of_pages spare;
+  static dword checksums[HISTORY_STEPS+1];
+  long long budget;
+  long long memory;
+  dword seed = 42;
+  int ok = 0;
+  int step;
+
+  Config.Undo_memory_budget = 1;
+  budget = (long long)Config.Undo_memory_budget * 1024 * 1024;
+  if (!Undo_file_open(tmpdir))
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "Cannot create the scratch file in %s", tmpdir);
+    return 0;
+  }
+  Init_list_of_pages(&spare);
+  if (!Start_history(&list))
+    goto cleanup;
+  checksums[0] = Page_checksum(list.Pages);
+
+  for (step = 1; step <= HISTORY_STEPS; step++)
+  {
+    checksums[step] = Draw_history_step(&list, &seed);
+    if (list.Memory > budget || !Only_recent_bitmaps(&list))
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "step %d: %lld bytes in memory, %s", step, list.Memory,
+               Only_recent_bitmaps(&list) ? "old steps tiled" : "old steps not tiled");
+      goto cleanup;
+    }
+  }
+  if (list.List_size != HISTORY_STEPS + 1 || Stats_pages_spilled_memory == 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%d steps kept, %lld bytes in the scratch file",
+             list.List_size, Stats_pages_spilled_memory);
+    goto cleanup;
+  }
+
+  // Draw in the spare page
+  memory = list.Memory;
+  if (!Start_history(&spare))
+    goto cleanup;
+  for (step = 1; step <= SPARE_STEPS; step++)
+    Draw_history_step(&spare, &seed);
+  if (spare.List_size != SPARE_STEPS + 1 || list.List_size != HISTORY_STEPS + 1 || list.Memory != memory)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%d steps kept in the spare page, %d steps and %lld bytes in the main one",
+             spare.List_size, list.List_size, list.Memory);
+    goto cleanup;
+  }
+
+  // Undo everything, then Redo everything
+  for (step = HISTORY_STEPS - 1; step >= 0; step--)
+  {
+    if (!Backward_in_list_of_pages(&list) || !Only_recent_bitmaps(&list)
+        || Page_checksum(list.Pages) != checksums[step] || list.Memory > budget)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Undo to step %d failed (%lld bytes in memory)", step, list.Memory);
+      goto cleanup;
+    }
+  }
+  for (step = 1; step <= HISTORY_STEPS; step++)
+  {
+    if (!Advance_in_list_of_pages(&list) || !Only_recent_bitmaps(&list)
+        || Page_checksum(list.Pages) != checksums[step] || list.Memory > budget)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Redo to step %d failed (%lld bytes in memory)", step, list.Memory);
+      goto cleanup;
+    }
+  }
+  ok = 1;
+
+cleanup:
+  while (list.List_size > 0)
+    Free_last_page_of_list(&list);
+  while (spare.List_size > 0)
+    Free_last_page_of_list(&spare);
+  if (ok && (list.Memory != 0 || spare.Memory != 0))
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%lld and %lld bytes still counted in the freed lists", list.Memory, spare.Memory);
+    ok = 0;
+  }
+  if (ok && (Undo_file_records != 0 || Stats_pages_spilled_memory != 0))
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%ld records of the scratch file were not released", Undo_file_records);
+    ok = 0;
+  }
+  Undo_file_close();
+  Config.Undo_memory_budget = 0;
+  return ok;
+}
+
+/**
+ * Backup() must not copy the working layer: the backup gets the tiles
+ * one by one, when Unshare_backup_area() is called before they are
+ * modified, and shares the other ones with the older step.
+ * Each step only costs the tiles it modified, and walking the history
+ * back and forth gives the right pixels.
+ */
+int Test_Shared_backup(char * errmsg)
+{
+  T_List_of_pages list;
+  T_List_of_pages * main_backups = Main.backups;
+  static dword checksums[SHARED_STEPS+1];
+  long size = (long)HISTORY_WIDTH * HISTORY_HEIGHT;
+  long long unpacked_memory;
+  dword seed = 11;
+  int ok = 0;
+  int step, layer;
+  long i;
+
+  Config.Max_undo_pages = SHARED_STEPS;
+  Config.FX_Feedback = 1;
+  Init_list_of_pages(&list);
+  list.Pages = New_page(2);
+  if (list.Pages == NULL)
+    return 0;
+  list.Pages->Next = list.Pages->Prev = list.Pages;
+  list.Pages->Width = HISTORY_WIDTH;
+  list.Pages->Height = HISTORY_HEIGHT;
+  list.List_size = 1;
+  for (layer = 0; layer < 2; layer++)
+  {
+    list.Pages->Image[layer].Pixels = New_layer(&list, size);
+    if (list.Pages->Image[layer].Pixels == NULL)
+      goto cleanup;
+    for (i = 0; i < size; i++)
+      list.Pages->Image[layer].Pixels[i] = (byte)Next_random(&seed);
+  }
+  Main.backups = &list;
+  Main.image_width = HISTORY_WIDTH;
+  Main.image_height = HISTORY_HEIGHT;
+  Main.current_layer = 1;
+  checksums[0] = Layer_checksum(list.Pages, 1);
+  unpacked_memory = Stats_pages_unpacked_memory;
+
+  for (step = 1; step <= SHARED_STEPS; step++)
+  {
+    long pages_number = Stats_pages_number;
+    int x, y, w, h;
+
+    Backup();
+    if (Stats_pages_number != pages_number || list.Pages->Next->Image[1].Pixels != NULL
+        || Main_shared_backup_layer != 1)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "step %d: the backup made a copy of the layer", step);
+      goto cleanup;
+    }
+    // A small rectangle of noise, over up to 4 tiles
+    w = 1 + Next_random(&seed) % 40;
+    h = 1 + Next_random(&seed) % 40;
+    x = Next_random(&seed) % (HISTORY_WIDTH - w);
+    y = Next_random(&seed) % (HISTORY_HEIGHT - h);
+    for (; h > 0; h--, y++)
+    {
+      Unshare_backup_area(x, y, w, 1);
+      for (i = 0; i < w; i++)
+        list.Pages->Image[1].Pixels[y * HISTORY_WIDTH + x + i] = (byte)Next_random(&seed);
+    }
+    checksums[step] = Layer_checksum(list.Pages, 1);
+  }
+  // Both layers are tiled once, then each step copies at most 4 tiles
+  // (8 when it's closed without knowing the tiles modified before).
+  if (Stats_pages_unpacked_memory - unpacked_memory > (2 * 2 * size) + (long long)SHARED_STEPS * 8 * 64 * 64)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "The history of %d small changes takes %lld bytes", SHARED_STEPS,
+             Stats_pages_unpacked_memory - unpacked_memory);
+    goto cleanup;
+  }
+
+  // Undo everything, then Redo everything
+  for (step = SHARED_STEPS - 1; step >= 0; step--)
+  {
+    if (!Backward_in_list_of_pages(&list) || Layer_checksum(list.Pages, 1) != checksums[step])
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Undo to step %d failed", step);
+      goto cleanup;
+    }
+  }
+  for (step = 1; step <= SHARED_STEPS; step++)
+  {
+    if (!Advance_in_list_of_pages(&list) || Layer_checksum(list.Pages, 1) != checksums[step])
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Redo to step %d failed", step);
+      goto cleanup;
+    }
+  }
+  ok = 1;
+
+cleanup:
+  while (list.List_size > 0)
+    Free_last_page_of_list(&list);
+  Main.backups = main_backups;
+  Main.current_layer = 0;
+  Config.Max_undo_pages = 0;
+  Config.FX_Feedback = 0;
+  return ok;
+}
+
+/// Checksum of all the layers of the current page, and of the visible image,
+/// after going through a conversion table (or none)
+static dword Image_checksum(const byte * conversion_table)
+{
+  long size = (long)Main.image_width * Main.image_height;
+  dword sum = 2166136261UL;
+  long i;
+  int layer;
+
+  for (layer = 0; layer < Main.backups->Pages->Nb_layers; layer++)
+    for (i = 0; i < size; i++)
+    {
+      byte color = Main.backups->Pages->Image[layer].Pixels[i];
+      sum = (sum ^ (conversion_table ? conversion_table[color] : color)) * 16777619UL;
+    }
+  for (i = 0; i < size; i++)
+  {
+    byte color = Main.visible_image.Image[i];
+    sum = (sum ^ (conversion_table ? conversion_table[color] : color)) * 16777619UL;
+  }
+  return sum;
+}
+
+/// Composes the layers (whole image and a part of it), counts the colors
+/// with Count_used_colors(), and remaps the image with
+/// Remap_image_highlevel(), then back to its colors.
+/// @return 0 if the remapped image or the flattened layers aren't the expected ones
+static int Compose_count_and_remap(byte * visible, byte * depth, byte * below, byte * above, dword * usage)
+{
+  byte conversion_table[256];
+  byte inverse_table[256];
+  long size = (long)Main.image_width * Main.image_height;
+  dword original;
+  dword expected;
+  int i;
+
+  memset(Main.visible_image.Image, 0xff, size);
+  Redraw_layered_image();
+  Main.current_layer = 3;
+  Redraw_layered_image_area(17, 33, 301, 177);
+  Main.current_layer = 2;
+  Update_depth_buffer();
+  if (!Layers_planes_ready())
+    return 0;
+  memcpy(visible, Main.visible_image.Image, size);
+  memcpy(depth, Main_visible_image_depth_buffer.Image, size);
+  memcpy(below, Main_layers_below.Image, size);
+  memcpy(above, Main_layers_above.Image, size);
+
+  Count_used_colors(usage);
+
+  for (i = 0; i < 256; i++)
+  {
+    conversion_table[i] = (byte)(i * 7); // Keeps the transparent color
+    inverse_table[conversion_table[i]] = (byte)i;
+  }
+  original = Image_checksum(NULL);
+  expected = Image_checksum(conversion_table);
+  Remap_image_highlevel(conversion_table);
+  if (Image_checksum(NULL) != expected || Main.backups->Pages->Transparent_color != conversion_table[0])
+    return 0;
+  // The flattened layers must follow
+  if (!Layers_planes_ready())
+    return 0;
+  for (i = 0; i < size; i++)
+    if (Main_layers_below.Image[i] != conversion_table[below[i]] || Main_layers_above.Image[i] != conversion_table[above[i]])
+      return 0;
+  Remap_image_highlevel(inverse_table);
+  return Image_checksum(NULL) == original && Main.backups->Pages->Transparent_color == 0;
+}
+
+/**
+ * The whole-image operations must give exactly the same result whatever
+ * the number of threads.
+ */
+int Test_Parallel_composite(char * errmsg)
+{
+  T_List_of_pages list;
+  T_List_of_pages * main_backups = Main.backups;
+  T_Page * page;
+  long size = (long)COMPOSITE_WIDTH * COMPOSITE_HEIGHT;
+  static byte serial[4][COMPOSITE_WIDTH * COMPOSITE_HEIGHT];
+  static byte parallel[4][COMPOSITE_WIDTH * COMPOSITE_HEIGHT];
+  dword serial_usage[256];
+  dword parallel_usage[256];
+  static const int threads[] = { 4, WORKERS_MAX_THREADS };
+  dword seed = 7;
+  int layer, i, t;
+  int ok = 0;
+
+  Init_list_of_pages(&list);
+  page = New_page(COMPOSITE_LAYERS);
+  if (page == NULL)
+    return 0;
+  page->Next = page->Prev = page;
+  page->Width = COMPOSITE_WIDTH;
+  page->Height = COMPOSITE_HEIGHT;
+  page->Image_mode = IMAGE_MODE_LAYERED;
+  page->Transparent_color = 0;
+  list.Pages = page;
+  list.List_size = 1;
+  for (layer = 0; layer < COMPOSITE_LAYERS; layer++)
+  {
+    page->Image[layer].Pixels = New_layer(&list, size);
+    if (page->Image[layer].Pixels == NULL)
+      goto cleanup;
+    // Opaque rectangles of noise, at random places
+    memset(page->Image[layer].Pixels, 0, size);
+    for (i = 0; i < 20; i++)
+    {
+      int w = 1 + Next_random(&seed) % 200;
+      int h = 1 + Next_random(&seed) % 200;
+      int x = Next_random(&seed) % (COMPOSITE_WIDTH - w);
+      int y = Next_random(&seed) % (COMPOSITE_HEIGHT - h);
+      for (; h > 0; h--, y++)
+        memset(page->Image[layer].Pixels + (long)y * COMPOSITE_WIDTH + x, (byte)Next_random(&seed), w);
+    }
+  }
+  Main.backups = &list;
+  Main.image_width = COMPOSITE_WIDTH;
+  Main.image_height = COMPOSITE_HEIGHT;
+  Main.layers_visible = 0x1d; // Layer 1 is hidden
+  Main.current_layer = 2;
+  if (!Update_buffers(COMPOSITE_WIDTH, COMPOSITE_HEIGHT))
+    goto cleanup;
+
+  // Nothing on the screen to remap
+  Main.magnifier_mode = 0;
+  Screen_width = 0;
+  Menu_Y_before_window = 0;
+  Init_workers(1);
+  if (!Compose_count_and_remap(serial[0], serial[1], serial[2], serial[3], serial_usage))
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "The image or its flattened layers are wrong after Remap_image_highlevel()");
+    goto cleanup;
+  }
+  for (t = 0; t < (int)(sizeof(threads) / sizeof(threads[0])); t++)
+  {
+    Init_workers(threads[t]);
+    if (!Compose_count_and_remap(parallel[0], parallel[1], parallel[2], parallel[3], parallel_usage))
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "The image or its flattened layers are wrong after Remap_image_highlevel() with %d threads", threads[t]);
+      goto cleanup;
+    }
+    for (i = 0; i < 4; i++)
+    {
+      if (memcmp(serial[i], parallel[i], size))
+      {
+        static const char * const names[4] = {"visible image", "depth buffer", "layers below", "layers above"};
+        snprintf(errmsg, ERRMSG_LENGTH, "The %s is different with %d threads", names[i], threads[t]);
+        goto cleanup;
+      }
+    }
+    if (memcmp(serial_usage, parallel_usage, sizeof(serial_usage)))
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "The color count is different with %d threads", threads[t]);
+      goto cleanup;
+    }
+  }
+  ok = 1;
+
+cleanup:
+  Close_workers();
+  Free_layers_planes();
+  free(Main.visible_image.Image);
+  free(Main_visible_image_backup.Image);
+  free(Main_visible_image_depth_buffer.Image);
+  Main.visible_image.Image = Main_visible_image_backup.Image = Main_visible_image_depth_buffer.Image = NULL;
+  Main.visible_image.Width = Main.visible_image.Height = 0;
+  Main_visible_image_backup.Width = Main_visible_image_backup.Height = 0;
+  Main_visible_image_depth_buffer.Width = Main_visible_image_depth_buffer.Height = 0;
+  Free_last_page_of_list(&list);
+  Main.backups = main_backups;
+  return ok;
+}
@@ -0,0 +1,193 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+    Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testpxrender.c
+/// Unit tests for the pixel renderers of pxrender.c
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../struct.h"
+#include "../global.h"
+#include "../pxrender.h"
+#include "../gfx2log.h"
+#include "tests.h"
+
+#define SCROLL_IMAGE_WIDTH 300
+#define SCROLL_IMAGE_HEIGHT 240
+#define SCROLL_X_ZOOM 40
+#define SCROLL_MENU_Y 100
+#define SCROLL_MOVES 300
+
+/// The screen of the mock functions of screen.h, see mockui.c
+extern byte * Mock_screen;
+
+static dword Next_random(dword * seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/// A pixel renderer, and its size of pixels
+typedef struct
+{
+  const char * Name;
+  int Width;
+  int Height;
+  Func_pixel Pixel;
+  Func_display_zoom Display_zoomed_screen;
+  Func_display_zoom_area Display_zoomed_area;
+} T_Test_renderer;
+
+#define TEST_RENDERER(suffix, width, height) \
+  { #suffix, width, height, Pixel_##suffix, Display_part_of_screen_scaled_##suffix, Display_part_of_screen_scaled_area_##suffix }
+
+/**
+ * Scrolling the magnifier with Scroll_zoomed_screen() must give the same
+ * screen as drawing it again completely, like Display_all_screen() does.
+ *
+ * Random moves are tried with each renderer and several zoom factors,
+ * with and without the grid (its phase only stays when the move is even
+ * on the screen, Display_all_screen_after_scroll() redraws everything
+ * otherwise). The magnifier doesn't end on a row of the image.
+ */
+int Test_Scroll_zoomed_screen(char * errmsg)
+{
+  static const T_Test_renderer renderers[] = {
+    TEST_RENDERER(simple, 1, 1),
+    TEST_RENDERER(tall, 1, 2),
+    TEST_RENDERER(wide, 2, 1),
+    TEST_RENDERER(double, 2, 2),
+    TEST_RENDERER(triple, 3, 3),
+    TEST_RENDERER(wide2, 4, 2),
+    TEST_RENDERER(tall2, 2, 4),
+    TEST_RENDERER(tall3, 3, 4),
+    TEST_RENDERER(quad, 4, 4),
+  };
+  static const int factors[] = { 2, 3, 4, 8, 12 };
+  static byte image[SCROLL_IMAGE_WIDTH * SCROLL_IMAGE_HEIGHT];
+  byte * scrolled = NULL;
+  byte * redrawn = NULL;
+  byte * buffer = NULL;
+  long screen_size;
+  dword seed = 17;
+  int r, f, grid, i;
+  int ok = 0;
+
+  for (i = 0; i < SCROLL_IMAGE_WIDTH * SCROLL_IMAGE_HEIGHT; i++)
+    image[i] = (byte)Next_random(&seed);
+  for (i = 0; i < 256; i++)
+    xor_lut[i] = (byte)(i ^ 0xff);
+  // Big enough for the largest pixels
+  screen_size = (long)(SCROLL_X_ZOOM + 120) * 4 * SCROLL_MENU_Y * 4;
+  scrolled = (byte *)malloc(screen_size);
+  redrawn = (byte *)malloc(screen_size);
+  buffer = (byte *)malloc((SCROLL_X_ZOOM + 120) * 4 * 12);
+  if (scrolled == NULL || redrawn == NULL || buffer == NULL)
+    goto cleanup;
+
+  Main_screen = image;
+  Main.image_width = SCROLL_IMAGE_WIDTH;
+  Main.image_height = SCROLL_IMAGE_HEIGHT;
+  Main.magnifier_mode = 1;
+  Main.X_zoom = SCROLL_X_ZOOM;
+  Menu_Y = SCROLL_MENU_Y;
+  Horizontal_line_buffer = buffer;
+  Snap_width = 5;
+  Snap_height = 7;
+  Snap_offset_X = 2;
+  Snap_offset_Y = 3;
+  for (r = 0; r < (int)(sizeof(renderers) / sizeof(renderers[0])); r++)
+  {
+    Pixel = renderers[r].Pixel;
+    Display_zoomed_screen = renderers[r].Display_zoomed_screen;
+    Display_zoomed_area = renderers[r].Display_zoomed_area;
+    Pixel_width = renderers[r].Width;
+    Pixel_height = renderers[r].Height;
+    for (f = 0; f < (int)(sizeof(factors) / sizeof(factors[0])); f++)
+    {
+      int factor = factors[f];
+
+      Main.magnifier_factor = factor;
+      Main.magnifier_width = 120 / factor;
+      Main.magnifier_height = (SCROLL_MENU_Y + factor - 1) / factor;
+      Screen_width = SCROLL_X_ZOOM + Main.magnifier_width * factor;
+      for (grid = 0; grid < 2; grid++)
+      {
+        int move;
+
+        Show_grid = grid;
+        Main.magnifier_offset_X = 10;
+        Main.magnifier_offset_Y = 20;
+        Mock_screen = scrolled;
+        memset(scrolled, 0, screen_size);
+        Display_zoomed_screen(Main.magnifier_width, Menu_Y, Main.image_width, Horizontal_line_buffer);
+        for (move = 0; move < SCROLL_MOVES; move++)
+        {
+          int dx = (int)(Next_random(&seed) % (2 * Main.magnifier_width - 1)) - (Main.magnifier_width - 1);
+          int dy = (int)(Next_random(&seed) % (2 * Main.magnifier_height - 1)) - (Main.magnifier_height - 1);
+          int x, y;
+
+          // Small moves are the usual ones
+          if (move & 1)
+          {
+            dx /= 4;
+            dy /= 4;
+          }
+          if (Show_grid && ((dx * factor) & 1 || (dy * factor) & 1))
+            continue;
+          if (Main.magnifier_offset_X + dx < 0 || Main.magnifier_offset_X + dx > Main.image_width - Main.magnifier_width)
+            dx = -dx;
+          if (Main.magnifier_offset_Y + dy < 0 || Main.magnifier_offset_Y + dy > Main.image_height - Main.magnifier_height)
+            dy = -dy;
+          Main.magnifier_offset_X += dx;
+          Main.magnifier_offset_Y += dy;
+          Mock_screen = scrolled;
+          Scroll_zoomed_screen(dx, dy);
+          Mock_screen = redrawn;
+          memset(redrawn, 0, screen_size);
+          Display_zoomed_screen(Main.magnifier_width, Menu_Y, Main.image_width, Horizontal_line_buffer);
+          for (y = 0; y < Menu_Y * Pixel_height; y++)
+            for (x = Main.X_zoom * Pixel_width; x < Screen_width * Pixel_width; x++)
+            {
+              long offset = x + (long)y * Screen_width * Pixel_width;
+              if (scrolled[offset] != redrawn[offset])
+              {
+                snprintf(errmsg, ERRMSG_LENGTH, "%s pixels, x%d zoom, grid %d: screen pixel (%d,%d) is %d instead of %d after a move of (%d,%d)",
+                         renderers[r].Name, factor, grid, x, y, scrolled[offset], redrawn[offset], dx, dy);
+                goto cleanup;
+              }
+            }
+        }
+      }
+    }
+  }
+  ok = 1;
+
+cleanup:
+  Mock_screen = NULL;
+  Main_screen = NULL;
+  Horizontal_line_buffer = NULL;
+  Show_grid = 0;
+  free(scrolled);
+  free(redrawn);
+  free(buffer);
+  return ok;
+}
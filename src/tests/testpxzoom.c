@@ -0,0 +1,144 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testpxzoom.c
+/// Unit tests and benchmark of the enlargement of rows of pixels.
+///
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../struct.h"
+#include "../pxzoom.h"
+#include "../gfx2log.h"
+#include "../osdep.h"
+#include "../gfx2mem.h"
+#include "tests.h"
+
+/// Size of the screen for the benchmark: 4K
+#define ZOOM_SCREEN_WIDTH 3840
+#define ZOOM_SCREEN_HEIGHT 2160
+#define ZOOM_PASSES 20
+
+/// The loop of the renderers before Zoom_line()
+static void Reference_zoom(const byte * src, byte * dest, int factor, int width)
+{
+  int x;
+
+  for (x = 0; x < width; x++)
+  {
+    memset(dest, src[x], factor);
+    dest += factor;
+  }
+}
+
+/// Draws a zoomed view on the whole screen, like Display_part_of_screen_scaled_simple()
+static void Draw_zoomed_view(Func_zoom_line zoom, const byte * image, byte * screen, int factor)
+{
+  int width = ZOOM_SCREEN_WIDTH / factor;
+  int y;
+
+  for (y = 0; y < ZOOM_SCREEN_HEIGHT; y++)
+  {
+    byte * row = screen + (long)y * ZOOM_SCREEN_WIDTH;
+
+    if (y % factor == 0)
+      zoom(image + (long)(y / factor) * ZOOM_SCREEN_WIDTH, row, factor, width);
+    else
+      memcpy(row, row - ZOOM_SCREEN_WIDTH, width * factor);
+  }
+}
+
+/**
+ * Checks all the implementations give the same result as the original
+ * loop, on all alignments, lengths and factors, without writing after the
+ * end of the row. Then compares their speed on a 4K screen.
+ */
+int Test_Zoom_line(char * errmsg)
+{
+  static const int factors[] = {2, 3, 4, 8, 16, 32};
+  const T_Zoom_line_implementation * implementation;
+  byte * image;
+  byte * reference;
+  byte * result;
+  long size = (long)ZOOM_SCREEN_WIDTH * ZOOM_SCREEN_HEIGHT;
+  long i;
+  int ok = 0;
+
+  image = GFX2_malloc(size);
+  reference = GFX2_malloc(size);
+  result = GFX2_malloc(size);
+  if (image == NULL || reference == NULL || result == NULL)
+    goto cleanup;
+  for (i = 0; i < size; i++)
+    image[i] = (byte)(i * 7 + i / 13);
+
+  for (implementation = Zoom_line_implementations(); implementation->Name != NULL; implementation++)
+  {
+    int start, width, factor, f;
+
+    for (factor = 1; factor <= 40; factor++)
+    {
+      for (start = 0; start < 17; start++)
+      {
+        for (width = 0; width < 70; width++)
+        {
+          memset(reference, 0x55, 40 * 70 + 64);
+          memset(result, 0x55, 40 * 70 + 64);
+          Reference_zoom(image + start, reference + start, factor, width);
+          implementation->Function(image + start, result + start, factor, width);
+          if (memcmp(reference, result, 40 * 70 + 64))
+          {
+            snprintf(errmsg, ERRMSG_LENGTH, "%s: wrong result at offset %d, width %d, factor %d",
+                     implementation->Name, start, width, factor);
+            goto cleanup;
+          }
+        }
+      }
+    }
+
+    // Benchmark, the whole screen being drawn like in the magnifier
+    for (f = 0; f < (int)(sizeof(factors)/sizeof(factors[0])); f++)
+    {
+      dword t0, t1;
+      int pass;
+
+      t0 = GFX2_GetTicks();
+      for (pass = 0; pass < ZOOM_PASSES; pass++)
+        Draw_zoomed_view(Reference_zoom, image + pass, reference, factors[f]);
+      t1 = GFX2_GetTicks();
+      for (pass = 0; pass < ZOOM_PASSES; pass++)
+        Draw_zoomed_view(implementation->Function, image + pass, result, factors[f]);
+      GFX2_Log(GFX2_INFO, "  %-6s x%-2d: %4.0fms  original loop: %4.0fms  (%d screens of %dx%d)\n",
+               implementation->Name, factors[f], (double)(GFX2_GetTicks() - t1),
+               (double)(t1 - t0), ZOOM_PASSES, ZOOM_SCREEN_WIDTH, ZOOM_SCREEN_HEIGHT);
+      if (memcmp(reference, result, size))
+      {
+        snprintf(errmsg, ERRMSG_LENGTH, "%s: wrong result on the whole screen, factor %d", implementation->Name, factors[f]);
+        goto cleanup;
+      }
+    }
+  }
+  ok = 1;
+
+cleanup:
+  free(image);
+  free(reference);
+  free(result);
+  return ok;
+}
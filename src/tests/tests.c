@@ -252,3 +252,54 @@ int Test_Packbits(char * errmsg)
   unlink(tempfilename);
   return 1; // test OK
 }
+
+/**
+ * Test for PackBits_pack_buffer_to_memory() and PackBits_unpack_from_memory()
+ */
+int Test_Packbits_memory(char * errmsg)
+{
+  byte unpacked[1024];
+  byte packed[1200];
+  byte buffer[1024];
+  int packed_len;
+  int i;
+
+  // a mix of runs and random bytes
+  for (i = 0; i < (int)sizeof(unpacked); i++)
+  {
+    if ((i / 100) & 1)
+      unpacked[i] = (byte)random();
+    else
+      unpacked[i] = (byte)(i / 100);
+  }
+  packed_len = PackBits_pack_buffer_to_memory(packed, sizeof(packed), unpacked, sizeof(unpacked));
+  if (packed_len < 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "PackBits_pack_buffer_to_memory() failed");
+    return 0;
+  }
+  GFX2_Log(GFX2_DEBUG, "%lu bytes packed to %d\n", (unsigned long)sizeof(unpacked), packed_len);
+  if (PackBits_unpack_from_memory(packed, packed_len, buffer, sizeof(buffer)) != PACKBITS_UNPACK_OK)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "PackBits_unpack_from_memory() failed");
+    return 0;
+  }
+  if (memcmp(unpacked, buffer, sizeof(buffer)) != 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "uncompressed stream mismatch");
+    return 0;
+  }
+  // the stream must be complete
+  if (PackBits_unpack_from_memory(packed, packed_len - 1, buffer, sizeof(buffer)) != PACKBITS_UNPACK_READ_ERROR)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "truncated stream not detected");
+    return 0;
+  }
+  // output buffer too small
+  if (PackBits_pack_buffer_to_memory(packed, packed_len - 1, unpacked, sizeof(unpacked)) >= 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "output buffer overflow not detected");
+    return 0;
+  }
+  return 1; // test OK
+}
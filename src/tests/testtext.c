@@ -0,0 +1,247 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+    Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testtext.c
+/// Unit tests for the font list of text.c
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <utime.h>
+#include "tests.h"
+#include "../struct.h"
+#include "../global.h"
+#include "../io.h"
+#include "../text.h"
+#include "../setup.h"
+#include "../gfx2log.h"
+
+/// A copy of the font list
+typedef struct
+{
+  int count;
+  char * * labels;
+  char * * names;
+  int * truetype;
+} T_Font_list_copy;
+
+static void Free_font_list_copy(T_Font_list_copy * copy)
+{
+  int i;
+
+  for (i = 0; i < copy->count && copy->labels != NULL && copy->names != NULL; i++)
+  {
+    free(copy->labels[i]);
+    free(copy->names[i]);
+  }
+  free(copy->labels);
+  free(copy->names);
+  free(copy->truetype);
+  memset(copy, 0, sizeof(T_Font_list_copy));
+}
+
+/// Builds the font list from scratch, as the program does, and copies it
+static int Copy_font_list(T_Font_list_copy * copy)
+{
+  int i;
+
+  Uninit_text();
+  Init_text();
+  copy->count = Font_count();
+  copy->labels = (char * *)calloc(copy->count + 1, sizeof(char *));
+  copy->names = (char * *)calloc(copy->count + 1, sizeof(char *));
+  copy->truetype = (int *)calloc(copy->count + 1, sizeof(int));
+  if (copy->labels == NULL || copy->names == NULL || copy->truetype == NULL)
+    return 0;
+  for (i = 0; i < copy->count; i++)
+  {
+    copy->labels[i] = strdup(Font_label(i));
+    copy->names[i] = strdup(Font_name(i));
+    copy->truetype[i] = TrueType_font(i);
+    if (copy->labels[i] == NULL || copy->names[i] == NULL)
+      return 0;
+  }
+  return 1;
+}
+
+/// Finds a font by its file name, without the directory. -1 if it's not in the list
+static int Find_font(const T_Font_list_copy * copy, const char * filename)
+{
+  size_t length = strlen(filename);
+  int i;
+
+  for (i = 0; i < copy->count; i++)
+  {
+    size_t name_length = strlen(copy->names[i]);
+    if (name_length > length && !strcmp(copy->names[i] + name_length - length, filename)
+        && copy->names[i][name_length - length - 1] == PATH_SEPARATOR[0])
+      return i;
+  }
+  return -1;
+}
+
+static int Create_empty_file(const char * directory, const char * filename)
+{
+  char * path = Filepath_append_to_dir(directory, filename);
+  FILE * f;
+
+  if (path == NULL)
+    return 0;
+  f = fopen(path, "wb");
+  free(path);
+  if (f == NULL)
+    return 0;
+  fclose(f);
+  return 1;
+}
+
+static void Remove_file(const char * directory, const char * filename)
+{
+  char * path = Filepath_append_to_dir(directory, filename);
+
+  if (path != NULL)
+    remove(path);
+  free(path);
+}
+
+/**
+ * The font list read back from the index file must be the one which was
+ * scanned, and a change in a font directory must be seen.
+ */
+int Test_Font_index(char * errmsg)
+{
+  static const char * files[] = { "zeta.png", "alpha.ttf", "Middle.gif", "readme.txt" };
+  char * old_data_directory = Data_directory;
+  char * old_config_directory = Config_directory;
+  char * data_directory;
+  char * fonts_directory;
+  char * config_directory;
+  char * index_path;
+  T_Font_list_copy scanned, indexed;
+  struct utimbuf times;
+  int i;
+  int ok = 0;
+
+  memset(&scanned, 0, sizeof(scanned));
+  memset(&indexed, 0, sizeof(indexed));
+  data_directory = Filepath_append_to_dir(tmpdir, "data");
+  config_directory = Filepath_append_to_dir(tmpdir, "config");
+  fonts_directory = Filepath_append_to_dir(data_directory, FONTS_SUBDIRECTORY);
+  index_path = Filepath_append_to_dir(config_directory, "fonts.idx");
+  if (data_directory == NULL || config_directory == NULL || fonts_directory == NULL || index_path == NULL)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "Out of memory");
+    goto cleanup;
+  }
+  if (Directory_create(data_directory) < 0 || Directory_create(fonts_directory) < 0
+      || Directory_create(config_directory) < 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "Cannot create the directories in %s", tmpdir);
+    goto cleanup;
+  }
+  for (i = 0; i < (int)(sizeof(files) / sizeof(files[0])); i++)
+    if (!Create_empty_file(fonts_directory, files[i]))
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Cannot create %s in %s", files[i], fonts_directory);
+      goto cleanup;
+    }
+  Data_directory = data_directory;
+  Config_directory = config_directory;
+
+  // First time: the directories are scanned and the index is written
+  if (!Copy_font_list(&scanned) || !File_exists(index_path))
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "The font list was not built, or %s was not written", index_path);
+    goto cleanup;
+  }
+  GFX2_Log(GFX2_DEBUG, "%d fonts\n", scanned.count);
+  for (i = 0; i < 3; i++)
+  {
+    int found = Find_font(&scanned, files[i]);
+
+    if (found < 0 || scanned.truetype[found] != (i == 1))
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "%s is missing from the font list, or has the wrong type", files[i]);
+      goto cleanup;
+    }
+  }
+
+  // Second time: the same list comes from the index
+  if (!Copy_font_list(&indexed) || indexed.count != scanned.count)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%d fonts read from the index instead of %d", indexed.count, scanned.count);
+    goto cleanup;
+  }
+  for (i = 0; i < scanned.count; i++)
+    if (strcmp(scanned.labels[i], indexed.labels[i]) || strcmp(scanned.names[i], indexed.names[i])
+        || scanned.truetype[i] != indexed.truetype[i])
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Font %d is \"%s\" %s in the index instead of \"%s\" %s",
+               i, indexed.labels[i], indexed.names[i], scanned.labels[i], scanned.names[i]);
+      goto cleanup;
+    }
+
+  // A new font: the directory time changes, so the index is out of date.
+  // The time is set explicitly, the file may be added in the same second.
+  if (!Create_empty_file(fonts_directory, "new.png"))
+    goto cleanup;
+  times.actime = times.modtime = (time_t)File_modification_time(fonts_directory) + 2;
+  if (utime(fonts_directory, &times) < 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "Cannot set the time of %s", fonts_directory);
+    goto cleanup;
+  }
+  Free_font_list_copy(&indexed);
+  if (!Copy_font_list(&indexed) || indexed.count != scanned.count + 1 || Find_font(&indexed, "new.png") < 0)
+  {
+    snprintf(errmsg, ERRMSG_LENGTH, "%d fonts after adding one to %d", indexed.count, scanned.count);
+    goto cleanup;
+  }
+  ok = 1;
+
+cleanup:
+  Uninit_text();
+  Init_text();
+  Free_font_list_copy(&scanned);
+  Free_font_list_copy(&indexed);
+  Data_directory = old_data_directory;
+  Config_directory = old_config_directory;
+  if (fonts_directory != NULL)
+  {
+    for (i = 0; i < (int)(sizeof(files) / sizeof(files[0])); i++)
+      Remove_file(fonts_directory, files[i]);
+    Remove_file(fonts_directory, "new.png");
+    rmdir(fonts_directory);
+  }
+  if (index_path != NULL)
+    remove(index_path);
+  if (config_directory != NULL)
+    rmdir(config_directory);
+  if (data_directory != NULL)
+    rmdir(data_directory);
+  free(index_path);
+  free(fonts_directory);
+  free(config_directory);
+  free(data_directory);
+  return ok;
+}
@@ -0,0 +1,193 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+    Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testtiles.c
+/// Unit tests for the tilemap of tiles.c
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../struct.h"
+#include "../global.h"
+#include "../pages.h"
+#include "../tiles.h"
+#include "tests.h"
+
+#define TILES_WIDTH 16
+#define TILES_HEIGHT 12
+#define TILES_SIZE 8
+#define TILES_BASES 12
+#define TILES_OFFSET_X 3
+#define TILES_OFFSET_Y 2
+/// The image has partial tiles on the right and at the bottom
+#define TILES_IMAGE_WIDTH (TILES_OFFSET_X + TILES_WIDTH * TILES_SIZE + 5)
+#define TILES_IMAGE_HEIGHT (TILES_OFFSET_Y + TILES_HEIGHT * TILES_SIZE + 3)
+
+static dword Next_random(dword * seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/// Pixel of a tile, seen through a flip: 1 horizontally, 2 vertically, 3 both
+static byte Tile_pixel(const byte * image, int tile, int flipped, int x, int y)
+{
+  if (flipped & 1)
+    x = TILES_SIZE - 1 - x;
+  if (flipped & 2)
+    y = TILES_SIZE - 1 - y;
+  return image[(TILES_OFFSET_Y + (tile / TILES_WIDTH) * TILES_SIZE + y) * TILES_IMAGE_WIDTH
+               + TILES_OFFSET_X + (tile % TILES_WIDTH) * TILES_SIZE + x];
+}
+
+/// Checks if a tile is the same as another one flipped
+static int Same_tile(const byte * image, int tile, int ref_tile, int flipped)
+{
+  int x, y;
+
+  for (y = 0; y < TILES_SIZE; y++)
+    for (x = 0; x < TILES_SIZE; x++)
+      if (Tile_pixel(image, tile, 0, x, y) != Tile_pixel(image, ref_tile, flipped, x, y))
+        return 0;
+  return 1;
+}
+
+/**
+ * Tilemap_update() must link together exactly the tiles which are the
+ * same, or the same flipped when it's allowed, with the right flip.
+ *
+ * The tiles are copies of a few noise tiles, randomly flipped, so they
+ * have no symmetry and the flip between two similar tiles is unique.
+ * The lists are compared with a comparison of all the pairs of tiles.
+ */
+int Test_Tilemap(char * errmsg)
+{
+  static const byte allowed[4][2] = { { 1, 1 }, { 0, 0 }, { 1, 0 }, { 0, 1 } };
+  static byte bases[TILES_BASES][TILES_SIZE * TILES_SIZE];
+  T_List_of_pages list;
+  T_List_of_pages * old_backups = Main.backups;
+  byte * image;
+  dword seed = 7;
+  int ok = 0;
+  int i, tile, a;
+
+  Init_list_of_pages(&list);
+  if (!Allocate_list_of_pages(&list))
+    return 0;
+  image = list.Pages->Image[0].Pixels = New_layer(&list, TILES_IMAGE_WIDTH * TILES_IMAGE_HEIGHT);
+  if (image == NULL)
+  {
+    Free_last_page_of_list(&list);
+    return 0;
+  }
+  list.Pages->Width = TILES_IMAGE_WIDTH;
+  list.Pages->Height = TILES_IMAGE_HEIGHT;
+  for (i = 0; i < TILES_IMAGE_WIDTH * TILES_IMAGE_HEIGHT; i++)
+    image[i] = (byte)Next_random(&seed);
+  for (i = 0; i < TILES_BASES; i++)
+    for (tile = 0; tile < TILES_SIZE * TILES_SIZE; tile++)
+      bases[i][tile] = (byte)Next_random(&seed);
+  for (tile = 0; tile < TILES_WIDTH * TILES_HEIGHT; tile++)
+  {
+    const byte * base = bases[Next_random(&seed) % TILES_BASES];
+    int flipped = Next_random(&seed) & 3;
+    int x, y;
+
+    for (y = 0; y < TILES_SIZE; y++)
+      for (x = 0; x < TILES_SIZE; x++)
+      {
+        int x2 = (flipped & 1) ? TILES_SIZE - 1 - x : x;
+        int y2 = (flipped & 2) ? TILES_SIZE - 1 - y : y;
+        image[(TILES_OFFSET_Y + (tile / TILES_WIDTH) * TILES_SIZE + y) * TILES_IMAGE_WIDTH
+              + TILES_OFFSET_X + (tile % TILES_WIDTH) * TILES_SIZE + x] = base[y2 * TILES_SIZE + x2];
+      }
+  }
+
+  Main.backups = &list;
+  Main.current_layer = 0;
+  Main.image_width = TILES_IMAGE_WIDTH;
+  Main.image_height = TILES_IMAGE_HEIGHT;
+  Snap_width = Snap_height = TILES_SIZE;
+  Snap_offset_X = TILES_OFFSET_X;
+  Snap_offset_Y = TILES_OFFSET_Y;
+  Config.Tilemap_show_count = 0;
+  for (a = 0; a < 4; a++)
+  {
+    Config.Tilemap_allow_flipped_x = allowed[a][0];
+    Config.Tilemap_allow_flipped_y = allowed[a][1];
+    Main.tilemap_mode = 1;
+    Tilemap_update();
+    if (Main.tilemap == NULL || Main.tilemap_width != TILES_WIDTH || Main.tilemap_height != TILES_HEIGHT)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "No tilemap of %dx%d tiles", TILES_WIDTH, TILES_HEIGHT);
+      goto cleanup;
+    }
+    for (tile = 0; tile < TILES_WIDTH * TILES_HEIGHT; tile++)
+    {
+      const T_Tile * tiles = Main.tilemap;
+      static byte in_list[TILES_WIDTH * TILES_HEIGHT];
+      int other;
+
+      // The circular list of the tile, and the flips of its tiles
+      memset(in_list, 0, sizeof(in_list));
+      other = tile;
+      do
+      {
+        if (tiles[tiles[other].Next].Previous != other || in_list[other])
+        {
+          snprintf(errmsg, ERRMSG_LENGTH, "The list of tile %d is broken at tile %d", tile, other);
+          goto cleanup;
+        }
+        in_list[other] = 1;
+        if (!Same_tile(image, other, tile, tiles[other].Flipped ^ tiles[tile].Flipped))
+        {
+          snprintf(errmsg, ERRMSG_LENGTH, "Tile %d is not tile %d with flip %d",
+                   other, tile, tiles[other].Flipped ^ tiles[tile].Flipped);
+          goto cleanup;
+        }
+        other = tiles[other].Next;
+      } while (other != tile);
+      // All the similar tiles are in the list
+      for (other = 0; other < TILES_WIDTH * TILES_HEIGHT; other++)
+      {
+        int flipped;
+
+        if (in_list[other])
+          continue;
+        for (flipped = 0; flipped < 4; flipped++)
+          if ((!(flipped & 1) || Config.Tilemap_allow_flipped_x)
+              && (!(flipped & 2) || Config.Tilemap_allow_flipped_y)
+              && Same_tile(image, other, tile, flipped))
+          {
+            snprintf(errmsg, ERRMSG_LENGTH, "Tile %d is tile %d with flip %d, but not in its list (flips x %d y %d)",
+                     other, tile, flipped, Config.Tilemap_allow_flipped_x, Config.Tilemap_allow_flipped_y);
+            goto cleanup;
+          }
+      }
+    }
+  }
+  ok = 1;
+
+cleanup:
+  Disable_tilemap(&Main);
+  Main.backups = old_backups;
+  Free_last_page_of_list(&list);
+  return ok;
+}
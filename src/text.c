@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h> // tolower()
+#include <limits.h> // for PATH_MAX (MAX_PATH_CHARACTERS)
 
 // TrueType
 #ifndef NOTTF
@@ -67,6 +68,8 @@
 #include "setup.h"
 #include "loadsave.h"
 #include "SFont.h"
+#include "osdep.h"
+#include "gfx2log.h"
 
 /**
  * Element of the font linked list
@@ -88,6 +91,8 @@ typedef struct T_Font
  */
 T_Font * font_list_start;
 
+static void Load_font_list(void);
+
 // Inspiré par Allegro
 #define EXTID(a,b,c) ((((a)&255)<<16) | (((b)&255)<<8) | (((c)&255)))
 #define EXTID4(a,b,c,d) ((((a)&255)<<24) | (((b)&255)<<16) | (((c)&255)<<8) | (((d)&255)))
@@ -241,7 +246,10 @@ static void Add_font(const char *name, const char * font_name)
 // Trouve le nom d'une fonte par son numéro
 const char * Font_name(int index)
 {
-  T_Font *font = font_list_start;
+  T_Font *font;
+
+  Load_font_list();
+  font = font_list_start;
   if (index < 0 || font == NULL)
     return "";
   while (index--)
@@ -258,8 +266,9 @@ const char * Font_name(int index)
 // Renvoie un pointeur sur un buffer statique de 20 caracteres.
 const char * Font_label(int index)
 {
-  T_Font *font = font_list_start;
-  
+  T_Font *font;
+
+  Load_font_list();
   font = font_list_start;
   if (index < 0 || font == NULL)
     return "                   ";
@@ -276,7 +285,10 @@ const char * Font_label(int index)
 // Vérifie si une fonte donnée est TrueType
 int TrueType_font(int index)
 {
-  T_Font *font = font_list_start;
+  T_Font *font;
+
+  Load_font_list();
+  font = font_list_start;
   if (index < 0 || font == NULL)
     return 0;
   while (index--)
@@ -290,9 +302,11 @@ int TrueType_font(int index)
 
 int Font_count(void)
 {
-  T_Font *font = font_list_start;
+  T_Font *font;
   int count = 0;
 
+  Load_font_list();
+  font = font_list_start;
   while (font != NULL)
   {
     count++;
@@ -326,26 +340,56 @@ static int CALLBACK EnumFontFamCallback(CONST LOGFONTA *lpelf, CONST TEXTMETRICA
 #endif
 
 
-// Initialisation à faire une fois au début du programme
-void Init_text(void)
+#if !(defined(WIN32) && defined(NOTTF))
+/// The font list is kept in this file of ::Config_directory
+#define FONT_INDEX_FILENAME "fonts.idx"
+/// First line of the font index file
+#define FONT_INDEX_HEADER "GrafX2 font index 1\n"
+#endif
+
+/// A directory scanned for fonts, and its time when it was scanned
+typedef struct
+{
+  char * Path;
+  unsigned long Time;
+} T_Font_directory;
+
+static T_Font_directory * Font_directories = NULL;
+static int Font_directories_count = 0;
+/// Set when the font list has been built
+static int Font_list_loaded = 0;
+
+static void Add_font_directory(const char * directory_name)
+{
+  T_Font_directory * directories;
+  char * path;
+
+  directories = (T_Font_directory *)realloc(Font_directories, (Font_directories_count + 1) * sizeof(T_Font_directory));
+  if (directories == NULL)
+    return;
+  Font_directories = directories;
+  path = strdup(directory_name);
+  if (path == NULL)
+    return;
+  Font_directories[Font_directories_count].Path = path;
+  Font_directories[Font_directories_count].Time = File_modification_time(directory_name);
+  Font_directories_count++;
+}
+
+/// Lists the directories which may contain fonts, with their modification times
+static void List_font_directories(void)
 {
   char * directory_name;
-  #ifndef NOTTF
-  // Initialisation de TTF
-  TTF_Init();
-  #endif
-  
-  // Initialisation des fontes
-  font_list_start = NULL;
+
   // Parcours du répertoire "fonts"
   directory_name = Filepath_append_to_dir(Data_directory, FONTS_SUBDIRECTORY);
-  For_each_file(directory_name, Add_font);
+  Add_font_directory(directory_name);
   free(directory_name);
   // fonts subdirectory in Config_directory
   directory_name = Filepath_append_to_dir(Config_directory, "fonts");
-  For_each_file(directory_name, Add_font);
+  Add_font_directory(directory_name);
   free(directory_name);
-  
+
   #if defined(WIN32)
     // Parcours du répertoire systeme windows "fonts"
     #ifndef NOTTF
@@ -354,48 +398,26 @@ void Init_text(void)
       if (WindowsPath)
       {
         directory_name = Filepath_append_to_dir(WindowsPath, "FONTS");
-        For_each_file(directory_name, Add_font);
+        Add_font_directory(directory_name);
         free(directory_name);
       }
     }
-    #else
-    {
-      LOGFONTA lf;
-      HDC dc = GetDC(NULL);
-      memset(&lf, 0, sizeof(lf));
-      lf.lfCharSet = ANSI_CHARSET /* DEFAULT_CHARSET*/;
-      lf.lfPitchAndFamily = 0;
-      //EnumFontsA(dc, NULL, EnumFontCallback, NULL);
-      //EnumFontFamiliesA(dc, NULL, EnumFontFamCallback, 0);
-      EnumFontFamiliesExA(dc, &lf, EnumFontFamCallback, 0, 0);
-      ReleaseDC(NULL, dc);
-    }
     #endif
   #elif defined(__macosx__)
     // Récupération de la liste des fonts avec fontconfig
     #ifndef NOTTF
     {
-
-      int i,number;
-      char * home_dir = NULL;
-      const char *font_path_list[3] = {
-         "/System/Library/Fonts",
-         "/Library/Fonts"
-      };
-      number = 2;
+      Add_font_directory("/System/Library/Fonts");
+      Add_font_directory("/Library/Fonts");
       // Make sure we also search into the user's fonts directory
       //CFURLRef url = (CFURLRef) CFCopyHomeDirectoryURLForUser(NULL);
       //CFURLGetFileSystemRepresentation(url, true, (UInt8 *) home_dir, MAXPATHLEN);
       if (getenv("HOME") != NULL)
       {
-        home_dir = Filepath_append_to_dir(getenv("HOME"), "Library/Fonts");
-        font_path_list[number++] = home_dir;
+        directory_name = Filepath_append_to_dir(getenv("HOME"), "Library/Fonts");
+        Add_font_directory(directory_name);
+        free(directory_name);
       }
-
-      for(i=0;i<number;i++)
-         For_each_file(font_path_list[i],Add_font);
-
-      free(home_dir);
       //CFRelease(url);
     }
     #endif
@@ -411,7 +433,7 @@ void Init_text(void)
 	fdir = FcStrListNext(dirs);
         while(fdir != NULL)
 	{
-            For_each_file((char *)fdir,Add_font);
+            Add_font_directory((char *)fdir);
 	    fdir = FcStrListNext(dirs);
 	}
 
@@ -420,32 +442,213 @@ void Init_text(void)
     #endif
   #elif defined(__amigaos4__) || defined(__amigaos__)
     #ifndef NOTTF
-      For_each_file( "FONTS:_TrueType", Add_font );
+      Add_font_directory("FONTS:_TrueType");
     #endif
   #elif defined(__AROS__)
     #ifndef NOTTF
-      For_each_file( "FONTS:TrueType", Add_font );
+      Add_font_directory("FONTS:TrueType");
     #endif
   #elif defined(__BEOS__)
     #ifndef NOTTF
-      For_each_file("/etc/fonts/ttfonts", Add_font);
+      Add_font_directory("/etc/fonts/ttfonts");
     #endif
   #elif defined(__HAIKU__)
     #ifndef NOTTF
-      For_each_file("/boot/system/data/fonts/ttfonts/", Add_font);
+      Add_font_directory("/boot/system/data/fonts/ttfonts/");
     #endif
   #elif defined(__SKYOS__)
     #ifndef NOTTF
-      For_each_file("/boot/system/fonts", Add_font);
+      Add_font_directory("/boot/system/fonts");
     #endif
   #elif defined(__MINT__)
     #ifndef NOTTF
-      For_each_file("C:/BTFONTS", Add_font);
+      Add_font_directory("C:/BTFONTS");
     #endif
 
   #endif
 }
 
+#ifdef FONT_INDEX_FILENAME
+/**
+ * Reads the font list saved by Write_font_index().
+ *
+ * The list is only used if the font directories are the same, and were not
+ * modified since it was saved.
+ * @return 1 if the font list was read, 0 if the directories must be scanned
+ */
+static int Read_font_index(const char * filename)
+{
+  char line[MAX_PATH_CHARACTERS + 32];
+  T_Font * last = NULL;
+  FILE * file;
+  size_t length;
+  int index = 0;
+
+  file = fopen(filename, "r");
+  if (file == NULL)
+    return 0;
+  if (!Read_byte_line(file, line, sizeof(line)) || strcmp(line, FONT_INDEX_HEADER))
+    goto invalid;
+  // The directories, in the same order
+  for (index = 0; index < Font_directories_count; index++)
+  {
+    unsigned long time;
+    int offset = 0;
+
+    if (!Read_byte_line(file, line, sizeof(line)))
+      goto invalid;
+    length = strlen(line);
+    if (length == 0 || line[length - 1] != '\n')
+      goto invalid;
+    line[length - 1] = '\0';
+    if (sscanf(line, "D %lu %n", &time, &offset) < 1 || offset == 0
+        || time != Font_directories[index].Time
+        || strcmp(line + offset, Font_directories[index].Path))
+      goto invalid;
+  }
+  // The fonts, already sorted: "T" or "B", the label and the name
+  while (Read_byte_line(file, line, sizeof(line)))
+  {
+    T_Font * font;
+
+    length = strlen(line);
+    if (line[0] == 'D' || length < 2 + 19 + 2 || line[length - 1] != '\n' || line[1] != ' ')
+      goto invalid;
+    line[length - 1] = '\0';
+    font = (T_Font *)malloc(sizeof(T_Font));
+    if (font == NULL)
+      goto invalid;
+    font->Name = strdup(line + 2 + 19);
+    if (font->Name == NULL)
+    {
+      free(font);
+      goto invalid;
+    }
+    font->Is_truetype = (line[0] == 'T');
+    font->Is_bitmap = !font->Is_truetype;
+    memcpy(font->Label, line + 2, 19);
+    font->Label[19] = '\0';
+    font->Next = NULL;
+    font->Previous = NULL;
+    if (last == NULL)
+      font_list_start = font;
+    else
+      last->Next = font;
+    last = font;
+  }
+  fclose(file);
+  return 1;
+
+invalid:
+  GFX2_Log(GFX2_DEBUG, "Font index %s is out of date\n", filename);
+  fclose(file);
+  while (font_list_start != NULL)
+  {
+    T_Font * font = font_list_start->Next;
+    free(font_list_start->Name);
+    free(font_list_start);
+    font_list_start = font;
+  }
+  return 0;
+}
+
+/// Saves the font list, so the next runs don't have to scan the directories
+static void Write_font_index(const char * filename)
+{
+  T_Font * font;
+  FILE * file;
+  int index;
+  int ok;
+
+  // The names are stored one per line
+  for (font = font_list_start; font != NULL; font = font->Next)
+    if (strchr(font->Name, '\n') != NULL || strlen(font->Label) != 19)
+      return;
+  file = fopen(filename, "w");
+  if (file == NULL)
+  {
+    GFX2_Log(GFX2_WARNING, "Cannot write font index %s\n", filename);
+    return;
+  }
+  ok = fputs(FONT_INDEX_HEADER, file) >= 0;
+  for (index = 0; ok && index < Font_directories_count; index++)
+    ok = fprintf(file, "D %lu %s\n", Font_directories[index].Time, Font_directories[index].Path) > 0;
+  for (font = font_list_start; ok && font != NULL; font = font->Next)
+    ok = fprintf(file, "%c %s%s\n", font->Is_truetype ? 'T' : 'B', font->Label, font->Name) > 0;
+  if (fclose(file) != 0 || !ok)
+  {
+    GFX2_Log(GFX2_WARNING, "Cannot write font index %s\n", filename);
+    remove(filename);
+  }
+}
+#endif
+
+/**
+ * Builds the font list, the first time it is needed.
+ *
+ * Scanning the system font directories is slow, so it's not done at startup
+ * but when the Text tool is opened. The list is then saved in
+ * ::FONT_INDEX_FILENAME, and loaded from it as long as none of the font
+ * directories is modified.
+ */
+static void Load_font_list(void)
+{
+  dword start;
+  int index;
+#ifdef FONT_INDEX_FILENAME
+  char * index_filename;
+#endif
+
+  if (Font_list_loaded)
+    return;
+  Font_list_loaded = 1;
+  start = GFX2_GetTicks();
+  List_font_directories();
+#ifdef FONT_INDEX_FILENAME
+  index_filename = Filepath_append_to_dir(Config_directory, FONT_INDEX_FILENAME);
+  if (index_filename != NULL && Read_font_index(index_filename))
+  {
+    GFX2_Log(GFX2_DEBUG, "Font list read from %s : %lu ms\n", index_filename, (unsigned long)(GFX2_GetTicks() - start));
+    free(index_filename);
+    return;
+  }
+#endif
+  for (index = 0; index < Font_directories_count; index++)
+    For_each_file(Font_directories[index].Path, Add_font);
+#if defined(WIN32) && defined(NOTTF)
+  {
+    LOGFONTA lf;
+    HDC dc = GetDC(NULL);
+    memset(&lf, 0, sizeof(lf));
+    lf.lfCharSet = ANSI_CHARSET /* DEFAULT_CHARSET*/;
+    lf.lfPitchAndFamily = 0;
+    //EnumFontsA(dc, NULL, EnumFontCallback, NULL);
+    //EnumFontFamiliesA(dc, NULL, EnumFontFamCallback, 0);
+    EnumFontFamiliesExA(dc, &lf, EnumFontFamCallback, 0, 0);
+    ReleaseDC(NULL, dc);
+  }
+#endif
+  GFX2_Log(GFX2_DEBUG, "Font directories scanned : %lu ms\n", (unsigned long)(GFX2_GetTicks() - start));
+#ifdef FONT_INDEX_FILENAME
+  if (index_filename != NULL)
+    Write_font_index(index_filename);
+  free(index_filename);
+#endif
+}
+
+// Initialisation à faire une fois au début du programme
+// The font list is only built when needed, see Load_font_list()
+void Init_text(void)
+{
+  #ifndef NOTTF
+  // Initialisation de TTF
+  TTF_Init();
+  #endif
+  
+  font_list_start = NULL;
+  Font_list_loaded = 0;
+}
+
 // Informe si texte.c a été compilé avec l'option de support TrueType ou pas.
 int TrueType_is_supported()
 {
@@ -456,9 +659,119 @@ int TrueType_is_supported()
   #endif
 }
 
+#ifndef NOTTF
+/// Estimated memory that the opened fonts may use
+#define FONT_CACHE_BUDGET (16*1024*1024)
+/// Maximum number of opened fonts
+#define FONT_CACHE_SIZE 16
+/// Number of glyphs SDL_ttf keeps rendered for each opened font
+#define FONT_CACHED_GLYPHS 256
+
+/// A font kept open for the next renderings, with its rendered glyphs
+typedef struct
+{
+  TTF_Font * Font; ///< NULL if the entry is free
+  char * Name;
+  int Size;
+  int Style;
+  unsigned long Bytes; ///< Estimated memory used by the font and its glyphs
+  dword Last_use;
+} T_Font_cache_entry;
+
+static T_Font_cache_entry Font_cache[FONT_CACHE_SIZE];
+static unsigned long Font_cache_bytes = 0;
+static dword Font_cache_clock = 0;
+
+static void Close_cached_font(T_Font_cache_entry * entry)
+{
+  TTF_CloseFont(entry->Font);
+  free(entry->Name);
+  Font_cache_bytes -= entry->Bytes;
+  memset(entry, 0, sizeof(T_Font_cache_entry));
+}
+
+/// Closes all the fonts of the cache
+static void Close_cached_fonts(void)
+{
+  int i;
+
+  for (i = 0; i < FONT_CACHE_SIZE; i++)
+    if (Font_cache[i].Font != NULL)
+      Close_cached_font(Font_cache + i);
+}
+
+/**
+ * Opens a TrueType font, or gets it from the cache.
+ *
+ * SDL_ttf keeps the glyphs it renders with each opened font, so while the
+ * font stays in the cache, the text is only made of already rendered glyphs.
+ * The least recently used fonts are closed when the cache is over
+ * ::FONT_CACHE_BUDGET.
+ * @return the font, which must not be closed, or NULL
+ */
+static TTF_Font * Open_font(const char * name, int size, int style)
+{
+  T_Font_cache_entry * entry = NULL;
+  TTF_Font * font;
+  unsigned long bytes;
+  dword start;
+  int i;
+
+  for (i = 0; i < FONT_CACHE_SIZE; i++)
+  {
+    if (Font_cache[i].Font != NULL && Font_cache[i].Size == size
+        && Font_cache[i].Style == style && !strcmp(Font_cache[i].Name, name))
+    {
+      Font_cache[i].Last_use = ++Font_cache_clock;
+      return Font_cache[i].Font;
+    }
+  }
+
+  start = GFX2_GetTicks();
+  font = TTF_OpenFont(name, size);
+  if (font == NULL)
+    return NULL;
+  TTF_SetFontStyle(font, style);
+  GFX2_Log(GFX2_DEBUG, "TTF_OpenFont(\"%s\", %d) : %lu ms\n", name, size, (unsigned long)(GFX2_GetTicks() - start));
+
+  // Make room, keeping at least the new font
+  bytes = File_length(name) + (unsigned long)FONT_CACHED_GLYPHS * size * size * 2;
+  for (;;)
+  {
+    T_Font_cache_entry * oldest = NULL;
+
+    entry = NULL;
+    for (i = 0; i < FONT_CACHE_SIZE; i++)
+    {
+      if (Font_cache[i].Font == NULL)
+        entry = Font_cache + i;
+      else if (oldest == NULL || Font_cache[i].Last_use < oldest->Last_use)
+        oldest = Font_cache + i;
+    }
+    if (oldest == NULL || (entry != NULL && Font_cache_bytes + bytes <= FONT_CACHE_BUDGET))
+      break;
+    Close_cached_font(oldest);
+  }
+  entry->Name = strdup(name);
+  if (entry->Name == NULL)
+  {
+    TTF_CloseFont(font);
+    return NULL;
+  }
+  entry->Font = font;
+  entry->Size = size;
+  entry->Style = style;
+  entry->Bytes = bytes;
+  entry->Last_use = ++Font_cache_clock;
+  Font_cache_bytes += bytes;
+  return font;
+}
+#endif
+
 void Uninit_text(void)
 {
 #ifndef NOTTF
+  Close_cached_fonts();
   TTF_Quit();
 #if defined(USE_FC)
   FcFini();
@@ -471,6 +784,11 @@ void Uninit_text(void)
     free(font_list_start);
     font_list_start = font;
   }
+  while (Font_directories_count > 0)
+    free(Font_directories[--Font_directories_count].Path);
+  free(Font_directories);
+  Font_directories = NULL;
+  Font_list_loaded = 0;
 }
   
 #ifndef NOTTF
@@ -480,24 +798,24 @@ byte *Render_text_TTF(const char *str, int font_number, int size, int antialias,
   SDL_Surface * text_surface;
   byte * new_brush;
   int style;
+  dword start = GFX2_GetTicks();
   
   SDL_Color fg_color;
   SDL_Color bg_color;
 
-  // Chargement de la fonte
-  font=TTF_OpenFont(Font_name(font_number), size);
-  if (!font)
-  {
-    return NULL;
-  }
-  
   // Style
   style=0;
   if (italic)
     style|=TTF_STYLE_ITALIC;
   if (bold)
     style|=TTF_STYLE_BOLD;
-  TTF_SetFontStyle(font, style);
+
+  // Chargement de la fonte
+  font=Open_font(Font_name(font_number), size, style);
+  if (!font)
+  {
+    return NULL;
+  }
   
   // Colors: Text will be generated as white on black.
   fg_color.r=fg_color.g=fg_color.b=255;
@@ -523,7 +841,6 @@ byte *Render_text_TTF(const char *str, int font_number, int size, int antialias,
   #endif
   if (!text_surface)
   {
-    TTF_CloseFont(font);
     return NULL;
   }
     
@@ -531,7 +848,6 @@ byte *Render_text_TTF(const char *str, int font_number, int size, int antialias,
   if (!new_brush)
   {
     SDL_FreeSurface(text_surface);
-    TTF_CloseFont(font);
     return NULL;
   }
   
@@ -607,7 +923,7 @@ byte *Render_text_TTF(const char *str, int font_number, int size, int antialias,
   *width=text_surface->w;
   *height=text_surface->h;
   SDL_FreeSurface(text_surface);
-  TTF_CloseFont(font);
+  GFX2_Log(GFX2_DEBUG, "Render_text_TTF(\"%s\") : %lu ms\n", str, (unsigned long)(GFX2_GetTicks() - start));
   return new_brush;
 }
 #endif
@@ -791,7 +1107,7 @@ byte *Render_text_SFont(const char *str, int font_number, int *width, int *heigh
 // et retourne l'adresse du bloc d'octets.
 byte *Render_text(const char *str, int font_number, int size, int antialias, int bold, int italic, int *width, int *height, T_Palette palette)
 {
-  T_Font *font = font_list_start;
+  T_Font *font;
   int index=font_number;
   #if defined(NOTTF) && !defined(WIN32)
     (void) size; // unused
@@ -801,6 +1117,8 @@ byte *Render_text(const char *str, int font_number, int size, int antialias, int
   #endif
   
   // Verification type de la fonte
+  Load_font_list();
+  font = font_list_start;
   if (font_number < 0 || font == NULL)
     return NULL;
     
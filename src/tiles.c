@@ -171,14 +171,105 @@ int Tile_is_same_flipped_xy(int t1, int t2)
   return 1;
 }
 
+/// Maximum number of tiles of a tilemap
+#define TILEMAP_MAX_TILES (4096l*1024)
+
+/// Entry of the hash table of the unique tiles
+typedef struct
+{
+  dword Hash; ///< Tile_hashes() of the tile, not flipped
+  int Tile;   ///< First tile of a list of similar tiles, or -1 if unused
+} T_Tile_hash_entry;
+
+///
+/// Hashes of a tile and of its flipped copies, indexed by ::TILE_FLIPPED.
+///
+/// Each pixel is multiplied by the weight of its column and the weight of
+/// its row: flipping the tile only reverses the order of the weights, so
+/// the four hashes are made in one pass on the pixels.
+/// @param weights Snap_width weights of the columns, then Snap_height weights of the rows
+/// @param flipped_x 0 if the flipped-x hashes are not needed
+static void Tile_hashes(const dword * weights, int t, int flipped_x, dword * hashes)
+{
+  const byte *bmp;
+  const dword *row_weights = weights + Snap_width;
+  int x, y;
+  
+  bmp = Main.backups->Pages->Image[Main.current_layer].Pixels+(TILE_Y(t))*Main.image_width+(TILE_X(t));
+  memset(hashes, 0, 4*sizeof(dword));
+  for (y=0; y < Snap_height; y++, bmp += Main.image_width)
+  {
+    dword row = 0;
+    dword row_flipped = 0;
+    
+    for (x=0; x < Snap_width; x++)
+      row += bmp[x] * weights[x];
+    if (flipped_x)
+      for (x=0; x < Snap_width; x++)
+        row_flipped += bmp[x] * weights[Snap_width-1-x];
+    hashes[TILE_FLIPPED_NONE] += row * row_weights[y];
+    hashes[TILE_FLIPPED_Y] += row * row_weights[Snap_height-1-y];
+    hashes[TILE_FLIPPED_X] += row_flipped * row_weights[y];
+    hashes[TILE_FLIPPED_XY] += row_flipped * row_weights[Snap_height-1-y];
+  }
+  // Mix the bits, so the low ones can be used as an index in the hash table
+  for (x=0; x < 4; x++)
+  {
+    hashes[x] = (hashes[x] ^ (hashes[x] >> 16)) * 0x45d9f3bUL;
+    hashes[x] ^= hashes[x] >> 16;
+  }
+}
+
+///
+/// Searches a tile which is the same as another one flipped.
+/// @param hash Tile_hashes() of the other tile, with the same flip
+/// Only the hash collisions are really compared.
+/// @return the tile found in the table, or -1
+static int Find_tile(const T_Tile_hash_entry * table, dword mask, dword hash, int tile, int flipped)
+{
+  dword i;
+  
+  for (i = hash & mask; table[i].Tile >= 0; i = (i + 1) & mask)
+  {
+    int ref_tile = table[i].Tile;
+    
+    if (table[i].Hash != hash)
+      continue;
+    switch (flipped)
+    {
+      case TILE_FLIPPED_NONE:
+        if (Tile_is_same(ref_tile, tile))
+          return ref_tile;
+        break;
+      case TILE_FLIPPED_X:
+        if (Tile_is_same_flipped_x(ref_tile, tile))
+          return ref_tile;
+        break;
+      case TILE_FLIPPED_Y:
+        if (Tile_is_same_flipped_y(ref_tile, tile))
+          return ref_tile;
+        break;
+      case TILE_FLIPPED_XY:
+        if (Tile_is_same_flipped_xy(ref_tile, tile))
+          return ref_tile;
+        break;
+    }
+  }
+  return -1;
+}
+
 /// Create or update a tilemap based on current screen (layer)'s pixels.
 void Tilemap_update(void)
 {
   int width;
   int height;
   int tile;
-  int count=1;
+  int count=0;
   T_Tile * tile_ptr;
+  T_Tile_hash_entry * table;
+  dword mask;
+  dword * weights;
+  dword seed;
   
   int wait_window=0;
   byte old_cursor=0;
@@ -189,17 +280,38 @@ void Tilemap_update(void)
   width=(Main.image_width-Snap_offset_X)/Snap_width;
   height=(Main.image_height-Snap_offset_Y)/Snap_height;
   
-  if (width<1 || height<1 || width*height>1000000l
+  if (width<1 || height<1 || (long)width*height>TILEMAP_MAX_TILES
    || (tile_ptr=(T_Tile *)malloc(width*height*sizeof(T_Tile))) == NULL)
   {
     // Cannot enable tilemap because either the image is too small
     // for the grid settings (and I don't want to implement partial tiles)
-    // Or the number of tiles seems unreasonable (one million) : This can
+    // Or the number of tiles seems unreasonable (4 millions) : This can
     // happen if you set grid 1x1 for example.
   
     Disable_tilemap(&Main);
     return;
   }
+  // Hash table of the unique tiles, at most half full
+  for (mask = 1; mask < (dword)(width*height)*2; mask <<= 1)
+    ;
+  table = (T_Tile_hash_entry *)malloc(mask*sizeof(T_Tile_hash_entry));
+  weights = (dword *)malloc((Snap_width+Snap_height)*sizeof(dword));
+  if (table == NULL || weights == NULL)
+  {
+    free(table);
+    free(weights);
+    free(tile_ptr);
+    Disable_tilemap(&Main);
+    return;
+  }
+  mask--;
+  // Random odd weights, the same on each run
+  seed = 1;
+  for (tile=0; tile<Snap_width+Snap_height; tile++)
+  {
+    seed = seed * 1103515245 + 12345;
+    weights[tile] = (seed & 0xffff0000UL) | (seed >> 16) | 1;
+  }
   
   if (Main.tilemap)
   {
@@ -212,7 +324,7 @@ void Tilemap_update(void)
   Main.tilemap_width=width;
   Main.tilemap_height=height;
 
-  if (width*height > 1000 || Config.Tilemap_show_count)
+  if (width*height > 1000000 || Config.Tilemap_show_count)
   {
     wait_window=1;
     old_cursor=Cursor_shape;
@@ -231,112 +343,63 @@ void Tilemap_update(void)
     Main.tilemap[tile].Next = tile;
     Main.tilemap[tile].Flipped = 0;
   }
+  for (tile=0; tile<=(int)mask; tile++)
+    table[tile].Tile = -1;
   
   // Now find similar tiles and link them in circular linked list
   //It will be used to modify all tiles whenever you draw on one.
-  for (tile=1; tile<width*height; tile++)
+  // The first tile of each list is in the hash table: try normal comparison,
+  // then flipped-y, flipped-x and flipped-xy.
+  for (tile=0; tile<width*height; tile++)
   {
     int ref_tile;
+    byte flipped = TILE_FLIPPED_NONE;
+    dword hashes[4];
     
-    // Try normal comparison
-    
-    for (ref_tile=0; ref_tile<tile; ref_tile++)
+    Tile_hashes(weights, tile, Config.Tilemap_allow_flipped_x, hashes);
+    ref_tile = Find_tile(table, mask, hashes[TILE_FLIPPED_NONE], tile, TILE_FLIPPED_NONE);
+    if (ref_tile<0 && Config.Tilemap_allow_flipped_y)
     {
-      if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same(ref_tile, tile))
-      {
-        break; // stop loop on ref_tile
-      }
+      flipped = TILE_FLIPPED_Y;
+      ref_tile = Find_tile(table, mask, hashes[flipped], tile, flipped);
+    }
+    if (ref_tile<0 && Config.Tilemap_allow_flipped_x)
+    {
+      flipped = TILE_FLIPPED_X;
+      ref_tile = Find_tile(table, mask, hashes[flipped], tile, flipped);
     }
-    if (ref_tile<tile)
+    if (ref_tile<0 && Config.Tilemap_allow_flipped_x && Config.Tilemap_allow_flipped_y)
+    {
+      flipped = TILE_FLIPPED_XY;
+      ref_tile = Find_tile(table, mask, hashes[flipped], tile, flipped);
+    }
+    if (ref_tile>=0)
     {
       // New occurrence of a known tile
       // Insert at the end. classic doubly-linked-list.
       int last_tile=Main.tilemap[ref_tile].Previous;
       Main.tilemap[tile].Previous=last_tile;
       Main.tilemap[tile].Next=ref_tile;
-      Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped;
+      Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ flipped;
       Main.tilemap[ref_tile].Previous=tile;
       Main.tilemap[last_tile].Next=tile;
-      continue; // next tile
     }
-    
-    // Try flipped-y comparison
-    if (Config.Tilemap_allow_flipped_y)
-    {
-      for (ref_tile=0; ref_tile<tile; ref_tile++)
-      {
-        if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same_flipped_y(ref_tile, tile))
-        {
-          break; // stop loop on ref_tile
-        }
-      }
-      if (ref_tile<tile)
-      {
-        // New occurrence of a known tile
-        // Insert at the end. classic doubly-linked-list.
-        int last_tile=Main.tilemap[ref_tile].Previous;
-        Main.tilemap[tile].Previous=last_tile;
-        Main.tilemap[tile].Next=ref_tile;
-        Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ TILE_FLIPPED_Y;
-        Main.tilemap[ref_tile].Previous=tile;
-        Main.tilemap[last_tile].Next=tile;
-        continue; // next tile
-      }
-    }
-    
-    // Try flipped-x comparison
-    if (Config.Tilemap_allow_flipped_x)
-    {
-      for (ref_tile=0; ref_tile<tile; ref_tile++)
-      {
-        if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same_flipped_x(ref_tile, tile))
-        {
-          break; // stop loop on ref_tile
-        }
-      }
-      if (ref_tile<tile)
-      {
-        // New occurrence of a known tile
-        // Insert at the end. classic doubly-linked-list.
-        int last_tile=Main.tilemap[ref_tile].Previous;
-        Main.tilemap[tile].Previous=last_tile;
-        Main.tilemap[tile].Next=ref_tile;
-        Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ TILE_FLIPPED_X;
-        Main.tilemap[ref_tile].Previous=tile;
-        Main.tilemap[last_tile].Next=tile;
-        continue; // next tile
-      }
-    }
-    
-    // Try flipped-xy comparison
-    if (Config.Tilemap_allow_flipped_x && Config.Tilemap_allow_flipped_y)
+    else
     {
-      for (ref_tile=0; ref_tile<tile; ref_tile++)
-      {
-        if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same_flipped_xy(ref_tile, tile))
-        {
-          break; // stop loop on ref_tile
-        }
-      }
-      if (ref_tile<tile)
-      {
-        // New occurrence of a known tile
-        // Insert at the end. classic doubly-linked-list.
-        int last_tile=Main.tilemap[ref_tile].Previous;
-        Main.tilemap[tile].Previous=last_tile;
-        Main.tilemap[tile].Next=ref_tile;
-        Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ TILE_FLIPPED_XY;
-        Main.tilemap[ref_tile].Previous=tile;
-        Main.tilemap[last_tile].Next=tile;
-        continue; // next tile
-      }
+      // This tile is really unique.
+      // The initialization has already set the right data for
+      // Main.tilemap[tile], it only needs to be in the hash table.
+      dword i;
+      
+      for (i = hashes[TILE_FLIPPED_NONE] & mask; table[i].Tile >= 0; i = (i + 1) & mask)
+        ;
+      table[i].Hash = hashes[TILE_FLIPPED_NONE];
+      table[i].Tile = tile;
+      count++;
     }
-    
-    // This tile is really unique.
-    // Nothing to do at this time: the initialization
-    // has already set the right data for Main.tilemap[tile].
-    count++;
   }
+  free(table);
+  free(weights);
   
   if (wait_window)
   {
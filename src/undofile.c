@@ -0,0 +1,264 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file undofile.c
+/// Memory-mapped scratch file for the old Undo history steps.
+///
+/// The file grows by chunks of ::UNDO_FILE_CHUNK_SIZE bytes, each chunk
+/// being mapped separately so the pointers returned by Undo_file_data()
+/// never move. The data is stored one record after the other in a chunk,
+/// whatever its size. A chunk is only reused when all its records were
+/// freed: the history steps are moved to the file and destroyed roughly in
+/// the same order, so the chunks empty one after the other.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define snprintf _snprintf
+#endif
+#if defined(WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__macosx__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#define UNDO_FILE_MMAP
+#endif
+
+#include "struct.h"
+#include "undofile.h"
+#include "io.h"
+#include "gfx2mem.h"
+#include "gfx2log.h"
+
+/// Records start on a multiple of this, so their position fits in a long
+#define UNDO_FILE_ALIGN 16
+
+long Undo_file_records = 0;
+long long Undo_file_size = 0;
+
+#if defined(WIN32)
+static HANDLE Undo_file = INVALID_HANDLE_VALUE;
+#elif defined(UNDO_FILE_MMAP)
+static int Undo_file = -1;
+#endif
+/// Set after a failure to create the file, so it's not retried every time
+static int Undo_file_failed = 0;
+/// A chunk of the file
+typedef struct
+{
+  byte * Data;  ///< Mapped address
+  long Records; ///< Number of records which were not freed
+} T_Undo_chunk;
+static T_Undo_chunk * Chunks = NULL;
+static long Nb_chunks = 0;
+/// Chunk where the records are added
+static long Current_chunk = 0;
+/// Byte size used in ::Current_chunk
+static size_t Chunk_fill = 0;
+int Undo_file_open(const char * directory)
+{
+  char name[32];
+  char * filename;
+
+  if (Chunks != NULL)
+    return 1;
+  if (Undo_file_failed || directory == NULL)
+    return 0;
+  Undo_file_failed = 1;
+
+#if defined(WIN32)
+  snprintf(name, sizeof(name), "undo-%lu.tmp", (unsigned long)GetCurrentProcessId());
+  filename = Filepath_append_to_dir(directory, name);
+  if (filename == NULL)
+    return 0;
+  Undo_file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                          FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+  if (Undo_file == INVALID_HANDLE_VALUE)
+  {
+    GFX2_Log(GFX2_WARNING, "Cannot create Undo scratch file %s\n", filename);
+    free(filename);
+    return 0;
+  }
+#elif defined(UNDO_FILE_MMAP)
+  snprintf(name, sizeof(name), "undo-%ld.tmp", (long)getpid());
+  filename = Filepath_append_to_dir(directory, name);
+  if (filename == NULL)
+    return 0;
+  Undo_file = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (Undo_file < 0)
+  {
+    GFX2_Log(GFX2_WARNING, "Cannot create Undo scratch file %s\n", filename);
+    free(filename);
+    return 0;
+  }
+  // The file stays usable until closed, and nothing is left behind on a crash
+  unlink(filename);
+#else
+  (void)name;
+  (void)filename;
+  return 0;
+#endif
+  GFX2_Log(GFX2_DEBUG, "Undo scratch file : %s\n", filename);
+  free(filename);
+  // The list of chunks is allocated even when empty: it tells the file is open
+  Chunks = (T_Undo_chunk *)GFX2_malloc(sizeof(T_Undo_chunk));
+  if (Chunks == NULL)
+  {
+    Undo_file_close();
+    return 0;
+  }
+  Undo_file_failed = 0;
+  return 1;
+}
+
+void Undo_file_close(void)
+{
+  long i;
+
+  for (i = 0; i < Nb_chunks; i++)
+  {
+#if defined(WIN32)
+    UnmapViewOfFile(Chunks[i].Data);
+#elif defined(UNDO_FILE_MMAP)
+    munmap(Chunks[i].Data, UNDO_FILE_CHUNK_SIZE);
+#endif
+  }
+#if defined(WIN32)
+  if (Undo_file != INVALID_HANDLE_VALUE)
+    CloseHandle(Undo_file);
+  Undo_file = INVALID_HANDLE_VALUE;
+#elif defined(UNDO_FILE_MMAP)
+  if (Undo_file >= 0)
+    close(Undo_file);
+  Undo_file = -1;
+#endif
+  free(Chunks);
+  Chunks = NULL;
+  Nb_chunks = 0;
+  Current_chunk = 0;
+  Chunk_fill = 0;
+  Undo_file_records = 0;
+  Undo_file_size = 0;
+}
+
+/// Grows the file by one chunk, and maps it.
+static int Add_chunk(void)
+{
+  T_Undo_chunk * new_chunks;
+  byte * chunk = NULL;
+#if defined(WIN32)
+  unsigned long long end = (unsigned long long)(Nb_chunks+1) * UNDO_FILE_CHUNK_SIZE;
+  unsigned long long offset = end - UNDO_FILE_CHUNK_SIZE;
+  HANDLE mapping;
+#elif defined(UNDO_FILE_MMAP)
+  static const byte zeros[65536];
+  off_t offset = (off_t)Nb_chunks * UNDO_FILE_CHUNK_SIZE;
+  size_t written;
+#endif
+
+  // The position of the records must fit in a long
+  if (Nb_chunks >= LONG_MAX / (long)(UNDO_FILE_CHUNK_SIZE / UNDO_FILE_ALIGN))
+    return 0;
+  new_chunks = (T_Undo_chunk *)realloc(Chunks, (Nb_chunks+1)*sizeof(T_Undo_chunk));
+  if (new_chunks == NULL)
+    return 0;
+  Chunks = new_chunks;
+
+#if defined(WIN32)
+  // The mapping object extends the file to its size
+  mapping = CreateFileMappingA(Undo_file, NULL, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)end, NULL);
+  if (mapping == NULL)
+    return 0;
+  chunk = (byte *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, (DWORD)(offset >> 32), (DWORD)offset, UNDO_FILE_CHUNK_SIZE);
+  CloseHandle(mapping); // the view keeps it alive
+  if (chunk == NULL)
+    return 0;
+#elif defined(UNDO_FILE_MMAP)
+  // Really write the chunk instead of making a sparse file: if the disk is
+  // full, it's better to know it now than on access to the mapped memory.
+  if (lseek(Undo_file, offset, SEEK_SET) != offset)
+    return 0;
+  for (written = 0; written < UNDO_FILE_CHUNK_SIZE; written += sizeof(zeros))
+  {
+    if (write(Undo_file, zeros, sizeof(zeros)) != (ssize_t)sizeof(zeros))
+    {
+      GFX2_Log(GFX2_WARNING, "Undo scratch file is full\n");
+      if (ftruncate(Undo_file, offset) < 0)
+        GFX2_Log(GFX2_WARNING, "Undo scratch file could not be truncated\n");
+      return 0;
+    }
+  }
+  chunk = mmap(NULL, UNDO_FILE_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, Undo_file, offset);
+  if (chunk == MAP_FAILED)
+    return 0;
+#endif
+  if (chunk == NULL)
+    return 0;
+  Chunks[Nb_chunks].Data = chunk;
+  Chunks[Nb_chunks].Records = 0;
+  Nb_chunks++;
+  Undo_file_size += UNDO_FILE_CHUNK_SIZE;
+  return 1;
+}
+
+long Undo_file_store(const byte * data, size_t size)
+{
+  size_t offset;
+
+  if (Chunks == NULL || size > UNDO_FILE_CHUNK_SIZE)
+    return -1;
+  if (Nb_chunks == 0 || Chunk_fill + size > UNDO_FILE_CHUNK_SIZE)
+  {
+    long chunk;
+
+    // Continue in an empty chunk, or in a new one
+    for (chunk = 0; chunk < Nb_chunks && Chunks[chunk].Records > 0; chunk++)
+      ;
+    if (chunk == Nb_chunks && !Add_chunk())
+      return -1;
+    Current_chunk = chunk;
+    Chunk_fill = 0;
+  }
+  offset = Chunk_fill;
+  memcpy(Chunks[Current_chunk].Data + offset, data, size);
+  Chunks[Current_chunk].Records++;
+  Chunk_fill += (size + UNDO_FILE_ALIGN - 1) & ~(size_t)(UNDO_FILE_ALIGN - 1);
+  Undo_file_records++;
+  return Current_chunk * (long)(UNDO_FILE_CHUNK_SIZE / UNDO_FILE_ALIGN) + (long)(offset / UNDO_FILE_ALIGN);
+}
+
+const byte * Undo_file_data(long record)
+{
+  return Chunks[record / (long)(UNDO_FILE_CHUNK_SIZE / UNDO_FILE_ALIGN)].Data
+       + (size_t)(record % (long)(UNDO_FILE_CHUNK_SIZE / UNDO_FILE_ALIGN)) * UNDO_FILE_ALIGN;
+}
+
+void Undo_file_free(long record)
+{
+  long chunk = record / (long)(UNDO_FILE_CHUNK_SIZE / UNDO_FILE_ALIGN);
+
+  Undo_file_records--;
+  if (--Chunks[chunk].Records == 0 && chunk == Current_chunk)
+    Chunk_fill = 0; // Start again at the beginning
+}
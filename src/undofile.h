@@ -0,0 +1,77 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file undofile.h
+/// Memory-mapped scratch file, where the old Undo history steps are
+/// moved when they don't fit in memory.
+///
+/// The data is stored in records of any size, packed one after the other.
+/// It is deleted automatically when closed or when the program exits.
+
+#ifndef UNDOFILE_H_INCLUDED
+#define UNDOFILE_H_INCLUDED
+
+/// Byte size of a chunk of the file (16 MB), the maximum size of a record
+#define UNDO_FILE_CHUNK_SIZE ((size_t)16*1024*1024)
+
+/**
+ * Creates the scratch file in a directory, if not already done.
+ *
+ * After a failure, the next calls return 0 immediately.
+ * @param directory where to create the file, usually ::Config_directory
+ * @return 1 if the scratch file can be used, 0 otherwise
+ */
+int Undo_file_open(const char * directory);
+
+/**
+ * Releases all records and deletes the scratch file.
+ */
+void Undo_file_close(void);
+
+/**
+ * Copies data to a new record of the scratch file.
+ *
+ * @param data data to store
+ * @param size byte size of data, up to ::UNDO_FILE_CHUNK_SIZE
+ * @return the record number, or -1 if the file is not open or full
+ */
+long Undo_file_store(const byte * data, size_t size);
+
+/**
+ * Access to the data of a record.
+ *
+ * The system reads it back from the disk on demand.
+ * @return a pointer which stays valid until the record is freed
+ */
+const byte * Undo_file_data(long record);
+
+/**
+ * Releases a record. Its space is reused when all the records around it
+ * are released too.
+ */
+void Undo_file_free(long record);
+
+/// Number of records in use
+extern long Undo_file_records;
+
+/// Byte size of the file
+extern long long Undo_file_size;
+
+#endif
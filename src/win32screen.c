@@ -21,12 +21,14 @@
 #include <windowsx.h>
 #include <malloc.h>
 #include <stdio.h>
+#include <string.h>
 #if defined(_MSC_VER) && _MSC_VER < 1900
 	#define snprintf _snprintf
 #endif
 #include "gfx2mem.h"
 #include "gfx2log.h"
 #include "screen.h"
+#include "dirtyrect.h"
 #include "errors.h"
 #include "windows.h"
 #include "input.h"
@@ -47,6 +49,10 @@ static int Windows_DIB_width = 0;
 static int Windows_DIB_height = 0;
 static HWND Win32_hwnd = NULL;
 static int Win32_Is_Fullscreen = 0;
+/// The parts of the screen modified since the last Flush_update()
+static T_Dirty_region Dirty_region;
+/// The colors of the DIB, to find which ones are changed
+static RGBQUAD Screen_colors[256];
 
 void * GFX2_Get_Window_Handle()
 {
@@ -54,6 +60,9 @@ void * GFX2_Get_Window_Handle()
 }
 
 /// Blit our "framebuffer" bitmap to the Window.
+///
+/// Each rectangle of the update region is copied, instead of the
+/// rectangle which contains them all.
 static void Win32_Repaint(HWND hwnd)
 {
   PAINTSTRUCT ps;
@@ -61,21 +70,45 @@ static void Win32_Repaint(HWND hwnd)
   HDC dc2;
   HBITMAP old_bmp;
   RECT rect;
+  HRGN region;
+  RGNDATA * region_data = NULL;
+  const RECT * rects = &rect;
+  DWORD nb_rects = 1;
+  DWORD i;
 
   if (!GetUpdateRect(hwnd, &rect, FALSE)) return;
-  //GFX2_Log(GFX2_DEBUG, "Repaint rect : (%d,%d)-(%d,%d)\n", rect.left, rect.top, rect.right, rect.bottom);
+  region = CreateRectRgn(0, 0, 0, 0);
+  if (region != NULL)
+  {
+    if (GetUpdateRgn(hwnd, region, FALSE) != ERROR)
+    {
+      DWORD size = GetRegionData(region, 0, NULL);
+      region_data = (RGNDATA *)GFX2_malloc(size);
+      if (region_data != NULL && GetRegionData(region, size, region_data) == size)
+      {
+        rects = (const RECT *)region_data->Buffer;
+        nb_rects = region_data->rdh.nCount;
+      }
+    }
+    DeleteObject(region);
+  }
   dc = BeginPaint(hwnd, &ps);
   dc2 = CreateCompatibleDC(dc);
   old_bmp = (HBITMAP)SelectObject(dc2, Windows_DIB);
-  if (!BitBlt(dc, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top,
-              dc2, rect.left, rect.top,
-              SRCCOPY))
-    GFX2_Log(GFX2_INFO, "BitBlt(dc, %d, %d, %d, %d, dc2, %d, %d, SRCCOPY) FAILED\n",
-             rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top,
-             rect.left, rect.top);
+  for (i = 0; i < nb_rects; i++)
+  {
+    //GFX2_Log(GFX2_DEBUG, "Repaint rect : (%d,%d)-(%d,%d)\n", rects[i].left, rects[i].top, rects[i].right, rects[i].bottom);
+    if (!BitBlt(dc, rects[i].left, rects[i].top, rects[i].right - rects[i].left, rects[i].bottom - rects[i].top,
+                dc2, rects[i].left, rects[i].top,
+                SRCCOPY))
+      GFX2_Log(GFX2_INFO, "BitBlt(dc, %d, %d, %d, %d, dc2, %d, %d, SRCCOPY) FAILED\n",
+               rects[i].left, rects[i].top, rects[i].right - rects[i].left, rects[i].bottom - rects[i].top,
+               rects[i].left, rects[i].top);
+  }
   SelectObject(dc2, old_bmp);
 	DeleteDC(dc2);
 	EndPaint(hwnd, &ps);
+  free(region_data);
 }
 
 /// WindowProc callback function
@@ -482,6 +515,8 @@ static int Video_AllocateDib(int width, int height)
 	bi->bmiHeader.biBitCount = 8;
 	bi->bmiHeader.biCompression = BI_RGB;
 
+	memset(Screen_colors, 0, sizeof(Screen_colors));
+
 	dc = GetDC(NULL);
 	Windows_DIB = CreateDIBSection(dc, bi, DIB_RGB_COLORS, &Windows_Screen, NULL, 0);
 	if (Windows_DIB == NULL) {
@@ -641,21 +676,29 @@ void Update_rect(short x, short y, unsigned short width, unsigned short height)
   if (width == 0 && height == 0)
   {
     // update whole window
-    InvalidateRect(Win32_hwnd, NULL, FALSE/*TRUE*/);
+    Dirty_region_add(&Dirty_region, 0, 0, Windows_DIB_width, Windows_DIB_height);
   }
   else
   {
-    RECT rect;
-    rect.left = x * Pixel_width;
-    rect.top = y * Pixel_height;
-    rect.right = (x + width) * Pixel_width;
-    rect.bottom = (y + height) * Pixel_height;
-    InvalidateRect(Win32_hwnd, &rect, FALSE/*TRUE*/);
+    Dirty_region_add(&Dirty_region, x * Pixel_width, y * Pixel_height,
+                     width * Pixel_width, height * Pixel_height);
   }
 }
 
+static void Invalidate_rect(int x, int y, int width, int height)
+{
+  RECT rect;
+
+  rect.left = x;
+  rect.top = y;
+  rect.right = x + width;
+  rect.bottom = y + height;
+  InvalidateRect(Win32_hwnd, &rect, FALSE/*TRUE*/);
+}
+
 void Flush_update(void)
 {
+  Dirty_region_flush(&Dirty_region, Windows_DIB_width, Windows_DIB_height, Invalidate_rect);
 }
 
 void Update_status_line(short char_pos, short width)
@@ -671,12 +714,24 @@ int GFX2_SetPalette(const T_Components * colors, int firstcolor, int ncolors)
 	HDC dc;
 	HDC dc2;
 	HBITMAP old_bmp;
+  byte changed[256];
+  int nb_changed = 0;
 
+	memset(changed, 0, sizeof(changed));
 	for (i = 0; i < ncolors; i++) {
     rgb[i].rgbRed      = colors[i].R;
 		rgb[i].rgbGreen    = colors[i].G;
 		rgb[i].rgbBlue     = colors[i].B;
+		rgb[i].rgbReserved = 0;
+		if (memcmp(Screen_colors + firstcolor + i, rgb + i, sizeof(RGBQUAD)) != 0)
+		{
+		  Screen_colors[firstcolor + i] = rgb[i];
+		  changed[firstcolor + i] = 1;
+		  nb_changed++;
+		}
 	}
+  if (nb_changed == 0)
+    return 1;
 
 	dc = GetDC(Win32_hwnd);
 	dc2 = CreateCompatibleDC(dc);
@@ -685,7 +740,10 @@ int GFX2_SetPalette(const T_Components * colors, int firstcolor, int ncolors)
 	SelectObject(dc2, old_bmp);
 	DeleteDC(dc2);
 	ReleaseDC(Win32_hwnd, dc);
-  InvalidateRect(Win32_hwnd, NULL, FALSE);  // Refresh the whole window
+  // Refresh the parts of the window which use these colors
+  if (Windows_Screen != NULL)
+    Dirty_region_add_colors(&Dirty_region, Windows_Screen, Windows_DIB_width,
+                            Windows_DIB_width, Windows_DIB_height, changed);
   return 1;
 }
 
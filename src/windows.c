@@ -51,6 +51,7 @@
 #include "readline.h"
 #include "screen.h"
 #include "palette.h"
+#include "pxrender.h"
 #include "unicode.h"
 #include "keycodes.h"
 #include "keyboard.h"
@@ -3017,12 +3018,12 @@ void Hide_cursor(void)
 
   // -- Reafficher toute l'image (en prenant en compte le facteur de zoom) --
 
-void Display_all_screen(void)
+/// Displays the non-zoomed part of the image, and clears what is around it.
+static void Display_unzoomed_part(void)
 {
   word width;
   word height;
 
-  // ---/\/\/\  Partie non zoomée: /\/\/\---
   if (Main.magnifier_mode)
   {
     if (Main.image_width<Main.separator_position)
@@ -3056,6 +3057,15 @@ void Display_all_screen(void)
   }
   if (Main.image_height<Menu_Y)
     Block(0,Main.image_height,width,(Menu_Y-height),Main.backups->Pages->Transparent_color);
+}
+
+void Display_all_screen(void)
+{
+  word width;
+  word height;
+
+  // ---/\/\/\  Partie non zoomée: /\/\/\---
+  Display_unzoomed_part();
 
   // ---/\/\/\  Partie zoomée: /\/\/\---
   if (Main.magnifier_mode)
@@ -3095,9 +3105,84 @@ void Display_all_screen(void)
   Update_rect(0,0,Screen_width,Menu_Y); // TODO On peut faire plus fin, en évitant de mettre à jour la partie à droite du split quand on est en mode loupe. Mais c'est pas vraiment intéressant ?
 }
 
+void Display_all_screen_after_scroll(short old_offset_X, short old_offset_Y,
+                                     short old_magnifier_offset_X, short old_magnifier_offset_Y)
+{
+  int factor = Main.magnifier_factor;
+  int dx = Main.magnifier_offset_X - old_magnifier_offset_X;
+  int dy = Main.magnifier_offset_Y - old_magnifier_offset_Y;
 
+  // The zoomed pixels can be reused when the image fills the magnifier
+  // before and after, and when the dots of the grid stay on the same
+  // columns and rows.
+  if (!Main.magnifier_mode
+      || abs(dx) >= Main.magnifier_width || abs(dy) >= Main.magnifier_height
+      || Main.image_width < Main.magnifier_width
+      || Main.image_height < Main.magnifier_offset_Y + Main.magnifier_height
+      || Main.image_height < old_magnifier_offset_Y + Main.magnifier_height
+      || (Show_grid && ((dx * factor) & 1 || (dy * factor) & 1)))
+  {
+    Display_all_screen();
+    return;
+  }
 
-byte Best_color(byte r,byte g,byte b)
+  if (Main.offset_X != old_offset_X || Main.offset_Y != old_offset_Y)
+  {
+    Display_unzoomed_part();
+    if (Config.Display_image_limits)
+      Display_image_limits();
+    Update_rect(0,0,Main.separator_position,Menu_Y);
+  }
+  if (dx == 0 && dy == 0)
+    return;
+
+  Scroll_zoomed_screen(dx, dy);
+}
+
+
+
+/// Number of entries in each table of ::Best_color_cache (power of 2)
+#define BEST_COLOR_CACHE_SIZE 4096
+
+/// An answer of a Best_color function
+typedef struct
+{
+  dword Key;  ///< 0x1000000 | RGB of the request, 0 if the entry is empty
+  byte  Color;
+} T_Best_color_entry;
+
+/// Last answers of the Best_color functions.
+///
+/// They depend on the palette and on ::Exclude_color: the tables are emptied
+/// when ::Palette_generation changes (see Palette_changed()).
+static struct
+{
+  int Valid;
+  dword Palette_generation;
+  T_Best_color_entry Nearest[BEST_COLOR_CACHE_SIZE];
+  T_Best_color_entry Nearest_nonexcluded[BEST_COLOR_CACHE_SIZE];
+  T_Best_color_entry Perceptual[BEST_COLOR_CACHE_SIZE];
+} Best_color_cache;
+
+/// Empties ::Best_color_cache if the palette or the excluded colors changed.
+static void Check_best_color_cache(void)
+{
+  if (Best_color_cache.Valid && Best_color_cache.Palette_generation == Palette_generation)
+    return;
+  Best_color_cache.Palette_generation = Palette_generation;
+  memset(Best_color_cache.Nearest, 0, sizeof(Best_color_cache.Nearest));
+  memset(Best_color_cache.Nearest_nonexcluded, 0, sizeof(Best_color_cache.Nearest_nonexcluded));
+  memset(Best_color_cache.Perceptual, 0, sizeof(Best_color_cache.Perceptual));
+  Best_color_cache.Valid = 1;
+}
+
+/// Entry of a table of ::Best_color_cache for a RGB request
+static T_Best_color_entry * Best_color_entry(T_Best_color_entry * table, dword key)
+{
+  return table + ((dword)(key * 2654435761UL) >> 20 & (BEST_COLOR_CACHE_SIZE-1));
+}
+
+byte Search_best_color(byte r,byte g,byte b)
 {
   int col;
   int   delta_r,delta_g,delta_b;
@@ -3131,7 +3216,22 @@ byte Best_color(byte r,byte g,byte b)
   return best_color;
 }
 
-byte Best_color_nonexcluded(byte red,byte green,byte blue)
+byte Best_color(byte r,byte g,byte b)
+{
+  dword key = 0x1000000 | (dword)r<<16 | (dword)g<<8 | b;
+  T_Best_color_entry * entry;
+
+  Check_best_color_cache();
+  entry = Best_color_entry(Best_color_cache.Nearest, key);
+  if (entry->Key != key)
+  {
+    entry->Key = key;
+    entry->Color = Search_best_color(r, g, b);
+  }
+  return entry->Color;
+}
+
+static byte Search_best_color_nonexcluded(byte red,byte green,byte blue)
 {
   int   col;
   int   delta_r,delta_g,delta_b;
@@ -3162,6 +3262,21 @@ byte Best_color_nonexcluded(byte red,byte green,byte blue)
   return best_color;
 }
 
+byte Best_color_nonexcluded(byte red,byte green,byte blue)
+{
+  dword key = 0x1000000 | (dword)red<<16 | (dword)green<<8 | blue;
+  T_Best_color_entry * entry;
+
+  Check_best_color_cache();
+  entry = Best_color_entry(Best_color_cache.Nearest_nonexcluded, key);
+  if (entry->Key != key)
+  {
+    entry->Key = key;
+    entry->Color = Search_best_color_nonexcluded(red, green, blue);
+  }
+  return entry->Color;
+}
+
 byte Best_color_range(byte r, byte g, byte b, byte max)
 {
 
@@ -3205,7 +3320,7 @@ byte Best_color_range(byte r, byte g, byte b, byte max)
   return best_color;
 }
 
-byte Best_color_perceptual(byte r,byte g,byte b)
+static byte Search_best_color_perceptual(byte r,byte g,byte b)
 {
 
   int col;
@@ -3248,6 +3363,21 @@ byte Best_color_perceptual(byte r,byte g,byte b)
   return best_color;
 }
 
+byte Best_color_perceptual(byte r,byte g,byte b)
+{
+  dword key = 0x1000000 | (dword)r<<16 | (dword)g<<8 | b;
+  T_Best_color_entry * entry;
+
+  Check_best_color_cache();
+  entry = Best_color_entry(Best_color_cache.Perceptual, key);
+  if (entry->Key != key)
+  {
+    entry->Key = key;
+    entry->Color = Search_best_color_perceptual(r, g, b);
+  }
+  return entry->Color;
+}
+
 byte Best_color_perceptual_except(byte r,byte g,byte b, byte except)
 {
 
@@ -94,6 +94,16 @@ int Dialog_multiple_choice(const char * title, const T_MultipleChoice * choices,
 
 void Display_image_limits(void);
 void Display_all_screen(void);
+/**
+ * Updates the screen after a move of the views, like Display_all_screen().
+ *
+ * The zoomed pixels which stay visible are moved instead of being drawn
+ * again, so only the uncovered rows and columns of the magnifier are drawn.
+ * @param old_offset_X, old_offset_Y the previous Main.offset_X and Main.offset_Y
+ * @param old_magnifier_offset_X, old_magnifier_offset_Y the previous offsets of the magnifier
+ */
+void Display_all_screen_after_scroll(short old_offset_X, short old_offset_Y,
+                                     short old_magnifier_offset_X, short old_magnifier_offset_Y);
 void Window_rectangle(word x_pos,word y_pos,word width,word height,byte color);
 void Window_display_frame_generic(word x_pos,word y_pos,word width,word height,
                                     byte color_tl,byte color_br,byte color_s,byte color_tlc,byte color_brc);
@@ -111,6 +121,9 @@ void Display_grad_block_in_window(word x_pos,word y_pos,word width,word height,w
 void Window_display_icon_sprite(word x_pos,word y_pos,byte type);
 
 byte Best_color(byte red,byte green,byte blue);
+/// Same as Best_color(), without the cache of answers: it can be called
+/// from several threads at once.
+byte Search_best_color(byte red,byte green,byte blue);
 byte Best_color_nonexcluded(byte red,byte green,byte blue);
 byte Best_color_range(byte red,byte green,byte blue,byte max);
 byte Best_color_perceptual(byte r,byte g,byte b);
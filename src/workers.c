@@ -0,0 +1,335 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file workers.c
+/// Pool of worker threads: pthreads, or the Windows API.
+
+#include <stdlib.h>
+#if defined(WIN32)
+#include <windows.h>
+#define WORKERS_WIN32
+#elif defined(__unix__) || defined(__macosx__) || defined(__APPLE__)
+#include <unistd.h>
+#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0
+#include <pthread.h>
+#define WORKERS_PTHREADS
+#endif
+#endif
+
+#include "struct.h"
+#include "workers.h"
+#include "gfx2log.h"
+
+/// Jobs with fewer rows are not worth waking up the workers
+#define WORKERS_MIN_ROWS 16
+
+/// Number of threads working on a job, including the calling one
+static int Nb_threads = 1;
+/// Set while a job runs: jobs started inside a job run serially
+static int Busy = 0;
+
+#if defined(WORKERS_WIN32) || defined(WORKERS_PTHREADS)
+
+#if defined(WORKERS_WIN32)
+static HANDLE Threads[WORKERS_MAX_THREADS];
+static CRITICAL_SECTION Lock;
+/// Set when Lock is initialized
+static int Lock_ready = 0;
+/// One token per worker to wake up for the current job
+static HANDLE Start_tokens;
+/// Set when the last worker has finished the current job
+static HANDLE Job_done;
+#define LOCK() EnterCriticalSection(&Lock)
+#define UNLOCK() LeaveCriticalSection(&Lock)
+#else
+static pthread_t Threads[WORKERS_MAX_THREADS];
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t Done_cond = PTHREAD_COND_INITIALIZER;
+/// One token per worker to wake up for the current job
+static int Start_tokens = 0;
+#define LOCK() pthread_mutex_lock(&Lock)
+#define UNLOCK() pthread_mutex_unlock(&Lock)
+#endif
+
+/// Number of worker threads running (Nb_threads - 1 once started)
+static int Nb_workers = 0;
+/// Set to stop the workers
+static int Quit = 0;
+
+/// The current job
+static Func_rows_job Job;
+static void * Job_data;
+static int Job_rows;
+static int Job_bands;
+static int Next_band;
+/// Tokens which were not finished yet
+static int Pending_tokens;
+
+/// Takes bands of the current job until there are none left.
+static void Work_on_bands(void)
+{
+  for (;;)
+  {
+    int band;
+
+    LOCK();
+    band = Next_band++;
+    UNLOCK();
+    if (band >= Job_bands)
+      return;
+    Job(Job_data, band,
+        (int)((long long)Job_rows * band / Job_bands),
+        (int)((long long)Job_rows * (band+1) / Job_bands));
+  }
+}
+
+/// Marks the end of the work done for one token
+static void Token_done(void)
+{
+  LOCK();
+  if (--Pending_tokens == 0)
+  {
+#if defined(WORKERS_WIN32)
+    SetEvent(Job_done);
+#else
+    pthread_cond_signal(&Done_cond);
+#endif
+  }
+  UNLOCK();
+}
+
+#if defined(WORKERS_WIN32)
+static DWORD WINAPI Worker_main(LPVOID param)
+{
+  (void)param;
+  for (;;)
+  {
+    WaitForSingleObject(Start_tokens, INFINITE);
+    if (Quit)
+      return 0;
+    Work_on_bands();
+    Token_done();
+  }
+}
+#else
+static void * Worker_main(void * param)
+{
+  (void)param;
+  for (;;)
+  {
+    pthread_mutex_lock(&Lock);
+    while (Start_tokens == 0 && !Quit)
+      pthread_cond_wait(&Start_cond, &Lock);
+    if (Quit)
+    {
+      pthread_mutex_unlock(&Lock);
+      return NULL;
+    }
+    Start_tokens--;
+    pthread_mutex_unlock(&Lock);
+    Work_on_bands();
+    Token_done();
+  }
+}
+#endif
+
+/// Wakes up the workers, lets them and the calling thread do the job, and
+/// waits for them.
+static void Run_job(void)
+{
+  LOCK();
+  Next_band = 0;
+  Pending_tokens = Nb_workers;
+#if defined(WORKERS_WIN32)
+  ResetEvent(Job_done);
+  UNLOCK();
+  ReleaseSemaphore(Start_tokens, Nb_workers, NULL);
+#else
+  Start_tokens = Nb_workers;
+  pthread_cond_broadcast(&Start_cond);
+  UNLOCK();
+#endif
+  Work_on_bands();
+#if defined(WORKERS_WIN32)
+  WaitForSingleObject(Job_done, INFINITE);
+#else
+  pthread_mutex_lock(&Lock);
+  while (Pending_tokens > 0)
+    pthread_cond_wait(&Done_cond, &Lock);
+  pthread_mutex_unlock(&Lock);
+#endif
+}
+
+/// Number of processors
+static int Nb_processors(void)
+{
+#if defined(WORKERS_WIN32)
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+  return 1;
+#endif
+}
+
+void Init_workers(int nb_threads)
+{
+  Close_workers();
+  if (nb_threads <= 0)
+    nb_threads = Nb_processors();
+  if (nb_threads > WORKERS_MAX_THREADS)
+    nb_threads = WORKERS_MAX_THREADS;
+  Nb_threads = 1;
+  if (nb_threads <= 1)
+    return;
+
+  Quit = 0;
+#if defined(WORKERS_WIN32)
+  InitializeCriticalSection(&Lock);
+  Lock_ready = 1;
+  Start_tokens = CreateSemaphore(NULL, 0, WORKERS_MAX_THREADS, NULL);
+  Job_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (Start_tokens == NULL || Job_done == NULL)
+  {
+    Close_workers();
+    return;
+  }
+#endif
+  while (Nb_workers < nb_threads - 1)
+  {
+#if defined(WORKERS_WIN32)
+    Threads[Nb_workers] = CreateThread(NULL, 0, Worker_main, NULL, 0, NULL);
+    if (Threads[Nb_workers] == NULL)
+      break;
+#else
+    if (pthread_create(&Threads[Nb_workers], NULL, Worker_main, NULL) != 0)
+      break;
+#endif
+    Nb_workers++;
+  }
+  Nb_threads = Nb_workers + 1;
+  GFX2_Log(GFX2_DEBUG, "Init_workers() : %d threads\n", Nb_threads);
+}
+
+void Close_workers(void)
+{
+  int i;
+
+#if defined(WORKERS_WIN32)
+  if (!Lock_ready)
+    return;
+  Quit = 1;
+  if (Start_tokens != NULL)
+    ReleaseSemaphore(Start_tokens, Nb_workers, NULL);
+  for (i = 0; i < Nb_workers; i++)
+  {
+    WaitForSingleObject(Threads[i], INFINITE);
+    CloseHandle(Threads[i]);
+  }
+  if (Start_tokens != NULL)
+    CloseHandle(Start_tokens);
+  Start_tokens = NULL;
+  if (Job_done != NULL)
+    CloseHandle(Job_done);
+  Job_done = NULL;
+  DeleteCriticalSection(&Lock);
+  Lock_ready = 0;
+#else
+  pthread_mutex_lock(&Lock);
+  Quit = 1;
+  pthread_cond_broadcast(&Start_cond);
+  pthread_mutex_unlock(&Lock);
+  for (i = 0; i < Nb_workers; i++)
+    pthread_join(Threads[i], NULL);
+  Start_tokens = 0;
+#endif
+  Nb_workers = 0;
+  Nb_threads = 1;
+}
+
+#else
+
+void Init_workers(int nb_threads)
+{
+  (void)nb_threads;
+}
+
+void Close_workers(void)
+{
+}
+
+#endif
+
+int Rows_bands(int nb_rows)
+{
+  int bands;
+
+  if (Nb_threads <= 1 || nb_rows < WORKERS_MIN_ROWS || Busy)
+    return 1;
+  // More bands than threads, so a thread which is slowed down by the
+  // system doesn't make the others wait
+  bands = 4 * Nb_threads;
+  if (bands > nb_rows / (WORKERS_MIN_ROWS / 4))
+    bands = nb_rows / (WORKERS_MIN_ROWS / 4);
+  if (bands > WORKERS_MAX_BANDS)
+    bands = WORKERS_MAX_BANDS;
+  return bands;
+}
+
+int Thread_bands(int nb_rows)
+{
+  if (Busy || nb_rows < 1)
+    return 1;
+  return nb_rows < Nb_threads ? nb_rows : Nb_threads;
+}
+
+/// Processes rows 0 to nb_rows-1 in a number of bands
+static void Run_bands(Func_rows_job job, void * data, int nb_rows, int bands)
+{
+#if defined(WORKERS_WIN32) || defined(WORKERS_PTHREADS)
+  if (bands > 1)
+  {
+    Busy = 1;
+    Job = job;
+    Job_data = data;
+    Job_rows = nb_rows;
+    Job_bands = bands;
+    Run_job();
+    Busy = 0;
+    return;
+  }
+#endif
+  if (nb_rows > 0)
+    job(data, 0, 0, nb_rows);
+}
+
+void Run_rows_in_parallel(Func_rows_job job, void * data, int nb_rows)
+{
+  Run_bands(job, data, nb_rows, Rows_bands(nb_rows));
+}
+
+void Run_thread_bands(Func_rows_job job, void * data, int nb_rows)
+{
+  Run_bands(job, data, nb_rows, Thread_bands(nb_rows));
+}
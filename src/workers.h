@@ -0,0 +1,87 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file workers.h
+/// Small pool of worker threads, to process whole images by bands of rows.
+///
+/// The calling thread works too, so a pool of N threads has N-1 workers.
+/// Without thread support, everything runs in the calling thread.
+
+#ifndef WORKERS_H_INCLUDED
+#define WORKERS_H_INCLUDED
+
+/// Maximum number of threads working together
+#define WORKERS_MAX_THREADS 16
+/// Maximum number of bands a job is split in
+#define WORKERS_MAX_BANDS (4*WORKERS_MAX_THREADS)
+
+/**
+ * Work on a band of rows.
+ *
+ * Bands can be processed at the same time in different threads, in any order.
+ * @param data the data given to Run_rows_in_parallel()
+ * @param band index of the band, from 0 to the number of bands - 1
+ * @param first_row first row of the band
+ * @param end_row row after the last one of the band
+ */
+typedef void (* Func_rows_job) (void * data, int band, int first_row, int end_row);
+
+/**
+ * Starts the worker threads, or changes their number.
+ *
+ * @param nb_threads total number of threads, including the calling one.
+ * 0 uses one thread per processor, 1 runs everything in the calling thread.
+ */
+void Init_workers(int nb_threads);
+
+/// Stops the worker threads.
+void Close_workers(void);
+
+/**
+ * Number of bands Run_rows_in_parallel() will use for an image.
+ *
+ * Lets the job allocate one result per band, to merge them afterwards.
+ */
+int Rows_bands(int nb_rows);
+
+/**
+ * Processes rows 0 to nb_rows-1 with the worker threads, and waits until
+ * all are done.
+ *
+ * Small jobs, and jobs started from a worker, run in the calling thread.
+ */
+void Run_rows_in_parallel(Func_rows_job job, void * data, int nb_rows);
+
+/**
+ * Number of bands Run_thread_bands() will use: one per thread, at most
+ * one per row.
+ */
+int Thread_bands(int nb_rows);
+
+/**
+ * Processes rows 0 to nb_rows-1 with the worker threads, in one band per
+ * thread, and waits until all are done.
+ *
+ * For the jobs where each band costs a pass over the whole data, whatever
+ * its number of rows: more bands would only repeat that pass.
+ */
+void Run_thread_bands(Func_rows_job job, void * data, int nb_rows);
+
+#endif
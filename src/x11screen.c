@@ -26,6 +26,7 @@
 #include <X11/XKBlib.h>
 #include "screen.h"
 #include "gfx2surface.h"
+#include "dirtyrect.h"
 #include "loadsave.h"
 #include "io.h"
 #include "gfx2log.h"
@@ -37,6 +38,11 @@ static XTextProperty windowName;
 static GC X11_gc = 0;
 static T_GFX2_Surface * screen = NULL;
 static T_GFX2_Surface * icon = NULL;
+/// Pixel value of each color of the palette, with the bytes in the order
+/// of X11_image : blue, green, red, 0
+static dword Screen_pixel_value[256];
+/// The parts of the screen modified since the last Flush_update()
+static T_Dirty_region Dirty_region;
 
 void GFX2_Set_mode(int *width, int *height, int fullscreen)
 {
@@ -240,66 +246,63 @@ void Screen_FillRect(int x, int y, int w, int h, byte color)
 
 int GFX2_SetPalette(const T_Components * colors, int firstcolor, int ncolors)
 {
+  int i;
+  byte changed[256];
+  int nb_changed = 0;
+
   if (screen == NULL) return 0;
   memcpy(screen->palette + firstcolor, colors, ncolors * sizeof(T_Components));
-  // update full screen
-  Update_rect(0, 0, screen->w, screen->h);
+  memset(changed, 0, sizeof(changed));
+  for (i = 0; i < ncolors; i++)
+  {
+    dword pixel_value;
+    byte * value = (byte *)&pixel_value;
+    value[0] = colors[i].B;
+    value[1] = colors[i].G;
+    value[2] = colors[i].R;
+    value[3] = 0;
+    if (Screen_pixel_value[firstcolor + i] != pixel_value)
+    {
+      Screen_pixel_value[firstcolor + i] = pixel_value;
+      changed[firstcolor + i] = 1;
+      nb_changed++;
+    }
+  }
+  // convert again the parts of the screen which use these colors
+  if (nb_changed > 0)
+    Dirty_region_add_colors(&Dirty_region, screen->pixels, screen->w, screen->w, screen->h, changed);
   return 1;
 }
 
 void Update_rect(short x, short y, unsigned short width, unsigned short height)
 {
-  int line, i;
-  if (screen == NULL || X11_image == NULL) return;
+  if (screen == NULL) return;
   if (x == 0 && y == 0 && width == 0 && height == 0)
-  {
-    width = screen->w;
-    height = screen->h;
-  }
-  x *= Pixel_width;
-  width *= Pixel_width;
-  y *= Pixel_height;
-  height *= Pixel_height;
-  //GFX2_Log(GFX2_DEBUG, "Update_rect(%d %d %d %d) %d %d\n", x, y, width, height, screen->w, screen->h);
-  if (y >= screen->h || x >= screen->w) return;
-  if (y + height > screen->h)
-    height = screen->h - y;
-  if (x + width > screen->w)
-    width = screen->w - x;
+    Dirty_region_add(&Dirty_region, 0, 0, screen->w, screen->h);
+  else
+    Dirty_region_add(&Dirty_region, x * Pixel_width, y * Pixel_height,
+                     width * Pixel_width, height * Pixel_height);
+}
+
+/// Converts a rectangle of the screen to 32 bits and sends it to the X server
+static void Send_rect(int x, int y, int width, int height)
+{
+  int line;
+
+  //GFX2_Log(GFX2_DEBUG, "Send_rect(%d %d %d %d)\n", x, y, width, height);
   for (line = y; line < y + height; line++)
   {
-#if 1
-    const byte * src = Get_Screen_pixel_ptr(x, line);
-    byte * dest = (byte *)X11_image->data + line * X11_image->bytes_per_line + x * 4;
-    i = width;
-    do
-    {
-      dest[0] = screen->palette[*src].B;
-      dest[1] = screen->palette[*src].G;
-      dest[2] = screen->palette[*src].R;
-      dest[3] = 0;
-      src++;
-      dest += 4;
-    }
-    while(--i > 0);
-#else
-    for (i = 0; i < width; i++)
-    {
-      byte v = Get_Screen_pixel(x + i, line);
-      XPutPixel(X11_image, x + i, line,
-                (unsigned)screen->palette[v].R << 16 | (unsigned)screen->palette[v].G << 8 | (unsigned)screen->palette[v].B);
-    }
-#endif
+    Pixels_to_ARGB((dword *)(X11_image->data + line * X11_image->bytes_per_line + x * 4),
+                   Get_Screen_pixel_ptr(x, line), width, Screen_pixel_value);
   }
   XPutImage(X11_display, X11_window, X11_gc, X11_image,
             x, y, x, y, width, height);
-  //XPutImage(X11_display, X11_window, X11_gc, X11_image,
-  //          0, 0, 0, 0, X11_image->width, X11_image->height);
-  //XSync(X11_display, False);
 }
 
 void Flush_update(void)
 {
+  if (screen != NULL && X11_image != NULL)
+    Dirty_region_flush(&Dirty_region, screen->w, screen->h, Send_rect);
   if (X11_display != NULL)
     XFlush(X11_display);
 }